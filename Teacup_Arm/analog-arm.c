@@ -4,8 +4,14 @@
 
   Nice feature of the LPC11xx is, it features a hardware scan mode, which scans
   a given set of ADC pins over and over again, without need for an interrupt
-  to switch between channels. Our code becomes pretty simple: set this
-  mechanism up at init time and be done for the time being.
+  to switch between channels. Each channel has its own data register.
+
+  For oversampling, the DONE flag of the last channel of a scan raises an
+  interrupt, which adds up all channels. After ANALOG_OVERSAMPLE scans the
+  sums get published to adc_result[] and the interrupt turns itself off
+  until the next read, so there are no more interrupts than readings are
+  used. Reads are plain memory reads, the main loop never waits for a
+  conversion.
 
   Unlike ATmegas, LPC1114 features no analog voltage reference selector, it
   always compares against Vdd. This is the equivalent of REFERENCE_AVCC on AVR.
@@ -15,7 +21,17 @@
 
 #include "cmsis-lpc11xx.h"
 #include "arduino.h"
+#include "clock.h"
+
+
+static volatile uint16_t adc_result[NUM_TEMP_SENSORS];
+#if ANALOG_EXTRA_BITS
+  static uint32_t adc_sum[NUM_TEMP_SENSORS];
+  static uint8_t adc_samples = 0;
+#endif
 
+/// INTEN bit of the last channel of a scan, 0 while a round is done
+static uint32_t adc_inten = 0;
 
 /** Inititalise the analog subsystem.
 
@@ -23,8 +39,9 @@
 
   LPC111x User Manual recommends an ADC clock of 4.5 MHz ("typically"), still
   we reduce this to 1 MHz, because we're not nearly as much in a hurry. A
-  conversion needs 11 ADC clocks per channel, so we still get many thousand
-  conversions/second; we need just 100/s.
+  conversion needs 11 ADC clocks per channel, so a round of ANALOG_OVERSAMPLE
+  scans over three channels takes half a millisecond at 16 times
+  oversampling.
 */
 void analog_init() {
 
@@ -50,7 +67,13 @@ void analog_init() {
                 | (0x0 << 17)                     // Maximum accuracy.
                 | (0x0 << 24);                    // Clear START.
 
-    LPC_ADC->INTEN = 0;                           // No interrupt generation.
+    // Interrupt on the highest channel, it ends a scan. Bit 8, global DONE,
+    // stays cleared.
+    for (adc_inten = 1 << 7; ! (analog_mask & adc_inten); adc_inten >>= 1);
+    LPC_ADC->INTEN = adc_inten;
+
+    NVIC_SetPriority(ADC_IRQn, 3);                // Lowest priority.
+    NVIC_EnableIRQ(ADC_IRQn);
 
     // Auto-generate pin setup.
     #undef DEFINE_TEMP_SENSOR
@@ -66,23 +89,68 @@ void analog_init() {
   } /* analog_mask */
 }
 
-/** Read analog value.
+/** End of scan interrupt.
+
+  Reading the data registers clears their DONE flags, which also ends the
+  interrupt request.
+*/
+void ADC_IRQHandler(void) {
+  uint8_t i;
+
+  #if ANALOG_EXTRA_BITS
+    for (i = 0; i < sizeof(adc_channel); i++)
+      if (adc_channel[i] < 8)
+        adc_sum[i] += (LPC_ADC->DR[adc_channel[i]] & 0xFFC0) >> 6;
+
+    if (++adc_samples < ANALOG_OVERSAMPLE)
+      return;
+
+    // Decimate to 10 + ANALOG_EXTRA_BITS bits, like analog-avr.c.
+    for (i = 0; i < sizeof(adc_channel); i++) {
+      adc_result[i] = adc_sum[i] >> ANALOG_EXTRA_BITS;
+      adc_sum[i] = 0;
+    }
+    adc_samples = 0;
+  #else
+    for (i = 0; i < sizeof(adc_channel); i++)
+      if (adc_channel[i] < 8)
+        adc_result[i] = (LPC_ADC->DR[adc_channel[i]] & 0xFFC0) >> 6;
+  #endif
+
+  // Round done, next one with the next read.
+  LPC_ADC->INTEN = 0;
+  event_post(EVENT_ADC);
+}
+
+/** Read oversampled analog value from saved result array.
 
   \param channel Channel to be read. Channel numbering starts at zero.
 
-  \return Analog reading, 10-bit right aligned.
+  \return Analog reading, 10 + ANALOG_EXTRA_BITS bits right aligned.
 
-  Hardware scan mode nicely saves all the converted values separately, so
-  there's no need to hold them in a copy.
+  Returns the last finished round and starts a new one, unless one is
+  running already. 16-bit reads are atomic on ARM.
 */
-uint16_t analog_read(uint8_t index) {
+uint16_t analog_read_filtered(uint8_t index) {
   uint16_t result = 0;
 
   if (index < sizeof(adc_channel) && adc_channel[index] < 8) {
-    result = (LPC_ADC->DR[adc_channel[index]] & 0xFFC0) >> 6;
+    result = adc_result[index];
   }
 
+  LPC_ADC->INTEN = adc_inten;
+
   return result;
 }
 
+/** Read analog value from saved result array.
+
+  \param channel Channel to be read. Channel numbering starts at zero.
+
+  \return Analog reading, 10-bit right aligned.
+*/
+uint16_t analog_read(uint8_t index) {
+  return analog_read_filtered(index) >> ANALOG_EXTRA_BITS;
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
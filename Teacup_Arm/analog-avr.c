@@ -7,10 +7,15 @@
 
 #include "pinio.h"
 #include	"memory_barrier.h"
+#include "clock.h"
 
 
 static uint8_t adc_counter = 0;
 static volatile uint16_t BSS adc_result[NUM_TEMP_SENSORS];
+#if ANALOG_EXTRA_BITS
+  static uint16_t adc_sum = 0;
+  static uint8_t adc_samples = 0;
+#endif
 
 //! Configure all registers, start interrupt loop
 void analog_init() {
@@ -63,8 +68,21 @@ void start_adc() {
 ISR(ADC_vect, ISR_NOBLOCK) {
 	// emulate free-running mode but be more deterministic about exactly which result we have, since this project has long-running interrupts
   if (analog_mask) {
+    #if ANALOG_EXTRA_BITS
+      // Sum up ANALOG_OVERSAMPLE conversions of the same channel, then
+      // decimate to 10 + ANALOG_EXTRA_BITS bits.
+      adc_sum += ADC;
+      if (++adc_samples < ANALOG_OVERSAMPLE) {
+        ADCSRA |= MASK(ADSC);
+        return;
+      }
+      adc_result[adc_counter] = adc_sum >> ANALOG_EXTRA_BITS;
+      adc_sum = 0;
+      adc_samples = 0;
+    #else
 		// store next result
 		adc_result[adc_counter] = ADC;
+    #endif
 
 		// next channel
 		do {
@@ -85,17 +103,20 @@ ISR(ADC_vect, ISR_NOBLOCK) {
     // If there is another channel to read, start a new conversion.
     if (adc_counter != 0) {
       ADCSRA |= MASK(ADSC);
+    }
+    else {
+      event_post(EVENT_ADC);
     }
 	}
 }
 
-/** Read analog value from saved result array.
+/** Read oversampled analog value from saved result array.
 
   \param channel Channel to be read. Channel numbering starts at zero.
 
-  \return Analog reading, 10-bit right aligned.
+  \return Analog reading, 10 + ANALOG_EXTRA_BITS bits right aligned.
 */
-uint16_t analog_read(uint8_t index) {
+uint16_t analog_read_filtered(uint8_t index) {
   uint16_t result = 0;
 
   #ifdef AIO8_PIN
@@ -113,4 +134,14 @@ uint16_t analog_read(uint8_t index) {
   return result;
 }
 
+/** Read analog value from saved result array.
+
+  \param channel Channel to be read. Channel numbering starts at zero.
+
+  \return Analog reading, 10-bit right aligned.
+*/
+uint16_t analog_read(uint8_t index) {
+  return analog_read_filtered(index) >> ANALOG_EXTRA_BITS;
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __AVR__ */
@@ -2,6 +2,7 @@
 #define	_ANALOG_H
 
 #include	<stdint.h>
+#include "config_wrapper.h"
 
 #ifdef __AVR__
   // TODO: these reference selectors should go away. A nice feature, but
@@ -60,10 +61,26 @@
 
 #endif /* __AVR__ */
 
+/** \def ANALOG_EXTRA_BITS
+  Bits of resolution oversampling adds to the 10 bits of the ADC, see
+  ANALOG_OVERSAMPLE in the board configuration.
+*/
+#if ! defined ANALOG_OVERSAMPLE || ANALOG_OVERSAMPLE == 1
+  #define ANALOG_EXTRA_BITS 0
+#elif ANALOG_OVERSAMPLE == 4
+  #define ANALOG_EXTRA_BITS 1
+#elif ANALOG_OVERSAMPLE == 16
+  #define ANALOG_EXTRA_BITS 2
+#else
+  #define ANALOG_EXTRA_BITS 3
+#endif
+
 void 			analog_init(void);
 
 uint16_t	analog_read(uint8_t index);
 
+uint16_t  analog_read_filtered(uint8_t index);
+
 #ifdef NEEDS_START_ADC
   void start_adc(void);
 #endif
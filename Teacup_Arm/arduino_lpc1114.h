@@ -31,6 +31,17 @@
 #define TXD             PIO1_7
 #define TXD_CMSIS       PIO1_7_CMSIS
 
+/** Pins for SPI, SSP0. SS isn't used by SSP0, but as chip select of
+  MAX6675 sensors, as on AVR.
+*/
+#define SCK             PIO0_6
+#define SCK_CMSIS       PIO0_6_CMSIS
+#define MISO            PIO0_8
+#define MISO_CMSIS      PIO0_8_CMSIS
+#define MOSI            PIO0_9
+#define MOSI_CMSIS      PIO0_9_CMSIS
+#define SS              PIO0_2
+
 /**
   Offsets to the various GPIO registers. See chapter 12.3 in LPC111x User
   Manual.
@@ -0,0 +1,157 @@
+#include "bench.h"
+
+/** \file
+  \brief Planner benchmark, G-code lines per second without moving.
+
+  M431 feeds canned G-code through gcode_parse_char(), just like lines from
+  the host, so parsing, processing, dda_create() and lookahead all run as
+  usual. The movement queue runs dry, see queue_dry_run(), moves get
+  planned but never started. This gives the rate at which a build plans
+  moves, independent of how fast they'd run.
+*/
+
+#ifdef BENCHMARK
+
+#include <string.h>
+#include "gcode_parse.h"
+#include "dda_queue.h"
+#include "dda_maths.h"
+#include "timer.h"
+#include "clock.h"
+#include "sersendf.h"
+#include "arduino.h"
+
+/// Relative moves, so the benchmark runs from wherever the machine is.
+static const char PROGMEM bench_setup_P[] =
+  "G91\n"
+  "M83\n"
+  "G1 F3000\n";
+
+/**
+  One round: short segments, a 10 mm circle split into 24 lines and long
+  moves. Each part ends where it started.
+*/
+static const char PROGMEM bench_round_P[] =
+  // short segments, zigzag
+  "G1 X0.2 Y0.1 E0.01\n"
+  "G1 X0.2 Y-0.1 E0.01\n"
+  "G1 X0.2 Y0.1 E0.01\n"
+  "G1 X0.2 Y-0.1 E0.01\n"
+  "G1 X0.2 Y0.1 E0.01\n"
+  "G1 X0.2 Y-0.1 E0.01\n"
+  "G1 X0.2 Y0.1 E0.01\n"
+  "G1 X0.2 Y-0.1 E0.01\n"
+  "G1 X-0.2 Y0.1 E0.01\n"
+  "G1 X-0.2 Y-0.1 E0.01\n"
+  "G1 X-0.2 Y0.1 E0.01\n"
+  "G1 X-0.2 Y-0.1 E0.01\n"
+  "G1 X-0.2 Y0.1 E0.01\n"
+  "G1 X-0.2 Y-0.1 E0.01\n"
+  "G1 X-0.2 Y0.1 E0.01\n"
+  "G1 X-0.2 Y-0.1 E0.01\n"
+  // circle, as a slicer would write an arc
+  "G1 X-0.170 Y1.294 E0.02\n"
+  "G1 X-0.500 Y1.206 E0.02\n"
+  "G1 X-0.794 Y1.036 E0.02\n"
+  "G1 X-1.036 Y0.794 E0.02\n"
+  "G1 X-1.206 Y0.500 E0.02\n"
+  "G1 X-1.294 Y0.170 E0.02\n"
+  "G1 X-1.294 Y-0.170 E0.02\n"
+  "G1 X-1.206 Y-0.500 E0.02\n"
+  "G1 X-1.036 Y-0.794 E0.02\n"
+  "G1 X-0.794 Y-1.036 E0.02\n"
+  "G1 X-0.500 Y-1.206 E0.02\n"
+  "G1 X-0.170 Y-1.294 E0.02\n"
+  "G1 X0.170 Y-1.294 E0.02\n"
+  "G1 X0.500 Y-1.206 E0.02\n"
+  "G1 X0.794 Y-1.036 E0.02\n"
+  "G1 X1.036 Y-0.794 E0.02\n"
+  "G1 X1.206 Y-0.500 E0.02\n"
+  "G1 X1.294 Y-0.170 E0.02\n"
+  "G1 X1.294 Y0.170 E0.02\n"
+  "G1 X1.206 Y0.500 E0.02\n"
+  "G1 X1.036 Y0.794 E0.02\n"
+  "G1 X0.794 Y1.036 E0.02\n"
+  "G1 X0.500 Y1.206 E0.02\n"
+  "G1 X0.170 Y1.294 E0.02\n"
+  // long moves
+  "G1 X20 F6000\n"
+  "G1 Y20\n"
+  "G1 X-20\n"
+  "G1 Y-20 F3000\n";
+
+/// Results of bench_run().
+typedef struct {
+  uint32_t  lines;    ///< lines timed
+  uint32_t  total;    ///< time of all lines, us
+  uint32_t  max;      ///< longest line, us
+} BENCH_STATS;
+
+/** Feed a string of G-code lines to the parser.
+
+  \param gcode_P The lines, in program memory, each ending with a newline.
+
+  \param stats Where to account the time of each line, NULL for none.
+
+  Time spent in clock() between lines isn't counted.
+*/
+static void bench_feed(const char *gcode_P, BENCH_STATS *stats) {
+  uint32_t start, duration;
+  uint8_t c;
+
+  while (pgm_read_byte(gcode_P)) {
+    start = timer_read();
+    do {
+      c = pgm_read_byte(gcode_P++);
+    } while ( ! gcode_parse_char(c));
+    duration = (timer_read() - start) / (F_CPU / 1000000);
+
+    if (stats) {
+      stats->lines++;
+      stats->total += duration;
+      if (duration > stats->max)
+        stats->max = duration;
+    }
+    clock();
+  }
+}
+
+/** Run the planner benchmark and report the results, see M431.
+
+  \param rounds How often bench_round_P gets fed.
+
+  Waits for the queue to empty first. Position, feedrate and relative modes
+  are the same afterwards as before.
+*/
+void bench_run(uint16_t rounds) {
+  GCODE_COMMAND saved_command;
+  TARGET saved_start;
+  BENCH_STATS stats = { 0, 0, 0 };
+  uint32_t timeouts, joined;
+
+  queue_wait();
+  memcpy(&saved_command, &next_target, sizeof(GCODE_COMMAND));
+  memcpy(&saved_start, &startpoint, sizeof(TARGET));
+  timeouts = queue_stats.timeouts;
+  joined = queue_stats.joined;
+
+  queue_dry_run(1);
+  bench_feed(bench_setup_P, NULL);
+  while (rounds--)
+    bench_feed(bench_round_P, &stats);
+  queue_dry_run(0);
+
+  memcpy(&startpoint, &saved_start, sizeof(TARGET));
+  dda_new_startpoint();
+  dda_break_lookahead();
+  memcpy(&next_target, &saved_command, sizeof(GCODE_COMMAND));
+
+  sersendf_P(PSTR("Bench: %lu lines %lu/s max %lu us"),
+             stats.lines,
+             stats.total ? muldiv(stats.lines, 1000000, stats.total) : 0,
+             stats.max);
+  sersendf_P(PSTR(" Timeouts:%lu Joined:%lu\n"),
+             queue_stats.timeouts - timeouts, queue_stats.joined - joined);
+}
+
+#endif /* BENCHMARK */
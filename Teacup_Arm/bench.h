@@ -0,0 +1,14 @@
+#ifndef	_BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+#include "config_wrapper.h"
+
+#ifdef BENCHMARK
+
+// plan canned G-code without moving and report lines per second, see M431
+void bench_run(uint16_t rounds);
+
+#endif /* BENCHMARK */
+
+#endif	/* _BENCH_H */
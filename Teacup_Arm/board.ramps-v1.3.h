@@ -93,6 +93,51 @@
 //#define STEPPER_ENABLE_PIN       xxxx
 //#define STEPPER_INVERT_ENABLE
 
+/** \def STEPPER_IDLE_DISABLE STEPPER_IDLE_TIME
+
+  Switch off the drivers of these axes after they stood still for
+  STEPPER_IDLE_TIME seconds, while the others stay on. They're switched on
+  again with the next move using them. For axes with their own enable pin,
+  e.g. (1 << E) to let the extruder motor cool off during travel heavy
+  parts. Axes holding a load, like the joints of an arm, should stay on.
+  All drivers go off with the power supply timeout regardless.
+
+    Valid values for STEPPER_IDLE_TIME: 1 to 60.
+*/
+//#define STEPPER_IDLE_DISABLE     (1 << E)
+//#define STEPPER_IDLE_TIME        10
+
+/** \def X_GRAYCODE Y_GRAYCODE Z_GRAYCODE U_GRAYCODE E_GRAYCODE
+
+  Drive this axis with graycode (coil polarity) signals instead of step and
+  direction. Coil A goes to the step pin, coil B to the dir pin. For drivers
+  without a step/dir interface, like plain H-bridges.
+*/
+//#define X_GRAYCODE
+//#define Y_GRAYCODE
+//#define Z_GRAYCODE
+//#define U_GRAYCODE
+//#define E_GRAYCODE
+
+/** \def STEP_PORT_BATCH
+
+  Write step pins sharing a port with a single port write instead of one
+  write per axis. Which pins share a port is found at compile time, so it
+  costs nothing if none do. On RAMPS, X and Y step pins share PORTF. Doesn't
+  work together with STEP_PULSE_MATCH.
+*/
+#define STEP_PORT_BATCH
+
+/** \def STEP_PULSE_MATCH
+
+  Let timer match outputs generate step pulses of this length, in
+  microseconds. The step interrupt only starts a pulse, the timer ends it,
+  which gives exact pulse widths and a shorter interrupt. Applies to step
+  pins which can be connected to a timer, other step pins work as usual.
+  Timers used this way can't be used for heater PWM. ARM (LPC1114) only.
+*/
+//#define STEP_PULSE_MATCH         2
+
 /** \def DEBUG_LED_PIN
 
   Enable flashing of a LED during motor stepping.
@@ -105,6 +150,29 @@
 */
 //#define DEBUG_LED_PIN            DIO13
 
+/** \def SYNC_PIN
+
+  Sync line shared by several machines working together, see M440. Connect
+  this pin of all controllers and their grounds. Each controller pulls the
+  line low, except while waiting at a barrier, so it goes high when all of
+  them reached their barrier. The internal pullup is enough for short
+  wires, add a 4.7 kOhm pullup for longer ones.
+*/
+//#define SYNC_PIN                 DIO40
+
+/** \def STEP_LINK
+
+  Stream moves and step timing to a stepping coprocessor on USART2, TX2
+  on DIO16, at this baud rate. See steplink.c for the
+  frames. This controller keeps stepping as well. Requires
+  STEP_TIMING_QUEUE and an ATmega1280 or ATmega2560. About 300 bytes of
+  RAM.
+
+    Unit: baud
+    Sane values: 250000 or 500000 at 16 MHz
+*/
+//#define STEP_LINK                500000
+
 /** \def SD_CARD_SELECT_PIN
 
   Chip Select pin of the SD card.
@@ -119,6 +187,51 @@
 */
 #define SD_CARD_SELECT_PIN       DIO53
 
+/** \def SD_SECTOR_CACHE
+  Keep the SD card sector currently read in a buffer of 512 bytes RAM.
+  Without this buffer each line read from the card reads its entire sector
+  again, which makes printing from SD slower than over serial for dense
+  paths with many short lines. Consecutive sectors get streamed with a
+  multiple block read then, saving a command for each of them.
+*/
+#define SD_SECTOR_CACHE
+
+/** \def SD_FILE_CACHE
+  Keep name, size and location of this many files of the top level
+  directory in RAM, read when mounting the card. M23 then opens them
+  without searching the directory and M20 lists them from RAM, if they're
+  all there. Each file takes 22 bytes of RAM.
+
+    Valid range: 1 to 32.
+*/
+//#define SD_FILE_CACHE            16
+
+/** \def SD_RECORD
+  Allow recording positions to the SD card while moving, e.g. jogging the
+  arm, with M435/M436, and replaying them with M437. The value is the
+  sample interval in milliseconds. Positions come from the step counters,
+  so moving the arm by hand with motors off isn't seen.
+
+  Petit FatFs can't create or grow files, so the file recorded to has to
+  exist on the card already, big enough. Each sample takes 16 bytes, one
+  hour at 50 ms takes 1.2 MB. No other SPI device may be used while
+  recording, like MAX6675 or MCP3008 sensors.
+
+    Valid values: 10 to 2550, multiples of 10.
+*/
+//#define SD_RECORD                50
+
+/** \def SD_LOG
+  Allow logging job telemetry to the SD card with M928, one line each this
+  many seconds: uptime, queue depth, temperatures and movement statistics
+  of M422. Lines get collected in a buffer of 512 bytes RAM and written a
+  full sector at a time when the main loop is idle, at no cost for the
+  serial line. Like with SD_RECORD, the file has to exist on the card.
+
+    Valid values: 1 to 255.
+*/
+//#define SD_LOG                   5
+
 /** \def MCP3008_SELECT_PIN
 
   Chip Select pin of the MCP3008 ADC.
@@ -155,6 +268,28 @@
 //#define TEMP_INTERCOM
 //#define TEMP_MCP3008
 
+/** \def INTERCOM_INTERVAL
+  With TEMP_INTERCOM, ask the extruder board for its state this often, in
+  milliseconds. Each exchange sends targets and DIO and returns both
+  temperatures and the error code in one packet of 11 bytes, about 2 ms each
+  way at 57600 baud. New targets or DIO states go out at the next 10 ms tick
+  regardless. Default is 250.
+
+    Valid values: 20 to 2550, in steps of 10.
+*/
+//#define INTERCOM_INTERVAL        100
+
+/** \def ANALOG_OVERSAMPLE
+  Take this many ADC conversions for each reading of an analog temperature
+  sensor and sum them up. Each 4 times oversampling gives one more bit of
+  resolution and halves noise, so 16 gives 12-bit readings. Conversions take
+  some 100 us each, so this makes no difference for the main loop. On ARM
+  the hardware scan adds up each channel in an end of scan interrupt.
+
+    Valid values: 1, 4, 16, 64.
+*/
+#define ANALOG_OVERSAMPLE        16
+
 /** \def TEMP_SENSOR_PIN
   Temperature sensor pins a user should be able to choose from in configtool.
   All commented out.
@@ -241,12 +376,18 @@ DEFINE_TEMP_SENSOR(bed,      TT_THERMISTOR, AIO14, THERMISTOR_BED)
   for this pin, e.g. for a MOSFET with a driver.
 
   Set 'pwm' to ...
-    1  for using PWM on a PWM-able pin and on/off on other pins.
+    1  for using PWM on a PWM-able pin at the timer's default frequency and
+       software PWM of about 2 Hz on other pins.
     0  for using on/off on a PWM-able pin, too.
+   >1  for using PWM with this frequency, in Hz. PWM-able pins get the
+       closest frequency their timer can do; pins sharing a timer also share
+       the frequency, the heater defined last wins. Other pins get software
+       PWM, driven by the system clock interrupt every 2 ms. This works up to
+       250 Hz, with 500 / frequency steps of duty.
 
   Using PWM usually gives smoother temperature control but can conflict
-  with slow switches, like solid state relays. PWM frequency can be
-  influenced globally with FAST_PWM, see below.
+  with slow switches, like solid state relays. Default frequency of PWM-able
+  pins can be influenced globally with FAST_PWM, see below.
 */
 //DEFINE_HEATERS_START
 //            name      pin      invert  pwm
@@ -288,6 +429,41 @@ DEFINE_HEATER(fan,      DIO9,    0,      1)
 */
 //#define USB_SERIAL
 
+/** \def SERIAL_RX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+  Sizes of the serial receive and transmit buffers. A larger receive buffer
+  gives more slack before XON/XOFF kicks in or characters get lost while the
+  main loop is busy. The ATmega2560 has the RAM for it. ARM receives into the
+  hardware FIFO and uses the transmit buffer only. Default is 64 for both.
+
+    Valid values: 32, 64, 128, 256.
+*/
+#define SERIAL_RX_BUFFER_SIZE    256
+//#define SERIAL_TX_BUFFER_SIZE    64
+
+/** \def BINARY_GCODE
+  Accept movement commands in a compact binary framing, next to plain text
+  G-code. It saves the host link some bandwidth and the parser most of its
+  work, which matters for dense paths at 115200 baud. Off until the host
+  sends M424 S1; see gcode_parse.c for the frame format. Files on the SD card
+  may contain such frames regardless of M424, so a job converted to frames
+  on the host plays without being parse bound.
+*/
+//#define BINARY_GCODE
+
+/** \def LINE_FIFO
+  Buffer this many characters of G-code between the serial line and the
+  parser and acknowledge lines as soon as they're received, instead of when
+  the movement queue has room. Each "ok" then tells the host with Q:n how many
+  more lines it may send before waiting for the next "ok", so it can keep the
+  line busy. Lines must not exceed 64 characters then. Messages from
+  processing a command may come after its "ok".
+
+  Undefined means one line in flight, which works with every host.
+
+    Valid values: 128, 256.
+*/
+//#define LINE_FIFO                256
+
 
 /***************************************************************************\
 *                                                                           *
@@ -5,15 +5,20 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 #include	"pinio.h"
 #include	"sersendf.h"
 #include	"dda_queue.h"
 #include	"watchdog.h"
 #include	"timer.h"
 #include	"debug.h"
+#include "trace.h"
 #include	"heater.h"
+#include	"temp.h"
 #include	"serial.h"
+#include	"msg.h"
 #include "display.h"
+#include "gcode_parse.h"
 #ifdef	TEMP_INTERCOM
 	#include	"intercom.h"
 #endif
@@ -30,10 +35,19 @@
   Every time our clock fires we increment this,
   so we know when 10ms/250ms/1s has elapsed.
 */
-static uint8_t clock_counter_10ms = 0;
+static uint16_t clock_counter_10ms = 0;
 static uint8_t clock_counter_250ms = 0;
 static uint8_t clock_counter_1s = 0;
 
+/**
+  Intervals of automatic temperature and position reports, set by M155 and
+  M154, and how far they're through.
+*/
+uint8_t autoreport_temp_interval = 0;
+uint8_t autoreport_pos_interval = 0;
+static uint8_t autoreport_temp_count = 0;
+static uint8_t autoreport_pos_count = 0;
+
 /**
   Flags to tell clock() when above have elapsed.
 */
@@ -41,6 +55,20 @@ static volatile uint8_t clock_flag_10ms = 0;
 static volatile uint8_t clock_flag_250ms = 0;
 static volatile uint8_t clock_flag_1s = 0;
 
+/// Events pending for the main loop, see EVENT_RX and friends.
+volatile uint8_t main_events = 0;
+
+/// Main loop load statistics, see loop_stats_print().
+LOOP_STATS loop_stats;
+
+/**
+  dda_clock() runs every this many ticks, see MOTION_CLOCK. Software PWM runs
+  every 2 ms, independent of TICK_TIME.
+*/
+static uint8_t motion_interval = MOTION_CLOCK / TICK_TIME_US;
+static uint8_t clock_counter_motion = 0;
+static uint8_t clock_counter_pwm = 0;
+
 
 /** Advance our clock by a tick.
 
@@ -48,10 +76,19 @@ static volatile uint8_t clock_flag_1s = 0;
   Interrupt in timer.c.
 */
 void clock_tick(void) {
-  clock_counter_10ms += TICK_TIME_MS;
-  if (clock_counter_10ms >= 10) {
-    clock_counter_10ms -= 10;
+  if (++clock_counter_pwm >= 2000 / TICK_TIME_US) {
+    clock_counter_pwm = 0;
+    heater_soft_pwm_tick();
+    #ifdef DISPLAY_TICK_ISR
+      display_tick();
+    #endif
+  }
+
+  clock_counter_10ms += TICK_TIME_US;
+  if (clock_counter_10ms >= 10000) {
+    clock_counter_10ms -= 10000;
     clock_flag_10ms = 1;
+    event_post(EVENT_TICK);
 
     clock_counter_250ms++;
     if (clock_counter_250ms >= 25) {
@@ -65,6 +102,90 @@ void clock_tick(void) {
       }
     }
   }
+
+  // Acceleration maths, only when there is something to accelerate.
+  if (++clock_counter_motion >= motion_interval) {
+    clock_counter_motion = 0;
+    if ( ! queue_empty())
+      timer_motion_maintenance();
+  }
+}
+
+/** Set how often dda_clock() runs.
+
+  \param us Interval in microseconds, rounded to TICK_TIME, 1 to 255 ticks.
+
+  Shorter intervals make ramps smoother at high accelerations, but cost more
+  CPU time while moving. See MOTION_CLOCK and M428.
+*/
+void clock_set_motion_interval(uint32_t us) {
+  us = (us + TICK_TIME_US / 2) / TICK_TIME_US;
+  if (us < 1)
+    us = 1;
+  if (us > 255)
+    us = 255;
+  motion_interval = us;
+}
+
+/** Account a round through the main loop.
+
+  \param ticks Duration of the round, CPU ticks, sleeping excluded.
+*/
+void loop_stats_round(uint32_t ticks) {
+  loop_stats.loops++;
+  loop_stats_add(LOOP_BUSY, ticks);
+  if (ticks > loop_stats.loop_max)
+    loop_stats.loop_max = ticks;
+}
+
+/** Move collected CPU ticks into milliseconds.
+
+  Called every 10 ms, so the tick counters never hold more than a few
+  milliseconds.
+*/
+static void loop_stats_fold(void) {
+  uint32_t now = timer_read();
+  uint8_t i;
+
+  loop_stats.ticks[LOOP_ELAPSED] += now - loop_stats.last;
+  loop_stats.last = now;
+
+  for (i = 0; i < LOOP_TIMES; i++) {
+    loop_stats.ms[i] += loop_stats.ticks[i] / (F_CPU / 1000);
+    loop_stats.ticks[i] %= (F_CPU / 1000);
+  }
+}
+
+/** Print main loop load statistics and start over.
+
+  Rounds per second, the longest round in microseconds and the share of time
+  spent sleeping at the end of a round, in process_gcode_command() and, as part of that, waiting
+  for room in the movement queue. Much G-code time with little queue waiting
+  means the parser or planner limits throughput, much queue waiting means
+  movements do.
+*/
+void loop_stats_print() {
+  uint32_t ms, busy, loops;
+
+  loop_stats_fold();
+  ms = loop_stats.ms[LOOP_ELAPSED];
+  if (ms == 0)
+    ms = 1;
+  busy = loop_stats.ms[LOOP_BUSY];
+  if (busy > ms)
+    busy = ms;
+  loops = ms >= 1000 ? loop_stats.loops / (ms / 1000) :
+                       loop_stats.loops * 1000 / ms;
+
+  sersendf_P(PSTR("Loops:%lu/s MaxLoop:%lu us Idle:%u%% Gcode:%u%% "
+                  "QueueWait:%u%%\n"),
+             loops, loop_stats.loop_max / (F_CPU / 1000000),
+             (uint16_t)((ms - busy) * 100 / ms),
+             (uint16_t)(loop_stats.ms[LOOP_GCODE] * 100 / ms),
+             (uint16_t)(loop_stats.ms[LOOP_QUEUE_WAIT] * 100 / ms));
+
+  memset(&loop_stats, 0, sizeof(LOOP_STATS));
+  loop_stats.last = timer_read();
 }
 
 /*!	do stuff every 1/4 second
@@ -84,8 +205,28 @@ static void clock_250ms(void) {
 		}
 	}
 
+  #ifdef STEPPER_IDLE_DISABLE
+    steppers_idle_tick();
+  #endif
+
+  #ifdef STEP_RATE_GUARD
+    dda_overload_report();
+  #endif
+
   temp_heater_tick();
 
+  if (autoreport_temp_interval &&
+      ++autoreport_temp_count >= autoreport_temp_interval) {
+    autoreport_temp_count = 0;
+    temp_print(TEMP_SENSOR_none);
+  }
+
+  if (autoreport_pos_interval &&
+      ++autoreport_pos_count >= autoreport_pos_interval) {
+    autoreport_pos_count = 0;
+    print_current_position();
+  }
+
 	ifclock(clock_flag_1s) {
     #ifdef DISPLAY
       display_clock();
@@ -93,22 +234,23 @@ static void clock_250ms(void) {
 
     temp_residency_tick();
 
+    #ifdef SD_LOG
+      sd_log_tick();
+    #endif
+
 		if (DEBUG_POSITION && (debug_flags & DEBUG_POSITION)) {
 			// current position
 			update_current_position();
-      sersendf_P(PSTR("Pos: %lq,%lq,%lq,%lq,%lq,%lu\n"),
-                 current_position.axis[X], current_position.axis[Y],
-                 current_position.axis[Z], current_position.axis[U], current_position.axis[E],
-                 current_position.F);
+      serial_writestr_P(PSTR("Pos: "));
+      write_int32_vf_list(serial_writechar, current_position.axis,
+                          AXIS_COUNT, 3);
+      sersendf_P(PSTR(",%lu\n"), current_position.F);
 
 			// target position
-      sersendf_P(PSTR("Dst: %lq,%lq,%lq,%lq,%lq,%lu\n"),
-                 movebuffer[mb_tail].endpoint.axis[X],
-                 movebuffer[mb_tail].endpoint.axis[Y],
-                 movebuffer[mb_tail].endpoint.axis[Z],
-                 movebuffer[mb_tail].endpoint.axis[U],
-                 movebuffer[mb_tail].endpoint.axis[E],
-                 movebuffer[mb_tail].endpoint.F);
+      serial_writestr_P(PSTR("Dst: "));
+      write_int32_vf_list(serial_writechar, movebuffer[mb_tail].endpoint.axis,
+                          AXIS_COUNT, 3);
+      sersendf_P(PSTR(",%lu\n"), movebuffer[mb_tail].endpoint.F);
 
 			// Queue
 			print_queue();
@@ -120,9 +262,6 @@ static void clock_250ms(void) {
 		/*		if (temp_get_target())
 		temp_print();*/
 	}
-	#ifdef	TEMP_INTERCOM
-	start_send();
-	#endif
 }
 
 /*! do stuff every 10 milliseconds
@@ -133,7 +272,24 @@ static void clock_10ms(void) {
 	// reset watchdog
 	wd_reset();
 
+  loop_stats_fold();
+
 	temp_sensor_tick();
+  queue_temp_wait_tick();
+
+  #ifdef SD_RECORD
+    sd_record_tick();
+  #endif
+
+  #ifdef TRACE
+    // A few at a time, so printing doesn't stall the main loop.
+    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
+      trace_print(4);
+  #endif
+
+	#ifdef	TEMP_INTERCOM
+	intercom_tick();
+	#endif
 
 	ifclock(clock_flag_250ms) {
 		clock_250ms();
@@ -152,7 +308,15 @@ void clock() {
 		clock_10ms();
 	}
 
-  #ifdef DISPLAY
+  #ifdef REALTIME_COMMANDS
+    serial_status();
+  #endif
+
+  #ifdef LINE_FIFO
+    gcode_receive();
+  #endif
+
+  #if defined DISPLAY && ! defined DISPLAY_TICK_ISR
     display_tick();
   #endif
 
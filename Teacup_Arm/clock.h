@@ -1,10 +1,64 @@
 #ifndef	_CLOCK_H
 #define	_CLOCK_H
 
+#include <stdint.h>
 
-// Should be called every TICK_TIME (currently 2 ms).
+
+// Should be called every TICK_TIME (currently 0.5 ms).
 void clock_tick(void);
 
+void clock_set_motion_interval(uint32_t us);
+
 void clock(void);
 
+/** \def EVENT_RX EVENT_QUEUE EVENT_TICK EVENT_ADC
+  Things the main loop waits for. Interrupts post them to main_events, the
+  main loop sleeps while none of them is pending and none of its tasks has
+  work left.
+*/
+#define EVENT_RX        0x01  ///< serial characters arrived
+#define EVENT_QUEUE     0x02  ///< a movement ended, the queue has room
+#define EVENT_TICK      0x04  ///< 10 ms elapsed, clock() has work
+#define EVENT_ADC       0x08  ///< a round of analog readings is done
+
+extern volatile uint8_t main_events;
+
+#define event_post(e) do { main_events |= (e); } while (0)
+
+/// Times collected by the main loop load statistics, see LOOP_STATS.
+enum loop_time_e {
+  LOOP_ELAPSED,     ///< time passed
+  LOOP_BUSY,        ///< rounds through the main loop, sleeping excluded
+  LOOP_GCODE,       ///< process_gcode_command()
+  LOOP_QUEUE_WAIT,  ///< waiting for room in the movement queue
+  LOOP_TIMES
+};
+
+/**
+  \struct LOOP_STATS
+  \brief Main loop load statistics, see M429.
+
+  Cheap enough to be always on. Times add up in CPU ticks and get folded
+  into milliseconds every 10 ms, so they don't overflow.
+*/
+typedef struct {
+  uint32_t  ticks[LOOP_TIMES];  ///< CPU ticks, not yet folded
+  uint32_t  ms[LOOP_TIMES];     ///< milliseconds
+  uint32_t  loops;              ///< rounds through the main loop
+  uint32_t  loop_max;           ///< longest round, CPU ticks
+  uint32_t  last;               ///< time of the last fold
+} LOOP_STATS;
+
+extern LOOP_STATS loop_stats;
+
+#define loop_stats_add(t, d) do { loop_stats.ticks[t] += (d); } while (0)
+
+void loop_stats_round(uint32_t ticks);
+
+void loop_stats_print(void);
+
+// Automatic reports, intervals in 250 ms units, 0 = off.
+extern uint8_t autoreport_temp_interval;
+extern uint8_t autoreport_pos_interval;
+
 #endif	/* _CLOCK_H */
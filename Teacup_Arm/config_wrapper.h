@@ -36,11 +36,346 @@
   #undef BAUD
 #endif
 
+/**
+  ACCELERATION_SCURVE modifies the ramps of ACCELERATION_RAMPING.
+*/
+#if defined ACCELERATION_SCURVE && ! defined ACCELERATION_RAMPING
+  #error ACCELERATION_SCURVE requires ACCELERATION_RAMPING.
+#endif
+
+/**
+  Real-time feed override recalculates the ramps of ACCELERATION_RAMPING.
+*/
+#ifdef FEED_OVERRIDE
+  #ifndef ACCELERATION_RAMPING
+    #error FEED_OVERRIDE requires ACCELERATION_RAMPING.
+  #endif
+  #ifdef ACCELERATION_SCURVE
+    #error FEED_OVERRIDE does not work with ACCELERATION_SCURVE.
+  #endif
+#endif
+
+/**
+  Feed hold stops moves along a ramp of ACCELERATION_RAMPING.
+*/
+#ifdef FEED_HOLD
+  #ifndef ACCELERATION_RAMPING
+    #error FEED_HOLD requires ACCELERATION_RAMPING.
+  #endif
+  #ifndef REALTIME_COMMANDS
+    #define REALTIME_COMMANDS
+  #endif
+#endif
+
+/**
+  Jog moves follow their commanded speed along a ramp of ACCELERATION_RAMPING.
+*/
+#if defined JOG && ! defined ACCELERATION_RAMPING
+  #error JOG requires ACCELERATION_RAMPING.
+#endif
+
+/**
+  Real-time commands get filtered by the receive interrupt of serial.c.
+*/
+#if defined REALTIME_COMMANDS && defined USB_SERIAL
+  #error REALTIME_COMMANDS does not work with USB_SERIAL.
+#endif
+
+/**
+  Pressure advance shifts the E Bresenham counter along the ramps.
+*/
+#ifdef ADVANCE_K
+  #ifndef ACCELERATION_RAMPING
+    #error ADVANCE_K requires ACCELERATION_RAMPING.
+  #endif
+  #if ADVANCE_K < 1 || ADVANCE_K > 1000
+    #error ADVANCE_K has to be between 1 and 1000.
+  #endif
+#endif
+
+/**
+  Step batching works with a common step timing for all axes, which excludes
+  ACCELERATION_REPRAP (per step speed calculation) and ACCELERATION_TEMPORAL.
+*/
+#if defined STEP_BATCH_RATE && \
+    (defined ACCELERATION_REPRAP || defined ACCELERATION_TEMPORAL)
+  #error STEP_BATCH_RATE works with ACCELERATION_RAMPING or no acceleration.
+#endif
+
+/**
+  The step timing queue carries precalculated acceleration ramps, so it needs
+  ACCELERATION_RAMPING.
+*/
+#if defined STEP_TIMING_QUEUE && ! defined ACCELERATION_RAMPING
+  #error STEP_TIMING_QUEUE requires ACCELERATION_RAMPING.
+#endif
+
+/**
+  The step link sends what the step timing queue computes, on USART2.
+*/
+#ifdef STEP_LINK
+  #ifndef STEP_TIMING_QUEUE
+    #error STEP_LINK requires STEP_TIMING_QUEUE.
+  #endif
+  #if ! defined __AVR_ATmega2560__ && ! defined __AVR_ATmega1280__
+    #error STEP_LINK requires USART2 of an ATmega1280 or ATmega2560.
+  #endif
+#endif
+
+#ifdef STEP_RATE_GUARD
+  #ifndef ACCELERATION_RAMPING
+    #error STEP_RATE_GUARD requires ACCELERATION_RAMPING.
+  #endif
+  #if STEP_RATE_GUARD < 100 || STEP_RATE_GUARD > 400
+    #error STEP_RATE_GUARD has to be between 100 and 400.
+  #endif
+#endif
+
+/**
+  Per step ramps replace the ramp calculations of dda_clock(), so nothing
+  else may change ramps there. Speed overrides, feed hold and jogging are
+  intentionally left out, see STEP_RAMP_EXACT in the printer configuration.
+*/
+#ifdef STEP_RAMP_EXACT
+  #ifndef ACCELERATION_RAMPING
+    #error STEP_RAMP_EXACT requires ACCELERATION_RAMPING.
+  #endif
+  #if defined STEP_TIMING_QUEUE || defined ACCELERATION_SCURVE || \
+      defined FEED_OVERRIDE || defined FEED_HOLD || defined JOG
+    #error STEP_RAMP_EXACT does not work with STEP_TIMING_QUEUE, ACCELERATION_SCURVE, FEED_OVERRIDE, FEED_HOLD or JOG.
+  #endif
+#endif
+
+/**
+  Input shaping works on the precalculated step timing.
+*/
+#ifdef INPUT_SHAPING_FREQUENCY
+  #ifndef STEP_TIMING_QUEUE
+    #error INPUT_SHAPING_FREQUENCY requires STEP_TIMING_QUEUE.
+  #endif
+  #if INPUT_SHAPING_FREQUENCY < 5 || INPUT_SHAPING_FREQUENCY > 100
+    #error INPUT_SHAPING_FREQUENCY has to be between 5 and 100.
+  #endif
+  #ifndef INPUT_SHAPING_DAMPING
+    #define INPUT_SHAPING_DAMPING 10
+  #endif
+  #if INPUT_SHAPING_DAMPING < 0 || INPUT_SHAPING_DAMPING > 30
+    #error INPUT_SHAPING_DAMPING has to be between 0 and 30.
+  #endif
+#endif
+
+/**
+  Timer match channels per axis exist for temporal stepping on the LPC1114
+  only, which has four match registers on its step timer.
+*/
+#ifdef TEMPORAL_MATCH_CHANNELS
+  #ifndef ACCELERATION_TEMPORAL
+    #error TEMPORAL_MATCH_CHANNELS requires ACCELERATION_TEMPORAL.
+  #endif
+  #ifndef __ARMEL__
+    #error TEMPORAL_MATCH_CHANNELS is available on ARM only.
+  #endif
+#endif
+
+/**
+  Endstop capture works on the Bresenham path of dda_step(), which counts
+  steps with ACCELERATION_RAMPING only.
+*/
+#ifdef ENDSTOP_CAPTURE
+  #ifndef ACCELERATION_RAMPING
+    #error ENDSTOP_CAPTURE requires ACCELERATION_RAMPING.
+  #endif
+#endif
+
+/**
+  Single pass homing takes home from the captured endstop trigger points.
+*/
+#if defined HOME_SINGLE_PASS && ! defined ENDSTOP_CAPTURE
+  #error HOME_SINGLE_PASS requires ENDSTOP_CAPTURE.
+#endif
+
+/**
+  The step trace records step intervals as set by ramping and step numbers,
+  which exist with ACCELERATION_RAMPING only.
+*/
+#if defined STEP_TRACE && ! defined ACCELERATION_RAMPING
+  #error STEP_TRACE requires ACCELERATION_RAMPING.
+#endif
+
+/**
+  SD recording writes samples from clock_10ms() and keeps the card selected
+  between them.
+*/
+#ifdef SD_RECORD
+  #ifndef SD_CARD_SELECT_PIN
+    #error SD_RECORD requires an SD card, see SD_CARD_SELECT_PIN.
+  #endif
+  #if SD_RECORD < 10 || SD_RECORD > 2550 || SD_RECORD % 10
+    #error SD_RECORD has to be 10 to 2550 ms, multiples of 10.
+  #endif
+  #if defined TEMP_MAX6675 || defined TEMP_MCP3008
+    #error SD_RECORD cannot share SPI with MAX6675 or MCP3008 sensors.
+  #endif
+#endif
+
+#if defined SD_FILE_CACHE && (SD_FILE_CACHE < 1 || SD_FILE_CACHE > 32)
+  #error SD_FILE_CACHE has to be between 1 and 32.
+#endif
+
+/**
+  SD logging writes to the file selected with M23.
+*/
+#ifdef SD_LOG
+  #ifndef SD_CARD_SELECT_PIN
+    #error SD_LOG requires an SD card, see SD_CARD_SELECT_PIN.
+  #endif
+  #if SD_LOG < 1 || SD_LOG > 255
+    #error SD_LOG has to be 1 to 255 seconds.
+  #endif
+#endif
+
+/**
+  Joint calibration corrects joint angles, which exist with arm kinematics
+  only.
+*/
+#if defined JOINT_CALIBRATION && ! defined KINEMATICS_ARM4
+  #error JOINT_CALIBRATION requires KINEMATICS_ARM4.
+#endif
+
+/**
+  The RAM report uses the symbols of the avr-libc linker scripts.
+*/
+#if defined RAM_REPORT && ! defined __AVR__
+  #error RAM_REPORT is available on AVR only.
+#endif
+
+/**
+  Serial buffers use the ringbuffer macros, which need powers of two and
+  byte sized indices. XON/XOFF needs more than 16 characters.
+*/
+#if defined SERIAL_RX_BUFFER_SIZE && SERIAL_RX_BUFFER_SIZE != 32 && \
+    SERIAL_RX_BUFFER_SIZE != 64 && SERIAL_RX_BUFFER_SIZE != 128 && \
+    SERIAL_RX_BUFFER_SIZE != 256
+  #error SERIAL_RX_BUFFER_SIZE has to be 32, 64, 128 or 256.
+#endif
+#if defined SERIAL_TX_BUFFER_SIZE && SERIAL_TX_BUFFER_SIZE != 32 && \
+    SERIAL_TX_BUFFER_SIZE != 64 && SERIAL_TX_BUFFER_SIZE != 128 && \
+    SERIAL_TX_BUFFER_SIZE != 256
+  #error SERIAL_TX_BUFFER_SIZE has to be 32, 64, 128 or 256.
+#endif
+
+/**
+  The line FIFO uses the ringbuffer macros, which limit it to 256 characters,
+  and needs room for more than one line of 64 characters to give credit.
+*/
+#if defined LINE_FIFO && LINE_FIFO != 128 && LINE_FIFO != 256
+  #error LINE_FIFO has to be 128 or 256.
+#endif
+
+/**
+  The line FIFO counts line ends, binary frames don't have them.
+*/
+#if defined LINE_FIFO && defined BINARY_GCODE
+  #error LINE_FIFO and BINARY_GCODE cannot be used together.
+#endif
+
+/**
+  Oversampling adds one bit of resolution per factor of 4. 64 conversions
+  still fit into the 16-bit sum.
+*/
+#if defined ANALOG_OVERSAMPLE && ANALOG_OVERSAMPLE != 1 && \
+    ANALOG_OVERSAMPLE != 4 && ANALOG_OVERSAMPLE != 16 && \
+    ANALOG_OVERSAMPLE != 64
+  #error ANALOG_OVERSAMPLE has to be 1, 4, 16 or 64.
+#endif
+
+/**
+  A motion macro has to fit into EEPROM, 4 kB on the ATmega2560.
+*/
+#if defined MOTION_MACRO && (MOTION_MACRO < 1 || MOTION_MACRO > 30)
+  #error MOTION_MACRO has to be between 1 and 30.
+#endif
+
+/**
+  Per axis acceleration, default to the common ACCELERATION for axes not
+  configured separately.
+*/
+#ifndef ACCELERATION_X
+  #define ACCELERATION_X ACCELERATION
+#endif
+#ifndef ACCELERATION_Y
+  #define ACCELERATION_Y ACCELERATION
+#endif
+#ifndef ACCELERATION_Z
+  #define ACCELERATION_Z ACCELERATION
+#endif
+#ifndef ACCELERATION_U
+  #define ACCELERATION_U ACCELERATION
+#endif
+#ifndef ACCELERATION_E
+  #define ACCELERATION_E ACCELERATION
+#endif
+
+/**
+  Backlash compensation is on as soon as one axis has some, the others
+  get zero.
+*/
+#if defined BACKLASH_X || defined BACKLASH_Y || defined BACKLASH_Z || \
+    defined BACKLASH_U
+  #define BACKLASH
+  #ifndef BACKLASH_X
+    #define BACKLASH_X 0
+  #endif
+  #ifndef BACKLASH_Y
+    #define BACKLASH_Y 0
+  #endif
+  #ifndef BACKLASH_Z
+    #define BACKLASH_Z 0
+  #endif
+  #ifndef BACKLASH_U
+    #define BACKLASH_U 0
+  #endif
+#endif
+
+/**
+  Acceleration update interval, default to what was the system clock tick
+  before it got shorter. Has to fit into 255 ticks of 500 us.
+*/
+#ifndef MOTION_CLOCK
+  #define MOTION_CLOCK 2000
+#endif
+#if MOTION_CLOCK < 500 || MOTION_CLOCK > 127500
+  #error MOTION_CLOCK has to be between 500 and 127500 microseconds.
+#endif
+
+/**
+  Idle time of single steppers, counted in 250 ms ticks in 8 bits.
+*/
+#ifdef STEPPER_IDLE_DISABLE
+  #ifndef STEPPER_IDLE_TIME
+    #define STEPPER_IDLE_TIME 10
+  #endif
+  #if STEPPER_IDLE_TIME < 1 || STEPPER_IDLE_TIME > 60
+    #error STEPPER_IDLE_TIME has to be between 1 and 60 seconds.
+  #endif
+#endif
+
+/**
+  Intercom exchange interval, see board.ramps-v1.3.h. A round trip has to
+  fit in, and the counter counts 10 ms ticks in 8 bits.
+*/
+#ifndef INTERCOM_INTERVAL
+  #define INTERCOM_INTERVAL 250
+#endif
+#if INTERCOM_INTERVAL < 20 || INTERCOM_INTERVAL > 2550
+  #error INTERCOM_INTERVAL has to be between 20 and 2550 milliseconds.
+#endif
+
 /**
   Check wether we need SPI.
 */
 #if (defined SD_CARD_SELECT_PIN || defined TEMP_MAX6675 || \
-     defined TEMP_MC3008) && ! defined SIMULATOR
+     defined TEMP_MCP3008) && ! defined SIMULATOR
   #define SPI
 #endif
 
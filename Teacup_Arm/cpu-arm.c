@@ -23,4 +23,16 @@ void cpu_init() {
   #endif
 }
 
+/** Sleep until the next interrupt.
+
+  WFI stops the core clock only, SCR->SLEEPDEEP is still cleared from reset,
+  so all peripherals keep running. The first interrupt wakes us up again, the
+  SysTick one at the latest after TICK_TIME. Interrupts have to be enabled,
+  with interrupts disabled by cli() WFI still returns, but without running
+  the interrupt handler.
+*/
+void cpu_idle() {
+  __ASM volatile ("wfi" ::: "memory");
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
@@ -8,6 +8,7 @@
 #if defined TEACUP_C_INCLUDE && defined __AVR__
 
 #include <avr/io.h>
+#include <avr/sleep.h>
 #include "pinio.h"
 
 
@@ -49,4 +50,18 @@ void cpu_init() {
   ACSR = MASK(ACD);
 }
 
+/** Sleep until the next interrupt.
+
+  Idle sleep mode stops the CPU core only. Timers, serial and the ADC keep
+  running, the first interrupt of any of them wakes us up again. The system
+  clock interrupt makes sure this happens within TICK_TIME. Interrupts have
+  to be enabled, of course.
+*/
+void cpu_idle() {
+  #ifndef SIMULATOR
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+  #endif
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __AVR__ */
@@ -34,8 +34,25 @@
     __ASM volatile ("cpsid i" ::: "memory");
   }
 
+  /** Check wether interrupts are enabled.
+
+    This reads the I-bit in PRIMASK, which is what sei() and cli() change.
+
+    Code copied from MBED, __get_PRIMASK(), in file
+    mbed/libraries/mbed/targets/cmsis/core_cmFunc.h.
+  */
+  static uint8_t interrupts_enabled(void) __attribute__ ((always_inline));
+  inline uint8_t interrupts_enabled(void) {
+    uint32_t primask;
+
+    __ASM volatile ("mrs %0, primask" : "=r" (primask));
+    return (primask & 1) == 0;
+  }
+
 #endif /* __AVR__, __ARMEL__ */
 
 void cpu_init(void);
 
+void cpu_idle(void);
+
 #endif /* _CPU_H */
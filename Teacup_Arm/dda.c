@@ -12,18 +12,21 @@
 #include "preprocessor_math.h"
 #include "dda_kinematics.h"
 #include	"dda_lookahead.h"
+#include "settings.h"
 #include "cpu.h"
 #include	"timer.h"
 #include	"serial.h"
 #include	"gcode_parse.h"
 #include	"dda_queue.h"
 #include	"debug.h"
+#include "trace.h"
 #include	"sersendf.h"
 #include	"pinio.h"
+#include	"delay.h"
 #include "memory_barrier.h"
-//#include "graycode.c"
+#include "steplink.h"
 
-#ifdef	DC_EXTRUDER
+#if defined DC_EXTRUDER || defined SPINDLE
 	#include	"heater.h"
 #endif
 
@@ -45,41 +48,204 @@ TARGET BSS startpoint_steps;
 /// \todo make current_position = real_position (from endstops) + offset from G28 and friends
 TARGET BSS current_position;
 
+#ifdef STEP_POSITION
+/// \var step_position
+/// \brief actual position in motor steps, counted by dda_step(), set to
+///        startpoint_steps by dda_new_startpoint()
+volatile axes_int32_t BSS step_position;
+
+/// Count one step of axis i.
+#define step_count(i) (step_position[i] += move_state.step_dir[i])
+#else
+#define step_count(i) do { } while (0)
+#endif
+
+/// \var work_offset
+/// \brief machine position of the G-code origin, applied to G-code
+///        coordinates before kinematics, see G54 and G43
+axes_int32_t work_offset;
+
+#ifdef FEED_OVERRIDE
+/// \var feed_override
+/// \brief requested speed of all moves, 256 = 100%, set by M220
+volatile uint16_t feed_override = 256;
+
+/// \var feed_override_now
+/// \brief override applied, follows feed_override in dda_clock()
+static uint16_t feed_override_now = 256;
+#endif
+
+#ifdef FEED_HOLD
+/// \var feed_hold
+/// \brief state of a feed hold, see FEED_HOLD_OFF and friends
+volatile uint8_t feed_hold = FEED_HOLD_OFF;
+
+/// \var hold_resumed
+/// \brief the next move started ramps up from standstill, see dda_resume()
+static uint8_t hold_resumed = 0;
+#endif
+
+#ifdef JOG
+/// \var jog_feedrate
+/// \brief commanded speed of jog moves in mm/min, set by jog()
+volatile uint16_t jog_feedrate = 0;
+#endif
+
+#ifdef KINEMATICS_ARM4
+/// \var current_joints
+/// \brief joint angles of current_position, millidegrees
+static axes_int32_t current_joints;
+#endif
+
+#ifdef LOOKAHEAD
+/// \var prev_dda
+/// \brief most recently created move, lookahead joins the next one to it
+static DDA *prev_dda = NULL;
+#endif
+
+#ifdef STEP_RATE_GUARD
+/// \var step_c_floor
+/// \brief shortest step interval the step interrupt keeps up with, learned
+///        by dda_overload()
+static volatile uint32_t step_c_floor = 0;
+
+/// \var step_floor_raised
+/// \brief step_c_floor went up since the last dda_overload_report()
+static volatile uint8_t step_floor_raised = 0;
+#endif
+
+/// \var e_relative_um
+/// \brief sum of relative E moves, see dda_create()
+static int32_t e_relative_um = 0;
+
+/// \var e_relative_steps
+/// \brief steps done for e_relative_um
+static int32_t e_relative_steps = 0;
+
 /// \var move_state
 /// \brief numbers for tracking the current state of movement
 MOVE_STATE BSS move_state;
 
-/// \var steps_per_m_P
-/// \brief motor steps required to advance one meter on each axis
-static const axes_uint32_t PROGMEM steps_per_m_P = {
-  STEPS_PER_M_X,
-  STEPS_PER_M_Y,
-  STEPS_PER_M_Z,
-  STEPS_PER_M_U,
-  STEPS_PER_M_E
-};
+#ifdef STEP_TIMING_QUEUE
+/**
+  Step timing queue. dda_clock() precalculates step intervals ahead of time,
+  the step interrupt picks them up as it reaches the step they start with.
 
-/// \var maximum_feedrate_P
-/// \brief maximum allowed feedrate on each axis
-static const axes_uint32_t PROGMEM maximum_feedrate_P = {
-  MAXIMUM_FEEDRATE_X,
-  MAXIMUM_FEEDRATE_Y,
-  MAXIMUM_FEEDRATE_Z,
-  MAXIMUM_FEEDRATE_U,
-  MAXIMUM_FEEDRATE_E
-};
+  Single producer (dda_clock(), writes st_head), single consumer (dda_step(),
+  writes st_tail), both indices are single bytes, so no locking is needed.
+  Entries are tagged with move_state.timing_gen, which changes with each
+  move started and on endstop stops. Entries not matching get dropped.
+*/
+typedef struct {
+  uint32_t  step_no;  ///< first step this interval applies to
+  uint32_t  c;        ///< step interval, see DDA.c
+  uint8_t   gen;      ///< see move_state.timing_gen
+} STEP_TIMING;
+
+#define STEP_TIMING_SIZE 8
+#define ST_NEXT(x) (((x) + 1) & (STEP_TIMING_SIZE - 1))
+
+/// Planned duration of one queue entry, in timer ticks ( = 1 ms).
+#define STEP_TIMING_TICKS (F_CPU / 1000)
+
+static STEP_TIMING step_timing[STEP_TIMING_SIZE];
+static volatile uint8_t st_head = 0;
+static volatile uint8_t st_tail = 0;
+#endif
+
+#ifdef INPUT_SHAPING_FREQUENCY
+/**
+  Input shaper. Impulses are IS_DELAY queue entries apart, half a ringing
+  period. Amplitudes are 0.8 fixed point, adding up to 256. With
+  K = exp(-zeta * pi / sqrt(1 - zeta^2)) they're 1 / (1 + K) and
+  K / (1 + K) for ZV, 1, 2K, K^2 over (1 + K)^2 for ZVD. exp() is a Taylor
+  series here, good enough for damping ratios up to 0.3.
+*/
+#define IS_DELAY     ((500 + INPUT_SHAPING_FREQUENCY / 2) / INPUT_SHAPING_FREQUENCY)
+#define IS_ZETA      (INPUT_SHAPING_DAMPING / 100.)
+#define IS_X         (IS_ZETA * 3.14159265 / SQRT(1. - IS_ZETA * IS_ZETA))
+#define IS_K         (1. - IS_X + IS_X * IS_X / 2. - IS_X * IS_X * IS_X / 6. + \
+                      IS_X * IS_X * IS_X * IS_X / 24.)
+
+#ifdef INPUT_SHAPING_ZVD
+  #define IS_HISTORY (2 * IS_DELAY)
+  #define IS_A0      ((uint16_t)(256. / ((1. + IS_K) * (1. + IS_K)) + .5))
+  #define IS_A2      ((uint16_t)(256. * IS_K * IS_K / \
+                                 ((1. + IS_K) * (1. + IS_K)) + .5))
+  #define IS_A1      (256 - IS_A0 - IS_A2)
+#else
+  #define IS_HISTORY IS_DELAY
+  #define IS_A0      ((uint16_t)(256. / (1. + IS_K) + .5))
+  #define IS_A1      (256 - IS_A0)
+#endif
+
+/// unshaped speed of the last IS_HISTORY queue entries, 8.8 fixed point
+/// steps per entry
+static uint16_t is_history[IS_HISTORY];
+#endif
+
+#ifdef STEP_TRACE
+/**
+  Speed profile trace. dda_clock() records the step interval in effect
+  whenever it changed, along with the time and step number, so the profile
+  actually run can be compared against the planned one on the host. The
+  buffer is a ring, keeping the latest entries.
+*/
+typedef struct {
+  uint32_t  time;     ///< CPU ticks, see timer_read()
+  uint32_t  step_no;  ///< step number within the move, 0 = new move
+  uint32_t  c;        ///< step interval in effect, CPU ticks
+} STEP_TRACE_ENTRY;
+
+#define STEP_TRACE_SIZE 32
+
+static STEP_TRACE_ENTRY step_trace[STEP_TRACE_SIZE];
+static uint8_t step_trace_head = 0;
+static uint8_t step_trace_count = 0;
+#endif
+
+#ifdef STEP_BATCH_RATE
+  /// Step interval below which dda_step() starts batching steps.
+  #define STEP_BATCH_TICKS ((uint32_t)(F_CPU / STEP_BATCH_RATE))
+#endif
 
-/// \var c0_P
+/// \var c0
 /// \brief Initialization constant for the ramping algorithm. Timer cycles for
-///        first step interval.
-static const axes_uint32_t PROGMEM c0_P = {
-  (uint32_t)((double)F_CPU / SQRT((double)STEPS_PER_M_X * ACCELERATION / 2000.)),
-  (uint32_t)((double)F_CPU / SQRT((double)STEPS_PER_M_Y * ACCELERATION / 2000.)),
-  (uint32_t)((double)F_CPU / SQRT((double)STEPS_PER_M_Z * ACCELERATION / 2000.)),
-  (uint32_t)((double)F_CPU / SQRT((double)STEPS_PER_M_U * ACCELERATION / 2000.)),
-  (uint32_t)((double)F_CPU / SQRT((double)STEPS_PER_M_E * ACCELERATION / 2000.))
+///        first step interval when accelerating the axis at its own limit.
+static axes_uint32_t c0;
+
+/// \var c_limit_um
+/// \brief Shortest time per micrometer of each axis, from its maximum
+///        feedrate, in timer cycles, 24.8 fixed point. See dda_create().
+static axes_uint32_t c_limit_um;
+
+#ifdef BACKLASH
+/// \var backlash_P
+/// \brief backlash of each bot axis, um, millidegrees for joints
+static const axes_uint32_t PROGMEM backlash_P = {
+  BACKLASH_X,
+  BACKLASH_Y,
+  BACKLASH_Z,
+  BACKLASH_U,
+  0
 };
 
+/// \var backlash_steps
+/// \brief backlash_P in steps, see dda_apply_settings()
+static axes_uint32_t backlash_steps;
+
+/// \var backlash_dir
+/// \brief one bit per axis, set if its last move went in positive direction
+static uint8_t backlash_dir = 0;
+
+#ifdef STEP_POSITION
+/// \var backlash_taken
+/// \brief backlash steps in step_position, of all moves started, see
+///        step_position_um()
+static axes_int32_t backlash_taken;
+#endif
+#endif
+
 /*! Set the direction of the 'n' axis
 */
 static void set_direction(DDA *dda, enum axis_e n, int32_t delta) {
@@ -110,6 +276,25 @@ static int8_t get_direction(DDA *dda, enum axis_e n) {
     return -1;
 }
 
+#ifdef SPINDLE
+/*! Laser or spindle power for a step interval.
+
+  \param *dda the move
+  \param c the current step interval
+
+  With M4, power follows speed, c_min / c, so energy per length stays the
+  same along the ramps. Null moves, like the one queued by M3/M4/M5 itself,
+  get the full power.
+*/
+static uint8_t spindle_power(DDA *dda, uint32_t c) {
+  #ifdef ACCELERATION_RAMPING
+    if (dda->endpoint.spindle_dynamic && ! dda->nullmove && c > dda->c_min)
+      return ((uint32_t)dda->endpoint.spindle * dda->c_min) / c;
+  #endif
+  return dda->endpoint.spindle;
+}
+#endif
+
 /*! Inititalise DDA movement structures
 */
 void dda_init(void) {
@@ -122,6 +307,42 @@ void dda_init(void) {
     startpoint.f_multiplier = next_target.target.f_multiplier = 256;
 }
 
+/** Recalculate movement constants from settings.
+
+  Called by settings_apply(). c0 is F_CPU / sqrt(steps_per_m * acceleration
+  / 2000), both operands of the division get scaled up before for precision.
+*/
+void dda_apply_settings(void) {
+  enum axis_e i;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    uint32_t f = F_CPU;
+    uint32_t x = muldiv(settings.steps_per_m[i], settings.acceleration[i],
+                        2000);
+
+    if (x == 0)
+      x = 1;
+    while (x < (1UL << 30) && f < (1UL << 31)) {
+      x <<= 2;
+      f <<= 1;
+    }
+    c0[i] = f / int_sqrt(x);
+
+    // 60 s/min * F_CPU / 1000 um/mm is 960000 at 16 MHz, so 24.8 fixed point
+    // works down to 1 mm/min.
+    c_limit_um[i] = ((60UL * F_CPU / 1000) << 8) /
+                    (settings.maximum_feedrate[i] ? settings.maximum_feedrate[i]
+                                                  : 1);
+
+    #ifdef BACKLASH
+      backlash_steps[i] = um_to_steps(pgm_read_dword(&backlash_P[i]), i);
+    #endif
+  }
+
+  // Same position in mm, new position in steps.
+  dda_new_startpoint();
+}
+
 /*! Distribute a new startpoint to DDA's internal structures without any movement.
 
 	This is needed for example after homing or a G92. The new location must be in startpoint already.
@@ -129,6 +350,27 @@ void dda_init(void) {
 void dda_new_startpoint(void) {
 	axes_um_to_steps(startpoint.axis, startpoint_steps.axis);
   startpoint_steps.axis[E] = um_to_steps(startpoint.axis[E], E);
+
+  #ifdef STEP_POSITION
+    // Only right without movement, callers wait for the queue to empty.
+    ATOMIC_START
+      memcpy((void *)step_position, startpoint_steps.axis,
+             sizeof(axes_int32_t));
+      #ifdef BACKLASH
+        memset(backlash_taken, 0, sizeof(axes_int32_t));
+      #endif
+    ATOMIC_END
+  #endif
+}
+
+/*! Have the next move start from standstill, not joined to the previous one.
+
+	This is needed after putting moves into the queue without dda_create(), like replaying a motion macro does. The new location must be in startpoint and startpoint_steps already.
+*/
+void dda_break_lookahead(void) {
+  #ifdef LOOKAHEAD
+    prev_dda = NULL;
+  #endif
 }
 
 /*! CREATE a dda given current_position and a target, save to passed location so we can write directly into the queue
@@ -152,11 +394,10 @@ void dda_new_startpoint(void) {
  *    prev_dda and prev_distance invalid. There might be more such cases in the
  *    future, e.g. when heater or fan changes are queued up, too.
  * 4. Nullmove due to no movement expected, e.g. a pure speed change. This
- *    shouldn't interrupt lookahead and be handled af if the change would come
- *    with the next movement.
- * 5. Nullmove due to movement smaller than a single step. Shouldn't interrupt
- *    lookahead either, but this small distance should be added to the next
- *    movement.
+ *    doesn't interrupt lookahead, the next movement joins the one before the
+ *    nullmove and comes with the change.
+ * 5. Nullmove due to movement smaller than a single step. Doesn't interrupt
+ *    lookahead either, the small distance gets added to the next movement.
  * 6. Lookahead calculation too slow. This is handled in dda_join_moves()
  *    already.
  */
@@ -166,15 +407,18 @@ void dda_create(DDA *dda, const TARGET *target) {
 	uint32_t	distance, c_limit, c_limit_calc;
   enum axis_e i;
   #ifdef LOOKAHEAD
+  // Signed displacements in micrometers, for the lookahead algorithms.
+  axes_int32_t move_um;
   // Number the moves to identify them; allowed to overflow.
   static uint8_t idcnt = 0;
-  static DDA* prev_dda = NULL;
 
-  if ((prev_dda && prev_dda->done) || dda->waitfor_temp)
+  // prev_dda == dda happens after a queue full of null moves.
+  if ((prev_dda && prev_dda->done) || prev_dda == dda ||
+      dda->waitfor_temp || dda->dwell)
     prev_dda = NULL;
   #endif
 
-  if (dda->waitfor_temp)
+  if (dda->waitfor_temp || dda->dwell)
     return;
 
   // We end at the passed target.
@@ -196,6 +440,7 @@ void dda_create(DDA *dda, const TARGET *target) {
     // Set the start and stop speeds to zero for now = full stops between
     // moves. Also fallback if lookahead calculations fail to finish in time.
     dda->crossF = 0;
+    dda->startF = 0;
     dda->start_steps = 0;
     dda->end_steps = 0;
     // Give this move an identifier.
@@ -204,6 +449,9 @@ void dda_create(DDA *dda, const TARGET *target) {
 
   // Handle bot axes. They're subject to kinematics considerations.
   code_axes_to_stepper_axes(&startpoint, target, delta_um, steps);
+  #if defined BACKLASH && defined STEP_POSITION
+    dda->takeup = 0;
+  #endif
   for (i = X; i < E; i++) {
     int32_t delta_steps;
 
@@ -214,61 +462,89 @@ void dda_create(DDA *dda, const TARGET *target) {
     set_direction(dda, i, delta_steps);
     #ifdef LOOKAHEAD
       // Also displacements in micrometers, but for the lookahead alogrithms.
-      // TODO: this is redundant. delta_um[] and dda->delta_um[] differ by
-      //       just signedness and storage location. Ideally, dda is used
-      //       as storage place only if neccessary (LOOKAHEAD turned on?)
-      //       because this space is multiplied by the movement queue size.
+      // Not stored in the DDA, as this space is multiplied by the movement
+      // queue size. Lookahead remembers these of the previous move.
       //
       // Update 2014/10: it was tried to use delta_um[]'s sign to set stepper
       //                 direction in dda_start() to allow getting rid of
       //                 some of this redundancy, but this increases dda_start()
       //                 by at least 20 clock cycles. Not good for performance.
       //                 Tried code can be found in the archive folder.
-      dda->delta_um[i] = (delta_steps >= 0) ?
-                         (int32_t)delta_um[i] : -(int32_t)delta_um[i];
+      move_um[i] = (delta_steps >= 0) ?
+                   (int32_t)delta_um[i] : -(int32_t)delta_um[i];
+    #endif
+    #ifdef BACKLASH
+      // Reversing? Take up the slack along with this move. Only the step
+      // count grows, the position in steps stays, so does move_um[] for
+      // lookahead. Speed limits below see the longer way in delta_um[].
+      if (delta_steps && (delta_steps > 0) != ((backlash_dir >> i) & 1)) {
+        backlash_dir ^= 1 << i;
+        dda->delta[i] += backlash_steps[i];
+        delta_um[i] += pgm_read_dword(&backlash_P[i]);
+        #ifdef STEP_POSITION
+          dda->takeup |= 1 << i;
+        #endif
+      }
     #endif
   }
 
   // Handle extruder axes. They act independently from the bots kinematics
   // type, but are subject to other special handling.
-  steps[E] = um_to_steps(target->axis[E], E);
+  for (i = E; i < AXIS_COUNT; i++) {
+    if ( ! target->e_relative) {
+      int32_t delta_steps;
 
-  // Apply extrusion multiplier.
-  if (target->e_multiplier != 256) {
-  steps[E] *= target->e_multiplier;
-    steps[E] += 128;
-    steps[E] /= 256;
-  }
+      steps[i] = um_to_steps(target->axis[i], i);
 
-  if ( ! target->e_relative) {
-    int32_t delta_steps;
+      // Apply extrusion multiplier.
+      if (target->e_multiplier != 256) {
+        steps[i] *= target->e_multiplier;
+        steps[i] += 128;
+        steps[i] /= 256;
+      }
 
-    delta_um[E] = (uint32_t)labs(target->axis[E] - startpoint.axis[E]);
-    delta_steps = steps[E] - startpoint_steps.axis[E];
-    dda->delta[E] = (uint32_t)labs(delta_steps);
-    startpoint_steps.axis[E] = steps[E];
+      delta_um[i] = (uint32_t)labs(target->axis[i] - startpoint.axis[i]);
+      delta_steps = steps[i] - startpoint_steps.axis[i];
+      dda->delta[i] = (uint32_t)labs(delta_steps);
+      startpoint_steps.axis[i] = steps[i];
 
-    set_direction(dda, E, delta_steps);
-    #ifdef LOOKAHEAD
-      // Also displacements in micrometers, but for the lookahead alogrithms.
-      // TODO: this is redundant. delta_um[] and dda->delta_um[] differ by
-      //       just signedness and storage location. Ideally, dda is used
-      //       as storage place only if neccessary (LOOKAHEAD turned on?)
-      //       because this space is multiplied by the movement queue size.
-      dda->delta_um[E] = (delta_steps >= 0) ?
-                         (int32_t)delta_um[E] : -(int32_t)delta_um[E];
-    #endif
+      set_direction(dda, i, delta_steps);
+      #ifdef LOOKAHEAD
+        move_um[i] = (delta_steps >= 0) ?
+                     (int32_t)delta_um[i] : -(int32_t)delta_um[i];
+      #endif
+    }
+    else {
+      int32_t um = target->axis[i];
+
+      // Rounding each relative move to steps on its own loses up to half a
+      // step per move, which adds up with dense G-code, and moves shorter
+      // than half a step get lost entirely. So add them up and step what
+      // the sum asks for, absolute moves do just that as well. Re-based
+      // every metre to stay in range.
+      if (target->e_multiplier != 256)
+        um = (um * target->e_multiplier + 128) / 256;
+      e_relative_um += um;
+      steps[i] = um_to_steps(e_relative_um, i) - e_relative_steps;
+      e_relative_steps += steps[i];
+      if (labs(e_relative_um) > 1000000) {
+        e_relative_um -= steps_to_um(e_relative_steps, i);
+        e_relative_steps = 0;
+      }
+
+      delta_um[i] = (uint32_t)labs(target->axis[i]);
+      dda->delta[i] = (uint32_t)labs(steps[i]);
+      #ifdef LOOKAHEAD
+        move_um[i] = target->axis[i];
+      #endif
+      set_direction(dda, i, target->axis[i]);
+    }
   }
-  else {
-    // When we get more extruder axes:
-    // for (i = E; i < AXIS_COUNT; i++) { ...
-    delta_um[E] = (uint32_t)labs(target->axis[E]);
-    dda->delta[E] = (uint32_t)labs(steps[E]);
-    #ifdef LOOKAHEAD
-      dda->delta_um[E] = target->axis[E];
-    #endif
-    dda->e_direction = (target->axis[E] >= 0)?1:0;
-	}
+
+  // Axes without a stepper don't step. All compiled away if all have one.
+  for (i = X; i < AXIS_COUNT; i++)
+    if ( ! (STEP_AXES & (1 << i)))
+      dda->delta[i] = 0;
 
 	if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("[%ld,%ld,%ld,%ld,%ld]"),
@@ -280,13 +556,19 @@ void dda_create(DDA *dda, const TARGET *target) {
   // sure, but my feeling says that when we achieve true circles and Beziers,
   // we'll have total_steps which matches neither of X, Y, Z or E. Accordingly,
   // keep it for now. --Traumflug
+  #if ! defined ACCELERATION_TEMPORAL || defined STEPPER_IDLE_DISABLE
+    dda->axis_mask = 0;
+  #endif
   for (i = X; i < AXIS_COUNT; i++) {
     if (i == X || dda->delta[i] > dda->total_steps) {
       dda->fast_axis = i;
       dda->total_steps = dda->delta[i];
       dda->fast_um = delta_um[i];
-      dda->fast_spm = pgm_read_dword(&steps_per_m_P[i]);
     }
+    #if ! defined ACCELERATION_TEMPORAL || defined STEPPER_IDLE_DISABLE
+      if (dda->delta[i])
+        dda->axis_mask |= 1 << i;
+    #endif
   }
 
 	if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
@@ -297,29 +579,47 @@ void dda_create(DDA *dda, const TARGET *target) {
 	}
 	else {
 		// get steppers ready to go
+		// Drivers get switched on in dda_start(), they may be switched off
+		// until then, see STEPPER_IDLE_DISABLE.
 		power_on();
-		stepper_enable();
-		x_enable();
-		y_enable();
-    z_enable();
-    u_enable();
-		e_enable();
-
-#ifdef SHAUKI_KO // if this block of code compiled then rotations are ultra slow
-		// since it's unusual to combine X, Y and Z changes in a single move on reprap, check if we can use simpler approximations before trying the full 3d approximation.
-		if (delta_um[Z] == 0)
-			distance = approx_distance(delta_um[X], delta_um[Y]);
-		else if (delta_um[X] == 0 && delta_um[Y] == 0)
-			distance = delta_um[Z];
-		else
-			distance = approx_distance_3(delta_um[X], delta_um[Y], delta_um[Z]);
+
+    // Feedrate applies to the G-code coordinate system, so does the distance.
+    // It's the same as delta_um[] with straight kinematics only.
+    #ifdef KINEMATICS_STRAIGHT
+      distance = int_distance(delta_um, E);
+    #else
+      {
+        axes_uint32_t delta_code;
+
+        for (i = X; i < E; i++)
+          delta_code[i] = (uint32_t)labs(target->axis[i] - startpoint.axis[i]);
+        distance = int_distance(delta_code, E);
+      }
+    #endif
 
 		if (distance < 2)
 			distance = delta_um[E];
 
 		if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
 			sersendf_P(PSTR(",ds:%lu"), distance);
-#endif
+
+    // Scale the feedrate down to what all axes can follow, before anything
+    // gets planned with it, lookahead included. With arm kinematics axes are
+    // joints, their share of a segment changes along the path and grows
+    // without bounds near singular poses, like close to the column.
+    for (i = X; i < AXIS_COUNT; i++) {
+      uint32_t axis_F;
+
+      if (delta_um[i] == 0)
+        continue;
+      axis_F = muldiv(dda->endpoint.F, delta_um[i], distance);
+      if (axis_F > settings.maximum_feedrate[i]) {
+        dda->endpoint.F = muldiv(dda->endpoint.F,
+                                 settings.maximum_feedrate[i], axis_F);
+        if (dda->endpoint.F == 0)
+          dda->endpoint.F = 1;
+      }
+    }
 
     #ifdef	ACCELERATION_TEMPORAL
       // bracket part of this equation in an attempt to avoid overflow:
@@ -328,8 +628,7 @@ void dda_create(DDA *dda, const TARGET *target) {
 
       move_duration = distance * ((60 * F_CPU) / (dda->endpoint.F * 1000UL));
       for (i = X; i < AXIS_COUNT; i++) {
-        md_candidate = dda->delta[i] * ((60 * F_CPU) /
-                       (pgm_read_dword(&maximum_feedrate_P[i]) * 1000UL));
+        md_candidate = dda->delta[i] * (c_limit_um[i] >> 8);
         if (md_candidate > move_duration)
           move_duration = md_candidate;
       }
@@ -349,23 +648,33 @@ void dda_create(DDA *dda, const TARGET *target) {
 
 			// changed distance * 6000 .. * F_CPU / 100000 to
 			//         distance * 2400 .. * F_CPU / 40000 so we can move a distance of up to 1800mm without overflowing
-			uint32_t move_duration = ((distance * 2400) / dda->total_steps) * (F_CPU / 40000);
+
+			// changed to muldiv(), which never overflows in between and keeps full
+			// precision also at 40960 steps/mm, where the above lost up to 2%
+			// in its first division. Costs about the same.
+			uint32_t move_duration = muldiv(distance, 60 * (F_CPU / 1000),
+			                                dda->total_steps);
 		#endif
 
 		// similarly, find out how fast we can run our axes.
 		// do this for each axis individually, as the combined speed of two or more axes can be higher than the capabilities of a single one.
-    // TODO: instead of calculating c_min directly, it's probably more simple
-    //       to calculate (maximum) move_duration for each axis, like done for
-    //       ACCELERATION_TEMPORAL above. This should make re-calculating the
-    //       allowed F easier.
+    // F is limited already, this catches rounding errors of the above.
+    // Each axis needs at least c_limit_um[] per um, so its share of a step
+    // takes delta_um / total_steps times that. One muldiv() instead of a
+    // chain of three divisions, and without their loss of precision.
     c_limit = 0;
     for (i = X; i < AXIS_COUNT; i++) {
-      c_limit_calc = (delta_um[i] * 2400L) /
-                     dda->total_steps * (F_CPU / 40000) /
-                     pgm_read_dword(&maximum_feedrate_P[i]);
+      if (delta_um[i] == 0)
+        continue;
+      c_limit_calc = muldiv(delta_um[i], c_limit_um[i], dda->total_steps) >> 8;
       if (c_limit_calc > c_limit)
         c_limit = c_limit_calc;
     }
+    #ifdef STEP_RATE_GUARD
+      // Nor faster than the step interrupt can go.
+      if (c_limit < step_c_floor)
+        c_limit = step_c_floor;
+    #endif
 
 		#ifdef ACCELERATION_REPRAP
 		// c is initial step time in IOclk ticks
@@ -387,36 +696,21 @@ void dda_create(DDA *dda, const TARGET *target) {
 			uint32_t esq = (enF * enF);
 			int32_t dsq = (int32_t) (esq - ssq) / 4;
 
-			uint8_t msb_ssq = msbloc(ssq);
-			uint8_t msb_tot = msbloc(dda->total_steps);
-
-			// the raw equation WILL overflow at high step rates, but 64 bit math routines take waay too much space
-			// at 65536 mm/min (1092mm/s), ssq/esq overflows, and dsq is also close to overflowing if esq/ssq is small
-			// but if ssq-esq is small, ssq/dsq is only a few bits
-			// we'll have to do it a few different ways depending on the msb locations of each
-			if ((msb_tot + msb_ssq) <= 30) {
-				// we have room to do all the multiplies first
-				if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-					serial_writechar('A');
-				dda->n = ((int32_t) (dda->total_steps * ssq) / dsq) + 1;
-			}
-			else if (msb_tot >= msb_ssq) {
-				// total steps has more precision
-				if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-					serial_writechar('B');
-				dda->n = (((int32_t) dda->total_steps / dsq) * (int32_t) ssq) + 1;
-			}
-			else {
-				// otherwise
-				if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-					serial_writechar('C');
-				dda->n = (((int32_t) ssq / dsq) * (int32_t) dda->total_steps) + 1;
-			}
+			// n = total_steps * ssq / dsq + 1. The product takes up to 60 bits,
+			// muldiv() gets the exact quotient without 64-bit maths, for any
+			// step count and feedrate. F / 4 keeps ssq within 28 bits.
+			if (dsq > 0)
+				dda->n = muldiv(ssq, dda->total_steps, dsq) + 1;
+			else if (dsq < 0)
+				dda->n = muldiv(-(int32_t)ssq, dda->total_steps, -dsq) + 1;
+			else
+				// Speeds differ by rounding only, see below.
+				dda->n = 0;
 
 			if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-        sersendf_P(PSTR("\n{DDA:CA end_c:%lu, n:%ld, md:%lu, ssq:%lu, esq:%lu, dsq:%lu, msbssq:%u, msbtot:%u}\n"), dda->end_c, dda->n, move_duration, ssq, esq, dsq, msb_ssq, msb_tot);
+        sersendf_P(PSTR("\n{DDA:CA end_c:%lu, n:%ld, md:%lu, ssq:%lu, esq:%lu, dsq:%lu}\n"), dda->end_c, dda->n, move_duration, ssq, esq, dsq);
 
-			dda->accel = 1;
+			dda->accel = (dsq != 0);
 		}
 		else
 			dda->accel = 0;
@@ -426,15 +720,57 @@ void dda_create(DDA *dda, const TARGET *target) {
         dda->c_min = c_limit;
         dda->endpoint.F = move_duration / dda->c_min;
       }
+      #ifdef FEED_OVERRIDE
+        dda->c_limit = c_limit;
+      #endif
 
       // Lookahead can deal with 16 bits ( = 1092 mm/s), only.
       if (dda->endpoint.F > 65535)
         dda->endpoint.F = 65535;
 
-      // Acceleration ramps are based on the fast axis, not the combined speed.
+      // Each axis accelerates in proportion to its share of the movement, so
+      // the weakest participating axis limits acceleration of the fast axis.
+      {
+        uint32_t fast_axis_acc, acc_candidate;
+
+        fast_axis_acc = settings.acceleration[dda->fast_axis];
+        dda->fast_acc = fast_axis_acc;
+        for (i = X; i < AXIS_COUNT; i++) {
+          if (i != dda->fast_axis && delta_um[i]) {
+            acc_candidate = muldiv(settings.acceleration[i],
+                                   dda->fast_um, delta_um[i]);
+            if (acc_candidate < dda->fast_acc)
+              dda->fast_acc = acc_candidate;
+          }
+        }
+        #ifdef ACCELERATION_SCURVE
+          // Peak acceleration of an S-curve is 1.5 times its average.
+          dda->fast_acc = (dda->fast_acc * 2) / 3;
+        #endif
+        if (dda->fast_acc == 0)
+          dda->fast_acc = 1;
+
+        // c0 ~ 1 / sqrt(acceleration).
+        dda->c0 = c0[dda->fast_axis];
+        if (dda->fast_acc != fast_axis_acc)
+          dda->c0 = muldiv(dda->c0, 1UL << 14,
+                           int_sqrt(muldiv(dda->fast_acc, 1UL << 28,
+                                           fast_axis_acc)));
+      }
+
+      #ifdef ADVANCE_K
+        // E speed is F_CPU / c * delta[E] / total_steps steps per second.
+        dda->advance = 0;
+        if (dda->fast_axis != E && dda->e_direction && dda->delta[E])
+          dda->advance = muldiv(ADVANCE_K * (F_CPU / 1000), dda->delta[E],
+                                dda->total_steps);
+      #endif
+
+      // Acceleration ramps are based on the fast axis, not the combined speed,
+      // in um/s, F * 1000 / 60.
       dda->rampup_steps =
-        acc_ramp_len(muldiv(dda->fast_um, dda->endpoint.F, distance),
-                     dda->fast_spm);
+        acc_ramp_len(muldiv(dda->fast_um, dda->endpoint.F * 50, distance * 3),
+                     dda->fast_axis, dda->fast_acc);
 
       if (dda->rampup_steps > dda->total_steps / 2)
         dda->rampup_steps = dda->total_steps / 2;
@@ -442,22 +778,18 @@ void dda_create(DDA *dda, const TARGET *target) {
 
       #ifdef LOOKAHEAD
         dda->distance = distance;
-        dda_find_crossing_speed(prev_dda, dda);
-        // TODO: this should become a reverse-stepping through the existing
-        //       movement queue to allow higher speeds for short moves.
-        //       dda_find_crossing_speed() is required only once.
+        dda_find_crossing_speed(prev_dda, dda, move_um);
         dda_join_moves(prev_dda, dda);
         dda->n = dda->start_steps;
         if (dda->n == 0)
-          dda->c = pgm_read_dword(&c0_P[dda->fast_axis]);
+          dda->c = dda->c0;
         else
-          dda->c = (pgm_read_dword(&c0_P[dda->fast_axis]) *
-                    int_inv_sqrt(dda->n)) >> 13;
+          dda->c = int_div_sqrt(dda->c0, dda->n) >> 1;
         if (dda->c < dda->c_min)
           dda->c = dda->c_min;
       #else
         dda->n = 0;
-        dda->c = pgm_read_dword(&c0_P[dda->fast_axis]);
+        dda->c = dda->c0;
       #endif
 
 		#elif defined ACCELERATION_TEMPORAL
@@ -490,10 +822,57 @@ void dda_create(DDA *dda, const TARGET *target) {
 	// next dda starts where we finish
 	memcpy(&startpoint, &dda->endpoint, sizeof(TARGET));
   #ifdef LOOKAHEAD
-    prev_dda = dda;
+    // Null moves, like G1 F1500 or less than a step, leave lookahead alone,
+    // the next move joins the one before. The less than a step gets added
+    // to it, as steps are taken from absolute positions.
+    if ( ! dda->nullmove)
+      prev_dda = dda;
   #endif
 }
 
+#ifdef TEMPORAL_MATCH_CHANNELS
+/** Time of the next step on one timer match channel.
+
+  \param dda The move.
+
+  \param ch The match channel, see TIMER_CHANNELS.
+
+  \return Time of the next step of the axes on this channel, relative to the
+          start of the move, or 0xFFFFFFFF if none of them has steps left.
+*/
+static uint32_t dda_channel_next(DDA *dda, uint8_t ch) {
+  uint32_t next = 0xFFFFFFFF, candidate;
+  uint8_t i;
+
+  for (i = ch; i < AXIS_COUNT; i += TIMER_CHANNELS) {
+    if (move_state.steps[i]) {
+      candidate = move_state.time[i] + dda->step_interval[i];
+      if (candidate < next)
+        next = candidate;
+    }
+  }
+
+  return next;
+}
+
+/** Schedule the next step of one timer match channel.
+
+  \param dda The move.
+
+  \param ch The match channel, see TIMER_CHANNELS.
+
+  Channels without steps left get stopped.
+*/
+static void dda_schedule_channel(DDA *dda, uint8_t ch) {
+  uint32_t next = dda_channel_next(dda, ch);
+
+  if (next == 0xFFFFFFFF)
+    timer_channel_stop(ch);
+  else
+    timer_channel_set(ch, move_state.start_time + next);
+}
+#endif /* TEMPORAL_MATCH_CHANNELS */
+
 /*! Start a prepared DDA
 	\param *dda pointer to entry in dda_queue to start
 
@@ -507,17 +886,50 @@ void dda_create(DDA *dda, const TARGET *target) {
 */
 void dda_start(DDA *dda) {
 	// called from interrupt context: keep it simple!
+  #ifdef TEMPORAL_MATCH_CHANNELS
+    enum axis_e i;
+  #endif
 
+  #ifdef TRACE
+    trace(TRACE_DDA_START, dda->total_steps, dda->c);
+  #else
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("Start: X %lq  Y %lq  Z %lq  U %lq  F %lu\n"),
                dda->endpoint.axis[X], dda->endpoint.axis[Y],
                dda->endpoint.axis[Z], dda->endpoint.axis[U], dda->endpoint.F);
+  #endif
+
+  #ifdef SPINDLE
+    heater_set(SPINDLE, spindle_power(dda, dda->c));
+  #endif
 
 	if ( ! dda->nullmove) {
 		// get ready to go
 		psu_timeout = 0;
-		//if (dda->endstop_check)
-		endstops_on(); // SHAUKI ensure ON
+    #ifdef STEP_RATE_GUARD
+      // Planned before the last overload, possibly.
+      if (dda->c_min < step_c_floor)
+        dda->c_min = step_c_floor;
+      if (dda->c < dda->c_min)
+        dda->c = dda->c_min;
+    #endif
+    #if defined BACKLASH && defined STEP_POSITION
+      if (dda->takeup) {
+        enum axis_e a;
+
+        // Counted by dda_step() along with the move, but not a movement.
+        for (a = X; a < E; a++)
+          if (dda->takeup & (1 << a))
+            backlash_taken[a] += (int32_t)get_direction(dda, a) *
+                                 (int32_t)backlash_steps[a];
+      }
+    #endif
+    if (steppers_on != STEPPERS_ALL)
+      steppers_enable();
+    #ifdef STEPPER_IDLE_DISABLE
+      steppers_moved |= dda->axis_mask;
+    #endif
+    // Endstop pullups are on since pinio_init().
 
 		// set direction outputs
 		x_direction(dda->x_direction);
@@ -535,10 +947,52 @@ void dda_start(DDA *dda) {
     move_state.counter[X] = move_state.counter[Y] = move_state.counter[Z] = move_state.counter[U] = \
       move_state.counter[E] = -(dda->total_steps >> 1);
     memcpy(&move_state.steps[X], &dda->delta[X], sizeof(uint32_t) * AXIS_COUNT); // SHAUKI sizeof(uint32_t) times hardcoded 4 ?!
+    #ifndef ACCELERATION_TEMPORAL
+      move_state.axis_mask = dda->axis_mask;
+    #endif
+    #ifdef STEP_POSITION
+      move_state.step_dir[X] = dda->x_direction ? 1 : -1;
+      move_state.step_dir[Y] = dda->y_direction ? 1 : -1;
+      move_state.step_dir[Z] = dda->z_direction ? 1 : -1;
+      move_state.step_dir[U] = dda->u_direction ? 1 : -1;
+      move_state.step_dir[E] = dda->e_direction ? 1 : -1;
+    #endif
     move_state.endstop_stop = 0;
+    // Endstop state is read only by moves checking endstops.
+    if (dda->endstop_check) {
+      memset(move_state.debounce_count, 0, sizeof(move_state.debounce_count));
+      #ifdef ENDSTOP_CAPTURE
+        memcpy(move_state.endstop_latch, move_state.steps,
+               sizeof(move_state.endstop_latch));
+      #endif
+    }
 		#ifdef ACCELERATION_RAMPING
 			move_state.step_no = 0;
 		#endif
+    #ifdef ADVANCE_K
+      move_state.e_advance = 0;
+    #endif
+    #ifdef FEED_HOLD
+      move_state.hold_step = 0;
+      move_state.resume_base = 0;
+      move_state.resume = hold_resumed;
+      hold_resumed = 0;
+      if (move_state.resume)
+        dda->c = dda->c0;
+    #endif
+    #ifdef JOG
+      move_state.jog_n = 0;
+      move_state.jog_step = 0;
+      move_state.jog_n_cmd = 0;
+      move_state.jog_f = 0;
+      move_state.jog_end = 0;
+    #endif
+    #ifdef STEP_TIMING_QUEUE
+      move_state.timing_gen++;
+    #endif
+    #ifdef STEP_LINK
+      steplink_move(dda, move_state.timing_gen);
+    #endif
 		#ifdef ACCELERATION_TEMPORAL
       move_state.time[X] = move_state.time[Y] = \
           move_state.time[Z] = move_state.time[U] = move_state.time[E] = 0UL;
@@ -547,8 +1001,15 @@ void dda_start(DDA *dda) {
 		// ensure this dda starts
 		dda->live = 1;
 
+    #ifdef TEMPORAL_MATCH_CHANNELS
+      // Each channel gets the first step of its axes.
+      move_state.start_time = timer_channel_now();
+      for (i = 0; i < TIMER_CHANNELS; i++)
+        dda_schedule_channel(dda, i);
+    #else
 		// set timeout for first step
     timer_set(dda->c, 0);
+    #endif
 	}
 	// else just a speed change, keep dda->live = 0
 
@@ -556,366 +1017,1301 @@ void dda_start(DDA *dda) {
 }
 
 /**
-  \brief Do per-step movement maintenance.
-
-  \param *dda the current move
+  Debounce one endstop reading of an axis.
 
-  \details Most important task here is to update the Bresenham algorithm and
-  to generate step pulses accordingly, this guarantees geometrical accuracy
-  of the movement. Other tasks, like acceleration calculations, are moved
-  into dda_clock() as much as possible.
+  \param i The axis.
 
-  This is called from our timer interrupt every time a step needs to occur.
-  Keep it as simple and fast as possible, this is most critical for the
-  achievable step frequency.
+  \param hit The endstop shows the condition we stop on.
 
-  Note: it was tried to do this in loops instead of straight, repeating code.
-        However, this resulted in at least 16% performance loss, no matter
-        how it was done. On how to measure, see commit "testcases: Add
-        config.h". On the various tries and measurement results, see commits
-        starting with "DDA: Move axis calculations into loops, part 6".
+  \return (1 << i) once the endstop showed it ENDSTOP_STEPS times in a row,
+          else 0.
 */
-void dda_step(DDA *dda) {
-
-#if ! defined ACCELERATION_TEMPORAL
-  if (move_state.steps[X]) {
-    move_state.counter[X] -= dda->delta[X];
-    if (move_state.counter[X] < 0) {
-			x_step();
-      move_state.steps[X]--;
-      move_state.counter[X] += dda->total_steps;
-		}
-	}
-  if (move_state.steps[Y]) {
-    move_state.counter[Y] -= dda->delta[Y];
-    if (move_state.counter[Y] < 0) {
-			y_step();
-      move_state.steps[Y]--;
-      move_state.counter[Y] += dda->total_steps;
-		}
-	}
-  if (move_state.steps[Z]) {
-    move_state.counter[Z] -= dda->delta[Z];
-    if (move_state.counter[Z] < 0) {
-			z_step();
-      move_state.steps[Z]--;
-      move_state.counter[Z] += dda->total_steps;
-		}
-	}
-  if (move_state.steps[U]) {
-    move_state.counter[U] -= dda->delta[U];
-    if (move_state.counter[U] < 0) {
-      u_step();
-      move_state.steps[U]--;
-      move_state.counter[U] += dda->total_steps;
-    }
+static uint8_t endstop_debounce(enum axis_e i, uint8_t hit) {
+  if (hit) {
+    #ifdef ENDSTOP_CAPTURE
+      if (move_state.debounce_count[i] == 0)
+        move_state.endstop_latch[i] = move_state.steps[i];
+    #endif
+    if (move_state.debounce_count[i] < ENDSTOP_STEPS)
+      move_state.debounce_count[i]++;
   }
-  if (move_state.steps[E]) {
-    move_state.counter[E] -= dda->delta[E];
-    if (move_state.counter[E] < 0) {
-			e_step();
-      move_state.steps[E]--;
-      move_state.counter[E] += dda->total_steps;
-		}
-	}
-#endif
-
-	#ifdef ACCELERATION_REPRAP
-		// linear acceleration magic, courtesy of http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
-		if (dda->accel) {
-      if ((dda->c > dda->end_c) && (dda->n > 0)) {
-				uint32_t new_c = dda->c - (dda->c * 2) / dda->n;
-        if (new_c <= dda->c && new_c > dda->end_c) {
-					dda->c = new_c; ///< time until next step, 24.8 fixed point
-					dda->n += 4; ///< precalculated step time offset variable
-				}
-				else
-          dda->c = dda->end_c;
-			}
-      else if ((dda->c < dda->end_c) && (dda->n < 0)) {
-				uint32_t new_c = dda->c + ((dda->c * 2) / -dda->n);
-        if (new_c >= dda->c && new_c < dda->end_c) {
-					dda->c = new_c; ///< time until next step, 24.8 fixed point
-					dda->n += 4; ///< precalculated step time offset variable
-				}
-				else
-          dda->c = dda->end_c;
-			}
-      else if (dda->c != dda->end_c) {
-        dda->c = dda->end_c;
-			}
-			// else we are already at target speed
-		}
-	#endif
-
-	#ifdef ACCELERATION_RAMPING
-		move_state.step_no++;
-	#endif
-
-  #ifdef ACCELERATION_TEMPORAL
-    /** How is this ACCELERATION TEMPORAL expected to work?
-
-      All axes work independently of each other, as if they were on four
-      different, synchronized timers. As we have not enough suitable timers,
-      we have to share one for all axes.
-
-      To do this, each axis maintains the time of its last step in
-      move_state.time[]. This time is updated as the step is done, see early
-      in dda_step(). To find out which axis is the next one to step, the time
-      of each axis' next step is compared to the time of the step just done.
-      Zero means this actually is the axis just stepped, the smallest value > 0
-      wins.
-
-      One problem undoubtedly arising is, steps should sometimes be done at
-      {almost,exactly} the same time. We trust the timer to deal properly with
-      very short or even zero periods. If a step can't be done in time, the
-      timer shall do the step as soon as possible and compensate for the delay
-      later. In turn we promise here to send a maximum of four such
-      short-delays consecutively and to give sufficient time on average.
-    */
-    // This is the time which led to this call of dda_step().
-    move_state.last_time = move_state.time[dda->axis_to_step] +
-                           dda->step_interval[dda->axis_to_step];
-
-    do {
-      uint32_t c_candidate;
-      enum axis_e i;
-
-      if (dda->axis_to_step == X) {
-        x_step();
-        move_state.steps[X]--;
-        move_state.time[X] += dda->step_interval[X];
-      }
-      if (dda->axis_to_step == Y) {
-        y_step();
-        move_state.steps[Y]--;
-        move_state.time[Y] += dda->step_interval[Y];
-      }
-      if (dda->axis_to_step == Z) {
-        z_step();
-        move_state.steps[Z]--;
-        move_state.time[Z] += dda->step_interval[Z];
-      }
-      if (dda->axis_to_step == U) {
-          u_step();
-          move_state.steps[U]--;
-          move_state.time[U] += dda->step_interval[U];
-      }
-      if (dda->axis_to_step == E) {
-        e_step();
-        move_state.steps[E]--;
-        move_state.time[E] += dda->step_interval[E];
-      }
-      unstep();
+  else
+    move_state.debounce_count[i] = 0;
 
-      // Find the next stepper to step.
-      dda->c = 0xFFFFFFFF;
-      for (i = X; i < AXIS_COUNT; i++) {
-        if (move_state.steps[i]) {
-          c_candidate = move_state.time[i] + dda->step_interval[i] -
-                        move_state.last_time;
-          if (c_candidate < dda->c) {
-            dda->axis_to_step = i;
-            dda->c = c_candidate;
-          }
-        }
-      }
+  return (move_state.debounce_count[i] >= ENDSTOP_STEPS) ? (1 << i) : 0;
+}
 
-      // No stepper to step found? Then we're done.
-      if (dda->c == 0xFFFFFFFF) {
-        dda->live = 0;
-        dda->done = 1;
-        break;
-      }
-    } while (timer_set(dda->c, 1));
+/**
+  Stop one axis of the current movement without ending it.
 
-  #endif /* ACCELERATION_TEMPORAL */
+  \param i The axis.
 
-  // If there are no steps left or an endstop stop happened, we have finished.
-  //
-  // TODO: with ACCELERATION_TEMPORAL this duplicates some code. See where
-  //       dda->live is zero'd, about 10 lines above.
-  if ((move_state.steps[X] == 0 && move_state.steps[Y] == 0 &&
-       move_state.steps[Z] == 0 && move_state.steps[U] == 0 && move_state.steps[E] == 0)
-    #ifdef ACCELERATION_RAMPING
-      || (move_state.endstop_stop && dda->n <= 0)
-    #endif
-      ) {
-		dda->live = 0;
-    dda->done = 1;
-    #ifdef LOOKAHEAD
-    // If look-ahead was using this move, it could have missed our activation:
-    // make sure the ids do not match.
-    dda->id--;
+  No more steps are sent to this axis, the other axes go on as planned. This
+  is an abrupt stop, fine at endstop search speeds. Keep in mind the axis
+  doesn't reach its target then, current position has to come from
+  update_current_position() or from the endstop position.
+*/
+void dda_stop_axis(enum axis_e i) {
+  ATOMIC_START
+    #ifdef ENDSTOP_CAPTURE
+      // Keep endstop_latch - steps, the overshoot, as it is.
+      move_state.endstop_latch[i] -= move_state.steps[i];
     #endif
-		#ifdef	DC_EXTRUDER
-			heater_set(DC_EXTRUDER, 0);
-		#endif
-
-    // No need to restart timer here.
-    // After having finished, dda_start() will do it.
-	}
-  else {
-		psu_timeout = 0;
+    move_state.steps[i] = 0;
     #ifndef ACCELERATION_TEMPORAL
-      timer_set(dda->c, 0);
+      move_state.axis_mask &= ~(1 << i);
     #endif
-  }
-
-	// turn off step outputs, hopefully they've been on long enough by now to register with the drivers
-	// if not, too bad. or insert a (very!) small delay here, or fire up a spare timer or something.
-	// we also hope that we don't step before the drivers register the low- limit maximum speed if you think this is a problem.
-	unstep();
+  ATOMIC_END
 }
 
-/*! Do regular movement maintenance.
-
-  This should be called pretty often, like once every 1 or 2 milliseconds.
+#ifdef STEP_RATE_GUARD
+/**
+  \brief The step interrupt didn't keep up with the step rate of a move.
 
-  Currently, this is checking the endstops and doing acceleration maths. These
-  don't need to be checked/recalculated on every single step, so this code
-  can be moved out of the highly time critical dda_step(). At high precision
-  (slow) searches of the endstop, this function is called more often than
-  dda_step() anyways.
+  \param *dda the live move
 
-  In the future, arc movement calculations might go here, too. Updating
-  movement direction 500 times a second is easily enough for smooth and
-  accurate curves!
+  Called from queue_step(), when the step interval was over before the step
+  interrupt was done. Raises step_c_floor to this interval plus a margin of
+  STEP_RATE_GUARD percent and slows down the live move to it. dda_create()
+  and dda_start() keep all further moves at or above it, so the step rate
+  caps itself at what this build sustains, instead of steps coming late.
 */
-void dda_clock() {
-  DDA *dda;
-  static DDA *last_dda = NULL;
-  uint8_t endstop_trigger = 0;
-  #ifdef ACCELERATION_RAMPING
-  uint32_t move_step_no, move_c;
-  int32_t move_n;
-  uint8_t recalc_speed;
-  uint8_t current_id ;
-  #endif
+void dda_overload(DDA *dda) {
+  uint32_t c_floor = dda->c * STEP_RATE_GUARD / 100;
 
-  dda = queue_current_movement();
-  if (dda != last_dda) {
-    move_state.debounce_count_x =
-    move_state.debounce_count_z =
-    move_state.debounce_count_u =
-    move_state.debounce_count_y = 0;
-    last_dda = dda;
+  queue_stats.overloads++;
+  if (c_floor > step_c_floor) {
+    step_c_floor = c_floor;
+    step_floor_raised = 1;
   }
+  if (dda->c_min < step_c_floor)
+    dda->c_min = step_c_floor;
+  if (dda->c < step_c_floor)
+    dda->c = step_c_floor;
+}
 
-  if (dda == NULL)
+/// Tell the host about a lowered step rate cap, see dda_overload().
+void dda_overload_report() {
+  if ( ! step_floor_raised)
     return;
 
-  // Caution: we mangle step counters here without locking interrupts. This
-  //          means, we trust dda isn't changed behind our back, which could
-  //          in principle (but rarely) happen if endstops are checked not as
-  //          endstop search, but as part of normal operations.
-  if (dda->endstop_check && ! move_state.endstop_stop) {
-    #ifdef X_MIN_PIN
-    if (dda->endstop_check & 0x01) {
-      if (x_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_x++;
+  step_floor_raised = 0;
+  sersendf_P(PSTR("Step rate overload, capped to %lu steps/s\n"),
+             F_CPU / step_c_floor);
+}
+#endif /* STEP_RATE_GUARD */
+
+#ifdef ENDSTOP_CAPTURE
+/**
+  Steps an axis went past its endstop trigger point.
+
+  \param i The axis.
+
+  \return Steps done after the first endstop hit, debouncing and
+          deceleration included. Without a hit this is the whole movement.
+
+  Valid after an endstop search completed, until the next movement starts,
+  so call it right after queue_wait().
+*/
+uint32_t dda_endstop_overshoot(enum axis_e i) {
+  uint32_t overshoot;
+
+  ATOMIC_START
+    overshoot = move_state.endstop_latch[i] - move_state.steps[i];
+  ATOMIC_END
+
+  return overshoot;
+}
+#endif
+
+/**
+  Read and debounce all endstops checked by a movement.
+
+  \param dda The movement.
+
+  \return Bit (1 << axis) set for each axis with a definitely triggered
+          endstop.
+*/
+static uint8_t endstop_read(DDA *dda) {
+  uint8_t triggered = 0;
+
+  #ifdef X_MIN_PIN
+  if (dda->endstop_check & ENDSTOP_MIN(X))
+    triggered |= endstop_debounce(X, x_min() == dda->endstop_stop_cond);
+  #endif
+  #ifdef X_MAX_PIN
+  if (dda->endstop_check & ENDSTOP_MAX(X))
+    triggered |= endstop_debounce(X, x_max() == dda->endstop_stop_cond);
+  #endif
+
+  #ifdef Y_MIN_PIN
+  if (dda->endstop_check & ENDSTOP_MIN(Y))
+    triggered |= endstop_debounce(Y, y_min() == dda->endstop_stop_cond);
+  #endif
+  #ifdef Y_MAX_PIN
+  if (dda->endstop_check & ENDSTOP_MAX(Y))
+    triggered |= endstop_debounce(Y, y_max() == dda->endstop_stop_cond);
+  #endif
+
+  #ifdef Z_MIN_PIN
+  if (dda->endstop_check & ENDSTOP_MIN(Z))
+    triggered |= endstop_debounce(Z, z_min() == dda->endstop_stop_cond);
+  #endif
+  #ifdef Z_MAX_PIN
+  if (dda->endstop_check & ENDSTOP_MAX(Z))
+    triggered |= endstop_debounce(Z, z_max() == dda->endstop_stop_cond);
+  #endif
+
+  #ifdef U_MIN_PIN
+  if (dda->endstop_check & ENDSTOP_MIN(U))
+    triggered |= endstop_debounce(U, u_min() == dda->endstop_stop_cond);
+  #endif
+  #ifdef U_MAX_PIN
+  if (dda->endstop_check & ENDSTOP_MAX(U))
+    triggered |= endstop_debounce(U, u_max() == dda->endstop_stop_cond);
+  #endif
+
+  return triggered;
+}
+
+/**
+  Act on triggered endstops.
+
+  \param dda The movement.
+
+  \param triggered Axes with a triggered endstop, see endstop_read().
+
+  Several axes searching at once, see home_axes(): each of them stops on its
+  own endstop, the others go on. The move ends as usual with the last one,
+  which is also the only one decelerating. A single endstop, like a probe
+  during a move, ends the whole move right away.
+*/
+static void endstop_act(DDA *dda, uint8_t triggered) {
+  uint8_t searching = 0;
+  enum axis_e i;
+
+  trace(TRACE_ENDSTOP, triggered, move_state.steps[dda->fast_axis]);
+
+  for (i = X; i < E; i++)
+    if ((dda->endstop_check & ENDSTOP_AXIS(i)) && move_state.steps[i])
+      searching |= 1 << i;
+
+  if (searching & ~triggered) {
+    for (i = X; i < E; i++)
+      if (searching & triggered & (1 << i))
+        dda_stop_axis(i);
+    return;
+  }
+
+  #ifdef ACCELERATION_RAMPING
+    // For always smooth operations, don't halt apruptly,
+    // but start deceleration here.
+    ATOMIC_START
+      move_state.endstop_stop = 1;
+      #ifdef STEP_TIMING_QUEUE
+        move_state.timing_gen++;
+      #endif
+      if (move_state.step_no < dda->rampup_steps)  // still accelerating
+        dda->total_steps = move_state.step_no * 2;
+      else
+        // A "-=" would overflow earlier.
+        dda->total_steps = dda->total_steps - dda->rampdown_steps +
+                           move_state.step_no;
+      dda->rampdown_steps = move_state.step_no;
+      #ifdef STEP_LINK
+        steplink_stop(move_state.timing_gen, dda->total_steps);
+      #endif
+    ATOMIC_END
+    // Not atomic, because not used in dda_step().
+    dda->rampup_steps = 0; // in case we're still accelerating
+  #else
+    dda->live = 0;
+  #endif
+
+  // endstops_off(); // SHAUKI NEVER CANCEL ENDSTOP CHECKS
+  endstops_on(); // SHAUKI ensure ON
+}
+
+/**
+  \brief End the live move from the step interrupt.
+
+  \param *dda the move
+
+  No need to restart the timer here. After having finished, dda_start() of
+  the next move will do it.
+*/
+static void dda_step_done(DDA *dda) __attribute__ ((always_inline));
+inline void dda_step_done(DDA *dda) {
+  trace(TRACE_DDA_END, dda->total_steps, dda->c);
+  dda->live = 0;
+  dda->done = 1;
+  #ifdef LOOKAHEAD
+  // If look-ahead was using this move, it could have missed our activation:
+  // make sure the ids do not match.
+  dda->id--;
+  #endif
+  #ifdef	DC_EXTRUDER
+    heater_set(DC_EXTRUDER, 0);
+  #endif
+  #ifdef SPINDLE
+    // M4 at standstill means off.
+    if (dda->endpoint.spindle_dynamic)
+      heater_set(SPINDLE, 0);
+  #endif
+}
+
+#ifdef ACCELERATION_REPRAP
+/**
+  \brief Per step speed change of ACCELERATION_REPRAP.
+
+  \param *dda the move
+
+  Linear acceleration magic, courtesy of http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
+*/
+static void dda_step_reprap(DDA *dda) __attribute__ ((always_inline));
+inline void dda_step_reprap(DDA *dda) {
+  if (dda->accel) {
+    if ((dda->c > dda->end_c) && (dda->n > 0)) {
+      uint32_t new_c = dda->c - (dda->c * 2) / dda->n;
+      if (new_c <= dda->c && new_c > dda->end_c) {
+        dda->c = new_c; ///< time until next step, 24.8 fixed point
+        dda->n += 4; ///< precalculated step time offset variable
+      }
       else
-        move_state.debounce_count_x = 0;
-      endstop_trigger = move_state.debounce_count_x >= ENDSTOP_STEPS;
+        dda->c = dda->end_c;
     }
-    #endif
-    #ifdef X_MAX_PIN
-    if (dda->endstop_check & 0x02) {
-      if (x_max() == dda->endstop_stop_cond)
-        move_state.debounce_count_x++;
+    else if ((dda->c < dda->end_c) && (dda->n < 0)) {
+      uint32_t new_c = dda->c + ((dda->c * 2) / -dda->n);
+      if (new_c >= dda->c && new_c < dda->end_c) {
+        dda->c = new_c; ///< time until next step, 24.8 fixed point
+        dda->n += 4; ///< precalculated step time offset variable
+      }
       else
-        move_state.debounce_count_x = 0;
-      endstop_trigger = move_state.debounce_count_x >= ENDSTOP_STEPS;
+        dda->c = dda->end_c;
     }
-    #endif
+    else if (dda->c != dda->end_c) {
+      dda->c = dda->end_c;
+    }
+    // else we are already at target speed
+  }
+}
+#endif /* ACCELERATION_REPRAP */
 
-    #ifdef Y_MIN_PIN
-    if (dda->endstop_check & 0x04) {
-      if (y_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_y++;
-      else
-        move_state.debounce_count_y = 0;
-      endstop_trigger = move_state.debounce_count_y >= ENDSTOP_STEPS;
+#ifdef STEP_RAMP_EXACT
+/**
+  \brief Per step speed change of STEP_RAMP_EXACT.
+
+  \param *dda the move
+
+  Same ramps as dda_ramp_plan(), but updated with each step. A recursion
+  like D. Austin's, c' = c - 2 * c / (4 * n - 1), would need a 32 bit
+  division per step and picks up an offset of about 1.4 percent on the
+  first few steps, which it keeps for the whole ramp. int_div_sqrt() is
+  division free and cheaper, so c comes straight from the ramp position n.
+*/
+static void dda_step_ramp(DDA *dda) __attribute__ ((always_inline));
+inline void dda_step_ramp(DDA *dda) {
+  uint32_t step_no = move_state.step_no;
+
+  if (step_no < dda->rampup_steps) {
+    dda->n = step_no;
+    #ifdef LOOKAHEAD
+      dda->n += dda->start_steps;
+    #endif
+    dda->c = int_div_sqrt(dda->c0, dda->n) >> 1;
+    if (dda->c < dda->c_min) {
+      dda->c = dda->c_min;
+      // See the hack in dda_ramp_plan().
+      #if ! defined LOOKAHEAD
+        dda->rampup_steps = step_no;
+        dda->rampdown_steps = dda->total_steps - dda->rampup_steps;
+      #endif
     }
+  }
+  else if (step_no >= dda->rampdown_steps) {
+    dda->n = step_no < dda->total_steps ? dda->total_steps - step_no : 0;
+    #ifdef LOOKAHEAD
+      dda->n += dda->end_steps;
     #endif
-    #ifdef Y_MAX_PIN
-    if (dda->endstop_check & 0x08) {
-      if (y_max() == dda->endstop_stop_cond)
-        move_state.debounce_count_y++;
-      else
-        move_state.debounce_count_y = 0;
-      endstop_trigger = move_state.debounce_count_y >= ENDSTOP_STEPS;
+    dda->c = (dda->n == 0) ? dda->c0 : int_div_sqrt(dda->c0, dda->n) >> 1;
+    if (dda->c < dda->c_min)
+      dda->c = dda->c_min;
+  }
+}
+#endif /* STEP_RAMP_EXACT */
+
+/**
+  \brief Do per-step movement maintenance.
+
+  \param *dda the current move
+
+  \details Most important task here is to update the Bresenham algorithm and
+  to generate step pulses accordingly, this guarantees geometrical accuracy
+  of the movement. Other tasks, like acceleration calculations, are moved
+  into dda_clock() as much as possible.
+
+  This is called from our timer interrupt every time a step needs to occur.
+  Keep it as simple and fast as possible, this is most critical for the
+  achievable step frequency.
+
+  There's one dda_step() for each kind of acceleration, picked at compile
+  time, so each carries only what its mode needs. ACCELERATION_RAMPING and
+  ACCELERATION_REPRAP share the Bresenham one, ACCELERATION_TEMPORAL has its
+  own. Measure changes here with PROFILE, see profile.h.
+
+  Note: it was tried to do this in loops instead of straight, repeating code.
+        However, this resulted in at least 16% performance loss, no matter
+        how it was done. On how to measure, see commit "testcases: Add
+        config.h". On the various tries and measurement results, see commits
+        starting with "DDA: Move axis calculations into loops, part 6".
+*/
+#ifndef ACCELERATION_TEMPORAL
+void dda_step(DDA *dda) {
+  uint8_t batch = 1, round;
+  // Axes with steps left, one bit per axis. Idle axes cost a bit test, only.
+  uint8_t mask = move_state.axis_mask;
+  #ifdef STEP_PORT_BATCH
+    uint8_t stepped;
+  #endif
+
+  // At high step rates, do 2 or 4 steps per interrupt to reduce interrupt
+  // overhead. The timer gets set to a correspondingly longer delay below.
+  #ifdef STEP_BATCH_RATE
+    if (dda->c < STEP_BATCH_TICKS)
+      batch = (dda->c < STEP_BATCH_TICKS / 2) ? 4 : 2;
+  #endif
+
+  for (round = batch; ; ) {
+    #ifdef STEP_PORT_BATCH
+      stepped = 0;
+    #endif
+    if (STEP_AXES & mask & (1 << X)) {
+      move_state.counter[X] -= dda->delta[X];
+      if (move_state.counter[X] < 0) {
+        STEP_COLLECT(stepped, STEP_BIT_X, x_step);
+        step_count(X);
+        if (--move_state.steps[X] == 0)
+          mask &= ~(1 << X);
+        move_state.counter[X] += dda->total_steps;
+      }
+    }
+    if (STEP_AXES & mask & (1 << Y)) {
+      move_state.counter[Y] -= dda->delta[Y];
+      if (move_state.counter[Y] < 0) {
+        STEP_COLLECT(stepped, STEP_BIT_Y, y_step);
+        step_count(Y);
+        if (--move_state.steps[Y] == 0)
+          mask &= ~(1 << Y);
+        move_state.counter[Y] += dda->total_steps;
+      }
+    }
+    if (STEP_AXES & mask & (1 << Z)) {
+      move_state.counter[Z] -= dda->delta[Z];
+      if (move_state.counter[Z] < 0) {
+        STEP_COLLECT(stepped, STEP_BIT_Z, z_step);
+        step_count(Z);
+        if (--move_state.steps[Z] == 0)
+          mask &= ~(1 << Z);
+        move_state.counter[Z] += dda->total_steps;
+      }
     }
+    if (STEP_AXES & mask & (1 << U)) {
+      move_state.counter[U] -= dda->delta[U];
+      if (move_state.counter[U] < 0) {
+        STEP_COLLECT(stepped, STEP_BIT_U, u_step);
+        step_count(U);
+        if (--move_state.steps[U] == 0)
+          mask &= ~(1 << U);
+        move_state.counter[U] += dda->total_steps;
+      }
+    }
+    if (STEP_AXES & mask & (1 << E)) {
+      move_state.counter[E] -= dda->delta[E];
+      if (move_state.counter[E] < 0) {
+        STEP_COLLECT(stepped, STEP_BIT_E, e_step);
+        step_count(E);
+        if (--move_state.steps[E] == 0)
+          mask &= ~(1 << E);
+        move_state.counter[E] += dda->total_steps;
+      }
+    }
+    step_flush(stepped);
+
+    #ifdef ACCELERATION_RAMPING
+      move_state.step_no++;
     #endif
 
-    #ifdef Z_MIN_PIN
-    if (dda->endstop_check & 0x10) {
-      if (z_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_z++;
-      else
-        move_state.debounce_count_z = 0;
-      endstop_trigger = move_state.debounce_count_z >= ENDSTOP_STEPS;
+    if (--round == 0 || mask == 0)
+      break;
+
+    // Give step pulses of the previous round their low time. Pulses made
+    // by timer match outputs have to end first.
+    unstep();
+    #ifdef STEP_PULSE_MATCH
+      delay_us(STEP_PULSE_MATCH + 1);
+    #else
+      delay_us(1);
+    #endif
+  }
+  move_state.axis_mask = mask;
+
+  #ifdef ENDSTOP_CAPTURE
+    // Sampling endstops here stops an axis on the very step its endstop
+    // triggers, see ENDSTOP_CAPTURE in config.h.
+    if (dda->endstop_check && ! move_state.endstop_stop) {
+      uint8_t triggered = endstop_read(dda);
+
+      if (triggered)
+        endstop_act(dda, triggered);
     }
+  #endif
+
+  #ifdef ACCELERATION_REPRAP
+    dda_step_reprap(dda);
+  #endif
+  #ifdef STEP_RAMP_EXACT
+    dda_step_ramp(dda);
+  #endif
+
+  // If there are no steps left or an endstop stop happened, we have finished.
+  if (move_state.axis_mask == 0
+    #if defined ACCELERATION_RAMPING && defined STEP_TIMING_QUEUE
+      || (move_state.endstop_stop && move_state.step_no >= dda->total_steps)
+    #elif defined ACCELERATION_RAMPING
+      || (move_state.endstop_stop && dda->n <= 0)
     #endif
-    #ifdef Z_MAX_PIN
-    if (dda->endstop_check & 0x20) {
-      if (z_max() == dda->endstop_stop_cond)
-        move_state.debounce_count_z++;
+    #ifdef JOG
+      || move_state.jog_end
+    #endif
+      ) {
+    dda_step_done(dda);
+	}
+  else {
+		psu_timeout = 0;
+    #ifdef STEP_TIMING_QUEUE
+      while (st_tail != st_head) {
+        STEP_TIMING *timing = &step_timing[st_tail];
+
+        if (timing->gen == move_state.timing_gen) {
+          if (timing->step_no > move_state.step_no)
+            break;
+          dda->c = timing->c;
+        }
+        st_tail = ST_NEXT(st_tail);
+      }
+    #endif
+    #ifdef FEED_HOLD
+      // Held, no more step interrupts until dda_resume().
+      if (move_state.hold_step && move_state.step_no >= move_state.hold_step)
+        feed_hold = FEED_HOLD_HELD;
       else
-        move_state.debounce_count_z = 0;
-      endstop_trigger = move_state.debounce_count_z >= ENDSTOP_STEPS;
+    #endif
+    timer_set(dda->c * batch, 0);
+  }
+
+	// turn off step outputs, hopefully they've been on long enough by now to register with the drivers
+	// if not, too bad. or insert a (very!) small delay here, or fire up a spare timer or something.
+	// we also hope that we don't step before the drivers register the low- limit maximum speed if you think this is a problem.
+	unstep();
+}
+
+#else /* ACCELERATION_TEMPORAL */
+void dda_step(DDA *dda) {
+  /** How is this ACCELERATION TEMPORAL expected to work?
+
+    All axes work independently of each other, as if they were on four
+    different, synchronized timers. As we have not enough suitable timers,
+    we have to share one for all axes.
+
+    To do this, each axis maintains the time of its last step in
+    move_state.time[]. This time is updated as the step is done, see early
+    in dda_step(). To find out which axis is the next one to step, the time
+    of each axis' next step is compared to the time of the step just done.
+    Zero means this actually is the axis just stepped, the smallest value > 0
+    wins.
+
+    One problem undoubtedly arising is, steps should sometimes be done at
+    {almost,exactly} the same time. We trust the timer to deal properly with
+    very short or even zero periods. If a step can't be done in time, the
+    timer shall do the step as soon as possible and compensate for the delay
+    later. In turn we promise here to send a maximum of four such
+    short-delays consecutively and to give sufficient time on average.
+  */
+  // This is the time which led to this call of dda_step().
+  move_state.last_time = move_state.time[dda->axis_to_step] +
+                         dda->step_interval[dda->axis_to_step];
+
+  do {
+    uint32_t c_candidate;
+    enum axis_e i;
+
+    if (dda->axis_to_step == X) {
+      x_step();
+      step_count(X);
+      move_state.steps[X]--;
+      move_state.time[X] += dda->step_interval[X];
+    }
+    if (dda->axis_to_step == Y) {
+      y_step();
+      step_count(Y);
+      move_state.steps[Y]--;
+      move_state.time[Y] += dda->step_interval[Y];
+    }
+    if (dda->axis_to_step == Z) {
+      z_step();
+      step_count(Z);
+      move_state.steps[Z]--;
+      move_state.time[Z] += dda->step_interval[Z];
+    }
+    if (dda->axis_to_step == U) {
+      u_step();
+      step_count(U);
+      move_state.steps[U]--;
+      move_state.time[U] += dda->step_interval[U];
+    }
+    if (dda->axis_to_step == E) {
+      e_step();
+      step_count(E);
+      move_state.steps[E]--;
+      move_state.time[E] += dda->step_interval[E];
     }
+    unstep();
+
+    // Find the next stepper to step.
+    dda->c = 0xFFFFFFFF;
+    for (i = X; i < AXIS_COUNT; i++) {
+      if (move_state.steps[i]) {
+        c_candidate = move_state.time[i] + dda->step_interval[i] -
+                      move_state.last_time;
+        if (c_candidate < dda->c) {
+          dda->axis_to_step = i;
+          dda->c = c_candidate;
+        }
+      }
+    }
+
+    // No stepper to step found? Then we're done.
+    if (dda->c == 0xFFFFFFFF)
+      break;
+  } while (timer_set(dda->c, 1));
+
+  // dda->c is 0xFFFFFFFF when no axis has steps left.
+  if (dda->c == 0xFFFFFFFF)
+    dda_step_done(dda);
+  else
+    psu_timeout = 0;
+}
+#endif /* ACCELERATION_TEMPORAL */
+
+#ifdef TEMPORAL_MATCH_CHANNELS
+/** Step the axes of one timer match channel.
+
+  \param dda The move.
+
+  \param ch The match channel which fired.
+
+  Like ACCELERATION_TEMPORAL in dda_step(), but each channel schedules only
+  its own axes, so there's no search across all axes and no axis has to wait
+  for another one. Axes sharing a channel and due at the same time step
+  together.
+*/
+void dda_step_channel(DDA *dda, uint8_t ch) {
+  uint32_t due = dda_channel_next(dda, ch);
+  uint8_t i;
+  #ifdef STEP_PORT_BATCH
+    uint8_t stepped = 0;
+  #endif
+
+  for (i = ch; i < AXIS_COUNT; i += TIMER_CHANNELS) {
+    if (move_state.steps[i] &&
+        move_state.time[i] + dda->step_interval[i] == due) {
+      switch (i) {
+        case X: STEP_COLLECT(stepped, STEP_BIT_X, x_step); break;
+        case Y: STEP_COLLECT(stepped, STEP_BIT_Y, y_step); break;
+        case Z: STEP_COLLECT(stepped, STEP_BIT_Z, z_step); break;
+        case U: STEP_COLLECT(stepped, STEP_BIT_U, u_step); break;
+        case E: STEP_COLLECT(stepped, STEP_BIT_E, e_step); break;
+      }
+      step_count(i);
+      move_state.steps[i]--;
+      move_state.time[i] = due;
+    }
+  }
+  step_flush(stepped);
+  unstep();
+
+  dda_schedule_channel(dda, ch);
+
+  if (move_state.steps[X] == 0 && move_state.steps[Y] == 0 &&
+      move_state.steps[Z] == 0 && move_state.steps[U] == 0 &&
+      move_state.steps[E] == 0) {
+    dda_step_done(dda);
+  }
+  else {
+    psu_timeout = 0;
+  }
+}
+#endif /* TEMPORAL_MATCH_CHANNELS */
+
+#if defined ACCELERATION_RAMPING && ! defined STEP_RAMP_EXACT
+/*! Find the step interval at a given position of the movement.
+
+  \param *dda the move
+  \param step_no the step to find the interval for
+  \param *move_n returns the position on the acceleration ramp
+  \param *move_c returns the step interval
+
+  \return 0 if the move is cruising at this step, so there's no new speed.
+
+  For maths about stepper speed profiles, see
+  http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
+  and http://www.atmel.com/images/doc8017.pdf (Atmel app note AVR446)
+*/
+static uint8_t dda_ramp_plan(DDA *dda, uint32_t step_no, int32_t *move_n,
+                             uint32_t *move_c) {
+#ifdef FEED_OVERRIDE
+  uint32_t n_down, c_cap;
+
+  // Speed is limited by both ramps, the one accelerating from the start and
+  // the one decelerating to the end, and by the overridden c_min. Without
+  // override, this gives the same as below.
+  *move_n = step_no;
+  n_down = dda->total_steps - step_no;
+  #ifdef LOOKAHEAD
+    *move_n += dda->start_steps;
+    n_down += dda->end_steps;
+  #endif
+  if ((uint32_t)*move_n > n_down)
+    *move_n = n_down;
+
+  if (*move_n == 0)
+    *move_c = dda->c0;
+  else
+    *move_c = int_div_sqrt(dda->c0, *move_n) >> 1;
+
+  c_cap = dda->c_min;
+  if (feed_override_now != 256) {
+    c_cap = muldiv(c_cap, 256, feed_override_now);
+    if (c_cap < dda->c_limit)
+      c_cap = dda->c_limit;
+  }
+  if (*move_c < c_cap)
+    *move_c = c_cap;
+
+  return 1;
+#else
+  if (step_no < dda->rampup_steps) {
+    #ifdef ACCELERATION_SCURVE
+      *move_n = scurve_ramp(step_no, dda->rampup_steps);
+    #else
+      *move_n = step_no;
+    #endif
+    #ifdef LOOKAHEAD
+      *move_n += dda->start_steps;
+    #endif
+  }
+  else if (step_no >= dda->rampdown_steps) {
+    #ifdef ACCELERATION_SCURVE
+      *move_n = scurve_ramp(dda->total_steps - step_no,
+                            dda->total_steps - dda->rampdown_steps);
+    #else
+      *move_n = dda->total_steps - step_no;
     #endif
+    #ifdef LOOKAHEAD
+      *move_n += dda->end_steps;
+    #endif
+  }
+  else {
+    return 0;
+  }
 
-    #ifdef U_MIN_PIN
-    if (dda->endstop_check & 0x10) {
-        if (u_min() == dda->endstop_stop_cond)
-          move_state.debounce_count_u++;
-        else
-          move_state.debounce_count_u = 0;
-        endstop_trigger = move_state.debounce_count_u >= ENDSTOP_STEPS;
+  if (*move_n == 0)
+    *move_c = dda->c0;
+  else
+    // Explicit formula: c0 * (sqrt(n + 1) - sqrt(n)),
+    // approximation here: c0 * (1 / (2 * sqrt(n))).
+    *move_c = int_div_sqrt(dda->c0, *move_n) >> 1;
+
+  // TODO: most likely this whole check is obsolete. It was left as a
+  //       safety margin, only. Rampup steps calculation should be accurate
+  //       now and give the requested target speed within a few percent.
+  if (*move_c < dda->c_min) {
+    // We hit max speed not always exactly.
+    *move_c = dda->c_min;
+
+    // This is a hack which deals with movements with an unknown number of
+    // acceleration steps. dda_create() sets a very high number, then,
+    // but we don't want to re-calculate all the time.
+    // This hack doesn't work with lookahead or S-curves.
+    #if ! defined LOOKAHEAD && ! defined ACCELERATION_SCURVE
+      dda->rampup_steps = step_no;
+      dda->rampdown_steps = dda->total_steps - dda->rampup_steps;
+    #endif
+  }
+
+  return 1;
+#endif /* FEED_OVERRIDE */
+}
+
+#ifdef JOG
+/*! Position on the jog ramp at a given step.
+
+  \param step_no the step, at or after move_state.jog_step
+
+  From jog_n at jog_step, the ramp moves one step per step towards the
+  commanded speed, which is accelerating or decelerating at the move's
+  acceleration.
+*/
+static uint32_t dda_jog_n(uint32_t step_no) {
+  uint32_t d, n = move_state.jog_n;
+
+  d = (step_no > move_state.jog_step) ? step_no - move_state.jog_step : 0;
+  if (n < move_state.jog_n_cmd)
+    n = (move_state.jog_n_cmd - n > d) ? n + d : move_state.jog_n_cmd;
+  else
+    n = (n - move_state.jog_n_cmd > d) ? n - d : move_state.jog_n_cmd;
+
+  return n;
+}
+#endif
+
+/*! Find the step interval at a given position, including feed hold.
+
+  Parameters and return value like dda_ramp_plan(), which gives the speed
+  as planned. With a feed hold pending, speed is also limited by a ramp down
+  to hold_step, after a resume by a ramp up from resume_base, whichever is
+  slower. Jog moves are also limited by the ramp to their commanded speed.
+*/
+static uint8_t dda_ramp_speed(DDA *dda, uint32_t step_no, int32_t *move_n,
+                              uint32_t *move_c) {
+  uint8_t ramping = dda_ramp_plan(dda, step_no, move_n, move_c);
+
+  #ifdef FEED_HOLD
+    int32_t n = -1;
+    uint32_t c;
+
+    if (move_state.hold_step)
+      n = (move_state.hold_step > step_no) ?
+          move_state.hold_step - step_no : 0;
+    if (move_state.resume &&
+        (n < 0 || (int32_t)step_no - move_state.resume_base < n))
+      n = (int32_t)step_no - move_state.resume_base;
+    if (n >= 0) {
+      if ( ! ramping) {
+        *move_c = dda->c_min;
+        ramping = 1;
+      }
+      c = (n == 0) ? dda->c0 : int_div_sqrt(dda->c0, n) >> 1;
+      if (c > *move_c) {
+        *move_c = c;
+        *move_n = n;
+      }
+    }
+  #endif
+
+  #ifdef JOG
+    if (dda->endpoint.jog) {
+      uint32_t n_jog = dda_jog_n(step_no), c_jog;
+
+      if ( ! ramping) {
+        *move_c = dda->c_min;
+        ramping = 1;
+      }
+      c_jog = (n_jog == 0) ? dda->c0 : int_div_sqrt(dda->c0, n_jog) >> 1;
+      if (c_jog > *move_c) {
+        *move_c = c_jog;
+        *move_n = n_jog;
+      }
+    }
+  #endif
+
+  return ramping;
+}
+#endif /* ACCELERATION_RAMPING && ! STEP_RAMP_EXACT */
+
+#ifdef ACCELERATION_RAMPING
+#ifdef FEED_HOLD
+/*! Stop moving, with a ramp down.
+
+  The running move decelerates along its ramp, as if it ended where the
+  ramp reaches standstill, then dda_step() stops the step interrupt. Moves
+  not long enough stop at their end. Queued moves don't start until
+  dda_resume(), see next_move().
+*/
+void dda_hold(void) {
+  DDA *dda;
+  int32_t n;
+  uint32_t c;
+
+  ATOMIC_START
+    if (feed_hold == FEED_HOLD_OFF) {
+      feed_hold = FEED_HOLD_STOPPING;
+      dda = queue_current_movement();
+      if (dda) {
+        if ( ! dda_ramp_speed(dda, move_state.step_no, &n, &c)) {
+          // Cruising, the ramp position of full speed.
+          n = dda->rampup_steps;
+          #ifdef LOOKAHEAD
+            n += dda->start_steps;
+          #endif
+        }
+        move_state.hold_step = move_state.step_no + n;
+        if (move_state.hold_step == 0)
+          move_state.hold_step = 1;
+        #ifdef STEP_TIMING_QUEUE
+          move_state.timing_gen++;
+        #endif
+      }
     }
+  ATOMIC_END
+}
+
+/*! Continue after dda_hold().
+
+  A held move ramps up from standstill, a move still decelerating for the
+  hold from where it is. If the hold happened between moves, the next move
+  starts from standstill.
+*/
+void dda_resume(void) {
+  DDA *dda;
+  int32_t n = 0;
+  uint8_t held;
+
+  ATOMIC_START
+    if (feed_hold != FEED_HOLD_OFF) {
+      held = (feed_hold == FEED_HOLD_HELD);
+      feed_hold = FEED_HOLD_OFF;
+      dda = queue_current_movement();
+      if (dda) {
+        if ( ! held && move_state.hold_step > move_state.step_no)
+          n = move_state.hold_step - move_state.step_no;
+        move_state.hold_step = 0;
+        move_state.resume_base = (int32_t)move_state.step_no - n;
+        move_state.resume = 1;
+        #ifdef STEP_TIMING_QUEUE
+          move_state.timing_gen++;
+        #endif
+        if (held) {
+          dda->c = dda->c0;
+          timer_reset();
+          timer_set(dda->c, 0);
+        }
+      }
+      else {
+        hold_resumed = 1;
+        if (held) {
+          timer_reset();
+          next_move();
+        }
+      }
+    }
+  ATOMIC_END
+}
+#endif /* FEED_HOLD */
+
+#ifdef JOG
+/*! Follow jog_feedrate.
+
+  \param *dda the running jog move
+
+  A jog move is planned for the highest speed the axes allow, the commanded
+  speed is a position on its acceleration ramp, jog_n_cmd. Speed follows a
+  new command along this ramp, see dda_jog_n(). A command of zero ramps all
+  the way down, then ends the move where it is, see dda_jog_end().
+*/
+static void dda_jog_clock(DDA *dda) {
+  uint32_t step_no, n, n_cmd, c, r;
+  uint16_t f = jog_feedrate;
+
+  ATOMIC_START
+    step_no = move_state.step_no;
+  ATOMIC_END
+
+  n = dda_jog_n(step_no);
+  n_cmd = move_state.jog_n_cmd;
+  if (f != move_state.jog_f) {
+    // c = c0 / (2 * sqrt(n)), so n = (c0 / c)^2 / 4.
+    n_cmd = 0;
+    if (f) {
+      c = muldiv(dda->c_min, dda->endpoint.F, f);
+      if (c < dda->c_min)
+        c = dda->c_min;
+      r = dda->c0 / c;
+      if (r > 65535)
+        r = 65535;
+      n_cmd = (r * r) / 4;
+    }
+  }
+
+  ATOMIC_START
+    move_state.jog_n = n;
+    move_state.jog_step = step_no;
+    if (f != move_state.jog_f) {
+      move_state.jog_f = f;
+      move_state.jog_n_cmd = n_cmd;
+      #ifdef STEP_TIMING_QUEUE
+        move_state.timing_gen++;
+      #endif
+    }
+    if (n_cmd == 0 && n == 0)
+      move_state.jog_end = 1;
+  ATOMIC_END
+}
+#endif /* JOG */
+#endif /* ACCELERATION_RAMPING */
+
+#ifdef STEP_TIMING_QUEUE
+#ifdef INPUT_SHAPING_FREQUENCY
+/**
+  Speed of a step interval in steps per STEP_TIMING_TICKS, 8.8 fixed point.
+*/
+static uint16_t is_speed(uint32_t c) {
+  uint32_t u = ((uint32_t)STEP_TIMING_TICKS << 8) / c;
+
+  return u > 0xFFFF ? 0xFFFF : u;
+}
+#endif
+
+/*! Fill the step timing queue for the running move.
+
+  \param *dda the move
+
+  Each entry covers about STEP_TIMING_TICKS, acceleration ramps are cut into
+  pieces accordingly. Cruising needs a single entry only.
+
+  With input shaping, the unshaped speed profile gets walked through one
+  entry after another, with position p_u. Each entry's speed goes into
+  is_history[], the shaped speed is the weighted sum of the current entry
+  and the ones IS_DELAY (and 2 * IS_DELAY) ago. Shaped position p_s runs
+  behind p_u, it's the one written into the queue. Both are 24.8 fixed
+  point steps.
+
+  After the unshaped profile reached total_steps, the delayed impulses still
+  have to run out, so the move takes IS_HISTORY entries longer. While
+  cruising and the history is steady, shaped and unshaped speed are the
+  same, so both positions jump to the start of deceleration at once.
+*/
+#ifdef INPUT_SHAPING_FREQUENCY
+static void dda_fill_step_timing(DDA *dda) {
+  static uint8_t fill_gen;
+  static uint32_t p_u, p_s;
+  static uint16_t is_pos, is_steady;
+  uint8_t head = st_head;
+  int32_t move_n;
+  uint32_t c, shaped, jump;
+  uint16_t u, u_min, i;
+  uint8_t new_gen = 0, cruise;
+
+  ATOMIC_START
+    if (move_state.timing_gen != fill_gen) {
+      fill_gen = move_state.timing_gen;
+      p_u = p_s = move_state.step_no << 8;
+      c = dda->c;
+      new_gen = 1;
+    }
+  ATOMIC_END
+
+  if (new_gen) {
+    // Start from the speed the move runs at already, standstill on a fresh
+    // move, unless lookahead joined it to the previous one.
+    u = 0;
+    if (p_u
+      #ifdef LOOKAHEAD
+        || dda->start_steps
+      #endif
+        )
+      u = is_speed(c);
+    for (i = 0; i < IS_HISTORY; i++)
+      is_history[i] = u;
+    is_pos = 0;
+    is_steady = 0;
+  }
+
+  // Floor, so the move gets finished despite rounding.
+  u_min = is_speed(dda->c0);
+  if (u_min == 0)
+    u_min = 1;
+
+  while (ST_NEXT(head) != st_tail && (p_s >> 8) < dda->total_steps) {
+    STEP_TIMING *timing = &step_timing[head];
+
+    cruise = 0;
+    if ((p_u >> 8) >= dda->total_steps) {
+      u = 0;
+      #ifdef LOOKAHEAD
+        if (dda->end_steps)
+          u = is_speed(int_div_sqrt(dda->c0, dda->end_steps) >> 1);
+      #endif
+    }
+    else if ( ! dda_ramp_speed(dda, p_u >> 8, &move_n, &c)) {
+      u = is_speed(dda->c_min);
+      cruise = 1;
+    }
+    else {
+      u = is_speed(c);
+    }
+
+    if (u == is_history[is_pos]) {
+      if (is_steady < IS_HISTORY)
+        is_steady++;
+    }
+    else {
+      is_steady = 0;
+    }
+
+    // is_history[is_pos] holds the entry IS_HISTORY ago.
+    #ifdef INPUT_SHAPING_ZVD
+      shaped = (uint32_t)IS_A0 * u +
+               (uint32_t)IS_A1 * is_history[(is_pos + IS_DELAY) % IS_HISTORY] +
+               (uint32_t)IS_A2 * is_history[is_pos];
+    #else
+      shaped = (uint32_t)IS_A0 * u + (uint32_t)IS_A1 * is_history[is_pos];
     #endif
-    #ifdef U_MAX_PIN
-    if (dda->endstop_check & 0x20) {
-        if (u_max() == dda->endstop_stop_cond)
-            move_state.debounce_count_u++;
-        else
-            move_state.debounce_count_u = 0;
-        endstop_trigger = move_state.debounce_count_u >= ENDSTOP_STEPS;
+    shaped >>= 8;
+    if (shaped < u_min)
+      shaped = u_min;
+
+    is_history[is_pos] = u;
+    if (++is_pos >= IS_HISTORY)
+      is_pos = 0;
+
+    timing->gen = fill_gen;
+    timing->step_no = p_s >> 8;
+    timing->c = ((uint32_t)STEP_TIMING_TICKS << 8) / shaped;
+    if (timing->c > dda->c0)
+      timing->c = dda->c0;
+    #ifdef STEP_LINK
+      steplink_timing(fill_gen, timing->step_no, timing->c);
+    #endif
+
+    if (cruise && is_steady >= IS_HISTORY &&
+        (dda->rampdown_steps << 8) > p_u + u) {
+      jump = (dda->rampdown_steps << 8) - p_u;
+      p_u += jump;
+      p_s += jump;
+    }
+    else {
+      p_u += u;
+      p_s += shaped;
+    }
+
+    head = ST_NEXT(head);
+    st_head = head;
+  }
+}
+#else
+static void dda_fill_step_timing(DDA *dda) {
+  static uint8_t fill_gen;
+  static uint32_t fill_step;
+  uint8_t head = st_head;
+  int32_t move_n;
+
+  // Start over on a new move or when the move got changed.
+  ATOMIC_START
+    if (move_state.timing_gen != fill_gen) {
+      fill_gen = move_state.timing_gen;
+      fill_step = move_state.step_no;
+    }
+  ATOMIC_END
+
+  while (ST_NEXT(head) != st_tail && fill_step < dda->total_steps) {
+    STEP_TIMING *timing = &step_timing[head];
+    uint32_t steps, next_step;
+
+    if ( ! dda_ramp_speed(dda, fill_step, &move_n, &timing->c)) {
+      // Cruising up to the start of deceleration.
+      timing->c = dda->c_min;
+      next_step = dda->rampdown_steps;
+    }
+    else {
+      steps = STEP_TIMING_TICKS / timing->c;
+      if (steps == 0)
+        steps = 1;
+      next_step = fill_step + steps;
+      if (fill_step < dda->rampup_steps && next_step > dda->rampup_steps)
+        next_step = dda->rampup_steps;
     }
+    timing->gen = fill_gen;
+    timing->step_no = fill_step;
+    #ifdef STEP_LINK
+      steplink_timing(fill_gen, timing->step_no, timing->c);
     #endif
 
-    // If an endstop is definitely triggered, stop the movement.
-    if (endstop_trigger) {
-      #ifdef ACCELERATION_RAMPING
-        // For always smooth operations, don't halt apruptly,
-        // but start deceleration here.
-        ATOMIC_START
-          move_state.endstop_stop = 1;
-          if (move_state.step_no < dda->rampup_steps)  // still accelerating
-            dda->total_steps = move_state.step_no * 2;
-          else
-            // A "-=" would overflow earlier.
-            dda->total_steps = dda->total_steps - dda->rampdown_steps +
-                               move_state.step_no;
-          dda->rampdown_steps = move_state.step_no;
-        ATOMIC_END
-        // Not atomic, because not used in dda_step().
-        dda->rampup_steps = 0; // in case we're still accelerating
-      #else
-        dda->live = 0;
-      #endif
+    fill_step = next_step;
+    head = ST_NEXT(head);
+    st_head = head;
+  }
+}
+#endif /* INPUT_SHAPING_FREQUENCY */
+#endif /* STEP_TIMING_QUEUE */
+
+#ifdef ADVANCE_K
+/*! Pressure advance.
+
+  \param *dda the move
+
+  The lead of E is ADVANCE_K times the current E speed. Raising it by one
+  step means subtracting total_steps from the E Bresenham counter, which
+  dda_step() then catches up with at up to one E step per fast axis step.
+  Lowering it pauses E accordingly. The total of E steps stays the same, a
+  lead left at the end of the move just makes E finish a bit earlier.
+*/
+static void dda_advance(DDA *dda) {
+  uint32_t c, target;
 
-      // endstops_off(); // SHAUKI NEVER CANCEL ENDSTOP CHECKS
-      endstops_on(); // SHAUKI ensure ON
+  if (dda->advance == 0)
+    return;
+
+  ATOMIC_START
+    c = dda->c;
+  ATOMIC_END
+
+  target = dda->advance / c;
+  if (target > 255)
+    target = 255;
+
+  ATOMIC_START
+    if (dda->live && ! move_state.endstop_stop) {
+      move_state.counter[E] -= ((int32_t)target - move_state.e_advance) *
+                               (int32_t)dda->total_steps;
+      move_state.e_advance = target;
     }
-  } /* ! move_state.endstop_stop */
+  ATOMIC_END
+}
+#endif /* ADVANCE_K */
+
+#ifdef STEP_TRACE
+/*! Record the speed of the running move, if it changed.
+
+  \param *dda the move
+  \param new_move whether this move was just started
+*/
+static void dda_trace(DDA *dda, uint8_t new_move) {
+  static uint32_t last_c = 0;
+  STEP_TRACE_ENTRY *entry;
+  uint32_t c, step_no;
+
+  ATOMIC_START
+    c = dda->c;
+    step_no = move_state.step_no;
+  ATOMIC_END
+
+  if (c == last_c && ! new_move)
+    return;
+  last_c = c;
+
+  entry = &step_trace[step_trace_head];
+  entry->time = timer_read();
+  entry->step_no = new_move ? 0 : step_no;
+  entry->c = c;
+  step_trace_head = (step_trace_head + 1) & (STEP_TRACE_SIZE - 1);
+  if (step_trace_count < STEP_TRACE_SIZE)
+    step_trace_count++;
+}
+
+/*! Print the recorded speed profile and clear it.
+
+  One line per entry, oldest first: time in CPU ticks, step number, step
+  interval in CPU ticks. Step number 0 marks the start of a move. Speed in
+  steps/s is F_CPU / interval, actual speed between two entries is the step
+  number difference over the time difference.
+*/
+void dda_trace_print() {
+  STEP_TRACE_ENTRY entry;
+  uint8_t i, count, index;
+
+  ATOMIC_START
+    count = step_trace_count;
+    index = (step_trace_head - count) & (STEP_TRACE_SIZE - 1);
+  ATOMIC_END
+
+  for (i = 0; i < count; i++) {
+    ATOMIC_START
+      memcpy(&entry, &step_trace[index], sizeof(STEP_TRACE_ENTRY));
+    ATOMIC_END
+    sersendf_P(PSTR("%lu %lu %lu\n"), entry.time, entry.step_no, entry.c);
+    index = (index + 1) & (STEP_TRACE_SIZE - 1);
+  }
+
+  ATOMIC_START
+    step_trace_count = 0;
+  ATOMIC_END
+}
+#endif /* STEP_TRACE */
+
+/*! Do regular movement maintenance.
+
+  This should be called pretty often, like once every 1 or 2 milliseconds.
+
+  Currently, this is checking the endstops and doing acceleration maths. These
+  don't need to be checked/recalculated on every single step, so this code
+  can be moved out of the highly time critical dda_step(). At high precision
+  (slow) searches of the endstop, this function is called more often than
+  dda_step() anyways.
+
+  In the future, arc movement calculations might go here, too. Updating
+  movement direction 500 times a second is easily enough for smooth and
+  accurate curves!
+*/
+void dda_clock() {
+  DDA *dda;
+  #ifdef STEP_TRACE
+  static DDA *last_dda = NULL;
+  #endif
+  #ifndef ENDSTOP_CAPTURE
+  uint8_t triggered;
+  #endif
+  #if defined ACCELERATION_RAMPING && ! defined STEP_TIMING_QUEUE && \
+      ! defined STEP_RAMP_EXACT
+  uint32_t move_step_no, move_c;
+  int32_t move_n;
+  uint8_t current_id ;
+  #endif
+
+  dda = queue_current_movement();
+  if (dda == NULL) {
+    #ifdef STEP_TRACE
+    last_dda = NULL;
+    #endif
+    return;
+  }
+
+  #ifdef STEP_TRACE
+    dda_trace(dda, dda != last_dda);
+    last_dda = dda;
+  #endif
+
+  #ifndef ENDSTOP_CAPTURE
+  // Caution: we mangle step counters here without locking interrupts. This
+  //          means, we trust dda isn't changed behind our back, which could
+  //          in principle (but rarely) happen if endstops are checked not as
+  //          endstop search, but as part of normal operations.
+  if (dda->endstop_check && ! move_state.endstop_stop) {
+    triggered = endstop_read(dda);
+    if (triggered)
+      endstop_act(dda, triggered);
+  }
+  #endif
+
+  #ifdef FEED_OVERRIDE
+    // Follow the override smoothly, one 256th per call.
+    if (feed_override_now < feed_override)
+      feed_override_now++;
+    else if (feed_override_now > feed_override)
+      feed_override_now--;
+  #endif
+
+  #ifdef JOG
+    if (dda->endpoint.jog && dda->live)
+      dda_jog_clock(dda);
+  #endif
 
   #ifdef ACCELERATION_RAMPING
-    // For maths about stepper speed profiles, see
-    // http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
-    // and http://www.atmel.com/images/doc8017.pdf (Atmel app note AVR446)
+    #if defined STEP_TIMING_QUEUE
+      dda_fill_step_timing(dda);
+    #elif defined STEP_RAMP_EXACT
+      // dda_step() does the ramp, with each step.
+    #else
     ATOMIC_START
       current_id = dda->id;
       move_step_no = move_state.step_no;
@@ -923,50 +2319,7 @@ void dda_clock() {
       // so no need for atomic operations.
     ATOMIC_END
 
-    recalc_speed = 0;
-    if (move_step_no < dda->rampup_steps) {
-      #ifdef LOOKAHEAD
-        move_n = dda->start_steps + move_step_no;
-      #else
-        move_n = move_step_no;
-      #endif
-      recalc_speed = 1;
-    }
-    else if (move_step_no >= dda->rampdown_steps) {
-      #ifdef LOOKAHEAD
-        move_n = dda->total_steps - move_step_no + dda->end_steps;
-      #else
-        move_n = dda->total_steps - move_step_no;
-      #endif
-      recalc_speed = 1;
-    }
-    if (recalc_speed) {
-      if (move_n == 0)
-        move_c = pgm_read_dword(&c0_P[dda->fast_axis]);
-      else
-        // Explicit formula: c0 * (sqrt(n + 1) - sqrt(n)),
-        // approximation here: c0 * (1 / (2 * sqrt(n))).
-        // This >> 13 looks odd, but is verified with the explicit formula.
-        move_c = (pgm_read_dword(&c0_P[dda->fast_axis]) *
-                  int_inv_sqrt(move_n)) >> 13;
-
-      // TODO: most likely this whole check is obsolete. It was left as a
-      //       safety margin, only. Rampup steps calculation should be accurate
-      //       now and give the requested target speed within a few percent.
-      if (move_c < dda->c_min) {
-        // We hit max speed not always exactly.
-        move_c = dda->c_min;
-
-        // This is a hack which deals with movements with an unknown number of
-        // acceleration steps. dda_create() sets a very high number, then,
-        // but we don't want to re-calculate all the time.
-        // This hack doesn't work with lookahead.
-        #ifndef LOOKAHEAD
-          dda->rampup_steps = move_step_no;
-          dda->rampdown_steps = dda->total_steps - dda->rampup_steps;
-        #endif
-      }
-
+    if (dda_ramp_speed(dda, move_step_no, &move_n, &move_c)) {
       // Write results.
       ATOMIC_START
         /**
@@ -983,44 +2336,206 @@ void dda_clock() {
         }
       ATOMIC_END
     }
+    #endif /* STEP_TIMING_QUEUE */
+  #endif
+
+  #ifdef ADVANCE_K
+    dda_advance(dda);
   #endif
+
+  #if defined SPINDLE && defined ACCELERATION_RAMPING
+    if (dda->endpoint.spindle_dynamic) {
+      uint32_t c;
+      uint8_t live;
+
+      ATOMIC_START
+        c = dda->c;
+        live = dda->live;
+      ATOMIC_END
+      if (live)
+        heater_set(SPINDLE, spindle_power(dda, c));
+    }
+  #endif
+}
+
+#if ! defined STEP_POSITION || defined JOG
+/*! Position of a move, from its endpoint and the steps it has left.
+
+  \param *dda the move, usually the live one
+  \param position resulting position in G-code space
+*/
+static void dda_position(DDA *dda, axes_int32_t position) {
+  enum axis_e i;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    position[i] = dda->endpoint.axis[i] -
+        (int32_t)get_direction(dda, i) * steps_to_um(move_state.steps[i], i);
+  }
+
+  #ifdef KINEMATICS_ARM4
+    // Remaining steps are joint steps, so go back from the joint angles
+    // at the end of the move, then forward to G-code space. Steps count
+    // motor angles, which differ from joint angles by the calibration.
+    joints_arm4(dda->endpoint.axis, current_joints);
+    for (i = X; i < E; i++) {
+      int32_t motor = current_joints[i];
+
+      #ifdef JOINT_CALIBRATION
+        motor = joint_calibrate(i, motor);
+      #endif
+      motor -= (int32_t)get_direction(dda, i) *
+               steps_to_um(move_state.steps[i], i);
+      #ifdef JOINT_CALIBRATION
+        motor = joint_uncalibrate(i, motor);
+      #endif
+      current_joints[i] = motor;
+    }
+    arm4_to_carthesian(current_joints, position);
+  #endif
+
+  if (dda->endpoint.e_relative)
+    position[E] = steps_to_um(move_state.steps[E], E);
+}
+#endif /* ! STEP_POSITION || JOG */
+
+#ifdef STEP_POSITION
+/*! Position from the step counters of dda_step().
+
+  \param *dda the live move, for E
+  \param position resulting position in G-code space
+
+  E steps include the extrusion multiplier and relative E restarts with each
+  move, so E comes from the live move, like dda_position() does it.
+
+  Backlash takeup steps get counted, but don't move. Takeup of the moves
+  started is taken out again, for the live move the part not stepped yet
+  is added back, assuming takeup is spread evenly over the move, like
+  Bresenham does it.
+*/
+static void step_position_um(DDA *dda, axes_int32_t position) {
+  axes_int32_t steps;
+  enum axis_e i;
+  #ifdef BACKLASH
+    axes_int32_t taken;
+    uint32_t step_no;
+  #endif
+
+  ATOMIC_START
+    memcpy(steps, (void *)step_position, sizeof(axes_int32_t));
+    #ifdef BACKLASH
+      memcpy(taken, backlash_taken, sizeof(axes_int32_t));
+      step_no = move_state.step_no;
+    #endif
+  ATOMIC_END
+
+  #ifdef BACKLASH
+    for (i = X; i < E; i++) {
+      steps[i] -= taken[i];
+      if (dda->takeup & (1 << i))
+        steps[i] += (int32_t)get_direction(dda, i) *
+                    (int32_t)(backlash_steps[i] -
+                              muldiv(backlash_steps[i], step_no,
+                                     dda->total_steps));
+    }
+  #endif
+
+  for (i = X; i < E; i++)
+    position[i] = steps_to_um(steps[i], i);
+
+  #if defined KINEMATICS_COREXY
+    // Motor A moved X + Y, motor B X - Y.
+    steps[X] = position[X];
+    position[X] = (steps[X] + position[Y]) / 2;
+    position[Y] = (steps[X] - position[Y]) / 2;
+  #elif defined KINEMATICS_ARM4
+    // Counted steps are joint steps.
+    for (i = X; i < E; i++)
+      #ifdef JOINT_CALIBRATION
+        current_joints[i] = joint_uncalibrate(i, position[i]);
+      #else
+        current_joints[i] = position[i];
+      #endif
+    arm4_to_carthesian(current_joints, position);
+  #endif
+
+  if (dda->endpoint.e_relative)
+    position[E] = steps_to_um(move_state.steps[E], E);
+  else
+    position[E] = dda->endpoint.axis[E] -
+        (int32_t)get_direction(dda, E) * steps_to_um(move_state.steps[E], E);
 }
+#endif /* STEP_POSITION */
 
 /// update global current_position struct
 void update_current_position() {
 	DDA *dda = &movebuffer[mb_tail];
   enum axis_e i;
 
-  // Use smaller values to adjust to avoid overflow in later calculations,
-  // (STEPS_PER_M_X / 1000) is a bit inaccurate for low STEPS_PER_M numbers.
-  static const axes_uint32_t PROGMEM steps_per_mm_P = {
-    ((STEPS_PER_M_X + 500) / 1000),
-    ((STEPS_PER_M_Y + 500) / 1000),
-    ((STEPS_PER_M_Z + 500) / 1000),
-    ((STEPS_PER_M_U + 500) / 1000),
-    ((STEPS_PER_M_E + 500) / 1000)
-  };
-
 	if (queue_empty()) {
     for (i = X; i < AXIS_COUNT; i++) {
       current_position.axis[i] = startpoint.axis[i];
     }
+    #ifdef KINEMATICS_ARM4
+      joints_arm4(startpoint.axis, current_joints);
+    #endif
 	}
 	else if (dda->live) {
-    for (i = X; i < AXIS_COUNT; i++) {
-      current_position.axis[i] = dda->endpoint.axis[i] -
-          (int32_t)get_direction(dda, i) *
-          // Should be: move_state.steps[i] * 1000000 / steps_per_m_P[i])
-          // but steps[i] can be like 1000000 already, so we'd overflow.
-          // Unfortunately, using muldiv() overwhelms the compiler.
-          // Also keep the parens around this term, else results go wrong.
-          ((move_state.steps[i] * 1000) / pgm_read_dword(&steps_per_mm_P[i]));
-    }
-
-    if (dda->endpoint.e_relative)
-      current_position.axis[E] =
-          (move_state.steps[E] * 1000) / pgm_read_dword(&steps_per_mm_P[E]);
+    #ifdef STEP_POSITION
+      step_position_um(dda, current_position.axis);
+    #else
+      dda_position(dda, current_position.axis);
+    #endif
 
 		// current_position.F is updated in dda_start()
 	}
 }
+
+#ifdef JOG
+/*! Take the position a jog move stopped at as the new startpoint.
+
+  A jog move ends before reaching its target when released, see
+  dda_jog_clock(). Call this with the queue empty, after the jog, before
+  creating the next move. E didn't move, so it stays as it is.
+*/
+void dda_jog_end(void) {
+  DDA *dda = &movebuffer[mb_tail];
+  int32_t e = startpoint.axis[E];
+  enum axis_e i;
+
+  if ( ! dda->endpoint.jog)
+    return;
+
+  // A null move never ran, so move_state is from the move before.
+  if ( ! dda->nullmove) {
+    dda_position(dda, startpoint.axis);
+    startpoint.axis[E] = e;
+    for (i = X; i < E; i++)
+      startpoint_steps.axis[i] -= (int32_t)get_direction(dda, i) *
+                                  (int32_t)move_state.steps[i];
+    #ifdef KINEMATICS_ARM4
+      // The next move starts from here, not from the jog target.
+      joints_from_steps_arm4(startpoint_steps.axis);
+    #endif
+  }
+  startpoint.jog = dda->endpoint.jog = 0;
+  dda_break_lookahead();
+}
+#endif /* JOG */
+
+/// update current_position and send it to the host, M114 style
+void print_current_position() {
+  update_current_position();
+  sersendf_P(PSTR("X:%lq,Y:%lq,Z:%lq,U:%lq,E:%lq,F:%lu"),
+             current_position.axis[X] - work_offset[X],
+             current_position.axis[Y] - work_offset[Y],
+             current_position.axis[Z] - work_offset[Z],
+             current_position.axis[U] - work_offset[U],
+             current_position.axis[E], current_position.F);
+  #ifdef KINEMATICS_ARM4
+    // Joint angles in degrees: base, shoulder, elbow, wrist.
+    sersendf_P(PSTR(",J:%lq/%lq/%lq/%lq"),
+               current_joints[X], current_joints[Y],
+               current_joints[Z], current_joints[U]);
+  #endif
+  serial_writechar('\n');
+}
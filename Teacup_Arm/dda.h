@@ -4,6 +4,7 @@
 #include	<stdint.h>
 
 #include	"config_wrapper.h"
+#include "sd.h"
 
 #ifdef ACCELERATION_REPRAP
 	#ifdef ACCELERATION_RAMPING
@@ -15,6 +16,29 @@
 // Enum to denote an axis
 enum axis_e { X = 0, Y, Z, U, E, AXIS_COUNT };
 
+/**
+  Axes with a stepper connected, one bit per axis. X and Y always have one,
+  the others only with step and dir pins defined. Moves on other axes keep
+  track of their position, but make no steps, and the step loop compiles
+  their code away.
+*/
+#if defined Z_STEP_PIN && defined Z_DIR_PIN
+  #define STEP_AXIS_Z (1 << 2)
+#else
+  #define STEP_AXIS_Z 0
+#endif
+#if defined U_STEP_PIN && defined U_DIR_PIN
+  #define STEP_AXIS_U (1 << 3)
+#else
+  #define STEP_AXIS_U 0
+#endif
+#if defined E_STEP_PIN && defined E_DIR_PIN
+  #define STEP_AXIS_E (1 << 4)
+#else
+  #define STEP_AXIS_E 0
+#endif
+#define STEP_AXES ((1 << 0) | (1 << 1) | STEP_AXIS_Z | STEP_AXIS_U | STEP_AXIS_E)
+
 /**
   \typedef axes_uint32_t
   \brief n-dimensional vector used to describe uint32_t axis information.
@@ -44,6 +68,13 @@ typedef struct {
   uint16_t  e_multiplier;
   uint16_t  f_multiplier;
   uint8_t   e_relative        :1; ///< bool: e axis relative? Overrides all_relative
+  #ifdef JOG
+  uint8_t   jog               :1; ///< bool: speed follows jog_feedrate, see M430
+  #endif
+  #ifdef SPINDLE
+  uint8_t   spindle_dynamic   :1; ///< bool: power scales with speed, see M4
+  uint8_t   spindle;          ///< laser or spindle power, 0 = off
+  #endif
 } TARGET;
 
 /**
@@ -58,6 +89,12 @@ typedef struct {
 
 	// step counters
   axes_uint32_t     steps;   ///< number of steps on each axis
+	#ifndef ACCELERATION_TEMPORAL
+  uint8_t           axis_mask; ///< bit (1 << axis) set while axis has steps left
+	#endif
+  #ifdef STEP_POSITION
+  int8_t            step_dir[AXIS_COUNT]; ///< 1 or -1, added to step_position
+  #endif
 
 	#ifdef ACCELERATION_RAMPING
 	/// counts actual steps done
@@ -66,13 +103,57 @@ typedef struct {
 	#ifdef ACCELERATION_TEMPORAL
   axes_uint32_t     time;       ///< time of the last step on each axis
   uint32_t          last_time;  ///< time of the last step of any axis
+  #ifdef TEMPORAL_MATCH_CHANNELS
+  uint32_t          start_time; ///< step timer time of the start of the move
+  #endif
+	#endif
+
+	#ifdef STEP_TIMING_QUEUE
+  /// changes with each move and endstop stop, see dda_fill_step_timing()
+  uint8_t           timing_gen;
 	#endif
+  #ifdef ADVANCE_K
+  /// E steps ahead of the Bresenham position, see dda_advance()
+  int16_t           e_advance;
+  #endif
+  #ifdef FEED_HOLD
+  /// step the move stops at for a feed hold, 0 for none, see dda_hold()
+  uint32_t          hold_step;
+  /// step the ramp up after a resume starts from, see dda_resume()
+  int32_t           resume_base;
+  /// whether this move got resumed
+  uint8_t           resume;
+  #endif
+  #ifdef JOG
+  /// position on the jog ramp at jog_step, see dda_jog_clock()
+  uint32_t          jog_n;
+  /// step jog_n applies to
+  uint32_t          jog_step;
+  /// ramp position of the commanded speed
+  uint32_t          jog_n_cmd;
+  /// jog_feedrate jog_n_cmd was calculated for
+  uint16_t          jog_f;
+  /// jog released and stopped, the move ends with the next step
+  uint8_t           jog_end;
+  #endif
 
 	/// Endstop handling.
   uint8_t endstop_stop; ///< Stop due to endstop trigger
-  uint8_t debounce_count_x, debounce_count_y, debounce_count_z, debounce_count_u;
+  uint8_t debounce_count[AXIS_COUNT]; ///< MIN and MAX of an axis share one
+  #ifdef ENDSTOP_CAPTURE
+  /// steps[] left at the first endstop hit, see dda_endstop_overshoot()
+  uint32_t endstop_latch[AXIS_COUNT];
+  #endif
 } MOVE_STATE;
 
+/**
+  Bits of DDA.endstop_check, one for each endstop: X_MIN = 0x01, X_MAX = 0x02,
+  Y_MIN = 0x04, ... U_MAX = 0x80. E has no endstops.
+*/
+#define ENDSTOP_MIN(axis)   (0x01 << (2 * (axis)))
+#define ENDSTOP_MAX(axis)   (0x02 << (2 * (axis)))
+#define ENDSTOP_AXIS(axis)  (ENDSTOP_MIN(axis) | ENDSTOP_MAX(axis))
+
 /**
 	\struct DDA
 	\brief this is a digital differential analyser data struct
@@ -96,6 +177,9 @@ typedef struct {
 
 			// wait for temperature to stabilise flag
 			uint8_t						waitfor_temp	:1; ///< bool: wait for temperatures to reach their set values
+			uint8_t						dwell			:1; ///< bool: sit still for c milliseconds (G4)
+      uint8_t           action        :1; ///< bool: null move running the action in c, see enqueue_action()
+      uint8_t           sync          :1; ///< bool: dwell until all nodes reach the barrier, see enqueue_sync()
 
 			// directions
       // As we have muldiv() now, overflows became much less an issue and
@@ -112,11 +196,13 @@ typedef struct {
 
 	// distances
   axes_uint32_t     delta;       ///< number of steps on each axis
+  #if defined BACKLASH && defined STEP_POSITION
+  uint8_t           takeup;      ///< bit (1 << axis) set if taking up backlash
+  #endif
 
   // uint8_t        fast_axis;   (see below)
   uint32_t          total_steps; ///< steps of the "fast" axis
   uint32_t          fast_um;     ///< movement length of this fast axis
-  uint32_t          fast_spm;    ///< steps per meter of the fast axis
 
 	uint32_t					c; ///< time until next step, 24.8 fixed point
 
@@ -133,23 +219,26 @@ typedef struct {
 	uint32_t					rampdown_steps;
 	/// 24.8 fixed point timer value, maximum speed
 	uint32_t					c_min;
+  /// timer value of the first step, depends on acceleration of this move
+  uint32_t          c0;
+  /// acceleration of the fast axis, limited by all participating axes, mm/s^2
+  uint32_t          fast_acc;
+  #ifdef FEED_OVERRIDE
+  /// timer value of the axis feedrate limits, c_min can't go below this
+  uint32_t          c_limit;
+  #endif
+  #ifdef ADVANCE_K
+  /// E lead in steps times step interval c, 0 for no pressure advance
+  uint32_t          advance;
+  #endif
   #ifdef LOOKAHEAD
   // With the look-ahead functionality, it is possible to retain physical
   // movement between G1 moves. These variables keep track of the entry and
   // exit speeds between moves.
   uint32_t          distance;
-  uint32_t          crossF;
   // These two are based on the "fast" axis, the axis with the most steps.
   uint32_t          start_steps; ///< would be required to reach start feedrate
   uint32_t          end_steps; ///< would be required to stop from end feedrate
-  // Displacement vector, in um, based between the difference of the starting
-  // point and the target. Required to obtain the jerk between 2 moves.
-  // Note: x_delta and co are in steps, not um.
-  axes_int32_t      delta_um;
-  // Number the moves to be able to test at the end of lookahead if the moves
-  // are the same. Note: we do not need a lot of granularity here: more than
-  // MOVEBUFFER_SIZE is already enough.
-  uint8_t           id;
   #endif
 	#endif
 	#ifdef ACCELERATION_TEMPORAL
@@ -157,14 +246,35 @@ typedef struct {
 	uint8_t						axis_to_step;    ///< axis to be stepped on the next interrupt
 	#endif
 
+  #ifdef SD
+  uint32_t          sd_pos;       ///< file position of the line of this move
+  #endif
+
   /// Small variables. Many CPUs can access 32-bit variables at word or double
   /// word boundaries only and fill smaller variables in between with gaps,
   /// so keep small variables grouped together to reduce the amount of these
   /// gaps. See e.g. NXP application note AN10963, page 10f.
+  #ifdef LOOKAHEAD
+  // Lookahead works with up to 16-bit feedrates ( = 1092 mm/s), see
+  // dda_create().
+  uint16_t          crossF;          ///< maximum crossing speed, mm/min
+  uint16_t          startF;          ///< planned entry speed, mm/min
+  #endif
   uint8_t           fast_axis;       ///< number of the fast axis
+  #if ! defined ACCELERATION_TEMPORAL || defined STEPPER_IDLE_DISABLE
+  /// bit (1 << axis) set for each axis with steps, for move_state.axis_mask
+  /// and STEPPER_IDLE_DISABLE
+  uint8_t           axis_mask;
+  #endif
+  #ifdef LOOKAHEAD
+  // Number the moves to be able to test at the end of lookahead if the moves
+  // are the same. Note: we do not need a lot of granularity here: more than
+  // MOVEBUFFER_SIZE is already enough.
+  uint8_t           id;
+  #endif
 
 	/// Endstop homing
-	uint8_t endstop_check; ///< Do we need to check endstops? 0x1=Check X, 0x2=Check Y, 0x4=Check Z
+	uint8_t endstop_check; ///< Endstops to check, ENDSTOP_MIN(axis) | ENDSTOP_MAX(axis) | ...
 	uint8_t endstop_stop_cond; ///< Endstop condition on which to stop motion: 0=Stop on detrigger, 1=Stop on trigger
 } DDA;
 
@@ -181,6 +291,36 @@ extern TARGET startpoint_steps;
 /// current_position holds the machine's current position. this is only updated when we step, or when G92 (set home) is received.
 extern TARGET current_position;
 
+/// machine position of the G-code origin
+extern axes_int32_t work_offset;
+
+#ifdef STEP_POSITION
+/// position in motor steps, counted by dda_step()
+extern volatile axes_int32_t step_position;
+#endif
+
+#ifdef FEED_OVERRIDE
+/// requested speed of all moves, 256 = 100%, see M220
+extern volatile uint16_t feed_override;
+#endif
+
+#ifdef FEED_HOLD
+/// values of feed_hold
+enum {
+  FEED_HOLD_OFF = 0,   ///< moving normally
+  FEED_HOLD_STOPPING,  ///< decelerating for a hold
+  FEED_HOLD_HELD       ///< standing, step interrupt stopped
+};
+
+/// state of a feed hold, see dda_hold()
+extern volatile uint8_t feed_hold;
+#endif
+
+#ifdef JOG
+/// commanded speed of a jog move in mm/min, 0 = stop, see jog()
+extern volatile uint16_t jog_feedrate;
+#endif
+
 /*
 	methods
 */
@@ -188,9 +328,15 @@ extern TARGET current_position;
 // initialize dda structures
 void dda_init(void);
 
+// recalculate movement constants after settings changed
+void dda_apply_settings(void);
+
 // distribute a new startpoint
 void dda_new_startpoint(void);
 
+// don't join the next move to the previous one
+void dda_break_lookahead(void);
+
 // create a DDA
 void dda_create(DDA *dda, const TARGET *target);
 
@@ -200,10 +346,52 @@ void dda_start(DDA *dda);
 // DDA takes one step (called from timer interrupt)
 void dda_step(DDA *dda);
 
+#ifdef TEMPORAL_MATCH_CHANNELS
+// DDA steps the axes of one timer match channel (called from timer interrupt)
+void dda_step_channel(DDA *dda, uint8_t ch);
+#endif
+
 // regular movement maintenance
 void dda_clock(void);
 
+// stop one axis of the current movement, the others go on
+void dda_stop_axis(enum axis_e i);
+
+#ifdef STEP_RATE_GUARD
+// step interrupt too slow for the live move, slow it and all further moves
+void dda_overload(DDA *dda);
+
+// report a lowered step rate cap
+void dda_overload_report(void);
+#endif
+
+#ifdef ENDSTOP_CAPTURE
+// steps an axis went past its endstop trigger point
+uint32_t dda_endstop_overshoot(enum axis_e i);
+#endif
+
+#ifdef FEED_HOLD
+// stop moving with a ramp down, keep the queue
+void dda_hold(void);
+
+// continue after dda_hold()
+void dda_resume(void);
+#endif
+
+#ifdef JOG
+// take the position a jog stopped at as new startpoint
+void dda_jog_end(void);
+#endif
+
 // update current_position
 void update_current_position(void);
 
+// update current_position and report it
+void print_current_position(void);
+
+#ifdef STEP_TRACE
+// print recorded speed profile
+void dda_trace_print(void);
+#endif
+
 #endif	/* _DDA_H */
@@ -4,8 +4,14 @@
 */
 
 #include <stdlib.h>
+#ifdef PLANNER_FLOAT
+  #include <math.h>
+#endif
 
 #include "dda_maths.h"
+#ifdef JOINT_CALIBRATION
+  #include "settings.h"
+#endif
 
 
 void
@@ -55,3 +61,418 @@ void axes_um_to_steps_corexy(const axes_int32_t um, axes_int32_t steps) {
   steps[Y] = um_to_steps(um[X] - um[Y], Y);
   steps[Z] = um_to_steps(um[Z], Z);
 }
+
+#ifdef KINEMATICS_ARM4
+
+// Sanity: make sure the arm geometry is in place.
+#if ! defined ARM_SHOULDER_HEIGHT || ! defined ARM_SHOULDER_OFFSET || \
+    ! defined ARM_UPPER_ARM_LENGTH || ! defined ARM_FOREARM_LENGTH
+  #error KINEMATICS_ARM4 needs ARM_SHOULDER_HEIGHT, ARM_SHOULDER_OFFSET, \
+         ARM_UPPER_ARM_LENGTH and ARM_FOREARM_LENGTH in config.h.
+#endif
+
+/**
+  Inverse kinematics are done in units of 2^ARM_IK_SHIFT micrometers. This
+  keeps all squares within 32 bits without resorting to 64-bit maths, which
+  is way too slow on AVR. With the default of 5, the resolution is 32 um and
+  the arm can reach up to 1.4 m from the shoulder.
+*/
+#ifndef ARM_IK_SHIFT
+  #define ARM_IK_SHIFT 5
+#endif
+
+#define ARM_IK_UNIT     (1L << ARM_IK_SHIFT)
+#define ARM_S_HEIGHT    ((int32_t)(ARM_SHOULDER_HEIGHT / ARM_IK_UNIT))
+#define ARM_S_OFFSET    ((int32_t)(ARM_SHOULDER_OFFSET / ARM_IK_UNIT))
+#define ARM_L1          ((int32_t)(ARM_UPPER_ARM_LENGTH / ARM_IK_UNIT))
+#define ARM_L2          ((int32_t)(ARM_FOREARM_LENGTH / ARM_IK_UNIT))
+#define ARM_L1_SQ       (ARM_L1 * ARM_L1)
+#define ARM_L2_SQ       (ARM_L2 * ARM_L2)
+#define ARM_2_L1_L2     ((uint32_t)2 * ARM_L1 * ARM_L2)
+#define ARM_REACH_MAX   ((uint32_t)(ARM_L1 + ARM_L2) * (ARM_L1 + ARM_L2))
+#define ARM_REACH_MIN   ((uint32_t)(ARM_L1 - ARM_L2) * (ARM_L1 - ARM_L2))
+
+#if (ARM_UPPER_ARM_LENGTH + ARM_FOREARM_LENGTH) / (1L << ARM_IK_SHIFT) > 46340
+  #error Arm too long for ARM_IK_SHIFT, squares would overflow. Raise it.
+#endif
+
+#if ! defined SEGMENT_TOLERANCE || ! defined SEGMENT_LENGTH_MIN || \
+    ! defined SEGMENT_LENGTH_MAX
+  #error KINEMATICS_ARM4 needs SEGMENT_TOLERANCE, SEGMENT_LENGTH_MIN and \
+         SEGMENT_LENGTH_MAX in config.h.
+#endif
+
+#ifdef PLANNER_FLOAT
+  /// Millidegrees per radian.
+  #define ARM_MDEG_PER_RAD 57295.7795f
+#endif
+
+/**
+  Joint angles of the most recently converted position, in millidegrees.
+  Caching them here saves a second inverse kinematics run for the start
+  point of each move.
+*/
+static axes_int32_t arm_joints_start;
+
+/** Inverse kinematics of the PantherArm.
+
+  \param um     Position in G-code space. X, Y, Z are the Cartesian
+                position of the wrist joint centre in micrometers, origin at
+                the base of the column. U is the tool pitch against the
+                horizon in millidegrees.
+
+  \param joints Resulting joint angles in millidegrees: X = base rotation
+                from the X axis, Y = upper arm elevation from the horizon,
+                Z = forearm angle relative to the upper arm (0 = stretched,
+                negative = elbow up), U = wrist angle relative to the
+                forearm.
+
+  Targets out of reach are clamped to the fully stretched or fully folded
+  arm on the line to the target. All maths is integer, the trigonometry is
+  done by int_atan2(), a table lookup. With PLANNER_FLOAT, it's floats.
+*/
+#ifdef PLANNER_FLOAT
+static void arm_inverse(const axes_int32_t um, axes_int32_t joints) {
+  const float l1 = ARM_UPPER_ARM_LENGTH, l2 = ARM_FOREARM_LENGTH;
+  float x, y, dr, dz, d_sq, c, s, elbow;
+
+  x = um[X];
+  y = um[Y];
+  joints[X] = lroundf(atan2f(y, x) * ARM_MDEG_PER_RAD);
+
+  // Vector from shoulder pivot to wrist, in the plane of the arm.
+  dr = sqrtf(x * x + y * y) - ARM_SHOULDER_OFFSET;
+  dz = um[Z] - ARM_SHOULDER_HEIGHT;
+
+  d_sq = dr * dr + dz * dz;
+  if (d_sq > (l1 + l2) * (l1 + l2))
+    d_sq = (l1 + l2) * (l1 + l2);
+  else if (d_sq < (l1 - l2) * (l1 - l2))
+    d_sq = (l1 - l2) * (l1 - l2);
+
+  // Law of cosines, cosine and sine of the elbow angle.
+  c = (d_sq - l1 * l1 - l2 * l2) / (2.f * l1 * l2);
+  if (c > 1.f)
+    c = 1.f;
+  else if (c < -1.f)
+    c = -1.f;
+  s = sqrtf(1.f - c * c);
+
+  // Elbow up solution.
+  elbow = atan2f(s, c);
+  joints[Z] = -lroundf(elbow * ARM_MDEG_PER_RAD);
+  joints[Y] = lroundf((atan2f(dz, dr) + atan2f(l2 * s, l1 + l2 * c)) *
+                      ARM_MDEG_PER_RAD);
+  joints[U] = um[U] - joints[Y] - joints[Z];
+}
+#else
+static void arm_inverse(const axes_int32_t um, axes_int32_t joints) {
+  int32_t x, y, dr, dz, c, s;
+  uint32_t ax, ay, d_sq;
+  uint8_t shift = 0;
+
+  x = um[X] / ARM_IK_UNIT;
+  y = um[Y] / ARM_IK_UNIT;
+  joints[X] = int_atan2(y, x);
+
+  // Vector from shoulder pivot to wrist, in the plane of the arm. Squares
+  // of up to 46340 fit into 32 bits, targets further away are out of reach
+  // anyways, so precision doesn't matter there.
+  ax = labs(x);
+  ay = labs(y);
+  while (ax > 46340 || ay > 46340) {
+    ax >>= 1;
+    ay >>= 1;
+    shift++;
+  }
+  dr = ((int32_t)int_sqrt(ax * ax + ay * ay) << shift) - ARM_S_OFFSET;
+  dz = um[Z] / ARM_IK_UNIT - ARM_S_HEIGHT;
+
+  // Surely out of reach, so fully stretched towards the target. Squares
+  // could overflow here, too.
+  if (labs(dr) > ARM_L1 + ARM_L2 || labs(dz) > ARM_L1 + ARM_L2) {
+    joints[Z] = 0;
+    joints[Y] = int_atan2(dz, dr);
+    joints[U] = um[U] - joints[Y];
+    return;
+  }
+
+  d_sq = (uint32_t)(dr * dr) + (uint32_t)(dz * dz);
+  if (d_sq > ARM_REACH_MAX)
+    d_sq = ARM_REACH_MAX;
+  else if (d_sq < ARM_REACH_MIN)
+    d_sq = ARM_REACH_MIN;
+
+  // Law of cosines, cosine and sine of the elbow angle in 2.14 fixed point.
+  c = muldiv((int32_t)d_sq - ARM_L1_SQ - ARM_L2_SQ, (uint32_t)1 << 14,
+             ARM_2_L1_L2);
+  if (c > ((int32_t)1 << 14))
+    c = (int32_t)1 << 14;
+  else if (c < -((int32_t)1 << 14))
+    c = -((int32_t)1 << 14);
+  s = int_sqrt(((uint32_t)1 << 28) - (uint32_t)(c * c));
+
+  // Elbow up solution.
+  joints[Z] = -int_atan2(s, c);
+  joints[Y] = int_atan2(dz, dr) +
+              int_atan2((ARM_L2 * s) >> 14, ARM_L1 + ((ARM_L2 * c) >> 14));
+  joints[U] = um[U] - joints[Y] - joints[Z];
+}
+#endif /* PLANNER_FLOAT */
+
+#ifdef JOINT_CALIBRATION
+/** Correction of a joint at some angle.
+
+  \param i     The joint, X to U.
+
+  \param angle Joint angle in millidegrees.
+
+  \return Correction in millidegrees, interpolated between the two table
+          entries around angle. Beyond the table ends, the last entry.
+
+  One shift, one multiply and a few adds, cheap enough for every segment.
+*/
+static int32_t joint_correction(enum axis_e i, int32_t angle) {
+  const int16_t *cal = settings.joint_cal[i];
+  uint32_t a;
+  uint8_t k;
+
+  if (angle <= -JOINT_CAL_ORIGIN)
+    return cal[0];
+  if (angle >= JOINT_CAL_ORIGIN)
+    return cal[JOINT_CAL_POINTS - 1];
+
+  a = (uint32_t)(angle + JOINT_CAL_ORIGIN);
+  k = a >> JOINT_CAL_SHIFT;
+  a &= ((uint32_t)1 << JOINT_CAL_SHIFT) - 1;
+
+  // Corrections are limited to JOINT_CAL_MAX, so this stays in 32 bits.
+  return cal[k] + (((int32_t)(cal[k + 1] - cal[k]) * (int32_t)a) >>
+                   JOINT_CAL_SHIFT);
+}
+
+/** Motor angle of a joint angle.
+
+  \param i     The joint, X to U.
+
+  \param angle Joint angle in millidegrees, as from arm_inverse().
+
+  \return Angle the motor has to go to for reaching it, millidegrees.
+*/
+int32_t joint_calibrate(enum axis_e i, int32_t angle) {
+  return angle + joint_correction(i, angle);
+}
+
+/** Joint angle of a motor angle, the reverse of joint_calibrate().
+
+  \param i     The joint, X to U.
+
+  \param motor Motor angle in millidegrees, like from counted steps.
+
+  \return Joint angle in millidegrees.
+
+  Looking up the correction at the motor angle instead of the joint angle
+  is off by the slope of the table times the correction, well below a
+  step for corrections changing slowly.
+*/
+int32_t joint_uncalibrate(enum axis_e i, int32_t motor) {
+  return motor - joint_correction(i, motor);
+}
+#endif /* JOINT_CALIBRATION */
+
+void
+carthesian_to_arm4(const TARGET *startpoint, const TARGET *target,
+                   axes_uint32_t delta_um, axes_int32_t steps) {
+  axes_int32_t joints;
+  enum axis_e i;
+
+  // startpoint is already known as joints in arm_joints_start.
+  (void)startpoint;
+
+  arm_inverse(target->axis, joints);
+
+  // The base angle from atan2 wraps at -X. Take the short way round from
+  // where the base stands, which may be beyond +-180 degrees by now.
+  while (joints[X] - arm_joints_start[X] > 180000L)
+    joints[X] -= 360000L;
+  while (joints[X] - arm_joints_start[X] < -180000L)
+    joints[X] += 360000L;
+
+  for (i = X; i < E; i++) {
+    // "Micrometers" of a joint are millidegrees.
+    delta_um[i] = (uint32_t)labs(joints[i] - arm_joints_start[i]);
+    arm_joints_start[i] = joints[i];
+    #ifdef JOINT_CALIBRATION
+      steps[i] = um_to_steps(joint_calibrate(i, joints[i]), i);
+    #else
+      steps[i] = um_to_steps(joints[i], i);
+    #endif
+  }
+}
+
+/** Joint angles of a position.
+
+  \param um     Position in G-code space.
+
+  \param joints Resulting joint angles in millidegrees.
+
+  Unlike axes_um_to_steps_arm4() this leaves the joint cache for the next
+  move alone.
+*/
+void joints_arm4(const axes_int32_t um, axes_int32_t joints) {
+  arm_inverse(um, joints);
+}
+
+/** Forward kinematics of the PantherArm, the reverse of arm_inverse().
+
+  \param joints Joint angles in millidegrees, see arm_inverse().
+
+  \param um     Resulting position in G-code space, E is left alone.
+
+  Four int_sin() lookups and a few muldiv()s, cheap enough for position
+  reports several times a second, still too slow for the step interrupt.
+  With PLANNER_FLOAT, it's sinf() and cosf().
+*/
+#ifdef PLANNER_FLOAT
+void arm4_to_carthesian(const axes_int32_t joints, axes_int32_t um) {
+  float base, upper, forearm, r;
+
+  base = joints[X] / ARM_MDEG_PER_RAD;
+  upper = joints[Y] / ARM_MDEG_PER_RAD;
+  // Forearm angle against the horizon.
+  forearm = (joints[Y] + joints[Z]) / ARM_MDEG_PER_RAD;
+
+  r = ARM_UPPER_ARM_LENGTH * cosf(upper) + ARM_FOREARM_LENGTH * cosf(forearm) +
+      ARM_SHOULDER_OFFSET;
+  // Rounding near the column only, arm_inverse() never goes behind it.
+  if (r < 0.f)
+    r = 0.f;
+  um[Z] = lroundf(ARM_UPPER_ARM_LENGTH * sinf(upper) +
+                  ARM_FOREARM_LENGTH * sinf(forearm)) + ARM_SHOULDER_HEIGHT;
+
+  um[X] = lroundf(cosf(base) * r);
+  um[Y] = lroundf(sinf(base) * r);
+  um[U] = joints[U] + joints[Y] + joints[Z];
+}
+#else
+void arm4_to_carthesian(const axes_int32_t joints, axes_int32_t um) {
+  int32_t forearm, r;
+
+  // Forearm angle against the horizon.
+  forearm = joints[Y] + joints[Z];
+
+  r = muldiv(int_sin(joints[Y] + 90000), ARM_UPPER_ARM_LENGTH, 1UL << 14) +
+      muldiv(int_sin(forearm + 90000), ARM_FOREARM_LENGTH, 1UL << 14) +
+      ARM_SHOULDER_OFFSET;
+  // Rounding near the column only, arm_inverse() never goes behind it.
+  if (r < 0)
+    r = 0;
+  um[Z] = muldiv(int_sin(joints[Y]), ARM_UPPER_ARM_LENGTH, 1UL << 14) +
+          muldiv(int_sin(forearm), ARM_FOREARM_LENGTH, 1UL << 14) +
+          ARM_SHOULDER_HEIGHT;
+
+  um[X] = muldiv(int_sin(joints[X] + 90000), r, 1UL << 14);
+  um[Y] = muldiv(int_sin(joints[X]), r, 1UL << 14);
+  um[U] = joints[U] + forearm;
+}
+#endif /* PLANNER_FLOAT */
+
+/** Convert a position to steps.
+
+  Used for distributing a new startpoint, so this also updates the joint
+  cache for the next move.
+*/
+void axes_um_to_steps_arm4(const axes_int32_t um, axes_int32_t steps) {
+  enum axis_e i;
+
+  arm_inverse(um, arm_joints_start);
+  for (i = X; i < E; i++) {
+    #ifdef JOINT_CALIBRATION
+      steps[i] = um_to_steps(joint_calibrate(i, arm_joints_start[i]), i);
+    #else
+      steps[i] = um_to_steps(arm_joints_start[i], i);
+    #endif
+  }
+}
+
+/** Reset the joint cache to where the motors are.
+
+  \param steps Motor positions in steps, like startpoint_steps.
+
+  For moves not ending where they were planned to, e.g. a released jog.
+  Taken from steps, so the base angle stays unwrapped like the motor.
+*/
+void joints_from_steps_arm4(const axes_int32_t steps) {
+  enum axis_e i;
+
+  for (i = X; i < E; i++) {
+    #ifdef JOINT_CALIBRATION
+      arm_joints_start[i] = joint_uncalibrate(i, steps_to_um(steps[i], i));
+    #else
+      arm_joints_start[i] = steps_to_um(steps[i], i);
+    #endif
+  }
+}
+
+/** Find a suitable segment length around a point.
+
+  \param um Position in G-code space.
+
+  \return Length of a segment starting there, in micrometers.
+
+  Joints move linearly during a move, so a G-code straight line becomes an
+  arc-like curve. Its deviation from the straight line is about
+  l^2 / (8 * rho), with l the segment length and rho the distance to the
+  centre of the rotation dominating there: the column axis for the base
+  joint, the shoulder pivot for shoulder and elbow. The closer we get to one
+  of them, the shorter the segments have to be.
+*/
+#ifdef PLANNER_FLOAT
+uint32_t segment_length_arm4(const axes_int32_t um) {
+  float x, y, r, d, rho;
+
+  x = um[X];
+  y = um[Y];
+  r = sqrtf(x * x + y * y);
+  x = r - ARM_SHOULDER_OFFSET;
+  y = um[Z] - ARM_SHOULDER_HEIGHT;
+  d = sqrtf(x * x + y * y);
+
+  rho = r < d ? r : d;
+  if (rho >= (float)SEGMENT_LENGTH_MAX * SEGMENT_LENGTH_MAX /
+             (8 * SEGMENT_TOLERANCE))
+    return SEGMENT_LENGTH_MAX;
+
+  r = sqrtf(8.f * SEGMENT_TOLERANCE * rho);
+  if (r < SEGMENT_LENGTH_MIN)
+    return SEGMENT_LENGTH_MIN;
+
+  return (uint32_t)r;
+}
+#else
+uint32_t segment_length_arm4(const axes_int32_t um) {
+  int32_t x, y, dr, dz;
+  uint32_t r, d, rho, length;
+
+  x = um[X] / ARM_IK_UNIT;
+  y = um[Y] / ARM_IK_UNIT;
+  r = int_sqrt((uint32_t)(x * x) + (uint32_t)(y * y));
+  dr = (int32_t)r - ARM_S_OFFSET;
+  dz = um[Z] / ARM_IK_UNIT - ARM_S_HEIGHT;
+  d = int_sqrt((uint32_t)(dr * dr) + (uint32_t)(dz * dz));
+
+  // Far enough away to allow the longest segment? Also avoids an overflow.
+  rho = (r < d ? r : d) * ARM_IK_UNIT;
+  if (rho >= (uint32_t)SEGMENT_LENGTH_MAX * SEGMENT_LENGTH_MAX /
+             (8 * SEGMENT_TOLERANCE))
+    return SEGMENT_LENGTH_MAX;
+
+  length = int_sqrt(8 * rho * SEGMENT_TOLERANCE);
+  if (length < SEGMENT_LENGTH_MIN)
+    length = SEGMENT_LENGTH_MIN;
+
+  return length;
+}
+#endif /* PLANNER_FLOAT */
+
+#endif /* KINEMATICS_ARM4 */
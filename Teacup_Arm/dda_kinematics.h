@@ -14,6 +14,9 @@ void carthesian_to_carthesian(const TARGET *startpoint, const TARGET *target,
 void carthesian_to_corexy(const TARGET *startpoint, const TARGET *target,
                           axes_uint32_t delta_um, axes_int32_t steps);
 
+void carthesian_to_arm4(const TARGET *startpoint, const TARGET *target,
+                         axes_uint32_t delta_um, axes_int32_t steps);
+
 //void carthesian_to_scara(TARGET *startpoint, TARGET *target,
 //                         axes_uint32_t delta_um, axes_int32_t steps);
 
@@ -27,6 +30,8 @@ inline void code_axes_to_stepper_axes(const TARGET *startpoint, const TARGET *ta
     carthesian_to_carthesian(startpoint, target, delta_um, steps);
   #elif defined KINEMATICS_COREXY
     carthesian_to_corexy(startpoint, target, delta_um, steps);
+  #elif defined KINEMATICS_ARM4
+    carthesian_to_arm4(startpoint, target, delta_um, steps);
 //  #elif defined KINEMATICS_SCARA
 //    return carthesian_to_scara(startpoint, target, delta_um, steps);
   #else
@@ -36,6 +41,7 @@ inline void code_axes_to_stepper_axes(const TARGET *startpoint, const TARGET *ta
 
 void axes_um_to_steps_cartesian(const axes_int32_t um, axes_int32_t steps);
 void axes_um_to_steps_corexy(const axes_int32_t um, axes_int32_t steps);
+void axes_um_to_steps_arm4(const axes_int32_t um, axes_int32_t steps);
 // void axes_um_to_steps_scara(const axes_int32_t um, axes_int32_t steps);
 
 static void axes_um_to_steps(const axes_int32_t, axes_int32_t)
@@ -45,6 +51,8 @@ inline void axes_um_to_steps(const axes_int32_t um, axes_int32_t steps) {
     axes_um_to_steps_cartesian(um, steps);
   #elif defined KINEMATICS_COREXY
     axes_um_to_steps_corexy(um, steps);
+  #elif defined KINEMATICS_ARM4
+    axes_um_to_steps_arm4(um, steps);
 //  #elif defined KINEMATICS_SCARA
 //    axes_um_to_steps_scara(um, steps);
   #else
@@ -52,4 +60,48 @@ inline void axes_um_to_steps(const axes_int32_t um, axes_int32_t steps) {
   #endif
 }
 
+/**
+  Non-linear kinematics turn a straight line in G-code space into a curve
+  on the motors. Such moves get subdivided into segments before they're
+  queued, see enqueue_home().
+*/
+#if defined KINEMATICS_ARM4
+  #define KINEMATICS_SEGMENTED
+#endif
+
+uint32_t segment_length_arm4(const axes_int32_t um);
+
+void joints_arm4(const axes_int32_t um, axes_int32_t joints);
+void arm4_to_carthesian(const axes_int32_t joints, axes_int32_t um);
+void joints_from_steps_arm4(const axes_int32_t steps);
+
+#ifdef JOINT_CALIBRATION
+/**
+  Joint calibration table layout: JOINT_CAL_POINTS corrections per joint,
+  2^JOINT_CAL_SHIFT millidegrees apart, centered around zero. Spacing is a
+  power of two, so finding the table entry is a shift, no division.
+*/
+#define JOINT_CAL_POINTS  13
+#define JOINT_CAL_SHIFT   15
+#define JOINT_CAL_ORIGIN  ((int32_t)(JOINT_CAL_POINTS - 1) << \
+                           (JOINT_CAL_SHIFT - 1))
+
+/// Largest correction accepted, millidegrees.
+#define JOINT_CAL_MAX     10000
+
+int32_t joint_calibrate(enum axis_e i, int32_t angle);
+int32_t joint_uncalibrate(enum axis_e i, int32_t motor);
+#endif
+
+static uint32_t kinematics_segment_length(const axes_int32_t)
+                                          __attribute__ ((always_inline));
+inline uint32_t kinematics_segment_length(const axes_int32_t um) {
+  #if defined KINEMATICS_ARM4
+    return segment_length_arm4(um);
+  #else
+    (void)um;
+    return 0xFFFFFFFF;
+  #endif
+}
+
 #endif /* _DDA_KINEMATICS_H */
@@ -14,30 +14,122 @@
 
 #include "dda_maths.h"
 #include "dda.h"
+#include "settings.h"
 #include "timer.h"
 #include "delay.h"
 #include "dda_queue.h"
 #include "sersendf.h"
 #include "pinio.h"
 #include "memory_barrier.h"
+#include "trace.h"
 
-#ifdef DEBUG
-  // Total number of moves joined together.
-  uint32_t lookahead_joined = 0;
-  // Moves that did not compute in time to be actually joined.
-  uint32_t lookahead_timeout = 0;
-#endif
 
-/// \var maximum_jerk_P
-/// \brief maximum allowed feedrate jerk on each axis
-static const axes_uint32_t PROGMEM maximum_jerk_P = {
-  MAX_JERK_X,
-  MAX_JERK_Y,
-  MAX_JERK_Z,
-  MAX_JERK_U,
-  MAX_JERK_E
-};
+/**
+ * \brief Axis speed from a direction and a feedrate.
+ * \details Direction is part of a unit vector, 2.14 fixed point. This can
+ * exceed 1 with non-straight kinematics, where the axis distance isn't the
+ * distance in G-code coordinates, so fall back to muldiv() if needed.
+ */
+static int32_t axis_speed(int32_t unit, uint32_t F) {
+  if (unit < (int32_t)1 << 16 && unit > -((int32_t)1 << 16) &&
+      F < (uint32_t)1 << 15)
+    return (unit * (int32_t)F) >> 14;
+  return muldiv(unit, F, (uint32_t)1 << 14);
+}
 
+/**
+ * \brief Acceleration along the movement direction.
+ *
+ * \param [in] dda is the move in question.
+ *
+ * \return Acceleration in mm/s^2. It's the one of the fast axis, scaled by
+ *         distance / fast_um.
+ */
+static uint32_t lookahead_path_acc(DDA *dda) {
+  return muldiv(dda->fast_acc, dda->distance, dda->fast_um);
+}
+
+#ifdef JUNCTION_DEVIATION
+/**
+ * \brief Corner speed after the junction deviation model.
+ *
+ * \param [in] prev is the previous move.
+ * \param [in] current is the move currently created.
+ * \param [in] prev_dir is the direction of the previous move.
+ * \param [in] dir is the direction of the current move.
+ * \param [in] F is the highest speed to consider, in mm/min.
+ *
+ * \return Corner speed in mm/min.
+ *
+ * The corner speed is the one where a circle, touching both moves and
+ * staying within JUNCTION_DEVIATION of the actual corner, can be passed
+ * with the lower acceleration of both moves:
+ *
+ *   v^2 = a * delta * sin(theta / 2) / (1 - sin(theta / 2))
+ *
+ * with theta being the angle between both moves, 180 degrees for a straight
+ * continuation. sin(theta / 2) = sqrt((1 + cos(phi)) / 2), phi being the
+ * angle between both directions, cos(phi) = dir1 * dir2 / (|dir1| * |dir2|).
+ * Directions get normalized here, because with non-straight kinematics they
+ * aren't unit vectors.
+ */
+static uint32_t junction_speed(DDA *prev, DDA *current,
+                               const axes_int32_t prev_dir,
+                               const axes_int32_t dir, uint32_t F) {
+  axes_int32_t a, b;
+  int32_t dot = 0, len_a = 0, len_b = 0, cos_phi;
+  uint32_t acc, x, sin_half, rest, F2;
+  uint8_t shift_a = 0, shift_b = 0;
+  enum axis_e i;
+
+  // Scale components to 2.14 or less, so the sums below fit into 32 bits.
+  for (i = X; i < AXIS_COUNT; i++) {
+    while (labs(prev_dir[i] >> shift_a) > ((int32_t)1 << 14))
+      shift_a++;
+    while (labs(dir[i] >> shift_b) > ((int32_t)1 << 14))
+      shift_b++;
+  }
+  for (i = X; i < AXIS_COUNT; i++) {
+    a[i] = prev_dir[i] >> shift_a;
+    b[i] = dir[i] >> shift_b;
+    dot += a[i] * b[i];
+    len_a += a[i] * a[i];
+    len_b += b[i] * b[i];
+  }
+  len_a = int_sqrt(len_a);
+  len_b = int_sqrt(len_b);
+  if (len_a == 0 || len_b == 0)
+    return F;
+
+  // cos(phi) in 2.14 fixed point.
+  cos_phi = muldiv(dot, (uint32_t)1 << 14, (uint32_t)len_a * len_b);
+  if (cos_phi > ((int32_t)1 << 14))
+    cos_phi = (int32_t)1 << 14;
+  if (cos_phi <= -((int32_t)1 << 14))
+    return 0;
+
+  // sin(theta / 2), also 2.14.
+  sin_half = int_sqrt((uint32_t)(((int32_t)1 << 14) + cos_phi) << 13);
+  rest = ((uint32_t)1 << 14) - sin_half;
+
+  // F^2 = 3600 * a * delta / 1000 * sin / (1 - sin), delta in um.
+  acc = lookahead_path_acc(prev);
+  x = lookahead_path_acc(current);
+  if (x < acc)
+    acc = x;
+  x = muldiv(acc * JUNCTION_DEVIATION, 18, 5);
+
+  // Nearly straight, result would overflow.
+  if (rest <= (x >> 17))
+    return F;
+
+  F2 = muldiv(x, sin_half, rest);
+  if (F == 0 || F2 / F >= F)
+    return F;
+
+  return int_sqrt(F2);
+}
+#endif /* JUNCTION_DEVIATION */
 
 /**
  * \brief Find maximum corner speed between two moves.
@@ -45,21 +137,34 @@ static const axes_uint32_t PROGMEM maximum_jerk_P = {
  * exceeding the expected jerk. Worst case this speed is zero, which means a
  * full stop between both moves. Best case it's the lower of the maximum speeds.
  *
- * This function is expected to be called from within dda_create().
+ * This function is expected to be called from within dda_create(), for
+ * each move in turn. Directions aren't stored in the DDA to save RAM, so
+ * the one of the previous move is remembered here, as a unit vector. This
+ * way each move's direction gets calculated only once and speeds at the
+ * crossing feedrate are a plain multiplication away.
  *
  * \param [in] prev is the DDA structure of the move previous to the current one.
  * \param [in] current is the DDA structure of the move currently created.
+ * \param [in] delta_um is the displacement of the current move, in um.
  *
  * \return dda->crossF
  */
-void dda_find_crossing_speed(DDA *prev, DDA *current) {
+void dda_find_crossing_speed(DDA *prev, DDA *current,
+                             const axes_int32_t delta_um) {
+  static axes_int32_t prev_unit;
   uint32_t F, dv, speed_factor, max_speed_factor;
-  axes_int32_t prevF, currF;
+  axes_int32_t unit, prevF, currF;
   enum axis_e i;
 
+  // Direction of the current move, 2.14 fixed point.
+  for (i = X; i < AXIS_COUNT; i++)
+    unit[i] = muldiv(delta_um[i], (uint32_t)1 << 14, current->distance);
+
   // Bail out if there's nothing to join (e.g. G1 F1500).
-  if ( ! prev || prev->nullmove)
+  if ( ! prev || prev->nullmove) {
+    memcpy(prev_unit, unit, sizeof(axes_int32_t));
     return;
+  }
 
   // We always look at the smaller of both combined speeds,
   // else we'd interpret intended speed changes as jerk.
@@ -71,17 +176,25 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
     sersendf_P(PSTR("Distance: %lu, then %lu\n"),
                prev->distance, current->distance);
 
-  // Find individual axis speeds.
-  // TODO: this is eight expensive muldiv()s. It should be possible to store
-  //       currF as prevF for the next calculation somehow, to save 4 of
-  //       these 8 muldiv()s. This would also allow to get rid of
-  //       dda->delta_um[] and using delta_um[] from dda_create() instead.
-  //       Caveat: bail out condition above and some other non-continuous
-  //               situations might need some extra code for handling.
+  #ifdef JUNCTION_DEVIATION
+    current->crossF = junction_speed(prev, current, prev_unit, unit, F);
+    memcpy(prev_unit, unit, sizeof(axes_int32_t));
+    if (current->crossF < queue_stats.min_crossF)
+      queue_stats.min_crossF = current->crossF;
+
+    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
+      sersendf_P(PSTR("Cross speed reduction from %lu to %u\n"),
+                 F, current->crossF);
+    return;
+  #endif
+
+  // Find individual axis speeds. Directions are independent of F, so the
+  // previous one is reused and F differing between calculations is fine.
   for (i = X; i < AXIS_COUNT; i++) {
-    prevF[i] = muldiv(prev->delta_um[i], F, prev->distance);
-    currF[i] = muldiv(current->delta_um[i], F, current->distance);
+    prevF[i] = axis_speed(prev_unit[i], F);
+    currF[i] = axis_speed(unit[i], F);
   }
+  memcpy(prev_unit, unit, sizeof(axes_int32_t));
 
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("prevF: %ld  %ld  %ld  %ld\ncurrF: %ld  %ld  %ld  %ld\n"),
@@ -114,12 +227,12 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
   for (i = X; i < AXIS_COUNT; i++) {
     dv = currF[i] > prevF[i] ? currF[i] - prevF[i] : prevF[i] - currF[i];
     if (dv) {
-      speed_factor = ((uint32_t)pgm_read_dword(&maximum_jerk_P[i]) << 8) / dv;
+      speed_factor = (settings.maximum_jerk[i] << 8) / dv;
       if (speed_factor < max_speed_factor)
         max_speed_factor = speed_factor;
       if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
         sersendf_P(PSTR("%c: dv %lu of %lu   factor %lu of %lu\n"),
-                   'X' + i, dv, (uint32_t)pgm_read_dword(&maximum_jerk_P[i]),
+                   'X' + i, dv, settings.maximum_jerk[i],
                    speed_factor, (uint32_t)1 << 8);
     }
   }
@@ -128,28 +241,77 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
     current->crossF = F;
   else
     current->crossF = (F * max_speed_factor) >> 8;
+  if (current->crossF < queue_stats.min_crossF)
+    queue_stats.min_crossF = current->crossF;
 
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-    sersendf_P(PSTR("Cross speed reduction from %lu to %lu\n"),
+    sersendf_P(PSTR("Cross speed reduction from %lu to %u\n"),
                F, current->crossF);
 
   return;
 }
 
 /**
- * \brief Join 2 moves by removing the full stop between them, where possible.
- * \details To join the moves, the deceleration ramp of the previous move and
- * the acceleration ramp of the current move are shortened, resulting in a
- * non-zero speed at that point. The target speed at the corner is already to
- * be found in dda->crossF. See dda_find_corner_speed().
+ * \brief Ramp length in steps of the fast axis to reach a given speed.
+ *
+ * \param [in] dda is the move in question.
+ * \param [in] F is the speed along the movement direction, in mm/min.
  *
- * Ideally, both ramps can be reduced to actually have Fcorner at the corner,
- * but the surrounding movements might no be long enough to achieve this speed.
- * Analysing both moves to find the best result is done here.
+ * \return Steps from standstill to this speed, see acc_ramp_len().
+ */
+static uint32_t lookahead_ramp_len(DDA *dda, uint32_t F) {
+  return acc_ramp_len(muldiv(dda->fast_um, F * 50, dda->distance * 3),
+                      dda->fast_axis, dda->fast_acc);
+}
+
+/**
+ * \brief Speed change a move allows by accelerating over its full length.
  *
- * TODO: to achieve better results with short moves (move distance < both ramps),
- *       this function should be able to enhance the corner speed on repeated
- *       calls when reverse-stepping through the movement queue.
+ * \param [in] dda is the move in question.
+ *
+ * \return Change of velocity squared along the movement direction,
+ *         in (mm/min)^2, saturated at 32 bits.
+ *
+ * v1^2 - v0^2 = 2 * a * s. With v in mm/min, a in mm/s^2 and s in um, this
+ * is 7.2 * a * s = 36 * a * s / 5. For acceleration along the movement
+ * direction see lookahead_path_acc().
+ */
+static uint32_t lookahead_speed_change(DDA *dda) {
+  uint32_t acc;
+
+  acc = lookahead_path_acc(dda);
+  if (acc == 0)
+    acc = 1;
+  if (acc > 0x7FFFFFFFUL / 36 ||
+      dda->distance > (0x7FFFFFFFUL / (acc * 36)) * 5)
+    return 0xFFFFFFFF;
+
+  return muldiv(dda->distance, acc * 36, 5);
+}
+
+/**
+ * \brief Join moves by removing the full stops between them, where possible.
+ * \details Crossing speeds of all moves are already known, see
+ * dda_find_crossing_speed(). Here we find out how much of these speeds can
+ * actually be reached, given acceleration limits and the fact that we have
+ * to be able to stop at the end of the last move in the queue.
+ *
+ * This is done over a chain of moves in the movement queue, not just the
+ * current move and the one before. A reverse pass walks from the current
+ * move back to the start of the chain and finds the maximum speed each move
+ * can be entered with, still allowing to decelerate down to the move
+ * following. Then a forward pass walks back to the current move and limits
+ * these speeds to what can be reached by accelerating. Finally, ramps of all
+ * moves in the chain are rebuilt from their entry and exit speeds.
+ *
+ * This allows a chain of short moves to keep up high speed, which wasn't
+ * the case when joining only two moves at a time.
+ *
+ * The chain starts at the first move whose entry speed can't change anymore.
+ * That's the case when it's entered at its full crossing speed already, when
+ * it follows a full stop, or when the move before is already running. This
+ * keeps the recalculation incremental, an already optimal plan stops the
+ * reverse pass.
  *
  * \param [in] prev is the DDA structure of the move previous to the current one.
  * \param [in] current is the DDA structure of the move currently created.
@@ -158,24 +320,17 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
  * constant while this function is running.
  *
  * Note: the planner always makes sure the movement can be stopped within the
- * last move (= 'current'); as a result a lot of small moves will still limit the speed.
+ * last move (= 'current').
  */
 void dda_join_moves(DDA *prev, DDA *current) {
-
-  // Calculating the look-ahead settings can take a while; before modifying
-  // the previous move, we need to locally store any values and write them
-  // when we are done (and the previous move is not already active).
-  uint32_t prev_F, prev_F_in_steps, prev_F_start_in_steps, prev_F_end_in_steps;
-  uint32_t prev_rampup, prev_rampdown, prev_total_steps;
-  uint32_t crossF, crossF_in_steps;
-  uint8_t prev_id;
-  // Similarly, we only want to modify the current move if we have the results of the calculations;
-  // until then, we do not want to touch the current move settings.
-  // Note: we assume 'current' will not be dispatched while this function runs, so we do not to
-  // back up the move settings: they will remain constant.
-  uint32_t this_F, this_F_in_steps, this_F_start_in_steps, this_rampup, this_rampdown, this_total_steps;
-  uint8_t this_id;
-  static uint32_t la_cnt = 0;     // Counter: how many moves did we join?
+  struct {
+    DDA *dda;
+    uint32_t speed_change;  ///< see lookahead_speed_change()
+    uint32_t exit_F2;       ///< maximum exit speed squared from reverse pass
+    uint32_t startF, start_steps, end_steps, rampup, rampdown, c;
+  } plan[MOVEBUFFER_SIZE];
+  uint8_t count, back, j, window;
+  uint32_t entry_F2, limit;
   #ifdef LOOKAHEAD_DEBUG
   static uint32_t moveno = 0;     // Debug counter to number the moves - helps while debugging
   moveno++;
@@ -185,154 +340,132 @@ void dda_join_moves(DDA *prev, DDA *current) {
   if ( ! prev || prev->nullmove || current->crossF == 0)
     return;
 
-    // Show the proposed crossing speed - this might get adjusted below.
-    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-      sersendf_P(PSTR("Initial crossing speed: %lu\n"), current->crossF);
-
-  // Make sure we have 2 moves and the previous move is not already active
-  if (prev->live == 0) {
-    // Perform an atomic copy to preserve volatile parameters during the calculations
-    ATOMIC_START
-      prev_id = prev->id;
-      prev_F = prev->endpoint.F;
-      prev_F_start_in_steps = prev->start_steps;
-      prev_F_end_in_steps = prev->end_steps;
-      prev_rampup = prev->rampup_steps;
-      prev_rampdown = prev->rampdown_steps;
-      prev_total_steps = prev->total_steps;
-      crossF = current->crossF;
-      this_id = current->id;
-      this_F = current->endpoint.F;
-      this_total_steps = current->total_steps;
-    ATOMIC_END
-
-    // Here we have to distinguish between feedrate along the movement
-    // direction and feedrate of the fast axis. They can differ by a factor
-    // of 2.
-    // Along direction: F, crossF.
-    // Along fast axis already: start_steps, end_steps.
-    //
-    // All calculations here are done along the fast axis, so recalculate
-    // F and crossF to match this, too.
-    prev_F = muldiv(prev->fast_um, prev_F, prev->distance);
-    this_F = muldiv(current->fast_um, current->endpoint.F, current->distance);
-    crossF = muldiv(current->fast_um, crossF, current->distance);
-
-    // TODO: calculate the steps from the fastest axis and not from X.
-    prev_F_in_steps = ACCELERATE_RAMP_LEN(prev_F);
-    this_F_in_steps = ACCELERATE_RAMP_LEN(this_F);
-    crossF_in_steps = ACCELERATE_RAMP_LEN(crossF);
-
-    // Show the proposed crossing speed - this might get adjusted below
-    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-      sersendf_P(PSTR("Initial crossing speed: %lu\n"), crossF_in_steps);
-
-    // Compute the maximum speed we can reach for crossing.
-    crossF_in_steps = MIN(crossF_in_steps, this_total_steps);
-    crossF_in_steps = MIN(crossF_in_steps, prev_total_steps + prev_F_start_in_steps);
-
-    if (crossF_in_steps == 0)
-      return;
+  // Collect the chain of moves to recalculate, latest first. The current
+  // move gets queued right after the last one in the queue.
+  window = queue_window_open();
+  plan[0].dda = current;
+  count = 1;
+  for (back = 0; count < MOVEBUFFER_SIZE; back++) {
+    DDA *dda = queue_peek_pending(back);
+
+    if ( ! dda || dda->waitfor_temp || dda->dwell)
+      break;
+    // Null moves pass through at speed, see dda_create().
+    if (dda->nullmove)
+      continue;
+    plan[count].dda = dda;
+    count++;
+
+    if (dda->crossF == 0 || dda->startF == dda->crossF)
+      break;
+  }
 
-    // Build ramps for previous move.
-    if (crossF_in_steps == prev_F_in_steps) {
-      prev_rampup = prev_F_in_steps - prev_F_start_in_steps;
-      prev_rampdown = 0;
-    }
-    else if (crossF_in_steps < prev_F_start_in_steps) {
-      uint32_t extra, limit;
+  // Previous move is running already or not joinable.
+  if (count < 2)
+    return;
 
-      prev_rampup = 0;
-      prev_rampdown = prev_F_start_in_steps - crossF_in_steps;
-      extra = (prev_total_steps - prev_rampdown) >> 1;
-      limit = prev_F_in_steps - prev_F_start_in_steps;
-      extra = MIN(extra, limit);
+  // Reverse pass. Current move ends with a full stop.
+  plan[0].exit_F2 = 0;
+  for (j = 0; j < count; j++) {
+    plan[j].speed_change = lookahead_speed_change(plan[j].dda);
+    if (j == count - 1)
+      break;
+
+    entry_F2 = plan[j].exit_F2 + plan[j].speed_change;
+    if (entry_F2 < plan[j].exit_F2)
+      entry_F2 = 0xFFFFFFFF;
+    limit = (uint32_t)plan[j].dda->crossF * plan[j].dda->crossF;
+    plan[j + 1].exit_F2 = MIN(entry_F2, limit);
+  }
 
-      prev_rampup += extra;
-      prev_rampdown += extra;
+  // Forward pass, building ramps on the way. Entry speed of the first move
+  // in the chain stays as it is.
+  entry_F2 = (uint32_t)plan[count - 1].dda->startF *
+             plan[count - 1].dda->startF;
+  j = count;
+  do {
+    DDA *dda;
+    uint32_t exit_F2, F_in_steps, up, down;
+
+    j--;
+    dda = plan[j].dda;
+
+    exit_F2 = entry_F2 + plan[j].speed_change;
+    if (exit_F2 < entry_F2)
+      exit_F2 = 0xFFFFFFFF;
+    exit_F2 = MIN(exit_F2, plan[j].exit_F2);
+
+    plan[j].startF = int_sqrt(entry_F2);
+    plan[j].start_steps = lookahead_ramp_len(dda, plan[j].startF);
+    plan[j].end_steps = lookahead_ramp_len(dda, int_sqrt(exit_F2));
+    F_in_steps = lookahead_ramp_len(dda, dda->endpoint.F);
+
+    // Trapezoid, or triangle if the move is too short to reach full speed.
+    up = F_in_steps > plan[j].start_steps ?
+         F_in_steps - plan[j].start_steps : 0;
+    down = F_in_steps > plan[j].end_steps ?
+           F_in_steps - plan[j].end_steps : 0;
+    if (up + down > dda->total_steps) {
+      if (plan[j].end_steps + dda->total_steps > plan[j].start_steps)
+        up = (plan[j].end_steps + dda->total_steps -
+              plan[j].start_steps) >> 1;
+      else
+        up = 0;
+      up = MIN(up, dda->total_steps);
+      down = dda->total_steps - up;
     }
-    else {
-      uint32_t extra, limit;
+    plan[j].rampup = up;
+    plan[j].rampdown = dda->total_steps - down;
 
-      prev_rampup = crossF_in_steps - prev_F_start_in_steps;
-      prev_rampdown = 0;
-      extra = (prev_total_steps - prev_rampup) >> 1;
-      limit = prev_F_in_steps - crossF_in_steps;
-      extra = MIN(extra, limit);
+    if (plan[j].start_steps == 0)
+      plan[j].c = dda->c0;
+    else
+      plan[j].c = int_div_sqrt(dda->c0, plan[j].start_steps) >> 1;
+    if (plan[j].c < dda->c_min)
+      plan[j].c = dda->c_min;
 
-      prev_rampup += extra;
-      prev_rampdown += extra;
-    }
-    prev_rampdown = prev_total_steps - prev_rampdown;
-    prev_F_end_in_steps = crossF_in_steps;
-
-    // Build ramps for current move.
-    if (crossF_in_steps == this_F_in_steps) {
-      this_rampup = 0;
-      this_rampdown = crossF_in_steps;
+    trace(TRACE_PLAN, dda->id, plan[j].end_steps);
+    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
+      sersendf_P(PSTR("Plan %u: start %lu  up %lu  down %lu  end %lu\n"),
+                 dda->id, plan[j].start_steps, plan[j].rampup,
+                 plan[j].rampdown, plan[j].end_steps);
+
+    entry_F2 = exit_F2;
+  } while (j);
+
+  uint8_t timeout = 0;
+
+  ATOMIC_START
+    // Evaluation: determine how we did...
+
+    // Determine if we are fast enough - if not, just leave the moves
+    // Note: no move started since we collected the chain means all of them
+    // are still pending. Plans are consistent only as a whole, so it's all
+    // or nothing.
+    if (queue_window_intact(window)) {
+      for (j = 0; j < count; j++) {
+        DDA *dda = plan[j].dda;
+
+        dda->startF = plan[j].startF;
+        dda->start_steps = plan[j].start_steps;
+        dda->end_steps = plan[j].end_steps;
+        dda->rampup_steps = plan[j].rampup;
+        dda->rampdown_steps = plan[j].rampdown;
+        dda->n = plan[j].start_steps;
+        dda->c = plan[j].c;
+      }
+      queue_stats.joined++;
     }
     else {
-      this_rampup = 0;
-      this_rampdown = crossF_in_steps;
-
-      uint32_t extra = (this_total_steps - this_rampdown) >> 1;
-      uint32_t limit = this_F_in_steps - crossF_in_steps;
-      extra = MIN(extra, limit);
-
-      this_rampup += extra;
-      this_rampdown += extra;
-    }
-    this_rampdown = this_total_steps - this_rampdown;
-    this_F_start_in_steps = crossF_in_steps;
-
-    if (DEBUG_DDA && (debug_flags & DEBUG_DDA)) {
-      sersendf_P(PSTR("prev_F_start: %lu\n"), prev_F_start_in_steps);
-      sersendf_P(PSTR("prev_F: %lu\n"), prev_F_in_steps);
-      sersendf_P(PSTR("prev_rampup: %lu\n"), prev_rampup);
-      sersendf_P(PSTR("prev_rampdown: %lu\n"),
-                 prev_total_steps - prev_rampdown);
-      sersendf_P(PSTR("crossF: %lu\n"), crossF_in_steps);
-      sersendf_P(PSTR("this_rampup: %lu\n"), this_rampup);
-      sersendf_P(PSTR("this_rampdown: %lu\n"),
-                 this_total_steps - this_rampdown);
-      sersendf_P(PSTR("this_F: %lu\n"), this_F_in_steps);
+      timeout = 1;
     }
+  ATOMIC_END
 
+  // If we were not fast enough, any feedback will happen outside the atomic block:
+  if (timeout) {
+    queue_stats.timeouts++;
     #ifdef DEBUG
-      uint8_t timeout = 0;
-    #endif
-
-    ATOMIC_START
-      // Evaluation: determine how we did...
-      #ifdef DEBUG
-        lookahead_joined++;
-      #endif
-
-      // Determine if we are fast enough - if not, just leave the moves
-      // Note: to test if the previous move was already executed and replaced by a new
-      // move, we compare the DDA id.
-      if(prev->live == 0 && prev->id == prev_id && current->live == 0 && current->id == this_id) {
-        prev->end_steps = prev_F_end_in_steps;
-        prev->rampup_steps = prev_rampup;
-        prev->rampdown_steps = prev_rampdown;
-        current->rampup_steps = this_rampup;
-        current->rampdown_steps = this_rampdown;
-        current->end_steps = 0;
-        current->start_steps = this_F_start_in_steps;
-        la_cnt++;
-      }
-      #ifdef DEBUG
-        else
-          timeout = 1;
-      #endif
-    ATOMIC_END
-
-    // If we were not fast enough, any feedback will happen outside the atomic block:
-    #ifdef DEBUG
-      if (timeout) {
-        sersendf_P(PSTR("// Notice: look ahead not fast enough\n"));
-        lookahead_timeout++;
-      }
+      sersendf_P(PSTR("// Notice: look ahead not fast enough\n"));
     #endif
   }
 }
@@ -25,7 +25,8 @@
 #define MAX(a,b)  (((a)>(b))?(a):(b))
 #define MIN(a,b)  (((a)<(b))?(a):(b))
 
-void dda_find_crossing_speed(DDA *prev, DDA *current);
+void dda_find_crossing_speed(DDA *prev, DDA *current,
+                             const axes_int32_t delta_um);
 void dda_join_moves(DDA *prev, DDA *current);
 
 #endif /* LOOKAHEAD */
@@ -8,27 +8,87 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "preprocessor_math.h"
+
 /*!
-  Pre-calculated constant values for axis um <=> steps conversions.
+  Pre-calculated values for axis um <=> steps conversions.
 
-  These should be calculated at run-time once in dda_init() if the
-  STEPS_PER_M_* constants are ever replaced with run-time options.
+  Both directions are stored as fixed point quotients for mul_q32(), so
+  neither needs a division at runtime. See axes_q32_init().
 */
-const axes_uint32_t PROGMEM axis_qn_P = {
-  (uint32_t)STEPS_PER_M_X / UM_PER_METER,
-  (uint32_t)STEPS_PER_M_Y / UM_PER_METER,
-  (uint32_t)STEPS_PER_M_Z / UM_PER_METER,
-  (uint32_t)STEPS_PER_M_U / UM_PER_METER,
-  (uint32_t)STEPS_PER_M_E / UM_PER_METER
-};
+axes_uint32_t axis_qn;
+axes_uint32_t axis_qf;
+axes_uint32_t axis_um_qn;
+axes_uint32_t axis_um_qf;
+
+/// Runtime equivalent of Q32_INT() and Q32_FRAC(), see there.
+static uint32_t q32_frac(uint32_t num, uint32_t den) {
+  return (((uint64_t)(num % den) << 32) + den / 2) / den;
+}
 
-const axes_uint32_t PROGMEM axis_qr_P = {
-  (uint32_t)STEPS_PER_M_X % UM_PER_METER,
-  (uint32_t)STEPS_PER_M_Y % UM_PER_METER,
-  (uint32_t)STEPS_PER_M_Z % UM_PER_METER,
-  (uint32_t)STEPS_PER_M_U % UM_PER_METER,
-  (uint32_t)STEPS_PER_M_E % UM_PER_METER
-};
+/** Calculate conversion quotients for um_to_steps() and steps_to_um().
+
+  \param steps_per_m Motor steps per meter of each axis.
+
+  This uses 64-bit divisions, so it's meant for startup and setting changes,
+  not for the movement code.
+*/
+void axes_q32_init(const axes_uint32_t steps_per_m) {
+  enum axis_e i;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    axis_qn[i] = steps_per_m[i] / UM_PER_METER;
+    axis_qf[i] = q32_frac(steps_per_m[i], UM_PER_METER);
+    axis_um_qn[i] = UM_PER_METER / steps_per_m[i];
+    axis_um_qf[i] = q32_frac(UM_PER_METER, steps_per_m[i]);
+  }
+}
+
+/*!
+  Fixed point multiplication.
+
+  \param multiplicand Any signed number.
+  \param qn Integer part of the multiplier.
+  \param qf Fractional part of the multiplier, in 0.32 fixed point.
+
+  \return Rounded result of multiplicand * (qn + qf / 2^32).
+
+  Precalculate qn and qf with Q32_INT() and Q32_FRAC() to get a division
+  without dividing. Rounding is symmetric around zero. As qf is rounded as
+  well, results are within 0.75 of the exact quotient.
+
+  On AVR, the upper half of the 32 x 32 bit product is assembled from four
+  16 x 16 bit multiplications, which the hardware multiplier handles well,
+  instead of pulling in 64-bit arithmetics.
+*/
+const int32_t mul_q32(int32_t multiplicand, uint32_t qn, uint32_t qf) {
+  uint32_t x, result;
+  uint8_t negative = 0;
+
+  if (multiplicand < 0) {
+    negative = 1;
+    multiplicand = -multiplicand;
+  }
+  x = (uint32_t)multiplicand;
+
+  #ifdef __ARMEL__
+    result = ((uint64_t)x * qf + ((uint64_t)1 << 31)) >> 32;
+  #else
+    uint16_t xh = x >> 16, xl = x & 0xFFFF;
+    uint16_t qh = qf >> 16, ql = qf & 0xFFFF;
+    uint32_t low, mid1, mid2;
+
+    low = (uint32_t)xl * ql;
+    mid1 = (uint32_t)xh * ql + (low >> 16);
+    mid2 = (uint32_t)xl * qh + (mid1 & 0xFFFF);
+    result = (uint32_t)xh * qh + (mid1 >> 16) + (mid2 >> 16) +
+             ((mid2 >> 15) & 1);                              // rounding
+  #endif
+
+  result += x * qn;
+
+  return negative ? -(int32_t)result : (int32_t)result;
+}
 
 /*!
   Integer multiply-divide algorithm. Returns the same as muldiv(multiplicand, multiplier, divisor), but also allowing to use precalculated quotients and remainders.
@@ -43,10 +103,15 @@ const axes_uint32_t PROGMEM axis_qr_P = {
   Doing this the standard way, a * b could easily overflow, even if the correct
   overall result fits into 32 bits. This algorithm avoids this intermediate
   overflow and delivers valid results for all cases where each of the three
-  operators as well as the result fits into 32 bits.
+  operators as well as the result fits into 32 bits. On AVR, the divisor has
+  to stay below 2^31, because remainders get doubled on the way.
 
   Found on  http://stackoverflow.com/questions/4144232/
   how-to-calculate-a-times-b-divided-by-c-only-using-32-bit-integer-types-even-i
+
+  On ARM, a 32 x 32 -> 64 bit multiplication is cheap, so multiply there and
+  divide only once, in 32 bits if the product allows. This is several times
+  faster than the bit by bit loop, which is still the better choice on AVR.
 */
 const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
                        uint32_t divisor) {
@@ -59,6 +124,19 @@ const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
     multiplicand = -multiplicand;
   }
 
+#ifdef __ARMEL__
+  uint64_t product = (uint64_t)(uint32_t)multiplicand * rn;
+
+  if ((product >> 32) == 0) {
+    quotient = (uint32_t)product / divisor;
+    remainder = (uint32_t)product - quotient * divisor;
+  }
+  else {
+    quotient = product / divisor;
+    remainder = product - (uint64_t)quotient * divisor;
+  }
+  quotient += (uint32_t)multiplicand * qn;
+#else
   while(multiplicand) {
     if (multiplicand & 1) {
       quotient += qn;
@@ -76,6 +154,7 @@ const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
       rn -= divisor;
     }
   }
+#endif /* __ARMEL__ */
 
   // rounding
   if (remainder > divisor / 2)
@@ -91,6 +170,8 @@ const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
   \param dy distance in Y plane
   \return 3-part linear approximation of \f$\sqrt{\Delta x^2 + \Delta y^2}\f$
 
+  Results are between 3.1 % short and 3.9 % long, exact along a single axis.
+
   see http://www.flipcode.com/archives/Fast_Approximate_Distance_Functions.shtml
 */
 uint32_t approx_distance(uint32_t dx, uint32_t dy) {
@@ -122,6 +203,9 @@ uint32_t approx_distance(uint32_t dx, uint32_t dy) {
   \param dz distance in Z plane
   \return 3-part linear approximation of \f$\sqrt{\Delta x^2 + \Delta y^2 + \Delta z^2}\f$
 
+  Results are between 17 % short, along a single axis, and 13 % long. Use
+  int_distance() where this matters.
+
   see http://www.oroboro.com/rafael/docserv.php/index/programming/article/distance
 */
 uint32_t approx_distance_3(uint32_t dx, uint32_t dy, uint32_t dz) {
@@ -155,6 +239,45 @@ uint32_t approx_distance_3(uint32_t dx, uint32_t dy, uint32_t dz) {
   return (( approx + 512 ) >> 10 );
 }
 
+/*! exact N-axis distance formula
+  \param delta array of axis distances, all positive
+  \param count number of axes to take into account, 15 at most
+  \return \f$\sqrt{\Delta_0^2 + \Delta_1^2 + ... + \Delta_{count-1}^2}\f$
+
+  Moves along a single axis are most common on an arm, so these are returned
+  directly. Else all distances get scaled down to 14 bits, which keeps the
+  sum of squares within 32 bits and allows to use int_sqrt(). Results are
+  accurate to a micrometer up to 16 mm, above that to better than 1/5000.
+*/
+uint32_t int_distance(const uint32_t *delta, uint8_t count) {
+  uint32_t max = 0, sum = 0, round;
+  uint8_t i, shift = 0, nonzero = 0;
+
+  for (i = 0; i < count; i++) {
+    if (delta[i]) {
+      nonzero++;
+      if (delta[i] > max)
+        max = delta[i];
+    }
+  }
+  if (nonzero <= 1)
+    return max;
+
+  while (max > 0x3FFF) {
+    max >>= 1;
+    shift++;
+  }
+  round = shift ? (1UL << (shift - 1)) : 0;
+
+  for (i = 0; i < count; i++) {
+    uint16_t d = (delta[i] + round) >> shift;
+
+    sum += (uint32_t)d * d;
+  }
+
+  return (uint32_t)int_sqrt(sum) << shift;
+}
+
 /*!
   integer square root algorithm
   \param a find square root of this number
@@ -203,75 +326,231 @@ uint16_t int_sqrt(uint32_t a) {
   return x;
 }
 
+/// \var inv_sqrt_table_P
+/// \brief 2^22 / sqrt(m) for m = 16384 to 65536 in steps of 1024, the
+///        nodes int_div_sqrt() interpolates between.
+static const uint16_t PROGMEM inv_sqrt_table_P[49] = {
+  32768, 31790, 30894, 30070, 29309, 28602, 27945, 27330,
+  26755, 26214, 25705, 25225, 24770, 24339, 23930, 23541,
+  23170, 22817, 22479, 22155, 21845, 21548, 21263, 20988,
+  20724, 20470, 20225, 19988, 19760, 19539, 19326, 19119,
+  18919, 18725, 18536, 18354, 18176, 18004, 17837, 17674,
+  17515, 17361, 17211, 17064, 16921, 16782, 16646, 16514,
+  16384
+};
+
 /*!
-  integer inverse square root algorithm
-  \param a find the inverse of the square root of this number
-  \return 0x1000 / sqrt(a) - 1 < returnvalue <= 0x1000 / sqrt(a)
+  integer division by a square root
+  \param c dividend
+  \param a find the square root of this number to divide by
+  \return c / sqrt(a), c for a = 0. Interpolation makes this up to 0.041
+          percent high, then it gets rounded down, so small results can
+          also be one less than the exact value.
+
+  For acceleration ramps, c0 / (2 * sqrt(n)) is int_div_sqrt(c0, n) >> 1,
+  for any ramp length n. dda_clock() does this every tick of a ramp.
+
+  a gets normalized to m * 4^s, with m in [2^14, 2^16), so the table nodes
+  are spaced logarithmically across the range of a. Linear interpolation
+  between the two nodes around m gives 1 / sqrt(m), two table reads and a
+  16 x 16 -> 32 bit multiplication, no division.
+*/
+uint32_t int_div_sqrt(uint32_t c, uint32_t a) {
+  int8_t s = 0;
+  uint8_t shift, i;
+  uint16_t m, y, d;
+  uint32_t hi, lo;
+
+  if (a == 0)
+    return c;
+
+  while (a >= (1UL << 16)) {
+    a >>= 2;
+    s++;
+  }
+  while (a < (1UL << 14)) {
+    a <<= 2;
+    s--;
+  }
+  m = a;
+
+  // y is 2^22 / sqrt(m), 1.15 fixed point of 1 / sqrt(m / 2^14).
+  i = (m >> 10) - 16;
+  y = pgm_read_word(&inv_sqrt_table_P[i]);
+  d = y - pgm_read_word(&inv_sqrt_table_P[i + 1]);
+  y -= ((uint32_t)d * (m & 1023)) >> 10;
+
+  // c / sqrt(a) = c * y / 2^(22 + s), c * y takes up to 48 bits.
+  shift = 22 + s;
+  hi = (c >> 16) * y;
+  lo = (c & 0xFFFF) * y;
+  if (shift >= 16)
+    return (hi + (lo >> 16)) >> (shift - 16);
+  else
+    return (hi << (16 - shift)) + (lo >> shift);
+}
+
+/// \var atan_table_P
+/// \brief atan(i / 64) for i = 0 to 64, in units of 1/262144 of a full turn.
+///        Covers the first octant, everything else is mirrored.
+static const uint16_t PROGMEM atan_table_P[65] = {
+      0,   652,  1303,  1954,  2604,  3253,  3900,  4545,  5188,  5829,
+   6467,  7101,  7733,  8361,  8985,  9605, 10221, 10832, 11439, 12040,
+  12637, 13228, 13814, 14394, 14968, 15537, 16100, 16656, 17206, 17750,
+  18288, 18819, 19344, 19862, 20374, 20879, 21378, 21870, 22355, 22834,
+  23306, 23771, 24230, 24682, 25128, 25568, 26001, 26427, 26848, 27262,
+  27670, 28072, 28467, 28857, 29241, 29619, 29991, 30357, 30718, 31073,
+  31423, 31767, 32106, 32439, 32768
+};
+
+/*! integer atan2 algorithm
+  \param y ordinate, any unit
+  \param x abscissa, same unit as y
+  \return angle of the vector (x, y) against the positive x axis, in
+          millidegrees, -180000 <= returnvalue <= 180000
 
-  This is a binary search but it uses only the minimum required bits for each step.
+  Table lookup in the first octant with linear interpolation, results are
+  within about 0.005 degrees of the exact value. Costs a single 32-bit
+  division, so it's cheap enough for dda_create().
 */
-uint16_t int_inv_sqrt(uint16_t a) {
-  /// 16bits inverse (much faster than doing a full 32bits inverse)
-  /// the 0xFFFFU instead of 0x10000UL hack allows using 16bits and 8bits
-  /// variable for the first 8 steps without overflowing and it seems to
-  /// give better results for the ramping equation too :)
-  uint8_t z = 0, i;
-  uint16_t x, j;
-  uint32_t q = ((uint32_t)(0xFFFFU / a)) << 8;
-
-  for (i = 0x80; i; i >>= 1) {
-    uint16_t y;
-
-    z |= i;
-    y = (uint16_t)z * z;
-    if (y > (q >> 8))
-      z ^= i;
+int32_t int_atan2(int32_t y, int32_t x) {
+  uint32_t ax, ay, small, big, ratio;
+  uint16_t a0, a1;
+  uint8_t idx;
+  int32_t angle;
+
+  ax = (x < 0) ? -x : x;
+  ay = (y < 0) ? -y : y;
+  if (ax == 0 && ay == 0)
+    return 0;
+
+  if (ay <= ax) {
+    small = ay;
+    big = ax;
+  } else {
+    small = ax;
+    big = ay;
   }
 
-  x = z << 4;
-  for (j = 0x8; j; j >>= 1) {
-    uint32_t y;
+  // Keep small << 16 within 32 bits.
+  while (big > 0xFFFF) {
+    big >>= 1;
+    small >>= 1;
+  }
 
-    x |= j;
-    y = (uint32_t)x * x;
-    if (y > q)
-      x ^= j;
+  // Ratio in 0.16 fixed point, upper 6 bits index, lower 10 bits interpolate.
+  ratio = (small << 16) / big;
+  idx = ratio >> 10;
+  a0 = pgm_read_word(&atan_table_P[idx]);
+  if (idx < 64) {
+    a1 = pgm_read_word(&atan_table_P[idx + 1]);
+    a0 += ((uint32_t)(a1 - a0) * (ratio & 0x3FF) + 512) >> 10;
   }
 
-  return x;
+  // Mirror into the other octants. 65536 = 90 deg, 131072 = 180 deg.
+  angle = a0;
+  if (ay > ax)
+    angle = 65536 - angle;
+  if (x < 0)
+    angle = 131072 - angle;
+  if (y < 0)
+    angle = -angle;
+
+  // To millidegrees: 360000 / 262144 = 5625 / 4096.
+  return (angle * 5625 + 2048) >> 12;
 }
 
-// this is an ultra-crude pseudo-logarithm routine, such that:
-// 2 ^ msbloc(v) >= v
-/*! crude logarithm algorithm
-  \param v value to find \f$log_2\f$ of
-  \return floor(log(v) / log(2))
+/// \var sin_table_P
+/// \brief sin(i * 90 deg / 64) for i = 0 to 64, 2.14 fixed point. Covers the
+///        first quadrant, everything else is mirrored.
+static const uint16_t PROGMEM sin_table_P[65] = {
+      0,   402,   804,  1205,  1606,  2006,  2404,  2801,  3196,  3590,
+   3981,  4370,  4756,  5139,  5520,  5897,  6270,  6639,  7005,  7366,
+   7723,  8076,  8423,  8765,  9102,  9434,  9760, 10080, 10394, 10702,
+  11003, 11297, 11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+  13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978, 15137, 15286,
+  15426, 15557, 15679, 15791, 15893, 15986, 16069, 16143, 16207, 16261,
+  16305, 16340, 16364, 16379, 16384
+};
+
+/*! integer sine algorithm
+  \param angle angle in millidegrees, any value
+  \return sine of the angle, 2.14 fixed point, -16384 <= returnvalue <= 16384
+
+  Table lookup in the first quadrant with linear interpolation, results are
+  within 1.9/16384 of the exact value, measured over 4 full turns in steps
+  of a millidegree. Use int_sin(angle + 90000) for the cosine.
 */
-const uint8_t msbloc (uint32_t v) {
-  uint8_t i;
-  uint32_t c;
-  for (i = 31, c = 0x80000000; i; i--) {
-    if (v & c)
-      return i;
-    c >>= 1;
+int32_t int_sin(int32_t angle) {
+  uint32_t pos, frac;
+  uint16_t s0, s1;
+  uint8_t idx, negative = 0;
+
+  angle %= 360000;
+  if (angle < 0)
+    angle += 360000;
+  if (angle >= 180000) {
+    angle -= 180000;
+    negative = 1;
+  }
+  if (angle > 90000)
+    angle = 180000 - angle;
+
+  // 90000 millidegrees are 64 table steps.
+  pos = (uint32_t)angle * 64;
+  idx = pos / 90000;
+  frac = pos - (uint32_t)idx * 90000;
+  s0 = pgm_read_word(&sin_table_P[idx]);
+  if (idx < 64) {
+    s1 = pgm_read_word(&sin_table_P[idx + 1]);
+    s0 += ((s1 - s0) * frac + 45000) / 90000;
   }
-  return 0;
+
+  return negative ? -(int32_t)s0 : s0;
 }
 
 /*! Acceleration ramp length in steps.
- * \param feedrate Target feedrate of the accelerateion.
- * \param steps_per_m Steps/m of the axis.
- * \return Accelerating steps neccessary to achieve target feedrate.
+ * \param speed Target speed of the acceleration, um/s.
+ * \param axis The axis accelerating.
+ * \param acceleration Acceleration of the axis, mm/s^2.
+ * \return Accelerating steps neccessary to achieve target speed.
  *
  * s = 1/2 * a * t^2, v = a * t ==> s = v^2 / (2 * a)
- * 7200000 = 60 * 60 * 1000 * 2 (mm/min -> mm/s, steps/m -> steps/mm, factor 2)
  *
- * Note: this function has shown to be accurate between 10 and 10'000 mm/s2 and
- *       2000 to 4096000 steps/m (and higher). The numbers are a few percent
- *       too high at very low acceleration. Test code see commit message.
+ * Both v and a get converted to steps first, with the fixed point quotients
+ * of um_to_steps(), so no division by large steps/m values loses precision.
+ * Up to 40960 steps/mm, 1092 mm/s and 10'000 mm/s^2 all fit into 32 bits.
  */
-uint32_t acc_ramp_len(uint32_t feedrate, uint32_t steps_per_m) {
-  return (feedrate * feedrate) /
-         (((uint32_t)7200000UL * ACCELERATION) / steps_per_m);
+uint32_t acc_ramp_len(uint32_t speed, enum axis_e axis,
+                      uint32_t acceleration) {
+  uint32_t v, a;
+
+  v = um_to_steps(speed, axis);
+  a = um_to_steps(acceleration * 1000, axis);
+  if (a == 0)
+    a = 1;
+
+  // Saturate, a ramp this long exceeds any move anyways.
+  if (v > 46340 && v / (2 * a) >= 0x7FFFFFFFUL / v)
+    return 0x7FFFFFFFUL;
+
+  return muldiv(v, v, 2 * a);
 }
 
+/*! S-curve shape of an acceleration ramp.
+ * \param x Steps done on this ramp.
+ * \param length Total length of the ramp in steps.
+ * \return Equivalent number of steps of a constant acceleration ramp.
+ *
+ * Constant acceleration means n = x. Here n follows the smoothstep polynomial
+ * n = length * (3 * t^2 - 2 * t^3) with t = x / length instead, so
+ * acceleration rises from zero at the start of the ramp to 1.5 times the
+ * average in the middle and goes back to zero at its end. This limits jerk.
+ * Written as x^2 * (3 * length - 2 * x) / length^2 to stay within 32 bits.
+ */
+uint32_t scurve_ramp(uint32_t x, uint32_t length) {
+  if (x >= length)
+    return length;
+
+  return muldiv(muldiv(x, x, length), 3 * length - 2 * x, length);
+}
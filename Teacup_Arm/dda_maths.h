@@ -11,6 +11,9 @@
 const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
                        uint32_t divisor);
 
+// return rounded result of multiplicand * (qn + qf / 2^32)
+const int32_t mul_q32(int32_t multiplicand, uint32_t qn, uint32_t qf);
+
 // return rounded result of multiplicand * multiplier / divisor
 static int32_t muldiv(int32_t, uint32_t, uint32_t) __attribute__ ((always_inline));
 inline int32_t muldiv(int32_t multiplicand, uint32_t multiplier,
@@ -25,13 +28,21 @@ inline int32_t muldiv(int32_t multiplicand, uint32_t multiplier,
 
 #define UM_PER_METER (1000000UL)
 
-extern const axes_uint32_t PROGMEM axis_qn_P;
-extern const axes_uint32_t PROGMEM axis_qr_P;
+extern axes_uint32_t axis_qn;
+extern axes_uint32_t axis_qf;
+extern axes_uint32_t axis_um_qn;
+extern axes_uint32_t axis_um_qf;
+
+void axes_q32_init(const axes_uint32_t steps_per_m);
 
 static int32_t um_to_steps(int32_t, enum axis_e) __attribute__ ((always_inline));
 inline int32_t um_to_steps(int32_t distance, enum axis_e a) {
-  return muldivQR(distance, pgm_read_dword(&axis_qn_P[a]),
-                  pgm_read_dword(&axis_qr_P[a]), UM_PER_METER);
+  return mul_q32(distance, axis_qn[a], axis_qf[a]);
+}
+
+static int32_t steps_to_um(int32_t, enum axis_e) __attribute__ ((always_inline));
+inline int32_t steps_to_um(int32_t steps, enum axis_e a) {
+  return mul_q32(steps, axis_um_qn[a], axis_um_qf[a]);
 }
 
 // approximate 2D distance
@@ -40,20 +51,26 @@ uint32_t approx_distance(uint32_t dx, uint32_t dy);
 // approximate 3D distance
 uint32_t approx_distance_3(uint32_t dx, uint32_t dy, uint32_t dz);
 
+// exact distance over count axes
+uint32_t int_distance(const uint32_t *delta, uint8_t count);
+
 // integer square root algorithm
 uint16_t int_sqrt(uint32_t a);
 
-// integer inverse square root, 12bits precision
-uint16_t int_inv_sqrt(uint16_t a);
+// integer atan2, result in millidegrees
+int32_t int_atan2(int32_t y, int32_t x);
 
-// this is an ultra-crude pseudo-logarithm routine, such that:
-// 2 ^ msbloc(v) >= v
-const uint8_t msbloc (uint32_t v);
+// integer sine of millidegrees, 2.14 fixed point result
+int32_t int_sin(int32_t angle);
 
-// Calculates acceleration ramp length in steps.
-uint32_t acc_ramp_len(uint32_t feedrate, uint32_t steps_per_m);
+// integer division by a square root, 0.04 percent precision
+uint32_t int_div_sqrt(uint32_t c, uint32_t a);
 
-// For X axis only, should become obsolete:
-#define ACCELERATE_RAMP_LEN(speed) (((speed)*(speed)) / (uint32_t)((7200000.0f * ACCELERATION) / (float)STEPS_PER_M_X))
+// S-curve shape of an acceleration ramp.
+uint32_t scurve_ramp(uint32_t x, uint32_t length);
+
+// Calculates acceleration ramp length in steps.
+uint32_t acc_ramp_len(uint32_t speed, enum axis_e axis,
+                      uint32_t acceleration);
 
 #endif	/* _DDA_MATHS_H */
@@ -5,16 +5,27 @@
 */
 
 #include	<string.h>
+#include	<stdlib.h>
+#include	<stddef.h>
 
 #include	"config_wrapper.h"
 #include	"timer.h"
 #include	"serial.h"
 #include	"temp.h"
-#include	"delay.h"
+#include	"heater.h"
 #include	"sersendf.h"
 #include	"clock.h"
 #include "cpu.h"
 #include	"memory_barrier.h"
+#include	"dda_kinematics.h"
+#include	"dda_maths.h"
+#include "profile.h"
+#include	"crc.h"
+#include	"pinio.h"
+
+#if defined MOTION_MACRO && defined EECONFIG && ! defined SIMULATOR
+  #include <avr/eeprom.h>
+#endif
 
 /// movebuffer head pointer. Points to the last move in the queue.
 /// this variable is used both in and out of interrupts, but is
@@ -34,76 +45,420 @@ uint8_t	mb_tail = 0;
 /// The size does not need to be a power of 2 anymore!
 DDA BSS movebuffer[MOVEBUFFER_SIZE];
 
+/// movement statistics, see queue_stats_print()
+QUEUE_STATS queue_stats = { .min_crossF = 0xFFFF };
+
 /// Find the next DDA index after 'x', where 0 <= x < MOVEBUFFER_SIZE
 #define MB_NEXT(x) ((x) < MOVEBUFFER_SIZE - 1 ? (x) + 1 : 0)
 
+/// Moves started so far, wrapping, see queue_window_open().
+static volatile uint8_t queue_dispatches = 0;
+
+/// Time of the last underrun for telling stalls from job ends, 0 = none.
+static uint32_t underrun_time = 0;
+
+#ifdef BENCHMARK
+/// Moves get planned, but not started, see queue_dry_run().
+static uint8_t dry_run = 0;
+
+/// Count the oldest move as done, without running it.
+static void queue_retire(void) {
+  uint8_t t = MB_NEXT(mb_tail);
+
+  movebuffer[t].done = 1;
+  mb_tail = t;
+  queue_dispatches++;
+}
+#endif
+
+/// Count the current queue depth in the histogram, see QUEUE_STATS.
+/// Call it with interrupts off or from the step interrupt.
+static void queue_stats_depth(void) {
+  uint8_t depth = mb_head >= mb_tail ? mb_head - mb_tail :
+                  mb_head + MOVEBUFFER_SIZE - mb_tail;
+
+  if (queue_stats.depth[depth] < 0xFFFF)
+    queue_stats.depth[depth]++;
+}
+
 /// check if the queue is completely full
 uint8_t queue_full() {
 	MEMORY_BARRIER();
   return MB_NEXT(mb_head) == mb_tail;
 }
 
+/// wait for room in the queue, accounted in loop_stats
+static void queue_wait_room(void) {
+  uint32_t start;
+
+  #ifdef BENCHMARK
+    if (dry_run && queue_full()) {
+      queue_retire();
+      return;
+    }
+  #endif
+  if (queue_full()) {
+    start = timer_read();
+    while (queue_full()) {
+      clock();
+      cpu_idle();
+    }
+    loop_stats_add(LOOP_QUEUE_WAIT, timer_read() - start);
+  }
+}
+
 /// check if the queue is completely empty
+///
+/// Lock free. Only the step interrupt advances mb_tail, towards mb_head only,
+/// and it clears live only when a move ends. Once mb_tail equals mb_head and
+/// live is cleared, nothing but a new move from outside interrupts changes
+/// this. So reading mb_tail before live can't see an empty queue which isn't.
+/// The step interrupt runs to completion, so its readers see either all or
+/// nothing of a move being started.
 uint8_t queue_empty() {
-  uint8_t result;
+  uint8_t tail;
 
-  ATOMIC_START
-    result = (mb_tail == mb_head && movebuffer[mb_tail].live == 0);
-  ATOMIC_END
+  MEMORY_BARRIER();
+  tail = mb_tail;
+  MEMORY_BARRIER();
 
-	return result;
+  return tail == mb_head && movebuffer[tail].live == 0;
 }
 
 /// Return the current movement, or NULL, if there's no movement going on.
+/// Lock free like queue_empty(). The move returned may end right after, as
+/// with any answer here.
 DDA *queue_current_movement() {
   DDA* current;
 
-  ATOMIC_START
-    current = &movebuffer[mb_tail];
+  MEMORY_BARRIER();
+  current = &movebuffer[mb_tail];
+  MEMORY_BARRIER();
 
-    if ( ! current->live || current->waitfor_temp || current->nullmove)
-      current = NULL;
-  ATOMIC_END
+  if ( ! current->live || current->waitfor_temp || current->dwell ||
+      current->nullmove)
+    current = NULL;
 
   return current;
 }
 
+/** Look back into the queue.
+
+  \param n How many moves to look back, 0 is the move queued last.
+
+  \return The move, or NULL if the queue doesn't hold that many.
+
+  For use outside interrupts, by code creating moves, so mb_head can't
+  change meanwhile. The oldest move returned is the one at mb_tail, which is
+  running or already done. The step interrupt can start or end moves any
+  time, so check flags of the move before relying on them, see
+  queue_peek_pending().
+*/
+DDA *queue_peek_back(uint8_t n) {
+  uint8_t tail, depth;
+
+  MEMORY_BARRIER();
+  tail = mb_tail;
+  depth = mb_head >= tail ? mb_head - tail : mb_head + MOVEBUFFER_SIZE - tail;
+  if (n > depth)
+    return NULL;
+
+  return &movebuffer[mb_head >= n ? mb_head - n : mb_head + MOVEBUFFER_SIZE - n];
+}
+
+/** Look back into the not yet started part of the queue.
+
+  \param n How many moves to look back, 0 is the move queued last.
+
+  \return The move, or NULL if it's started or done already, or beyond the
+          queue.
+
+  Walking n up from 0 iterates pending moves, latest first, until NULL. A
+  move returned can still get started right after. Code changing it has to
+  open a window before looking, see queue_window_open().
+*/
+DDA *queue_peek_pending(uint8_t n) {
+  DDA *dda = queue_peek_back(n);
+
+  if (dda && (dda->live || dda->done))
+    dda = NULL;
+
+  return dda;
+}
+
+/** Lock pending moves against being started, optimistically.
+
+  \return A window, to be checked with queue_window_intact().
+
+  The step interrupt can't wait for anybody without stopping the machine
+  dead, so this doesn't keep it from starting moves. Instead, open a window
+  before looking at pending moves, calculate, then commit changes with
+  interrupts disabled, only if queue_window_intact() tells no move got
+  started meanwhile:
+
+    window = queue_window_open();
+    for (n = 0; (dda = queue_peek_pending(n)); n++)
+      ... calculate ...
+    ATOMIC_START
+      if (queue_window_intact(window))
+        ... write to the moves ...
+    ATOMIC_END
+
+  Moves looked at as pending are still pending then. This works as long as
+  fewer than 256 moves get started during the calculation.
+*/
+uint8_t queue_window_open() {
+  MEMORY_BARRIER();
+  return queue_dispatches;
+}
+
+/** Tell whether no move got started since the window was opened.
+
+  \param window The window, see queue_window_open().
+
+  Call it with interrupts disabled, together with committing the changes.
+*/
+uint8_t queue_window_intact(uint8_t window) {
+  MEMORY_BARRIER();
+  return queue_dispatches == window;
+}
+
+#ifdef SYNC_PIN
+/** \def SYNC_POLL_TIME
+  How often a node at a barrier looks at the sync line, in CPU ticks. This
+  is the timing jitter between nodes.
+*/
+#define SYNC_POLL_TIME (100 US)
+
+/** \def SYNC_HOLD_TIME
+  How long a node keeps the sync line released after it saw all nodes at
+  the barrier, in CPU ticks, so slower polling nodes see it, too. Much
+  longer than SYNC_POLL_TIME.
+*/
+#define SYNC_HOLD_TIME (1 MS)
+
+/// Pull the sync line low, this node isn't at a barrier.
+static void sync_pull(void) {
+  WRITE(SYNC_PIN, 0);
+  SET_OUTPUT(SYNC_PIN);
+}
+
+/// Release the sync line, it goes high as soon as all nodes release it.
+static void sync_release(void) {
+  SET_INPUT(SYNC_PIN);
+  PULLUP_ON(SYNC_PIN);
+}
+
+/** Wait at a sync barrier.
+
+  The sync line is wired-AND: each node pulls it low, except while it's at a
+  barrier. The line going high means all nodes reached their barrier. Each
+  node then waits SYNC_HOLD_TIME, pulls the line low again and starts the
+  moves queued after the barrier. So all nodes start within SYNC_POLL_TIME.
+
+  Runs on the step timer like a dwell. dda->c is 0 while waiting for the
+  line, 1 during the hold time.
+*/
+static void queue_sync(DDA *dda) {
+  if (dda->c == 0) {
+    sync_release();
+    if (READ(SYNC_PIN)) {
+      dda->c = 1;
+      timer_set(SYNC_HOLD_TIME, 0);
+    }
+    else {
+      timer_set(SYNC_POLL_TIME, 0);
+    }
+    return;
+  }
+
+  sync_pull();
+  dda->live = dda->done = 0;
+}
+#endif /* SYNC_PIN */
+
+/** Sleep for the next part of a dwell, or end it.
+
+  Parts are a second at most, so the timer delay fits into int32_t on ARM's
+  48 MHz as well. dda->c counts down the milliseconds left.
+*/
+static void queue_dwell(DDA *dda) {
+  uint16_t ms = dda->c;
+
+  #ifdef SYNC_PIN
+    if (dda->sync) {
+      queue_sync(dda);
+      return;
+    }
+  #endif
+
+  if (ms == 0) {
+    dda->live = dda->done = 0;
+    return;
+  }
+  if (ms > 1000)
+    ms = 1000;
+  dda->c -= ms;
+  timer_set((uint32_t)ms MS, 0);
+}
+
+/** Release a queue waiting for temperatures.
+
+  Called every 10 ms from clock.c, right after temp_sensor_tick() updated
+  temp_achieved(), so movement goes on in the very tick temperatures are
+  reached. While waiting, the step timer is off, see next_move(), so this
+  can't race with the step interrupt; releasing starts the queue the same way
+  queue_publish() starts a dead one. Also reports temperatures every
+  HEATER_WAIT_REPORT ticks.
+*/
+void queue_temp_wait_tick() {
+  static uint8_t wait_ticks = 0;
+  DDA *current = &movebuffer[mb_tail];
+
+  if ( ! current->live || ! current->waitfor_temp)
+    return;
+
+  if ( ! temp_achieved()) {
+    if (++wait_ticks >= HEATER_WAIT_REPORT) {
+      wait_ticks = 0;
+      temp_print(TEMP_SENSOR_none);
+    }
+    return;
+  }
+
+  wait_ticks = 0;
+  current->live = current->done = 0;
+  serial_writestr_P(PSTR("Temp achieved\n"));
+
+  timer_reset();
+  next_move();
+  event_post(EVENT_QUEUE);
+  // Compensate for the cli() in timer_set().
+  sei();
+}
+
 // -------------------------------------------------------
 // This is the one function called by the timer interrupt.
 // It calls a few other functions, though.
 // -------------------------------------------------------
 /// Take a step or go to the next move.
 void queue_step() {
-	// do our next step
+  DDA* current_movebuffer;
+
+  do {
+    // do our next step
+    current_movebuffer = &movebuffer[mb_tail];
+    if (current_movebuffer->live) {
+      // Waits for temperatures end in queue_temp_wait_tick().
+      if (current_movebuffer->waitfor_temp)
+        return;
+      if (current_movebuffer->dwell)
+        queue_dwell(current_movebuffer);
+      else
+        dda_step(current_movebuffer);
+    }
+
+    if (current_movebuffer->live) {
+      #ifdef STEP_RATE_GUARD
+        // The next step is due already and would wait for a full round of
+        // the timer. Slow down, then do it right away.
+        if (timer_missed()) {
+          dda_overload(current_movebuffer);
+          continue;
+        }
+      #endif
+      return;
+    }
+
+    // Start the next move if this one is done.
+    next_move();
+    event_post(EVENT_QUEUE);
+    queue_stats_depth();
+    if (movebuffer[mb_tail].live == 0) {
+      queue_stats.underruns++;
+      underrun_time = timer_read() | 1;
+    }
+
+    // The first step of the next move is timed from the last step of this
+    // one, so joined moves keep their step rhythm across the move boundary.
+    // Getting the next move going can take longer than this first step
+    // interval, then the step is due already and gets done right here.
+  } while (timer_missed());
+}
+
+#ifdef TEMPORAL_MATCH_CHANNELS
+/** Take the next step on one timer match channel.
+
+  Like queue_step(), for the step interrupt of a single match channel.
+  Waiting for temperatures runs on channel 0 only and goes through
+  queue_step(). A channel firing after the move ended gets stopped.
+*/
+void queue_step_channel(uint8_t ch) {
 	DDA* current_movebuffer = &movebuffer[mb_tail];
 	if (current_movebuffer->live) {
-		if (current_movebuffer->waitfor_temp) {
-      timer_set(HEATER_WAIT_TIMEOUT, 0);
-			if (temp_achieved()) {
-				current_movebuffer->live = current_movebuffer->done = 0;
-				serial_writestr_P(PSTR("Temp achieved\n"));
-			}
-      else {
-        temp_print(TEMP_SENSOR_none);
-      }
-		}
-		else {
-			dda_step(current_movebuffer);
+		if (current_movebuffer->waitfor_temp || current_movebuffer->dwell) {
+			queue_step();
+			return;
 		}
+		dda_step_channel(current_movebuffer, ch);
+	}
+	else {
+		timer_channel_stop(ch);
 	}
 
   // Start the next move if this one is done.
-	if (current_movebuffer->live == 0)
+	if (current_movebuffer->live == 0) {
 		next_move();
+    event_post(EVENT_QUEUE);
+    queue_stats_depth();
+    if (movebuffer[mb_tail].live == 0) {
+      queue_stats.underruns++;
+      underrun_time = timer_read() | 1;
+    }
+  }
 }
+#endif
 
-/// add a move to the movebuffer
+/// hand a filled movebuffer entry to the step interrupt, starting it if idle
+static void queue_publish(uint8_t h) {
+	// make certain all writes to global memory
+	// are flushed before modifying mb_head.
+	MEMORY_BARRIER();
+
+	mb_head = h;
+
+  #ifdef BENCHMARK
+    if (dry_run)
+      return;
+  #endif
+
+  uint8_t isdead;
+
+  ATOMIC_START
+    isdead = (movebuffer[mb_tail].live == 0);
+    queue_stats_depth();
+    // Starting over shortly after running empty means the movement stopped
+    // dead in the middle of a job, instead of at its end.
+    if (isdead && underrun_time && timer_read() - underrun_time < F_CPU)
+      queue_stats.stalls++;
+    underrun_time = 0;
+  ATOMIC_END
+
+	if (isdead) {
+    timer_reset();
+		next_move();
+    // Compensate for the cli() in timer_set().
+		sei();
+	}
+}
+
+/// add a single move to the movebuffer
 /// \note this function waits for space to be available if necessary, check queue_full() first if waiting is a problem
 /// This is the only function that modifies mb_head and it always called from outside an interrupt.
-void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
+static void enqueue_move(TARGET *t, uint8_t endstop_check,
+                         uint8_t endstop_stop_cond) {
 	// don't call this function when the queue is full, but just in case, wait for a move to complete and free up the space for the passed target
-	while (queue_full())
-		delay_us(100);
+	queue_wait_room();
 
   uint8_t h = MB_NEXT(mb_head);
 
@@ -113,6 +468,12 @@ void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
   // dda->live, dda->done and dda->wait_for_temp.
   new_movebuffer->allflags = 0;
 
+  #ifdef SD
+    // Lines from other sources get the position of the last SD line, which
+    // is fine for resuming, see sd_resume_pos().
+    new_movebuffer->sd_pos = sd_line_pos;
+  #endif
+
   if (t != NULL) {
 		new_movebuffer->endstop_check = endstop_check;
 		new_movebuffer->endstop_stop_cond = endstop_stop_cond;
@@ -121,28 +482,655 @@ void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
 		// it's a wait for temp
 		new_movebuffer->waitfor_temp = 1;
 	}
-  dda_create(new_movebuffer, t);
+  {
+    uint32_t plan_time = timer_read();
 
-	// make certain all writes to global memory
-	// are flushed before modifying mb_head.
-	MEMORY_BARRIER();
+    dda_create(new_movebuffer, t);
 
-	mb_head = h;
+    plan_time = timer_read() - plan_time;
+    queue_stats.moves++;
+    queue_stats.plan_total += plan_time;
+    if (plan_time > queue_stats.plan_max)
+      queue_stats.plan_max = plan_time;
+    profile_add(PROFILE_CREATE, plan_time);
+  }
 
-  uint8_t isdead;
+  queue_publish(h);
+}
 
-  ATOMIC_START
-    isdead = (movebuffer[mb_tail].live == 0);
-  ATOMIC_END
+#ifdef KINEMATICS_SEGMENTED
+/** Add a move to the movebuffer, subdivided into segments.
 
-	if (isdead) {
-    timer_reset();
-		next_move();
-    // Compensate for the cli() in timer_set().
-		sei();
-	}
+  \param t The target of the move.
+
+  Each segment gets a length suitable for the position it starts at, see
+  kinematics_segment_length(). Segments are queued as soon as there's room
+  in the movebuffer, so the queue is kept filled, but never blocked for
+  other activities. We keep the clock running while waiting, like
+  queue_wait() does.
+*/
+static void enqueue_segmented(TARGET *t) {
+  TARGET segment;
+  axes_int32_t start;
+  uint32_t delta[3], total, done, length;
+  int32_t e_done = 0, e_now;
+  enum axis_e i;
+
+  memcpy(start, startpoint.axis, sizeof(axes_int32_t));
+  memcpy(&segment, t, sizeof(TARGET));
+  // Exact, segment count and proportions depend on it.
+  for (i = X; i <= Z; i++)
+    delta[i] = labs(t->axis[i] - start[i]);
+  total = int_distance(delta, 3);
+
+  for (done = 0; ; ) {
+    length = kinematics_segment_length(startpoint.axis);
+    if (length >= total - done)
+      break;
+    done += length;
+
+    for (i = X; i < E; i++)
+      segment.axis[i] = start[i] + muldiv(t->axis[i] - start[i], done, total);
+    if (t->e_relative) {
+      e_now = muldiv(t->axis[E], done, total);
+      segment.axis[E] = e_now - e_done;
+      e_done = e_now;
+    }
+    else {
+      segment.axis[E] = start[E] + muldiv(t->axis[E] - start[E], done, total);
+    }
+
+    queue_wait_room();
+    enqueue_move(&segment, 0, 0);
+  }
+
+  // Last segment ends exactly at the target.
+  memcpy(&segment, t, sizeof(TARGET));
+  if (t->e_relative)
+    segment.axis[E] = t->axis[E] - e_done;
+  queue_wait_room();
+  enqueue_move(&segment, 0, 0);
+}
+#endif /* KINEMATICS_SEGMENTED */
+
+#ifdef TEMP_WAIT_DEFERRED
+/// A wait for temperatures was requested, but not queued yet.
+static uint8_t temp_wait_pending = 0;
+
+/// Queue a pending wait for temperatures, if there is one.
+static void temp_wait_flush(void) {
+  if (temp_wait_pending) {
+    temp_wait_pending = 0;
+    queue_wait_room();
+    enqueue_move(NULL, 0, 0);
+  }
+}
+#endif
+
+/// add a move to the movebuffer
+/// \note this function waits for space to be available if necessary, check queue_full() first if waiting is a problem
+/// With non-linear kinematics, moves are subdivided into segments. Endstop
+/// searches are not, they end at the endstop anyways.
+/// With TEMP_WAIT_DEFERRED, a wait for temperatures (t == NULL) is held back
+/// until the first move which moves the extruder, so positioning moves can
+/// run while heating up.
+void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
+  #ifdef TEMP_WAIT_DEFERRED
+    if (t == NULL) {
+      temp_wait_pending = 1;
+      return;
+    }
+    if (t->e_relative ? t->axis[E] != 0 : t->axis[E] != startpoint.axis[E])
+      temp_wait_flush();
+  #endif
+  #ifdef KINEMATICS_SEGMENTED
+    if (t != NULL && endstop_check == 0) {
+      enqueue_segmented(t);
+      return;
+    }
+  #endif
+  enqueue_move(t, endstop_check, endstop_stop_cond);
 }
 
+/** Queue a dwell.
+
+  \param ms How long to sit still, in milliseconds.
+
+  The dwell runs on the step timer like a move, so G-code after it gets
+  read and planned meanwhile. Lookahead ends at the dwell, as movement stops
+  there. Temperatures get controlled as usual.
+*/
+void enqueue_dwell(uint16_t ms) {
+	queue_wait_room();
+
+  uint8_t h = MB_NEXT(mb_head);
+  DDA *dda = &movebuffer[h];
+
+  dda->allflags = 0;
+  #ifdef SD
+    dda->sd_pos = sd_line_pos;
+  #endif
+  dda->dwell = 1;
+  dda->c = ms;
+  // Stays where it is, for anything looking at the endpoint.
+  memcpy(&dda->endpoint, &startpoint, sizeof(TARGET));
+  dda_create(dda, NULL);
+
+  queue_publish(h);
+}
+
+#ifdef SYNC_PIN
+/** Queue a sync barrier.
+
+  Moves queued after it start only when all nodes on the sync line reached
+  a barrier, see queue_sync(). It's a dwell otherwise, so lookahead ends
+  here and temperatures get controlled meanwhile.
+*/
+void enqueue_sync(void) {
+	queue_wait_room();
+
+  uint8_t h = MB_NEXT(mb_head);
+  DDA *dda = &movebuffer[h];
+
+  dda->allflags = 0;
+  #ifdef SD
+    dda->sd_pos = sd_line_pos;
+  #endif
+  dda->dwell = 1;
+  dda->sync = 1;
+  dda->c = 0;
+  memcpy(&dda->endpoint, &startpoint, sizeof(TARGET));
+  dda_create(dda, NULL);
+
+  queue_publish(h);
+}
+#endif
+
+#ifdef ENFORCE_ORDER
+/** Queue a heater or fan change.
+
+  \param action What to do, see enum action_e.
+  \param index  Temperature sensor or heater to change.
+  \param value  New temperature or PWM.
+
+  Instead of waiting for the queue to drain, the change gets queued as a
+  null move to where we are and runs as the moves before end, see
+  next_move(). Null moves don't end lookahead, so movement goes on at
+  speed. dda->c holds the action, like it holds the time of a dwell.
+*/
+void enqueue_action(enum action_e action, uint8_t index, uint16_t value) {
+  TARGET t;
+
+	queue_wait_room();
+
+  uint8_t h = MB_NEXT(mb_head);
+  DDA *dda = &movebuffer[h];
+
+  memcpy(&t, &startpoint, sizeof(TARGET));
+  if (t.e_relative)
+    t.axis[E] = 0;
+
+  dda->allflags = 0;
+  #ifdef SD
+    dda->sd_pos = sd_line_pos;
+  #endif
+  dda->action = 1;
+  dda_create(dda, &t);
+  dda->c = ((uint32_t)action << 24) | ((uint32_t)index << 16) | value;
+
+  queue_publish(h);
+}
+
+/** Run the action of a queued heater or fan change.
+
+  Called from next_move(), so possibly from interrupt context.
+*/
+static void queue_action(DDA *dda) {
+  uint8_t index = (uint8_t)(dda->c >> 16);
+  uint16_t value = (uint16_t)dda->c;
+
+  switch ((uint8_t)(dda->c >> 24)) {
+    case ACTION_TEMP:
+      temp_set(index, value);
+      break;
+    case ACTION_HEATER:
+      heater_set(index, (uint8_t)value);
+      break;
+  }
+}
+#endif /* ENFORCE_ORDER */
+
+#ifdef JOG
+/** Queue a jog move.
+
+  Jog moves are a single move in joint space, with any kinematics, so they
+  can change speed while running, see jog().
+*/
+void enqueue_jog(TARGET *t) {
+  enqueue_move(t, 0, 0);
+}
+#endif
+
+#if defined ARC_SEGMENT_LENGTH || defined BEZIER_TOLERANCE
+/** Queue one segment of a curve in the XY plane.
+
+  \param segment The segment, X and Y already set, other axes get set here.
+  \param t End point of the whole curve.
+  \param start Start point of the whole curve.
+  \param k Number of this segment, 1 to n.
+  \param n Total number of segments.
+  \param e_done Relative E queued so far, updated here.
+
+  Z, U and E get interpolated linearly, the last segment ends exactly at t.
+  Waits for queue space with the clock running, like enqueue_segmented().
+*/
+static void enqueue_curve_segment(TARGET *segment, TARGET *t,
+                                  const axes_int32_t start, uint32_t k,
+                                  uint32_t n, int32_t *e_done) {
+  int32_t e_now;
+  enum axis_e a;
+
+  if (k >= n) {
+    memcpy(segment, t, sizeof(TARGET));
+    if (t->e_relative)
+      segment->axis[E] = t->axis[E] - *e_done;
+  }
+  else {
+    for (a = Z; a < E; a++)
+      segment->axis[a] = start[a] + muldiv(t->axis[a] - start[a], k, n);
+    if (t->e_relative) {
+      e_now = muldiv(t->axis[E], k, n);
+      segment->axis[E] = e_now - *e_done;
+      *e_done = e_now;
+    }
+    else {
+      segment->axis[E] = start[E] + muldiv(t->axis[E] - start[E], k, n);
+    }
+  }
+
+  queue_wait_room();
+  enqueue(segment);
+}
+#endif
+
+#ifdef ARC_SEGMENT_LENGTH
+/** Add an arc in the XY plane to the movebuffer, as a series of chords.
+
+  \param t End point of the arc. Z, U and E move linearly along.
+  \param i X offset from the start point to the arc centre, in um.
+  \param j Y offset from the start point to the arc centre, in um.
+  \param clockwise 1 for G2, 0 for G3.
+
+  Chords are about ARC_SEGMENT_LENGTH long. Chord end points are found by
+  rotating the radius vector by a fixed angle, so each chord costs a few
+  muldiv()s, only. Sine and cosine of this angle get calculated once per arc,
+  with a Taylor series. The radius vector is kept in 1/16 um, so rounding
+  errors don't add up, and the last chord ends exactly at t.
+
+  Chords get queued as soon as there's room, see enqueue_curve_segment().
+*/
+void enqueue_arc(TARGET *t, int32_t i, int32_t j, uint8_t clockwise) {
+  TARGET segment;
+  axes_int32_t start;
+  uint32_t radius[2];
+  int32_t cx, cy, px, py, rx, ry, sweep, e_done = 0;
+  int32_t theta, theta2, theta4, sin_t, cos_d;
+  uint32_t n, k;
+
+  if (i == 0 && j == 0) {
+    enqueue(t);
+    return;
+  }
+
+  memcpy(start, startpoint.axis, sizeof(axes_int32_t));
+  memcpy(&segment, t, sizeof(TARGET));
+  cx = start[X] + i;
+  cy = start[Y] + j;
+
+  // Angle to sweep, in millidegrees. Same start and end means a full circle.
+  sweep = int_atan2(t->axis[Y] - cy, t->axis[X] - cx) - int_atan2(-j, -i);
+  if (clockwise) {
+    if (sweep >= 0)
+      sweep -= 360000;
+    sweep = -sweep;
+  }
+  else if (sweep <= 0) {
+    sweep += 360000;
+  }
+
+  // Number of chords. 57296 millidegrees = 1 radian. The Taylor series
+  // below wants less than half a radian (28648 millidegrees) per chord.
+  radius[0] = labs(i);
+  radius[1] = labs(j);
+  n = muldiv(int_distance(radius, 2), sweep, 57296) / ARC_SEGMENT_LENGTH;
+  if (n < sweep / 28648 + 1)
+    n = sweep / 28648 + 1;
+
+  // Angle per chord in radians, 2.30 fixed point. 2^30 / 57295.78 = 18740.108.
+  theta = muldiv(sweep, 18740108UL, 1000UL * n);
+  theta2 = muldiv(theta, theta, 1UL << 30);
+  theta4 = muldiv(theta2, theta2, 1UL << 30);
+  // sin(theta) = theta * (1 - theta^2 / 6 + theta^4 / 120)
+  sin_t = theta - muldiv(theta, theta2 / 6 - theta4 / 120, 1UL << 30);
+  // 1 - cos(theta) = theta^2 / 2 - theta^4 / 24 + theta^6 / 720
+  cos_d = theta2 / 2 - theta4 / 24 + muldiv(theta4, theta2 / 720, 1UL << 30);
+
+  px = -i * 16;
+  py = -j * 16;
+  for (k = 1; k < n; k++) {
+    rx = muldiv(py, sin_t, 1UL << 30);
+    ry = muldiv(px, sin_t, 1UL << 30);
+    if (clockwise) {
+      rx = -rx;
+      ry = -ry;
+    }
+    px -= muldiv(px, cos_d, 1UL << 30) + rx;
+    py += ry - muldiv(py, cos_d, 1UL << 30);
+
+    segment.axis[X] = cx + ((px + 8) >> 4);
+    segment.axis[Y] = cy + ((py + 8) >> 4);
+    enqueue_curve_segment(&segment, t, start, k, n, &e_done);
+  }
+  enqueue_curve_segment(&segment, t, start, n, n, &e_done);
+}
+#endif /* ARC_SEGMENT_LENGTH */
+
+#ifdef BEZIER_TOLERANCE
+/** \def BEZIER_DEPTH
+  Halvings of a G5 curve at most, so it gets 2^BEZIER_DEPTH segments at
+  most. Each halving divides the deviation from the chord by four, so with
+  8, curves deviating up to 65536 times BEZIER_TOLERANCE from their chord
+  meet the tolerance, 655 mm for 10 um. Bends beyond that stop at the
+  deepest level and deviate more. Costs 25 bytes of stack per level.
+*/
+#define BEZIER_DEPTH 8
+
+/** Whether a piece of a Bezier curve is close enough to its chord.
+
+  \param c Control points of the piece, X and Y.
+
+  R. Willcocks' bound, the curve stays within
+  sqrt(max(ux^2, vx^2) + max(uy^2, vy^2)) / 4 of the chord, with
+  u = 3 * P1 - 2 * P0 - P3 and v = 3 * P2 - P0 - 2 * P3.
+*/
+static uint8_t bezier_flat(int32_t c[4][2]) {
+  uint32_t d[2];
+  uint8_t a;
+
+  for (a = X; a <= Y; a++) {
+    uint32_t u = labs(3 * c[1][a] - 2 * c[0][a] - c[3][a]);
+    uint32_t v = labs(3 * c[2][a] - c[0][a] - 2 * c[3][a]);
+
+    d[a] = u > v ? u : v;
+  }
+
+  return int_distance(d, 2) <= 4 * BEZIER_TOLERANCE;
+}
+
+/** Add a cubic Bezier curve in the XY plane to the movebuffer.
+
+  \param t End point of the curve. Z, U and E move linearly along.
+  \param i X offset from the start point to the first control point, in um.
+  \param j Y offset from the start point to the first control point, in um.
+  \param p X offset from the end point to the second control point, in um.
+  \param q Y offset from the end point to the second control point, in um.
+
+  The curve gets flattened into straight segments deviating no more than
+  BEZIER_TOLERANCE from the curve. Pieces not flat enough, see
+  bezier_flat(), get halved with de Casteljau's algorithm, which takes
+  additions and shifts only. So segments are short where the curve bends
+  and long where it's flat, also within the same curve. The first half goes
+  on, the second waits on a stack until the first is queued.
+
+  Z, U and E follow the curve parameter, in units of 2^-BEZIER_DEPTH. Corner
+  speeds between segments are left to lookahead, which sees the small
+  angles between them and lets them pass at nearly full speed.
+*/
+void enqueue_bezier(TARGET *t, int32_t i, int32_t j, int32_t p, int32_t q) {
+  TARGET segment;
+  axes_int32_t start;
+  int32_t c[4][2], stack[BEZIER_DEPTH][3][2];
+  uint8_t level[BEZIER_DEPTH], sp = 0, depth = 0;
+  uint16_t pos = 0;
+  int32_t e_done = 0;
+  uint8_t a;
+
+  memcpy(start, startpoint.axis, sizeof(axes_int32_t));
+  memcpy(&segment, t, sizeof(TARGET));
+
+  // P1 = P0 + (i, j) and P2 = P3 + (p, q).
+  for (a = X; a <= Y; a++) {
+    c[0][a] = start[a];
+    c[1][a] = start[a] + (a == X ? i : j);
+    c[2][a] = t->axis[a] + (a == X ? p : q);
+    c[3][a] = t->axis[a];
+  }
+
+  for (;;) {
+    if (depth < BEZIER_DEPTH && ! bezier_flat(c)) {
+      // Halve, keep the first half, push the second.
+      for (a = X; a <= Y; a++) {
+        int32_t p01 = (c[0][a] + c[1][a]) >> 1;
+        int32_t p12 = (c[1][a] + c[2][a]) >> 1;
+        int32_t p23 = (c[2][a] + c[3][a]) >> 1;
+        int32_t p012 = (p01 + p12) >> 1;
+        int32_t p123 = (p12 + p23) >> 1;
+
+        stack[sp][0][a] = p123;
+        stack[sp][1][a] = p23;
+        stack[sp][2][a] = c[3][a];
+        c[1][a] = p01;
+        c[2][a] = p012;
+        c[3][a] = (p012 + p123) >> 1;
+      }
+      level[sp++] = ++depth;
+      continue;
+    }
+
+    pos += 1 << (BEZIER_DEPTH - depth);
+    segment.axis[X] = c[3][X];
+    segment.axis[Y] = c[3][Y];
+    enqueue_curve_segment(&segment, t, start, pos, 1 << BEZIER_DEPTH,
+                          &e_done);
+    if (sp == 0)
+      break;
+
+    // Next is the second half pushed last, it starts where this one ended.
+    sp--;
+    for (a = X; a <= Y; a++) {
+      c[0][a] = c[3][a];
+      c[1][a] = stack[sp][0][a];
+      c[2][a] = stack[sp][1][a];
+      c[3][a] = stack[sp][2][a];
+    }
+    depth = level[sp];
+  }
+}
+#endif /* BEZIER_TOLERANCE */
+
+#ifdef MOTION_MACRO
+/**
+  \struct MACRO
+  \brief A recorded sequence of moves, see M820 to M822.
+
+  Moves get copied as they start, so they're complete, lookahead included.
+  They start and end at standstill, because recording starts and ends with
+  an empty queue.
+*/
+typedef struct {
+  axes_int32_t  start;          ///< startpoint of the recording, um
+  axes_int32_t  start_steps;    ///< the same in steps
+  axes_int32_t  end_steps;      ///< endpoint of the recording, steps
+  uint16_t      dda_size;       ///< sizeof(DDA) of the firmware recording
+  uint8_t       moves;          ///< number of moves recorded
+  DDA           dda[MOTION_MACRO];
+} MACRO;
+
+static MACRO BSS macro;
+
+/**
+  The macro sits in RAM next to the movebuffer. sizeof(DDA) depends on the
+  features configured, so this can't be checked by the preprocessor.
+*/
+#define MACRO_RAM_MAX 2048
+_Static_assert(sizeof(MACRO) <= MACRO_RAM_MAX,
+               "MOTION_MACRO takes more than 2 kB of RAM, reduce it.");
+
+/// MACRO_RECORDING while recording, MACRO_FAILED if a move didn't fit
+static volatile uint8_t macro_recording = 0;
+#define MACRO_RECORDING 1
+#define MACRO_FAILED    2
+
+#ifdef EECONFIG
+  static MACRO EEMEM ee_macro;
+  static uint16_t EEMEM ee_macro_crc;
+#endif
+
+/// bytes of the macro in use
+#define MACRO_USED(m) (offsetof(MACRO, dda) + (m) * sizeof(DDA))
+
+/** Copy a move as it starts into the macro.
+
+  Called from next_move(), so from interrupt context. Endstop searches don't
+  end at a known position, so they can't be replayed.
+*/
+static void macro_record(DDA *dda) {
+  if (dda->nullmove)
+    return;
+
+  if (dda->endstop_check || macro.moves >= MOTION_MACRO) {
+    macro_recording = MACRO_FAILED;
+    return;
+  }
+  memcpy(&macro.dda[macro.moves], dda, sizeof(DDA));
+  macro.moves++;
+}
+
+/// read the macro stored in EEPROM, if there's a valid one
+void macro_init(void) {
+  #ifdef EECONFIG
+    uint16_t i;
+    uint8_t *m = (uint8_t *)&macro;
+
+    for (i = 0; i < offsetof(MACRO, dda); i++)
+      m[i] = eeprom_read_byte((uint8_t *)&ee_macro + i);
+    if (macro.dda_size == sizeof(DDA) && macro.moves <= MOTION_MACRO) {
+      for ( ; i < MACRO_USED(macro.moves); i++)
+        m[i] = eeprom_read_byte((uint8_t *)&ee_macro + i);
+      if (crc_block(&macro, MACRO_USED(macro.moves)) ==
+          eeprom_read_word(&ee_macro_crc))
+        return;
+    }
+    macro.moves = 0;
+  #endif
+}
+
+/** Start recording a motion macro.
+
+  Waits for the queue to empty, so the first move starts from standstill.
+*/
+void macro_record_start(void) {
+  queue_wait();
+  memcpy(macro.start, startpoint.axis, sizeof(axes_int32_t));
+  memcpy(macro.start_steps, startpoint_steps.axis, sizeof(axes_int32_t));
+  macro.dda_size = sizeof(DDA);
+  macro.moves = 0;
+  macro_recording = MACRO_RECORDING;
+}
+
+/** Stop recording a motion macro.
+
+  \return Number of moves recorded, 0 if there were too many or endstop
+          searches.
+
+  Waits for all moves to start and end, so the last one ends at standstill.
+  With EECONFIG the macro then gets written to EEPROM, which takes some 3 ms
+  per changed byte. The clock keeps running meanwhile.
+*/
+uint8_t macro_record_stop(void) {
+  queue_wait();
+  if (macro_recording != MACRO_RECORDING)
+    macro.moves = 0;
+  macro_recording = 0;
+  memcpy(macro.end_steps, startpoint_steps.axis, sizeof(axes_int32_t));
+
+  #ifdef EECONFIG
+    uint16_t i;
+    uint8_t *m = (uint8_t *)&macro;
+
+    for (i = 0; i < MACRO_USED(macro.moves); i++) {
+      eeprom_update_byte((uint8_t *)&ee_macro + i, m[i]);
+      clock();
+    }
+    eeprom_update_word(&ee_macro_crc,
+                       crc_block(&macro, MACRO_USED(macro.moves)));
+  #endif
+
+  return macro.moves;
+}
+
+/** Add the recorded motion macro to the movebuffer.
+
+  \return Number of moves queued, 0 if there is no macro or it can't start
+          here.
+
+  Moves go into the movebuffer as recorded, shifted by the distance between
+  the current startpoint and the one of the recording. Step counts stay the
+  same, so this works with linear kinematics only. With other kinematics the
+  macro has to start where it was recorded.
+
+  Waits for queue space with the clock running, like enqueue_segmented().
+*/
+uint8_t enqueue_macro(void) {
+  axes_int32_t offset;
+  DDA *dda = NULL;
+  uint8_t h, n;
+  enum axis_e i;
+
+  if (macro_recording || macro.moves == 0)
+    return 0;
+
+  #ifdef TEMP_WAIT_DEFERRED
+    // Macros usually extrude, don't look into each move.
+    temp_wait_flush();
+  #endif
+
+  for (i = X; i < AXIS_COUNT; i++)
+    offset[i] = startpoint.axis[i] - macro.start[i];
+  #ifdef KINEMATICS_SEGMENTED
+    for (i = X; i < E; i++)
+      if (startpoint_steps.axis[i] != macro.start_steps[i])
+        return 0;
+  #endif
+
+  for (n = 0; n < macro.moves; n++) {
+    queue_wait_room();
+
+    h = MB_NEXT(mb_head);
+    dda = &movebuffer[h];
+    memcpy(dda, &macro.dda[n], sizeof(DDA));
+    for (i = X; i < E; i++)
+      dda->endpoint.axis[i] += offset[i];
+    if ( ! dda->endpoint.e_relative)
+      dda->endpoint.axis[E] += offset[E];
+    #ifdef LOOKAHEAD
+      // Neighbours need distinct identifiers, see dda_clock().
+      dda->id = movebuffer[mb_head].id + 1;
+    #endif
+
+    queue_publish(h);
+  }
+
+  // Continue where the macro ended.
+  memcpy(&startpoint, &dda->endpoint, sizeof(TARGET));
+  for (i = X; i < AXIS_COUNT; i++)
+    startpoint_steps.axis[i] += macro.end_steps[i] - macro.start_steps[i];
+  dda_break_lookahead();
+
+  return macro.moves;
+}
+#endif /* MOTION_MACRO */
+
 /// go to the next move.
 /// be aware that this is sometimes called from interrupt context, sometimes not.
 /// Note that if it is called from outside an interrupt it must not/can not
@@ -153,6 +1141,13 @@ void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
 /// timer interrupt is disabled).
 void next_move() {
 	while ((queue_empty() == 0) && (movebuffer[mb_tail].live == 0)) {
+    #ifdef FEED_HOLD
+      // Held between moves, dda_resume() calls us again.
+      if (feed_hold != FEED_HOLD_OFF) {
+        feed_hold = FEED_HOLD_HELD;
+        break;
+      }
+    #endif
 		// next item
     uint8_t t = MB_NEXT(mb_tail);
 		DDA* current_movebuffer = &movebuffer[t];
@@ -160,12 +1155,25 @@ void next_move() {
     // the timer interrupt, potentially exposing mb_tail to the timer
     // interrupt routine.
 		mb_tail = t;
+    queue_dispatches++;
 		if (current_movebuffer->waitfor_temp) {
 			serial_writestr_P(PSTR("Waiting for target temp\n"));
 			current_movebuffer->live = 1;
-      timer_set(HEATER_WAIT_TIMEOUT, 0);
+      // No timer, queue_temp_wait_tick() takes it from here.
+		}
+		else if (current_movebuffer->dwell) {
+			current_movebuffer->live = 1;
+			queue_dwell(current_movebuffer);
 		}
 		else {
+      #ifdef ENFORCE_ORDER
+        if (current_movebuffer->action)
+          queue_action(current_movebuffer);
+      #endif
+      #ifdef MOTION_MACRO
+        if (macro_recording)
+          macro_record(current_movebuffer);
+      #endif
 			dda_start(current_movebuffer);
 		}
 	}
@@ -177,6 +1185,40 @@ void print_queue() {
   sersendf_P(PSTR("Queue: %d/%d%c\n"), mb_tail, mb_head, (queue_full()?'F':(queue_empty()?'E':' ')));
 }
 
+/** Print movement statistics and reset them.
+
+  Times are reported in microseconds. Planning time is the time dda_create()
+  takes, including lookahead. Underruns count how often the queue ran empty,
+  which includes the end of each job. Stalls count the underruns followed
+  by a new move within a second, which are unlikely job ends. The depth
+  histogram gives, for each number of moves waiting, how often the queue
+  was found this full. Mostly full means the printer is busy with moving,
+  often empty means G-code arrives too slowly.
+*/
+void queue_stats_print() {
+  QUEUE_STATS stats;
+  uint8_t i;
+
+  ATOMIC_START
+    memcpy(&stats, &queue_stats, sizeof(QUEUE_STATS));
+    memset(&queue_stats, 0, sizeof(QUEUE_STATS));
+    queue_stats.min_crossF = 0xFFFF;
+  ATOMIC_END
+
+  sersendf_P(PSTR("Moves:%lu Joined:%lu Timeouts:%lu MinCross:%u\n"),
+             stats.moves, stats.joined, stats.timeouts,
+             stats.min_crossF == 0xFFFF ? 0 : stats.min_crossF);
+  sersendf_P(PSTR("Plan:%lu/%lu us Underruns:%u StepISR:%lu us\n"),
+             stats.moves ? stats.plan_total / stats.moves / (F_CPU / 1000000) : 0,
+             stats.plan_max / (F_CPU / 1000000), stats.underruns,
+             stats.step_isr_max / (F_CPU / 1000000));
+  sersendf_P(PSTR("Stalls:%u Overloads:%u Depth:"), stats.stalls,
+             stats.overloads);
+  for (i = 0; i < MOVEBUFFER_SIZE; i++)
+    sersendf_P(PSTR(" %u"), stats.depth[i]);
+  sersendf_P(PSTR("\n"));
+}
+
 /// dump queue for emergency stop.
 /// Make sure to have all timers stopped with timer_stop() or
 /// unexpected things might happen.
@@ -187,10 +1229,44 @@ void queue_flush() {
   // wrapping in ATOMIC_START ... ATOMIC_END.
   mb_tail = mb_head;
   movebuffer[mb_head].live = 0;
+  #ifdef FEED_HOLD
+    feed_hold = FEED_HOLD_OFF;
+  #endif
+  #ifdef TEMP_WAIT_DEFERRED
+    temp_wait_pending = 0;
+  #endif
 }
 
 /// wait for queue to empty
+/// Moves end in the step interrupt, which also wakes us from cpu_idle().
 void queue_wait() {
-	while (queue_empty() == 0)
+	while (queue_empty() == 0) {
+    #ifdef BENCHMARK
+      if (dry_run) {
+        queue_retire();
+        continue;
+      }
+    #endif
 		clock();
+		cpu_idle();
+	}
+}
+
+#ifdef BENCHMARK
+/** Plan moves without running them.
+
+  \param on 1 to start, 0 to end.
+
+  For benchmarking the planner, see bench.c. Call this with the queue
+  empty. Moves then get queued and planned as usual, lookahead included,
+  but never started. Instead the oldest one counts as done as soon as room
+  is needed, as if the machine moved infinitely fast. At the end, moves
+  left get dropped.
+*/
+void queue_dry_run(uint8_t on) {
+  dry_run = on;
+  if ( ! on)
+    while (mb_tail != mb_head)
+      queue_retire();
 }
+#endif /* BENCHMARK */
@@ -4,7 +4,8 @@
 #include	"dda.h"
 #include	"timer.h"
 
-#define HEATER_WAIT_TIMEOUT 1000 MS
+/// how often temperatures get reported while waiting, in 10 ms ticks
+#define HEATER_WAIT_REPORT  100
 
 /*
 	variables
@@ -15,6 +16,29 @@ extern uint8_t	mb_head;
 extern uint8_t	mb_tail;
 extern DDA movebuffer[MOVEBUFFER_SIZE];
 
+/**
+  \struct QUEUE_STATS
+  \brief Movement statistics, see M422.
+
+  Cheap enough to be always on. Times are in CPU ticks.
+*/
+typedef struct {
+  uint32_t  moves;          ///< moves created
+  uint32_t  joined;         ///< moves planned by lookahead
+  uint32_t  timeouts;       ///< plans dropped, lookahead was too slow
+  uint32_t  plan_total;     ///< time spent in dda_create(), all moves
+  uint32_t  plan_max;       ///< longest dda_create()
+  uint32_t  step_isr_max;   ///< longest step interrupt
+  uint16_t  underruns;      ///< queue ran empty
+  uint16_t  stalls;         ///< queue ran empty, next move came within 1 s
+  uint16_t  overloads;      ///< step interrupts too late, see STEP_RATE_GUARD
+  uint16_t  min_crossF;     ///< lowest crossing speed, mm/min
+  /// Moves waiting in the queue, counted at each enqueue and move start.
+  uint16_t  depth[MOVEBUFFER_SIZE];
+} QUEUE_STATS;
+
+extern QUEUE_STATS queue_stats;
+
 /*
 	methods
 */
@@ -27,6 +51,24 @@ DDA *queue_current_movement(void);
 // take one step
 void queue_step(void);
 
+// release a wait for temperatures when they're reached, every 10 ms
+void queue_temp_wait_tick(void);
+
+// look back into the queue, 0 = the move queued last, NULL beyond the queue
+DDA *queue_peek_back(uint8_t n);
+
+// same, but NULL at the first move already started
+DDA *queue_peek_pending(uint8_t n);
+
+// optimistic lock of pending moves against being started, see dda_queue.c
+uint8_t queue_window_open(void);
+uint8_t queue_window_intact(uint8_t window);
+
+#ifdef TEMPORAL_MATCH_CHANNELS
+// take one step on one timer match channel
+void queue_step_channel(uint8_t ch);
+#endif
+
 // add a new target to the queue
 // t == NULL means add a wait for target temp to the queue
 void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond);
@@ -36,16 +78,62 @@ inline void enqueue(TARGET *t) {
   enqueue_home(t, 0, 0);
 }
 
+#ifdef JOG
+// add a jog move, never segmented, see jog()
+void enqueue_jog(TARGET *t);
+#endif
+
+// add a dwell of ms milliseconds, see G4
+void enqueue_dwell(uint16_t ms);
+
+#ifdef SYNC_PIN
+// add a barrier waiting for all nodes on the sync line, see M440
+void enqueue_sync(void);
+#endif
+
+#ifdef ENFORCE_ORDER
+/// actions to run in sync with moves, see enqueue_action()
+enum action_e {
+  ACTION_TEMP,    ///< temp_set(index, value)
+  ACTION_HEATER,  ///< heater_set(index, value)
+};
+
+// add a heater or fan change, run where the moves queued before end
+void enqueue_action(enum action_e action, uint8_t index, uint16_t value);
+#endif
+
+// add an arc in the XY plane, see G2/G3
+void enqueue_arc(TARGET *t, int32_t i, int32_t j, uint8_t clockwise);
+
+// add a cubic Bezier curve in the XY plane, see G5
+void enqueue_bezier(TARGET *t, int32_t i, int32_t j, int32_t p, int32_t q);
+
+#ifdef MOTION_MACRO
+// record and replay a motion macro, see M820 to M822
+void macro_init(void);
+void macro_record_start(void);
+uint8_t macro_record_stop(void);
+uint8_t enqueue_macro(void);
+#endif
+
 // called from step timer when current move is complete
 void next_move(void);
 
 // print queue status
 void print_queue(void);
 
+// print and reset movement statistics
+void queue_stats_print(void);
+
 // flush the queue for eg; emergency stop
 void queue_flush(void);
 
 // wait for queue to empty
 void queue_wait(void);
 
+#ifdef BENCHMARK
+// plan moves without running them, see bench.c
+void queue_dry_run(uint8_t on);
+#endif
+
 #endif	/* _DDA_QUEUE */
@@ -16,6 +16,47 @@
 */
 //#define DEBUG
 
+/** \def PROFILE
+  Time the step interrupt, dda_clock() and dda_create() with the hardware
+  timer and keep min/avg/max and a histogram of each. M422 prints them. Costs
+  about 170 bytes of RAM and some microseconds per step interrupt.
+*/
+//#define PROFILE
+
+/** \def STEP_TRACE
+  Record the speed profile actually run: each change of the step interval
+  with time and step number, the latest 32 of them. M423 prints them. Helps
+  comparing acceleration ramps and lookahead against the planned profile.
+  Costs about 400 bytes of RAM. Requires ACCELERATION_RAMPING.
+*/
+//#define STEP_TRACE
+
+/** \def TRACE
+  Record motion events like move start and end, endstop hits and lookahead
+  replanning with a timestamp in a ring buffer, the latest 32 of them. M425
+  prints them, so does the main loop with DEBUG_DDA. Recording takes a few
+  microseconds only, so the step interrupt keeps its timing, unlike with
+  the plain DEBUG_DDA printouts it replaces in dda_start(). Costs about
+  420 bytes of RAM.
+*/
+//#define TRACE
+
+/** \def RAM_REPORT
+  Paint free RAM at startup and add M432, which reports RAM usage, the most
+  stack used so far and how much RAM was never touched. Tells how far
+  MOVEBUFFER_SIZE and the serial buffers can grow safely. Costs about
+  250 bytes of flash, no RAM. AVR only.
+*/
+//#define RAM_REPORT
+
+/** \def BENCHMARK
+  Add M431, which plans canned G-code as fast as possible without moving
+  and reports G-code lines per second, the longest line and lookahead
+  timeouts. Tells how much a build option costs the planner. Costs about
+  1.5 kB of flash.
+*/
+//#define BENCHMARK
+
 #ifdef	DEBUG
   #define DEBUG_ECHO       1
   #define DEBUG_INFO       2
@@ -20,6 +20,12 @@ volatile uint8_t displaybuf[BUFSIZE];
 
 #include "ringbuffer.h"
 
+/// seconds the greeting stays before display_clock() takes over
+#define DISPLAY_GREETING_TIME 5
+
+/// counts down DISPLAY_GREETING_TIME, see display_greeting()
+static uint8_t greeting_hold = 0;
+
 
 #define TEACUP_C_INCLUDE
   #include "display_ssd1306.c"
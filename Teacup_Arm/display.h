@@ -28,6 +28,12 @@
     #define DISPLAY_LINES               2
     #define DISPLAY_SYMBOLS_PER_LINE    16
 
+    /**
+      The display queue gets drained from the clock interrupt, one byte
+      every 2 milliseconds, instead of from the main loop. See display_tick().
+    */
+    #define DISPLAY_TICK_ISR
+
     #define DISPLAY
 
   #else
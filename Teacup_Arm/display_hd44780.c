@@ -42,13 +42,9 @@ void display_greeting(void) {
   // We have only 16 characters at our disposal ...
   display_writestr_P(PSTR("Welcome @ Teacup"));
 
-  // Forward this to the display immediately.
-  while (buf_canread(display)) {
-    display_tick();
-  }
-
-  // Allow the user to worship our work for a moment :-)
-  delay_ms(5000);
+  // Allow the user to worship our work for a moment :-) The clock interrupt
+  // forwards it to the display, startup doesn't wait for that.
+  greeting_hold = DISPLAY_GREETING_TIME;
 }
 
 /**
@@ -57,6 +53,11 @@ void display_greeting(void) {
 void display_clock(void) {
   uint16_t temperature;
 
+  if (greeting_hold) {
+    greeting_hold--;
+    return;
+  }
+
   display_clear();
 
   update_current_position();
@@ -80,53 +81,66 @@ void display_clock(void) {
 /**
   Forwards a character or a control command from the display queue to display
   bus. As this is a character based display it's easy.
+
+  Called from clock_tick() every 2 milliseconds, see DISPLAY_TICK_ISR. Each
+  call sends one byte at most, and only if the display reports not busy, so
+  it never waits. The HD44780 needs some 40 microseconds per byte, a clear
+  screen 1.5 milliseconds, so a full display update takes some 70 ms.
 */
 void display_tick() {
   uint8_t data, command;
 
+  if ( ! buf_canread(display)) {
+    return;
+  }
+
+  // Cursor commands are three bytes, don't start on an incomplete one.
+  if (displaybuf[displaytail] == low_code_set_cursor &&
+      buf_canread(display) < 3) {
+    return;
+  }
+
   if (displaybus_busy()) {
     return;
   }
 
-  if (buf_canread(display)) {
-    buf_pop(display, data);
-    switch (data) {
-      case low_code_clear:
-        displaybus_write(0x01, parallel_4bit_instruction);
-        break;
-
-      case low_code_set_cursor:
-        /**
-          Set the cursor to the given position.
-
-          This is a three-byte control command, so we fetch additional bytes
-          from the queue and cross fingers they're actually there.
-        */
-        command = 0x80;    // "Set DDRAM Address" base command.
-
-        /**
-          Add address of line.
-
-          As we have two lines only, this can be "calculated" without
-          a multiplication.
-        */
-        buf_pop(display, data);
-        if (data) {
-          command += 0x40;
-        }
-
-        // Add column address.
-        buf_pop(display, data);
-        command += data;
-
-        displaybus_write(command, parallel_4bit_instruction);
-        break;
-
-      default:
-        // Should be a printable character.
-        displaybus_write(data, parallel_4bit_data);
-        break;
-    }
+  buf_pop(display, data);
+  switch (data) {
+    case low_code_clear:
+      displaybus_write(0x01, parallel_4bit_instruction);
+      break;
+
+    case low_code_set_cursor:
+      /**
+        Set the cursor to the given position.
+
+        This is a three-byte control command, all of them are in the queue,
+        see above.
+      */
+      command = 0x80;    // "Set DDRAM Address" base command.
+
+      /**
+        Add address of line.
+
+        As we have two lines only, this can be "calculated" without
+        a multiplication.
+      */
+      buf_pop(display, data);
+      if (data) {
+        command += 0x40;
+      }
+
+      // Add column address.
+      buf_pop(display, data);
+      command += data;
+
+      displaybus_write(command, parallel_4bit_instruction);
+      break;
+
+    default:
+      // Should be a printable character.
+      displaybus_write(data, parallel_4bit_data);
+      break;
   }
 }
 
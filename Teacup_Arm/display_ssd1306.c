@@ -17,8 +17,13 @@
       wait cycles.
 
     - 128 byte queue holding characters to send. This queue is filled by
-      display_writechar(). It's drained by display_tick(), which processes,
-      renders and forwards these characters to the I2C queue.
+      display_writechar(). It's drained by display_tick(), which processes
+      and renders these characters into a framebuffer.
+
+    - Framebuffer with dirty flags for each 8 column chunk of a page. Only
+      chunks actually changed get sent, one small I2C transmission per call
+      of display_tick(), queued with i2c_submit(). This never waits for the
+      bus, so the display costs close to no main loop time.
 
     - Display initialisation.
 
@@ -70,6 +75,36 @@
 #include "sendf.h"
 #include "delay.h"
 #include "dda.h"
+#include "temp.h"
+#include <string.h>
+
+
+#define DISPLAY_PAGES       DISPLAY_LINES
+#define DISPLAY_COLUMNS     128
+/// Columns sent in one I2C transmission, see display_tick().
+#define DISPLAY_CHUNK       8
+
+/// Page and column commands, then pixel data of one chunk.
+static uint8_t chunk_data[7 + DISPLAY_CHUNK];
+
+/// Chunk on its way to the display and where it belongs.
+static I2C_TRANSACTION chunk = {
+  .address = DISPLAY_I2C_ADDRESS,
+  .tx = chunk_data,
+  .tx_len = sizeof(chunk_data)
+};
+static uint8_t chunk_page, chunk_index;
+
+/**
+  Framebuffer. Each byte is a column of 8 pixels in a page ( = line). Queued
+  characters get rendered here, the display controller gets it from here.
+*/
+static uint8_t framebuffer[DISPLAY_PAGES][DISPLAY_COLUMNS];
+
+/// Bit n set if columns n * DISPLAY_CHUNK ... of this page need sending.
+static uint16_t dirty[DISPLAY_PAGES];
+
+static uint8_t cursor_page, cursor_column;
 
 
 static const uint8_t PROGMEM init_sequence[] = {
@@ -110,6 +145,29 @@ void display_init(void) {
     // Send last byte with 'last_byte' set.
     displaybus_write(init_sequence[i], (i == sizeof(init_sequence) - 1));
   }
+
+  // Controller memory is random after power up, send the whole (blank)
+  // framebuffer once.
+  for (i = 0; i < DISPLAY_PAGES; i++)
+    dirty[i] = 0xFFFF;
+}
+
+/**
+  Put a column of pixels into the framebuffer at the cursor and advance the
+  cursor. Columns beyond the right edge get dropped.
+*/
+static void framebuffer_put(uint8_t pixels) {
+  uint8_t *p;
+
+  if (cursor_column >= DISPLAY_COLUMNS)
+    return;
+
+  p = &framebuffer[cursor_page][cursor_column];
+  if (*p != pixels) {
+    *p = pixels;
+    dirty[cursor_page] |= 1 << (cursor_column / DISPLAY_CHUNK);
+  }
+  cursor_column++;
 }
 
 /**
@@ -127,71 +185,59 @@ void display_greeting(void) {
 
   display_writestr_P(PSTR("Welcome to Teacup"));
 
-  // Forward this to the display immediately.
-  while (buf_canread(display)) {
-    display_tick();
-  }
-
-  // Allow the user to worship our work for a moment :-)
-  delay_ms(5000);
+  // Allow the user to worship our work for a moment :-) display_tick() from
+  // the main loop sends it, startup doesn't wait for that.
+  greeting_hold = DISPLAY_GREETING_TIME;
 }
 
 /**
   Regular update of the display. Typically called once a second from clock.c.
 */
 void display_clock(void) {
+  temp_sensor_t i;
+
+  if (greeting_hold) {
+    greeting_hold--;
+    return;
+  }
 
   display_set_cursor(0, 2);
   update_current_position();
   sendf_P(display_writechar, PSTR("X:%lq Y:%lq Z:%lq  F:%lu  "),
           current_position.axis[X], current_position.axis[Y],
           current_position.axis[Z], current_position.F);
+
+  // Temperatures, whole degrees.
+  display_set_cursor(2, 2);
+  for (i = 0; i < NUM_TEMP_SENSORS; i++)
+    sendf_P(display_writechar, PSTR("T%u:%u  "), i, temp_get(i) >> 2);
 }
 
 /**
-  Forwards a character or a control command from the display queue to the I2C
-  queue.
+  Renders the display queue into the framebuffer, then sends one changed
+  chunk of the framebuffer to the display.
+
+  Rendering is cheap, it's RAM only. Sending means queueing an I2C
+  transaction, one at a time, so this never waits. The I2C interrupt does
+  the actual transmission, a failed one gets repeated. Unchanged parts of the
+  screen don't get sent at all, so a typical update of a few characters is
+  done in a few calls.
 */
 void display_tick() {
   uint16_t i, data, index;
+  uint8_t page, column;
 
-  if (displaybus_busy()) {
-    return;
-  }
-
-  /**
-    Possible strategy for error recovery: after a failed, aborted I2C
-    transmisson, 'i2c_state & I2C_INTERRUPTED' in i2c.c evaluates to true.
-
-    Having a getter like displaybus_failed() would allow to test this condition
-    here, so we could resend the previous data again, instead of grabbing a
-    new byte from the buffer.
-  */
-
-  if (buf_canread(display)) {
+  while (buf_canread(display)) {
     buf_pop(display, data);
     switch (data) {
       case low_code_clear:
-        /**
-          Clear the screen. As this display supports many sophisticated
-          commands, but not a simple 'clear', we have to overwrite the entire
-          memory with zeros, byte by byte.
-        */
-        // Set horizontal adressing mode.
-        displaybus_write(0x00, 0);
-        displaybus_write(0x20, 0);
-        displaybus_write(0x00, 1);
-
-        // Write 512 zeros.
-        displaybus_write(0x40, 0);
-        for (i = 0; i < 512; i++) {
-          displaybus_write(0x00, (i == 511));
+        for (page = 0; page < DISPLAY_PAGES; page++) {
+          cursor_page = page;
+          cursor_column = 0;
+          for (i = 0; i < DISPLAY_COLUMNS; i++)
+            framebuffer_put(0x00);
         }
-
-        // Return to page adressing mode.
-        displaybus_write(0x00, 0);
-        displaybus_write(0x20, 0);
-        displaybus_write(0x02, 1);
+        cursor_page = cursor_column = 0;
         break;
 
       case low_code_set_cursor:
@@ -201,39 +247,65 @@ void display_tick() {
           This is a three-byte control command, so we fetch additional bytes
           from the queue and cross fingers they're actually there.
         */
-        // Enter command mode.
-        displaybus_write(0x00, 0);
-        // Set line.
         buf_pop(display, data);
-        displaybus_write(0xB0 | (data & 0x03), 0);
-        // Set column.
+        cursor_page = data % DISPLAY_PAGES;
         buf_pop(display, data);
-        displaybus_write(0x00 | (data & 0x0F), 0);
-        displaybus_write(0x10 | ((data >> 4) & 0x0F), 1);
+        cursor_column = data;
         break;
 
       default:
         // Should be a printable character.
         index = data - 0x20;
 
-        // Write pixels command.
-        displaybus_write(0x40, 0);
-
-        // Send the character bitmap.
         #ifdef FONT_IS_PROPORTIONAL
           for (i = 0; i < pgm_read_byte(&font[index].columns); i++) {
         #else
           for (i = 0; i < FONT_COLUMNS; i++) {
         #endif
-            displaybus_write(pgm_read_byte(&font[index].data[i]), 0);
+            framebuffer_put(pgm_read_byte(&font[index].data[i]));
         }
-        // Send space between characters.
+        // Space between characters.
         for (i = 0; i < FONT_SYMBOL_SPACE; i++) {
-          displaybus_write(0x00, (i == FONT_SYMBOL_SPACE - 1));
+          framebuffer_put(0x00);
         }
         break;
     }
   }
+
+  // Other devices may use the bus meanwhile, ours is queued behind them.
+  if (chunk.status == I2C_PENDING) {
+    return;
+  }
+  if (chunk.status == I2C_FAILED) {
+    dirty[chunk_page] |= 1 << chunk_index;
+    chunk.status = I2C_DONE;
+  }
+
+  for (page = 0; page < DISPLAY_PAGES; page++) {
+    if (dirty[page]) {
+      for (i = 0; (dirty[page] & (1 << i)) == 0; i++);
+      dirty[page] &= ~(1 << i);
+      chunk_page = page;
+      chunk_index = i;
+      column = i * DISPLAY_CHUNK;
+
+      /**
+        One transmission: three single commands, each preceeded by a control
+        byte with the Co bit set, to set page and column. Then pixel data.
+      */
+      chunk_data[0] = 0x80;
+      chunk_data[1] = 0xB0 | page;
+      chunk_data[2] = 0x80;
+      chunk_data[3] = 0x00 | (column & 0x0F);
+      chunk_data[4] = 0x80;
+      chunk_data[5] = 0x10 | ((column >> 4) & 0x0F);
+      chunk_data[6] = 0x40;
+      memcpy(&chunk_data[7], &framebuffer[page][column], DISPLAY_CHUNK);
+
+      i2c_submit(&chunk);
+      break;
+    }
+  }
 }
 
 #endif /* TEACUP_C_INCLUDE && DISPLAY_TYPE_SSD1306 */
@@ -12,6 +12,8 @@
 #include	"debug.h"
 #include	"heater.h"
 #include	"sersendf.h"
+#include	"crc.h"
+#include "clock.h"
 
 #include	"gcode_process.h"
 
@@ -21,7 +23,11 @@
   A typical source is the SD card or canned G-code. Serial is currently never
   turned off.
 */
-enum gcode_source gcode_sources = GCODE_SOURCE_SERIAL;
+enum gcode_source gcode_sources = GCODE_SOURCE_SERIAL
+  #ifdef CANNED_CYCLE
+    | GCODE_SOURCE_CANNED
+  #endif
+  ;
 
 /** Bitfield for the current source of G-code.
 
@@ -30,6 +36,30 @@ enum gcode_source gcode_sources = GCODE_SOURCE_SERIAL;
 */
 enum gcode_source gcode_active = 0;
 
+#ifdef CANNED_CYCLE
+  static const char PROGMEM canned_gcode_P[] = CANNED_CYCLE;
+#endif
+
+#ifdef LINE_FIFO
+  /// Longest line accepted with LINE_FIFO, the unit of credits given.
+  #define LINE_FIFO_LINE 64
+
+  #define BUFSIZE LINE_FIFO
+  static uint8_t linehead = 0;
+  static uint8_t linetail = 0;
+  static uint8_t linebuf[BUFSIZE];
+  #include "ringbuffer.h"
+
+  /// Complete lines in the line FIFO, not yet parsed.
+  uint8_t gcode_lines_waiting = 0;
+
+  /// Lines received, but not yet acknowledged.
+  static uint8_t lines_unacked = 0;
+#else
+  /// A line was processed, its acknowledgement waits for queue room.
+  static uint8_t ack_waiting = 0;
+#endif
+
 /// current or previous gcode word
 /// for working out what to do with data just received
 uint8_t last_field = 0;
@@ -37,12 +67,51 @@ uint8_t last_field = 0;
 /// crude crc macro
 #define crc(a, b)		(a ^ b)
 
+#ifdef REQUIRE_LINENUMBER
+  /**
+    A resend was requested and line N_expected didn't arrive yet. Lines the
+    host had sent already behind the bad one get dropped without asking
+    again, so a burst of noise costs one resend starting at N_expected, not
+    one per line in flight.
+  */
+  static uint8_t resend_pending = 0;
+#endif
+
 /// crude floating point data storage
 decfloat BSS read_digit;
 
 /// this is where we store all the data for the current command before we work out what to do with it
 GCODE_COMMAND BSS next_target;
 
+#ifdef BINARY_GCODE
+  /**
+    Binary frame format. All multibyte values are little endian.
+
+      byte 0     0x80 | G number, e.g. 0x81 for G1.
+      byte 1     Field mask: bit 0 to bit 4 X, Y, Z, U, E, bit 5 F,
+                 bit 6 I and J, bit 7 N.
+      ...        One int32 per field in the mask, in mask order; I before J.
+                 Distances in um, F in mm/min, independent of G20/G21.
+      last 2     crc_block() of all preceding bytes.
+
+    A frame replaces a whole line, including its N and checksum, and gets
+    acknowledged the same way. The high bit of the first byte never appears
+    in text G-code, which is how both coexist.
+
+    Lines read from the SD card are accepted as frames as well, without M424,
+    to allow pre-parsed jobs. Petit FatFs can't create files, so converting
+    a job happens on the host, e.g. by writing the frames a host would send
+    into a file instead. Such a file may mix frames and text lines.
+  */
+  #define BINARY_FRAME_MAX (2 + 9 * 4 + 2)
+
+  uint8_t gcode_binary = 0;
+
+  static uint8_t frame[BINARY_FRAME_MAX];
+  static uint8_t frame_len = 0;
+  static uint8_t frame_size;
+#endif
+
 #ifdef SD
   #define STR_BUF_LEN 13
   char gcode_str_buf[STR_BUF_LEN];
@@ -111,6 +180,208 @@ void gcode_init(void) {
 	#endif
 }
 
+/** Convert a distance in the current units to um.
+
+  \param *df pointer to floating point structure that holds fp value to convert
+
+  In millimeters, this is a single multiplication, as the number of decimals
+  is limited to DECFLOAT_EXP_MAX, which is 3. Distances are by far the most
+  frequently parsed values, so this saves decfloat_to_int()'s scaling loop.
+*/
+static int32_t decfloat_to_um(decfloat *df) {
+  uint32_t r;
+  uint8_t e;
+
+  if (next_target.option_inches)
+    return decfloat_to_int(df, 25400);
+
+  // e=1 means decimal point seen, but no digits after it, see above.
+  e = df->exponent;
+  if (e)
+    e--;
+  r = df->mantissa * powers[DECFLOAT_EXP_MAX - e];
+
+  return df->sign ? -(int32_t)r : (int32_t)r;
+}
+
+/** A full line was received, check it and process it.
+
+  Also resets everything for receiving the next line.
+*/
+static void gcode_line_done(void) {
+	#ifdef REQUIRE_LINENUMBER
+	if ( ! (next_target.seen_M && (next_target.M == 110)) &&
+	    (next_target.seen_N == 1) &&
+	    ((next_target.N < next_target.N_expected) ||
+	     (resend_pending && (next_target.N != next_target.N_expected)))) {
+		// Done already or still in flight behind a bad line, both get sent
+		// again (or were) by the one resend asked for. Acknowledge and drop.
+	}
+	else
+	#endif
+	if (
+	#ifdef	REQUIRE_LINENUMBER
+		((next_target.N >= next_target.N_expected) && (next_target.seen_N == 1)) ||
+		(next_target.seen_M && (next_target.M == 110))
+	#else
+		1
+	#endif
+		) {
+		if (
+			#ifdef	REQUIRE_CHECKSUM
+			((next_target.checksum_calculated == next_target.checksum_read) && (next_target.seen_checksum == 1))
+			#else
+			((next_target.checksum_calculated == next_target.checksum_read) || (next_target.seen_checksum == 0))
+			#endif
+			) {
+			// process
+			uint32_t start = timer_read();
+
+			process_gcode_command();
+			loop_stats_add(LOOP_GCODE, timer_read() - start);
+
+      // Acknowledgement ("ok") is sent by gcode_schedule().
+
+			// expect next line number
+			if (next_target.seen_N == 1)
+				next_target.N_expected = next_target.N + 1;
+			#ifdef REQUIRE_LINENUMBER
+				resend_pending = 0;
+			#endif
+		}
+		else {
+			sersendf_P(PSTR("rs N%ld Expected checksum %d\n"), next_target.N_expected, next_target.checksum_calculated);
+			#ifdef REQUIRE_LINENUMBER
+				resend_pending = 1;
+			#endif
+		}
+	}
+	else {
+		sersendf_P(PSTR("rs N%ld Expected line number %ld\n"), next_target.N_expected, next_target.N_expected);
+		#ifdef REQUIRE_LINENUMBER
+			resend_pending = 1;
+		#endif
+	}
+
+	// reset variables
+	next_target.seen_X = next_target.seen_Y = next_target.seen_Z = next_target.seen_U = \
+		next_target.seen_E = next_target.seen_F = next_target.seen_S = \
+		next_target.seen_P = next_target.seen_T = next_target.seen_N = \
+    next_target.seen_I = next_target.seen_J = next_target.seen_Q = \
+    next_target.seen_G = next_target.seen_M = next_target.seen_checksum = \
+    next_target.seen_semi_comment = next_target.seen_parens_comment = \
+    next_target.read_string = next_target.checksum_read = \
+    next_target.checksum_calculated = 0;
+    last_field = 0;
+    read_digit.sign = read_digit.mantissa = read_digit.exponent = 0;
+    next_target.I = next_target.J = next_target.P_um = next_target.Q = 0;
+
+	if (next_target.option_all_relative) {
+    next_target.target.axis[X] = next_target.target.axis[Y] = next_target.target.axis[Z] = next_target.target.axis[U] = 0;
+	}
+	if (next_target.option_all_relative || next_target.option_e_relative) {
+    next_target.target.axis[E] = 0;
+	}
+}
+
+#ifdef BINARY_GCODE
+/** Size of a binary frame.
+
+  \param mask The field mask, byte 1 of the frame.
+
+  \return Bytes of the whole frame, including G number and CRC.
+
+  Also used by the receive interrupt of serial.c, for telling frame bytes
+  from real-time characters.
+*/
+uint8_t gcode_frame_size(uint8_t mask) {
+  uint8_t size = 2 + 2;
+
+  if (mask & 0x40)
+    size += 4;
+  for ( ; mask; mask >>= 1)
+    if (mask & 1)
+      size += 4;
+
+  return size;
+}
+
+/// Read a little endian int32 from a binary frame and advance the pointer.
+static int32_t frame_int32(uint8_t **p) {
+  uint8_t *b = *p;
+
+  *p += 4;
+  return (int32_t)((uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+                   ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24));
+}
+
+/** Byte of a binary frame received.
+
+  \param c The next byte to process.
+
+  \return Whether the frame is complete.
+*/
+static uint8_t gcode_parse_binary(uint8_t c) {
+  uint8_t *p, mask;
+  enum axis_e axis;
+
+  frame[frame_len++] = c;
+  if (frame_len == 2)
+    frame_size = gcode_frame_size(c);
+  if (frame_len < 2 || frame_len < frame_size)
+    return 0;
+
+  frame_len = 0;
+  if (crc_block(frame, frame_size - 2) !=
+      (frame[frame_size - 2] | ((uint16_t)frame[frame_size - 1] << 8))) {
+    #ifdef REQUIRE_LINENUMBER
+      if (resend_pending)
+        return 1;
+      resend_pending = 1;
+    #endif
+    sersendf_P(PSTR("rs N%ld Bad binary frame\n"), next_target.N_expected);
+    return 1;
+  }
+
+  next_target.seen_G = 1;
+  next_target.G = frame[0] & 0x7F;
+  next_target.seen_M = 0;
+  next_target.M = 0;
+
+  p = &frame[2];
+  mask = frame[1];
+  for (axis = X; axis < AXIS_COUNT; axis++)
+    if (mask & (1 << axis))
+      next_target.target.axis[axis] = frame_int32(&p);
+  next_target.seen_X = (mask & (1 << X)) ? 1 : 0;
+  next_target.seen_Y = (mask & (1 << Y)) ? 1 : 0;
+  next_target.seen_Z = (mask & (1 << Z)) ? 1 : 0;
+  next_target.seen_U = (mask & (1 << U)) ? 1 : 0;
+  next_target.seen_E = (mask & (1 << E)) ? 1 : 0;
+  if (mask & 0x20) {
+    next_target.seen_F = 1;
+    next_target.target.F = frame_int32(&p);
+  }
+  if (mask & 0x40) {
+    next_target.seen_I = next_target.seen_J = 1;
+    next_target.I = frame_int32(&p);
+    next_target.J = frame_int32(&p);
+  }
+  if (mask & 0x80) {
+    next_target.seen_N = 1;
+    next_target.N = frame_int32(&p);
+  }
+
+  // The CRC replaces the line checksum.
+  next_target.seen_checksum = 1;
+  next_target.checksum_read = next_target.checksum_calculated = 0;
+
+  gcode_line_done();
+
+  return 1;
+}
+#endif /* BINARY_GCODE */
+
 /** Character received - add it to our command.
 
   \param c The next character to process.
@@ -123,6 +394,47 @@ void gcode_init(void) {
 uint8_t gcode_parse_char(uint8_t c) {
 	uint8_t checksum_char = c;
 
+  #ifdef BINARY_GCODE
+    if (frame_len ||
+        ((gcode_binary
+          #ifdef SD
+            || gcode_active == GCODE_SOURCE_SD
+          #endif
+         ) && (c & 0x80) &&
+         next_target.seen_semi_comment == 0 &&
+         next_target.seen_parens_comment == 0))
+      return gcode_parse_binary(c);
+  #endif
+
+  /**
+    Fast path for digits, which make up most of a line. A digit never ends a
+    field or a line, so all it can do outside comments and strings is adding
+    to the number being read.
+  */
+  if (c >= '0' && c <= '9' &&
+      next_target.seen_semi_comment == 0 &&
+      next_target.seen_parens_comment == 0 &&
+      next_target.read_string == 0) {
+    #ifdef SIMULATOR
+      sim_gcode_ch(c);
+    #endif
+    if (read_digit.exponent < DECFLOAT_EXP_MAX + 1 &&
+        ((next_target.option_inches == 0 &&
+        read_digit.mantissa < DECFLOAT_MANT_MM_MAX) ||
+        (next_target.option_inches &&
+        read_digit.mantissa < DECFLOAT_MANT_IN_MAX))) {
+      // this is simply mantissa = (mantissa * 10) + atoi(c) in different clothes
+      read_digit.mantissa = (read_digit.mantissa << 3) +
+                            (read_digit.mantissa << 1) + (c - '0');
+      if (read_digit.exponent)
+        read_digit.exponent++;
+    }
+    if (next_target.seen_checksum == 0)
+      next_target.checksum_calculated =
+        crc(next_target.checksum_calculated, c);
+    return 0;
+  }
+
 	// uppercase
 	if (c >= 'a' && c <= 'z')
 		c &= ~32;
@@ -160,48 +472,43 @@ uint8_t gcode_parse_char(uint8_t c) {
             }
           #endif
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
-						serwrite_uint8(next_target.M);
+						serwrite_uint16(next_target.M);
 					break;
 				case 'X':
-					if (next_target.option_inches)
-            next_target.target.axis[X] = decfloat_to_int(&read_digit, 25400);
-					else
-            next_target.target.axis[X] = decfloat_to_int(&read_digit, 1000);
+					next_target.target.axis[X] = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
             serwrite_int32(next_target.target.axis[X]);
 					break;
 				case 'Y':
-					if (next_target.option_inches)
-            next_target.target.axis[Y] = decfloat_to_int(&read_digit, 25400);
-					else
-            next_target.target.axis[Y] = decfloat_to_int(&read_digit, 1000);
+					next_target.target.axis[Y] = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
             serwrite_int32(next_target.target.axis[Y]);
 					break;
 				case 'Z':
-					if (next_target.option_inches)
-						next_target.target.axis[Z] = decfloat_to_int(&read_digit, 25400);
-					else
-						next_target.target.axis[Z] = decfloat_to_int(&read_digit, 1000);
+					next_target.target.axis[Z] = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
 						serwrite_int32(next_target.target.axis[Z]);
 					break;
 				case 'U':
-					if (next_target.option_inches)
-						next_target.target.axis[U] = decfloat_to_int(&read_digit, 25400);
-					else
-						next_target.target.axis[U] = decfloat_to_int(&read_digit, 1000);
+					next_target.target.axis[U] = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
 						serwrite_int32(next_target.target.axis[U]);
 					break;
 				case 'E':
-					if (next_target.option_inches)
-            next_target.target.axis[E] = decfloat_to_int(&read_digit, 25400);
-					else
-            next_target.target.axis[E] = decfloat_to_int(&read_digit, 1000);
+					next_target.target.axis[E] = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
             serwrite_int32(next_target.target.axis[E]);
 					break;
+				case 'I':
+					next_target.I = decfloat_to_um(&read_digit);
+					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+						serwrite_int32(next_target.I);
+					break;
+				case 'J':
+					next_target.J = decfloat_to_um(&read_digit);
+					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+						serwrite_int32(next_target.J);
+					break;
 				case 'F':
 					// just use raw integer, we need move distance and n_steps to convert it to a useful value, so wait until we have those to convert it
 					if (next_target.option_inches)
@@ -215,7 +522,10 @@ uint8_t gcode_parse_char(uint8_t c) {
 					// if this is temperature, multiply by 4 to convert to quarter-degree units
 					// cosmetically this should be done in the temperature section,
 					// but it takes less code, less memory and loses no precision if we do it here instead
-					if ((next_target.M == 104) || (next_target.M == 109) || (next_target.M == 140))
+					// same for report intervals, which count quarter seconds
+					if ((next_target.M == 104) || (next_target.M == 109) || (next_target.M == 140) ||
+					    (next_target.M == 154) || (next_target.M == 155) ||
+					    (next_target.M == 303))
 						next_target.S = decfloat_to_int(&read_digit, 4);
 					// if this is heater PID stuff, multiply by PID_SCALE because we divide by PID_SCALE later on
 					else if ((next_target.M >= 130) && (next_target.M <= 132))
@@ -226,9 +536,22 @@ uint8_t gcode_parse_char(uint8_t c) {
 						serwrite_int32(next_target.S);
 					break;
 				case 'P':
-					next_target.P = decfloat_to_int(&read_digit, 1);
+					// G5 wants a distance here, everything else an integer.
+					if (next_target.seen_G && next_target.G == 5) {
+						next_target.P_um = decfloat_to_um(&read_digit);
+						if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+							serwrite_int32(next_target.P_um);
+					}
+					else {
+						next_target.P = decfloat_to_int(&read_digit, 1);
+						if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+							serwrite_uint16(next_target.P);
+					}
+					break;
+				case 'Q':
+					next_target.Q = decfloat_to_um(&read_digit);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
-						serwrite_uint16(next_target.P);
+						serwrite_int32(next_target.Q);
 					break;
 				case 'T':
 					next_target.T = read_digit.mantissa;
@@ -257,22 +580,7 @@ uint8_t gcode_parse_char(uint8_t c) {
 		}
 
 		// process character
-    // Can't do ranges in switch..case, so process actual digits here.
-    // Do it early, as there are many more digits than characters expected.
-    if (c >= '0' && c <= '9') {
-      if (read_digit.exponent < DECFLOAT_EXP_MAX + 1 &&
-          ((next_target.option_inches == 0 &&
-          read_digit.mantissa < DECFLOAT_MANT_MM_MAX) ||
-          (next_target.option_inches &&
-          read_digit.mantissa < DECFLOAT_MANT_IN_MAX))) {
-        // this is simply mantissa = (mantissa * 10) + atoi(c) in different clothes
-        read_digit.mantissa = (read_digit.mantissa << 3) +
-                              (read_digit.mantissa << 1) + (c - '0');
-        if (read_digit.exponent)
-          read_digit.exponent++;
-      }
-    }
-    else {
+    // Digits never get here, see the fast path at the start.
       switch (c) {
         // Each currently known command is either G or M, so preserve
         // previous G/M unless a new one has appeared.
@@ -302,6 +610,15 @@ uint8_t gcode_parse_char(uint8_t c) {
 		    case 'E':
           next_target.seen_E = 1;
           break;
+        case 'I':
+          next_target.seen_I = 1;
+          break;
+        case 'J':
+          next_target.seen_J = 1;
+          break;
+        case 'Q':
+          next_target.seen_Q = 1;
+          break;
         case 'F':
           next_target.seen_F = 1;
           break;
@@ -358,7 +675,6 @@ uint8_t gcode_parse_char(uint8_t c) {
           #endif
           break;
       }
-		}
 	} else if ( next_target.seen_parens_comment == 1 && c == ')')
 		next_target.seen_parens_comment = 0; // recognize stuff after a (comment)
 
@@ -379,57 +695,7 @@ uint8_t gcode_parse_char(uint8_t c) {
       next_target.G = 1;
     }
 
-		if (
-		#ifdef	REQUIRE_LINENUMBER
-			((next_target.N >= next_target.N_expected) && (next_target.seen_N == 1)) ||
-			(next_target.seen_M && (next_target.M == 110))
-		#else
-			1
-		#endif
-			) {
-			if (
-				#ifdef	REQUIRE_CHECKSUM
-				((next_target.checksum_calculated == next_target.checksum_read) && (next_target.seen_checksum == 1))
-				#else
-				((next_target.checksum_calculated == next_target.checksum_read) || (next_target.seen_checksum == 0))
-				#endif
-				) {
-				// process
-				process_gcode_command();
-
-        // Acknowledgement ("ok") is sent in the main loop, in mendel.c.
-
-				// expect next line number
-				if (next_target.seen_N == 1)
-					next_target.N_expected = next_target.N + 1;
-			}
-			else {
-				sersendf_P(PSTR("rs N%ld Expected checksum %d\n"), next_target.N_expected, next_target.checksum_calculated);
-// 				request_resend();
-			}
-		}
-		else {
-			sersendf_P(PSTR("rs N%ld Expected line number %ld\n"), next_target.N_expected, next_target.N_expected);
-// 			request_resend();
-		}
-
-		// reset variables
-		next_target.seen_X = next_target.seen_Y = next_target.seen_Z = next_target.seen_U = \
-			next_target.seen_E = next_target.seen_F = next_target.seen_S = \
-			next_target.seen_P = next_target.seen_T = next_target.seen_N = \
-      next_target.seen_G = next_target.seen_M = next_target.seen_checksum = \
-      next_target.seen_semi_comment = next_target.seen_parens_comment = \
-      next_target.read_string = next_target.checksum_read = \
-      next_target.checksum_calculated = 0;
-      last_field = 0;
-      read_digit.sign = read_digit.mantissa = read_digit.exponent = 0;
-
-		if (next_target.option_all_relative) {
-      next_target.target.axis[X] = next_target.target.axis[Y] = next_target.target.axis[Z] = next_target.target.axis[U] = 0;
-		}
-		if (next_target.option_all_relative || next_target.option_e_relative) {
-      next_target.target.axis[E] = 0;
-		}
+    gcode_line_done();
 
     return 1;
 	}
@@ -452,6 +718,134 @@ uint8_t gcode_parse_char(uint8_t c) {
   return 0;
 }
 
+/** Feed the parser from the available G-code sources.
+
+  Sources get arbitrated per line. A source which started a line keeps the
+  parser until that line is done, so lines from different sources never get
+  mixed up. Then the next line goes to the first source with something to
+  offer, in this order of priority: serial, SD card, canned G-code. Serial
+  goes first, so the host can always step in, e.g. with M25.
+
+  SD card and canned G-code have all of a line at hand, so these get parsed
+  in one go, without waiting for the next round through the main loop.
+
+  Call this only when the movement queue has room.
+*/
+void gcode_schedule(void) {
+  #ifndef LINE_FIFO
+    uint8_t line_done;
+
+    /**
+      Postpone sending acknowledgement until there's a free slot in the
+      movement queue. This way the host waits with sending the next line
+      until it can be processed immediately. As a result, the serial receive
+      queue is always almost empty; it exists only for receiving via XON/XOFF
+      flow control. Another result is, the incoming line can be longer than
+      the receiving buffer, see Github issue #52.
+
+      At the time of the introduction of this strategy gcode_parse_char()
+      parsed a single character in 100 to 400 CPU clocks, processing
+      the line end took some 30'000 clocks. 115200 baud mean one character
+      incoming every about 1250 CPU clocks on AVR 16 MHz.
+    */
+    if (ack_waiting) {
+      serial_writestr_P(PSTR("ok\n"));
+      ack_waiting = 0;
+    }
+  #endif
+  #ifdef CANNED_CYCLE
+    static uint16_t canned_gcode_pos = 0;
+    uint8_t c;
+  #endif
+
+  if ( ! gcode_active) {
+    #ifdef LINE_FIFO
+      if (gcode_lines_waiting)
+    #else
+      if (serial_rxchars() != 0)
+    #endif
+        gcode_active = GCODE_SOURCE_SERIAL;
+    #ifdef SD
+      else if (gcode_sources & GCODE_SOURCE_SD)
+        gcode_active = GCODE_SOURCE_SD;
+    #endif
+    #ifdef CANNED_CYCLE
+      else if (gcode_sources & GCODE_SOURCE_CANNED)
+        gcode_active = GCODE_SOURCE_CANNED;
+    #endif
+  }
+
+  switch (gcode_active) {
+    case GCODE_SOURCE_SERIAL:
+      #ifdef LINE_FIFO
+        gcode_parse_line();
+        gcode_active = 0;
+      #else
+        // Take everything received so far, up to the end of the line, so a
+        // slow pass through clock() doesn't leave characters piling up.
+        do {
+          line_done = gcode_parse_char(serial_popchar());
+        } while ( ! line_done && serial_rxchars() != 0);
+        if (line_done) {
+          gcode_active = 0;
+          ack_waiting = 1;
+        }
+      #endif
+      break;
+
+    #ifdef SD
+    case GCODE_SOURCE_SD:
+      if (sd_read_gcode_line()) {
+        serial_writestr_P(PSTR("\nSD file done.\n"));
+        gcode_sources &= ~GCODE_SOURCE_SD;
+        // There is no pf_close(), subsequent reads will stick at EOF
+        // and return zeros.
+      }
+      gcode_active = 0;
+      break;
+    #endif
+
+    #ifdef CANNED_CYCLE
+    case GCODE_SOURCE_CANNED:
+      // Start over at the end of the string. The newline there ends a line
+      // which misses its own.
+      do {
+        c = pgm_read_byte(&canned_gcode_P[canned_gcode_pos]);
+        if (c) {
+          canned_gcode_pos++;
+        }
+        else {
+          canned_gcode_pos = 0;
+          c = '\n';
+        }
+      } while ( ! gcode_parse_char(c));
+      gcode_active = 0;
+      break;
+    #endif
+
+    default:
+      break;
+  }
+}
+
+/** Tell whether gcode_schedule() has work to do.
+
+  True for a line in progress, an acknowledgement not yet sent, received
+  characters or lines and for SD or canned G-code, which never run out until
+  they're done. The main loop sleeps only when this is false or the movement
+  queue is full.
+*/
+uint8_t gcode_pending(void) {
+  #ifdef LINE_FIFO
+    if (gcode_lines_waiting)
+  #else
+    if (ack_waiting || serial_rxchars() != 0)
+  #endif
+      return 1;
+
+  return gcode_active || (gcode_sources & ~GCODE_SOURCE_SERIAL);
+}
+
 /***************************************************************************\
 *                                                                           *
 * Request a resend of the current line - used from various places.          *
@@ -465,3 +859,54 @@ void request_resend(void) {
 	serwrite_uint8(next_target.N);
 	serial_writechar('\n');
 }
+
+#ifdef LINE_FIFO
+/** Move received characters into the line FIFO and acknowledge lines.
+
+  Receive and acknowledge regardless of the movement queue. The host may
+  send as many lines as the last Q:n said, minus what it sent since the
+  acknowledged line. No credit means the acknowledgement waits for the parser
+  to make room.
+
+  Besides the main loop, clock() calls this, so lines keep coming in while
+  processing a command waits for the movement queue, e.g. when splitting a
+  move into segments. Such a wait is where most of the time goes once the
+  queue is full, so the host can fill the FIFO meanwhile and the next line is
+  ready to parse the moment the wait ends.
+*/
+void gcode_receive(void) {
+  uint8_t chunk[16], i, n;
+
+  do {
+    n = buf_canwrite(line);
+    n = serial_read(chunk, n < sizeof(chunk) ? n : sizeof(chunk));
+    for (i = 0; i < n; i++) {
+      buf_push(line, chunk[i]);
+      if (chunk[i] == 10 || chunk[i] == 13) {
+        gcode_lines_waiting++;
+        lines_unacked++;
+      }
+    }
+  } while (n == sizeof(chunk));
+
+  if (lines_unacked && buf_canwrite(line) >= LINE_FIFO_LINE) {
+    sersendf_P(PSTR("ok Q:%u\n"),
+               (uint16_t)(buf_canwrite(line) / LINE_FIFO_LINE));
+    lines_unacked--;
+  }
+}
+
+/** Parse and process the oldest complete line in the line FIFO.
+
+  The line is complete, so parse all of it in one go. Check
+  gcode_lines_waiting first.
+*/
+void gcode_parse_line(void) {
+  uint8_t c;
+
+  do {
+    buf_pop(line, c);
+  } while ( ! gcode_parse_char(c));
+  gcode_lines_waiting--;
+}
+#endif /* LINE_FIFO */
@@ -37,6 +37,9 @@ typedef struct {
 		uint8_t					seen_P	:1;
 		uint8_t					seen_T	:1;
 		uint8_t					seen_N	:1;
+		uint8_t					seen_I	:1;
+		uint8_t					seen_J	:1;
+		uint8_t					seen_Q	:1;
 		uint8_t					seen_checksum				:1; ///< seen a checksum?
 		uint8_t					seen_semi_comment		:1; ///< seen a semicolon?
 		uint8_t					seen_parens_comment	:1; ///< seen an open parenthesis
@@ -53,9 +56,14 @@ typedef struct {
   uint16_t          P;          ///< P word (various uses)
 
 	uint8_t						G;				///< G command number
-	uint8_t						M;				///< M command number
+	uint16_t					M;				///< M command number
 	TARGET						target;		///< target position: X, Y, Z, E and F
 
+  int32_t           I;          ///< arc centre X offset (G2/G3), um
+  int32_t           J;          ///< arc centre Y offset (G2/G3), um
+  int32_t           P_um;       ///< P word in um (G5)
+  int32_t           Q;          ///< Q word in um (G5)
+
 	uint8_t						T;				///< T word (tool index)
 
 	uint8_t						checksum_read;				///< checksum in gcode command
@@ -65,6 +73,7 @@ typedef struct {
 enum gcode_source {
   GCODE_SOURCE_SERIAL  = 0b00000001,
   GCODE_SOURCE_SD      = 0b00000010,
+  GCODE_SOURCE_CANNED  = 0b00000100,
 };
 
 
@@ -74,6 +83,14 @@ extern enum gcode_source gcode_active;
 /// the command being processed
 extern GCODE_COMMAND next_target;
 
+#ifdef BINARY_GCODE
+  /// Whether binary frames are accepted, see M424.
+  extern uint8_t gcode_binary;
+
+  /// size of a binary frame with the given field mask
+  uint8_t gcode_frame_size(uint8_t mask);
+#endif
+
 #ifdef SD
   /// For storing incoming strings. Currently the only use is SD card filename.
   extern char gcode_str_buf[];
@@ -84,6 +101,19 @@ void gcode_init(void);
 /// accept the next character and process it
 uint8_t gcode_parse_char(uint8_t c);
 
+/// feed the parser from the available sources
+void gcode_schedule(void);
+
+/// whether gcode_schedule() has work to do
+uint8_t gcode_pending(void);
+
+#ifdef LINE_FIFO
+  extern uint8_t gcode_lines_waiting;
+
+  void gcode_receive(void);
+  void gcode_parse_line(void);
+#endif
+
 // uses the global variable next_target.N
 void request_resend(void);
 
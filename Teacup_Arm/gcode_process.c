@@ -11,6 +11,7 @@
 #include "cpu.h"
 #include	"dda.h"
 #include	"dda_queue.h"
+#include	"memory_barrier.h"
 #include	"watchdog.h"
 #include	"delay.h"
 #include	"serial.h"
@@ -23,7 +24,14 @@
 #include	"clock.h"
 #include	"config_wrapper.h"
 #include	"home.h"
+#include "jog.h"
+#include "bench.h"
 #include "sd.h"
+#include "profile.h"
+#include "trace.h"
+#include "ram.h"
+#include "steplink.h"
+#include "settings.h"
 
 
 /// the current tool
@@ -32,6 +40,110 @@ uint8_t tool;
 /// the tool to be changed when we get an M6
 uint8_t next_tool;
 
+/// number of fixture offsets, G54 to G59
+#define FIXTURES 6
+
+/// fixture offsets, machine position of the work origin, see G10
+static axes_int32_t fixture_offset[FIXTURES];
+
+/// tool offset, wrist centre relative to the tool tip, see G43
+static axes_int32_t tool_offset;
+
+/// the active fixture, 0 for G54
+static uint8_t fixture = 0;
+
+/// whether the tool offset applies
+static uint8_t tool_offset_on = 0;
+
+/** Precalculate work_offset from the active fixture and tool offsets.
+
+  Startpoint and targets are machine positions, so changing offsets doesn't
+  move anything, only G-code coordinates given from now on mean other
+  machine positions.
+*/
+static void work_offset_update(void) {
+  enum axis_e i;
+
+  for (i = X; i < E; i++) {
+    work_offset[i] = fixture_offset[fixture][i];
+    if (tool_offset_on)
+      work_offset[i] += tool_offset[i];
+  }
+}
+
+/** Take axis words of G10 or G43 into an offset.
+
+  \param offset Offset to change, axes not given stay as they are.
+
+  Same as for M-codes, these axis words are no coordinates, so they get
+  taken back from the target of the next move.
+*/
+static void axes_offset(int32_t *offset) {
+  uint8_t seen[E] = {
+    next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+    next_target.seen_U
+  };
+  enum axis_e i;
+
+  for (i = X; i < E; i++) {
+    if ( ! seen[i])
+      continue;
+    offset[i] = next_target.target.axis[i];
+    next_target.target.axis[i] = startpoint.axis[i];
+  }
+  work_offset_update();
+}
+
+#ifdef SPINDLE
+/** Queue a change of laser or spindle power.
+
+  \param power New power, 0 to 255.
+  \param dynamic Whether power scales with speed, see M4.
+
+  All following moves carry the new power. To switch in sync with the
+  moves queued already, the change gets queued as a null move to where we
+  are.
+*/
+static void spindle_set(uint8_t power, uint8_t dynamic) {
+  TARGET t;
+
+  next_target.target.spindle = power;
+  next_target.target.spindle_dynamic = dynamic;
+
+  memcpy(&t, &startpoint, sizeof(TARGET));
+  t.axis[E] = 0;
+  t.e_relative = 1;
+  t.spindle = power;
+  t.spindle_dynamic = dynamic;
+  enqueue(&t);
+}
+#endif
+
+/** Take axis words of a settings M-code, like M92 X80.
+
+  \param setting Settings to change, one per axis.
+  \param divisor Axis words come in thousandths, divide them by this.
+
+  Only axes given with a positive value get changed. These axis words aren't
+  coordinates, so they get taken back from the target of the next move.
+*/
+static void axes_setting(uint32_t *setting, uint32_t divisor) {
+  uint8_t seen[AXIS_COUNT] = {
+    next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+    next_target.seen_U, next_target.seen_E
+  };
+  enum axis_e i;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    if ( ! seen[i])
+      continue;
+    if (next_target.target.axis[i] >= (int32_t)divisor)
+      setting[i] = next_target.target.axis[i] / divisor;
+    next_target.target.axis[i] = startpoint.axis[i];
+  }
+  settings_apply();
+}
+
 /************************************************************************//**
 
   \brief Processes command stored in global \ref next_target.
@@ -45,55 +157,76 @@ uint8_t next_tool;
 void process_gcode_command() {
 	uint32_t	backup_f;
 
-	// convert relative to absolute
-	if (next_target.option_all_relative) {
-    next_target.target.axis[X] += startpoint.axis[X];
-    next_target.target.axis[Y] += startpoint.axis[Y];
-    next_target.target.axis[Z] += startpoint.axis[Z];
-    next_target.target.axis[U] += startpoint.axis[U];
-	}
-
-	// E relative movement.
-	// Matches Sprinter's behaviour as of March 2012.
-	if (next_target.option_all_relative || next_target.option_e_relative)
-		next_target.target.e_relative = 1;
-	else
-		next_target.target.e_relative = 0;
-
-	// implement axis limits
-	#ifdef	X_MIN
-    if (next_target.target.axis[X] < (int32_t)(X_MIN * 1000.))
-      next_target.target.axis[X] = (int32_t)(X_MIN * 1000.);
-	#endif
-	#ifdef	X_MAX
-    if (next_target.target.axis[X] > (int32_t)(X_MAX * 1000.))
-      next_target.target.axis[X] = (int32_t)(X_MAX * 1000.);
-	#endif
-	#ifdef	Y_MIN
-    if (next_target.target.axis[Y] < (int32_t)(Y_MIN * 1000.))
-      next_target.target.axis[Y] = (int32_t)(Y_MIN * 1000.);
-	#endif
-	#ifdef	Y_MAX
-    if (next_target.target.axis[Y] > (int32_t)(Y_MAX * 1000.))
-      next_target.target.axis[Y] = (int32_t)(Y_MAX * 1000.);
-	#endif
-	#ifdef	Z_MIN
-    if (next_target.target.axis[Z] < (int32_t)(Z_MIN * 1000.))
-      next_target.target.axis[Z] = (int32_t)(Z_MIN * 1000.);
-	#endif
-	#ifdef	Z_MAX
-    if (next_target.target.axis[Z] > (int32_t)(Z_MAX * 1000.))
-      next_target.target.axis[Z] = (int32_t)(Z_MAX * 1000.);
-	#endif
-  #ifdef	U_MIN
-    if (next_target.target.axis[U] < (int32_t)(U_MIN * 1000.))
-      next_target.target.axis[U] = (int32_t)(U_MIN * 1000.);
-  #endif
-  #ifdef	U_MAX
-    if (next_target.target.axis[U] > (int32_t)(U_MAX * 1000.))
-      next_target.target.axis[U] = (int32_t)(U_MAX * 1000.);
+  #ifdef JOG
+    // G-codes move from where a jog stopped.
+    if (next_target.seen_G)
+      jog_release();
   #endif
 
+  // Axis words of M-codes, G10 and G43 are settings, not coordinates.
+  if ( ! next_target.seen_M &&
+       ! (next_target.seen_G && (next_target.G == 10 || next_target.G == 43))) {
+    // convert relative to absolute
+    if (next_target.option_all_relative) {
+      next_target.target.axis[X] += startpoint.axis[X];
+      next_target.target.axis[Y] += startpoint.axis[Y];
+      next_target.target.axis[Z] += startpoint.axis[Z];
+      next_target.target.axis[U] += startpoint.axis[U];
+    }
+    else {
+      // Work offsets, see G54. Axes not given are machine positions already.
+      if (next_target.seen_X)
+        next_target.target.axis[X] += work_offset[X];
+      if (next_target.seen_Y)
+        next_target.target.axis[Y] += work_offset[Y];
+      if (next_target.seen_Z)
+        next_target.target.axis[Z] += work_offset[Z];
+      if (next_target.seen_U)
+        next_target.target.axis[U] += work_offset[U];
+    }
+
+    // E relative movement.
+    // Matches Sprinter's behaviour as of March 2012.
+    if (next_target.option_all_relative || next_target.option_e_relative)
+      next_target.target.e_relative = 1;
+    else
+      next_target.target.e_relative = 0;
+
+    // implement axis limits
+    #ifdef	X_MIN
+      if (next_target.target.axis[X] < (int32_t)(X_MIN * 1000.))
+        next_target.target.axis[X] = (int32_t)(X_MIN * 1000.);
+    #endif
+    #ifdef	X_MAX
+      if (next_target.target.axis[X] > (int32_t)(X_MAX * 1000.))
+        next_target.target.axis[X] = (int32_t)(X_MAX * 1000.);
+    #endif
+    #ifdef	Y_MIN
+      if (next_target.target.axis[Y] < (int32_t)(Y_MIN * 1000.))
+        next_target.target.axis[Y] = (int32_t)(Y_MIN * 1000.);
+    #endif
+    #ifdef	Y_MAX
+      if (next_target.target.axis[Y] > (int32_t)(Y_MAX * 1000.))
+        next_target.target.axis[Y] = (int32_t)(Y_MAX * 1000.);
+    #endif
+    #ifdef	Z_MIN
+      if (next_target.target.axis[Z] < (int32_t)(Z_MIN * 1000.))
+        next_target.target.axis[Z] = (int32_t)(Z_MIN * 1000.);
+    #endif
+    #ifdef	Z_MAX
+      if (next_target.target.axis[Z] > (int32_t)(Z_MAX * 1000.))
+        next_target.target.axis[Z] = (int32_t)(Z_MAX * 1000.);
+    #endif
+    #ifdef	U_MIN
+      if (next_target.target.axis[U] < (int32_t)(U_MIN * 1000.))
+        next_target.target.axis[U] = (int32_t)(U_MIN * 1000.);
+    #endif
+    #ifdef	U_MAX
+      if (next_target.target.axis[U] > (int32_t)(U_MAX * 1000.))
+        next_target.target.axis[U] = (int32_t)(U_MAX * 1000.);
+    #endif
+  }
+
 	// The GCode documentation was taken from http://reprap.org/wiki/Gcode .
 
 	if (next_target.seen_T) {
@@ -133,27 +266,80 @@ void process_gcode_command() {
 				enqueue(&next_target.target);
 				break;
 
+			#ifdef ARC_SEGMENT_LENGTH
+			case 2:
+				//? --- G2: Clockwise Arc ---
+				//?
+				//? Example: G2 X10 Y20 I5 J0
+				//?
+				//? Move along a clockwise arc in the XY plane from the current point to (10, 20).  I and J give the centre of the arc, relative to the current point, they're always relative.  Z, U and E move linearly along, so this also does helices.  The arc is cut into chords of about ARC_SEGMENT_LENGTH on the controller, so there's no need to send lots of short G1 moves.  Same start and end point gives a full circle.
+				//?
+			case 3:
+				//? --- G3: Counter-clockwise Arc ---
+				//?
+				//? Example: G3 X10 Y20 I5 J0
+				//?
+				//? Same as G2, but counter-clockwise.
+				//?
+				if ( ! next_target.seen_I && ! next_target.seen_J) {
+					sersendf_P(PSTR("E: G%d needs I or J\n"), next_target.G);
+					break;
+				}
+				enqueue_arc(&next_target.target, next_target.I, next_target.J,
+				            next_target.G == 2);
+				break;
+			#else
 				//	G2 - Arc Clockwise
 				// unimplemented
 
 				//	G3 - Arc Counter-clockwise
 				// unimplemented
+			#endif
 
 			case 4:
 				//? --- G4: Dwell ---
 				//?
 				//? Example: G4 P200
 				//?
-				//? In this case sit still doing nothing for 200 milliseconds.  During delays the state of the machine (for example the temperatures of its extruders) will still be preserved and controlled.
+				//? In this case sit still doing nothing for 200 milliseconds, after the moves queued before.  During delays the state of the machine (for example the temperatures of its extruders) will still be preserved and controlled.  The dwell is queued like a move, so commands after it get read and planned meanwhile.
 				//?
-				queue_wait();
-				// delay
-				if (next_target.seen_P) {
-					for (;next_target.P > 0;next_target.P--) {
-						clock();
-						delay_ms(1);
-					}
+				//? Without P, or with P0, this waits until all queued moves are done, instead.
+				//?
+				if (next_target.seen_P && next_target.P)
+					enqueue_dwell(next_target.P);
+				else
+					queue_wait();
+				break;
+
+			#ifdef BEZIER_TOLERANCE
+			case 5:
+				//? --- G5: Cubic Bezier Curve ---
+				//?
+				//? Example: G5 I0 J10 P-10 Q0 X30 Y20
+				//?
+				//? Move along a cubic Bezier curve in the XY plane from the current point to (30, 20).  I and J give the first control point relative to the current point, P and Q the second control point relative to the end point.  Z, U and E move linearly along.  The curve is cut into straight moves deviating no more than BEZIER_TOLERANCE from the curve on the controller.
+				//?
+				enqueue_bezier(&next_target.target, next_target.I, next_target.J,
+				               next_target.P_um, next_target.Q);
+				break;
+			#endif
+
+			case 10:
+				//? --- G10: Set fixture offset ---
+				//?
+				//? Example: G10 P2 X100 Y-50 Z12
+				//?
+				//? Sets the machine position of the work origin for coordinate
+				//? system P, 1 to 6 for G54 to G59. Without P, the active one gets
+				//? changed. Axes not given keep their offsets. Nothing moves, the
+				//? new offsets apply to coordinates given from now on.
+				//?
+				if (next_target.seen_P && next_target.P > FIXTURES) {
+					sersendf_P(PSTR("E: no fixture %u\n"), next_target.P);
+					break;
 				}
+				axes_offset(fixture_offset[(next_target.seen_P && next_target.P) ?
+				                           next_target.P - 1 : fixture]);
 				break;
 
 			case 20:
@@ -191,7 +377,8 @@ void process_gcode_command() {
         //? This causes the RepRap machine to search for its X, Y and Z
         //? endstops. It does so at high speed, so as to get there fast. When
         //? it arrives it backs off slowly until the endstop is released again.
-        //? Backing off slowly ensures more accurate positioning.
+        //? Backing off slowly ensures more accurate positioning. All axes
+        //? search at the same time, each stopping on its own endstop.
 				//?
         //? If you add axis characters, then just the axes specified will be
         //? seached. Thus
@@ -204,43 +391,67 @@ void process_gcode_command() {
 
 				queue_wait();
 
-				if (next_target.seen_X) {
-					#if defined	X_MIN_PIN
-						home_x_negative();
-					#elif defined X_MAX_PIN
-						home_x_positive();
-					#endif
-					axisSelected = 1;
-				}
-				if (next_target.seen_Y) {
-					#if defined	Y_MIN_PIN
-						home_y_negative();
-					#elif defined Y_MAX_PIN
-						home_y_positive();
-					#endif
-					axisSelected = 1;
-				}
-				if (next_target.seen_Z) {
-          #if defined Z_MIN_PIN
-					    home_z_negative();
-          #elif defined Z_MAX_PIN
-					    home_z_positive();
-          #endif
-					axisSelected = 1;
-				}
-				if (next_target.seen_U) {
-          #if defined U_MIN_PIN
-					     home_u_negative();
-          #elif defined U_MAX_PIN
-					    home_u_positive();
-          #endif
-					axisSelected = 1;
-				}
+        // All selected axes are searched at once, see home_axes().
+				if (next_target.seen_X)
+					axisSelected |= 1 << X;
+				if (next_target.seen_Y)
+					axisSelected |= 1 << Y;
+				if (next_target.seen_Z)
+					axisSelected |= 1 << Z;
+				if (next_target.seen_U)
+					axisSelected |= 1 << U;
 				// there's no point in moving E, as E has no endstops
 
-				if (!axisSelected) {
+				if (axisSelected)
+					home_axes(axisSelected);
+				else
 					home();
-				}
+				break;
+
+			case 43:
+				//? --- G43: Apply tool offset ---
+				//?
+				//? Example: G43 Z-45
+				//?
+				//? Applies the offset of the wrist centre from the tool tip, so
+				//? coordinates given from now on are the ones of the tool tip.
+				//? Axes given change the offset, G43 alone applies the previous
+				//? one again. Like the fixture offsets, this is a translation
+				//? only, it doesn't turn with the wrist.
+				//?
+				tool_offset_on = 1;
+				axes_offset(tool_offset);
+				break;
+
+			case 49:
+				//? --- G49: Cancel tool offset ---
+				//?
+				//? Example: G49
+				//?
+				//? Coordinates given from now on are the ones of the wrist centre
+				//? again.
+				//?
+				tool_offset_on = 0;
+				work_offset_update();
+				break;
+
+			case 54:
+			case 55:
+			case 56:
+			case 57:
+			case 58:
+			case 59:
+				//? --- G54 to G59: Select coordinate system ---
+				//?
+				//? Example: G55
+				//?
+				//? Coordinates given from now on are relative to the work origin
+				//? set for this system with G10, G54 is the default. Fixture
+				//? offsets start out zero, so G54 equals machine coordinates until
+				//? changed. M114 reports coordinates of the active system.
+				//?
+				fixture = next_target.G - 54;
+				work_offset_update();
 				break;
 
 			case 90:
@@ -305,10 +516,10 @@ void process_gcode_command() {
 				}
 
 				if (axisSelected == 0) {
-          startpoint.axis[X] = next_target.target.axis[X] =
-          startpoint.axis[Y] = next_target.target.axis[Y] =
-          startpoint.axis[Z] = next_target.target.axis[Z] =
-          startpoint.axis[U] = next_target.target.axis[U] =
+          startpoint.axis[X] = next_target.target.axis[X] = work_offset[X];
+          startpoint.axis[Y] = next_target.target.axis[Y] = work_offset[Y];
+          startpoint.axis[Z] = next_target.target.axis[Z] = work_offset[Z];
+          startpoint.axis[U] = next_target.target.axis[U] = work_offset[U];
           startpoint.axis[E] = next_target.target.axis[E] = 0;
 				}
 
@@ -411,7 +622,10 @@ void process_gcode_command() {
       case 21:
         //? --- M21: initialise SD card. ---
         //?
-        //? Has to be done before doing any other operation, including M20.
+        //? Not mandatory, M20 and M23 do this on their own if needed. Use it
+        //? to mount another card without a previous M22. With SD_FILE_CACHE
+        //? this also re-reads the file cache, use it after changing files on
+        //? the card.
         sd_mount();
         break;
 
@@ -429,7 +643,8 @@ void process_gcode_command() {
         //? --- M23: select file. ---
         //?
         //? This opens a file for reading. This file is valid up to M22 or up
-        //? to the next M23.
+        //? to the next M23. With BINARY_GCODE the file may contain binary
+        //? frames as well, see M424.
         sd_open(gcode_str_buf);
         break;
 
@@ -447,8 +662,63 @@ void process_gcode_command() {
         //? This removes the SD card from the bitfield of available G-code
         //? sources. The file is kept open. The position inside the file
         //? is kept as well, to allow resuming.
-        gcode_sources &= ! GCODE_SOURCE_SD;
+        gcode_sources &= ~GCODE_SOURCE_SD;
+        break;
+
+      case 26:
+        //? --- M26: set SD position ---
+        //?
+        //? Example: M26 S12345
+        //?
+        //? Continue reading the file selected with M23 at byte position S,
+        //? which should be the start of a line. The next M24 starts there.
+        //? The parser limits S to some 4 million.
+        //?
+        if (next_target.seen_S)
+          sd_seek(next_target.S);
+        break;
+
+      case 27:
+        //? --- M27: report SD print status ---
+        //?
+        //? Example: M27
+        //?
+        //? Reports the file position of the line currently being executed,
+        //? and the size of the file, like "SD printing byte 1234/56789".
+        //?
+        sd_print_position();
+        break;
+
+      #ifdef EECONFIG
+      case 426:
+        //? --- M426: save SD resume point ---
+        //?
+        //? Example: M426
+        //?
+        //? Stores the file position of the line currently being executed
+        //? and the current position in EEPROM, for resuming with M427,
+        //? even after a reset. For the position to be the one the machine
+        //? actually stops at, pause with M25 and wait for moves to finish
+        //? first.
+        //? This command is only available with SD and EECONFIG, see config.h.
+        //?
+        sd_resume_save();
+        break;
+
+      case 427:
+        //? --- M427: resume SD print ---
+        //?
+        //? Example: M23 job.gco, then M427
+        //?
+        //? Resumes the file selected with M23 from the point saved with M426,
+        //? without reading the lines before. The machine has to stand at the
+        //? saved position, which becomes the current one. Works with
+        //? absolute positioning, only.
+        //? This command is only available with SD and EECONFIG, see config.h.
+        //?
+        sd_resume();
         break;
+      #endif /* EECONFIG */
       #endif /* SD */
 
 			case 82:
@@ -477,7 +747,35 @@ void process_gcode_command() {
 				break;
 
 			// M3/M101- extruder on
+			#ifdef SPINDLE
 			case 3:
+			case 4:
+				//? --- M3: laser or spindle on ---
+				//? --- M4: laser or spindle on, dynamic power ---
+				//?
+				//? Example: M3 S200
+				//?
+				//? Switch the laser or spindle on, with power 200 of 255, after the moves queued before. No S gives full power. With M4, power scales with the speed of each move relative to its target speed, it's off at standstill.
+				//?
+				//? This command is only available with SPINDLE, see config.h.
+				//?
+				spindle_set(next_target.seen_S ?
+				            (next_target.S > 255 ? 255 : next_target.S) : 255,
+				            next_target.M == 4);
+				break;
+
+			case 5:
+				//? --- M5: laser or spindle off ---
+				//?
+				//? Switch the laser or spindle off, after the moves queued before.
+				//?
+				//? This command is only available with SPINDLE, see config.h.
+				//?
+				spindle_set(0, 0);
+				break;
+			#else
+			case 3:
+			#endif
 			case 101:
 				//? --- M101: extruder on ---
 				//?
@@ -491,7 +789,9 @@ void process_gcode_command() {
 				break;
 
 			// M5/M103- extruder off
+			#ifndef SPINDLE
 			case 5:
+			#endif
 			case 103:
 				//? --- M103: extruder off ---
 				//?
@@ -514,6 +814,9 @@ void process_gcode_command() {
         //? sensor index to address (e.g. M104 P1 S100 will set the temperature
         //? of the heater connected to the second temperature sensor rather
         //? than the extruder temperature).
+        //?
+        //? With ENFORCE_ORDER the change happens as the moves queued before
+        //? end, without stopping movement.
         //?
 				if ( ! next_target.seen_S)
 					break;
@@ -523,7 +826,11 @@ void process_gcode_command() {
           #else
             next_target.P = 0;
           #endif
-				temp_set(next_target.P, next_target.S);
+        #ifdef ENFORCE_ORDER
+          enqueue_action(ACTION_TEMP, next_target.P, next_target.S);
+        #else
+          temp_set(next_target.P, next_target.S);
+        #endif
 				break;
 
 			case 105:
@@ -559,11 +866,10 @@ void process_gcode_command() {
         //? Teacup supports an optional P parameter as a zero-based heater
         //? index to address. The heater index can differ from the temperature
         //? sensor index, see config.h.
+        //?
+        //? With ENFORCE_ORDER the change happens as the moves queued before
+        //? end, without stopping movement.
 
-				#ifdef ENFORCE_ORDER
-					// wait for all moves to complete
-					queue_wait();
-				#endif
         if ( ! next_target.seen_P)
           #ifdef HEATER_FAN
             next_target.P = HEATER_FAN;
@@ -572,7 +878,11 @@ void process_gcode_command() {
           #endif
 				if ( ! next_target.seen_S)
 					break;
-        heater_set(next_target.P, next_target.S);
+        #ifdef ENFORCE_ORDER
+          enqueue_action(ACTION_HEATER, next_target.P, next_target.S);
+        #else
+          heater_set(next_target.P, next_target.S);
+        #endif
 				break;
 
 			case 110:
@@ -636,16 +946,15 @@ void process_gcode_command() {
 				//?
 				//? <tt>ok C: X:0.00 Y:0.00 Z:0.00 E:0.00</tt>
 				//?
+				//? With KINEMATICS_ARM4 joint angles in degrees follow, base,
+				//? shoulder, elbow and wrist, like <tt>J:18.434/66.741/-115.502/48.761</tt>.
+				//? Coordinates during a move are calculated from them.
+				//?
 				#ifdef ENFORCE_ORDER
 					// wait for all moves to complete
 					queue_wait();
 				#endif
-				update_current_position();
-				sersendf_P(PSTR("X:%lq,Y:%lq,Z:%lq,U:%lq,E:%lq,F:%lu\n"),
-                        current_position.axis[X], current_position.axis[Y],
-                        current_position.axis[Z], current_position.axis[U],
-                        current_position.axis[E],
-				                current_position.F);
+				print_current_position();
 
         if (DEBUG_POSITION && (debug_flags & DEBUG_POSITION)) {
           sersendf_P(PSTR("Endpoint: X:%ld,Y:%ld,Z:%ld,U:%ld,E:%ld,F:%lu,c:%lu}\n"),
@@ -687,6 +996,9 @@ void process_gcode_command() {
 				//? Example: M116
 				//?
 				//? Wait for temperatures and other slowly-changing variables to arrive at their set values.
+				//?
+				//? With TEMP_WAIT_DEFERRED (see config.h), moves not moving the
+				//? extruder still run, only the first extruding move waits.
 
 				enqueue(NULL);
 				break;
@@ -831,16 +1143,65 @@ void process_gcode_command() {
 				#ifdef	HEATER_BED
 					if ( ! next_target.seen_S)
 						break;
-					temp_set(HEATER_BED, next_target.S);
+          #ifdef ENFORCE_ORDER
+            enqueue_action(ACTION_TEMP, HEATER_BED, next_target.S);
+          #else
+            temp_set(HEATER_BED, next_target.S);
+          #endif
 				#endif
 				break;
 
+      case 154:
+        //? --- M154: automatic position report ---
+        //?
+        //? Example: M154 S0.5
+        //?
+        //? Sends the current position every S seconds, in the same format as
+        //? M114, until turned off with S0. The interval is rounded to
+        //? quarter seconds, 63.75 seconds at most. Saves the host polling.
+        //?
+        if (next_target.S < 0 || ! next_target.seen_S)
+          next_target.S = 0;
+        autoreport_pos_interval = next_target.S > 255 ? 255 : next_target.S;
+        break;
+
+      case 155:
+        //? --- M155: automatic temperature report ---
+        //?
+        //? Example: M155 S1
+        //?
+        //? Sends temperatures every S seconds, in the same format as M105
+        //? without P, until turned off with S0. Interval as with M154.
+        //?
+        if (next_target.S < 0 || ! next_target.seen_S)
+          next_target.S = 0;
+        autoreport_temp_interval = next_target.S > 255 ? 255 : next_target.S;
+        break;
+
       case 220:
         //? --- M220: Set speed factor override percentage ---
+        //?
+        //? Example: M220 S120
+        //?
+        //? Run moves at 120% of their feedrate. With FEED_OVERRIDE, see
+        //? config.h, this applies to the running move and all queued moves
+        //? at once, limited to 10% to 400%, else to moves queued from now on.
+        //?
         if ( ! next_target.seen_S)
           break;
         // Scale 100% = 256
-        next_target.target.f_multiplier = (next_target.S * 64 + 12) / 25;
+        #ifdef FEED_OVERRIDE
+          if (next_target.S < 10)
+            next_target.S = 10;
+          if (next_target.S > 400)
+            next_target.S = 400;
+          // The serial receive interrupt may change it, too.
+          ATOMIC_START
+            feed_override = (next_target.S * 64 + 12) / 25;
+          ATOMIC_END
+        #else
+          next_target.target.f_multiplier = (next_target.S * 64 + 12) / 25;
+        #endif
         break;
 
       case 221:
@@ -851,6 +1212,234 @@ void process_gcode_command() {
         next_target.target.e_multiplier = (next_target.S * 64 + 12) / 25;
         break;
 
+      case 92:
+        //? --- M92: set steps per mm ---
+        //?
+        //? Example: M92 X80 E95.5
+        //?
+        //? Sets motor steps per mm of the given axes, overriding
+        //? STEPS_PER_M_* of config.h. Waits for moves to finish; the current
+        //? position stays the same in mm. With LOOKAHEAD, X and Y have to
+        //? stay the same. Use M500 to keep the change after a reset.
+        //?
+        queue_wait();
+        axes_setting(settings.steps_per_m, 1);
+        break;
+
+      case 201:
+        //? --- M201: set maximum acceleration ---
+        //?
+        //? Example: M201 X1000 Z100
+        //?
+        //? Sets acceleration of the given axes in mm/s^2, overriding
+        //? ACCELERATION of config.h, starting with the next move queued.
+        //?
+        axes_setting(settings.acceleration, 1000);
+        break;
+
+      case 203:
+        //? --- M203: set maximum feedrate ---
+        //?
+        //? Example: M203 X12000 E1200
+        //?
+        //? Sets maximum feedrate of the given axes in mm/min, overriding
+        //? MAXIMUM_FEEDRATE_* of config.h, starting with the next move queued.
+        //?
+        axes_setting(settings.maximum_feedrate, 1000);
+        break;
+
+      #ifdef LOOKAHEAD
+      case 205:
+        //? --- M205: set maximum jerk ---
+        //?
+        //? Example: M205 X600 Y600
+        //?
+        //? Sets maximum jerk of the given axes in mm/min, overriding MAX_JERK_*
+        //? of config.h, starting with the next move queued.
+        //?
+        //? This command is only available with LOOKAHEAD, see config.h.
+        //?
+        axes_setting(settings.maximum_jerk, 1000);
+        break;
+      #endif /* LOOKAHEAD */
+
+      #ifdef EECONFIG
+      case 500:
+        //? --- M500: save settings to EEPROM ---
+        //?
+        //? Example: M500
+        //?
+        //? Stores the settings of M92, M201, M203 and M205 in EEPROM, so they
+        //? get used after a reset, too.
+        //?
+        //? This command is only available with EECONFIG, see config.h.
+        //?
+        settings_save();
+        break;
+
+      case 501:
+        //? --- M501: read settings from EEPROM ---
+        //?
+        //? Example: M501
+        //?
+        //? Goes back to the settings last saved with M500, if there are any.
+        //?
+        //? This command is only available with EECONFIG, see config.h.
+        //?
+        queue_wait();
+        if ( ! settings_load())
+          serial_writestr_P(PSTR("No saved settings\n"));
+        break;
+      #endif /* EECONFIG */
+
+      case 502:
+        //? --- M502: default settings ---
+        //?
+        //? Example: M502
+        //?
+        //? Goes back to the settings of config.h. Saved settings stay in
+        //? EEPROM until the next M500.
+        //?
+        queue_wait();
+        settings_reset();
+        break;
+
+      #ifdef SD_LOG
+      case 928:
+        //? --- M928: start logging to SD ---
+        //?
+        //? Example: M23 log.txt, then M928
+        //?
+        //? Logs telemetry into the file selected with M23, overwriting it,
+        //? one line every SD_LOG seconds, until M29 or the file is full.
+        //? The file has to exist on the card, big enough. Each line has
+        //? uptime in seconds, moves queued, temperatures, moves created,
+        //? moves joined, queue underruns and lowest crossing speed (see
+        //? M422). Don't print from SD while logging, it's for serial jobs.
+        //? This command is only available with SD_LOG, see config.h.
+        //?
+        sd_log_start();
+        break;
+
+      case 29:
+        //? --- M29: stop logging to SD ---
+        //?
+        //? Example: M29
+        //?
+        //? Writes the lines logged since M928 and stops logging. The rest
+        //? of the file's last sector is filled with zeros.
+        //? This command is only available with SD_LOG, see config.h.
+        //?
+        sd_log_stop();
+        break;
+      #endif /* SD_LOG */
+
+      #ifdef SD_RECORD
+      case 435:
+        //? --- M435: start recording positions to SD ---
+        //?
+        //? Example: M23 teach.bin, then M435
+        //?
+        //? Records the position every SD_RECORD milliseconds into the file
+        //? selected with M23, overwriting it, until M436 or the file is full.
+        //? The file has to exist on the card, big enough for the recording,
+        //? 16 bytes per sample. Move the machine meanwhile, e.g. by jogging.
+        //? Don't print from SD while recording.
+        //? This command is only available with SD_RECORD, see config.h.
+        //?
+        sd_record_start();
+        break;
+
+      case 436:
+        //? --- M436: stop recording positions ---
+        //?
+        //? Example: M436
+        //?
+        //? Ends the recording started with M435 and reports the number of
+        //? samples taken.
+        //? This command is only available with SD_RECORD, see config.h.
+        //?
+        sd_record_stop();
+        break;
+
+      case 437:
+        //? --- M437: replay recorded positions ---
+        //?
+        //? Example: M23 teach.bin, then M437
+        //?
+        //? Moves through the positions recorded with M435, at the speed they
+        //? were recorded with. Pauses become dwells. The first move goes
+        //? from wherever the machine is to the first sample, so go to the
+        //? start of the recording first.
+        //? This command is only available with SD_RECORD, see config.h.
+        //?
+        if (sd_replay()) {
+          next_target.target.axis[X] = startpoint.axis[X];
+          next_target.target.axis[Y] = startpoint.axis[Y];
+          next_target.target.axis[Z] = startpoint.axis[Z];
+          next_target.target.axis[U] = startpoint.axis[U];
+        }
+        else {
+          serial_writestr_P(PSTR("E: no recording\n"));
+        }
+        break;
+      #endif /* SD_RECORD */
+
+      #ifdef JOINT_CALIBRATION
+      case 434:
+        //? --- M434: set joint calibration ---
+        //?
+        //? Example: M434 S7 X0.25 Y-0.1
+        //?
+        //? Sets the corrections of the joints given at calibration point S,
+        //? in degrees, added to the joint angle on the way to the motors.
+        //? Point S is at (S - 6) * 32.768 degrees, S going from 0 to 12;
+        //? between points, corrections get interpolated. X is base, Y
+        //? shoulder, Z elbow, U wrist, corrections up to 10 degrees. Waits
+        //? for moves to finish. M503 reports the table, M500 saves it. A
+        //? table measured on the machine can be kept as a file of M434 lines
+        //? on the SD card, too.
+        //?
+        //? This command is only available with JOINT_CALIBRATION, see
+        //? config.h.
+        //?
+        if ( ! next_target.seen_S || next_target.S >= JOINT_CAL_POINTS) {
+          serial_writestr_P(PSTR("E: S has to be 0 to 12\n"));
+          break;
+        }
+        queue_wait();
+        {
+          uint8_t seen[E] = {
+            next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+            next_target.seen_U
+          };
+          enum axis_e i;
+
+          for (i = X; i < E; i++) {
+            if ( ! seen[i])
+              continue;
+            if (next_target.target.axis[i] <= JOINT_CAL_MAX &&
+                next_target.target.axis[i] >= -JOINT_CAL_MAX)
+              settings.joint_cal[i][next_target.S] =
+                next_target.target.axis[i];
+            next_target.target.axis[i] = startpoint.axis[i];
+          }
+        }
+        break;
+      #endif /* JOINT_CALIBRATION */
+
+      case 503:
+        //? --- M503: report settings ---
+        //?
+        //? Example: M503
+        //?
+        //? Reports the settings of M92, M201, M203 and M205 in the units of
+        //? config.h, which is steps per meter for M92, like
+        //? "steps/m X:80000 Y:80000 Z:1280000 U:80000 E:95000".
+        //?
+        settings_print();
+        break;
+
       #ifdef DEBUG
 			case 240:
 				//? --- M240: echo off ---
@@ -869,6 +1458,287 @@ void process_gcode_command() {
 				break;
       #endif /* DEBUG */
 
+      #ifndef BANG_BANG
+      case 303:
+        //? --- M303: PID autotune ---
+        //?
+        //? Example: M303 P0 S200
+        //?
+        //? Tunes the PID factors of heater 0 at 200 deg Celsius by letting it
+        //? oscillate around this temperature a few times, which takes some
+        //? minutes. Progress is reported each cycle; when done, factors are
+        //? applied and, with EECONFIG, saved to EEPROM like M134 does. Without
+        //? P the extruder heater is tuned, S0 cancels tuning. The heater
+        //? ignores its regular target temperature while tuning.
+        //?
+        //? This command is only available without BANG_BANG, see config.h.
+        //?
+        if ( ! next_target.seen_P)
+          #ifdef HEATER_EXTRUDER
+            next_target.P = HEATER_EXTRUDER;
+          #else
+            next_target.P = 0;
+          #endif
+        heater_autotune(next_target.P, next_target.seen_S ? next_target.S : 0);
+        break;
+      #endif /* BANG_BANG */
+
+      case 422:
+        //? --- M422: report movement statistics ---
+        //?
+        //? Example: M422
+        //?
+        //? Reports statistics collected since startup or the previous M422,
+        //? then starts over. These are the number of moves, moves planned by
+        //? lookahead, lookahead plans dropped for being too slow, the lowest
+        //? crossing speed between moves (mm/min), average and longest
+        //? planning time per move, how often the queue ran empty, the
+        //? longest step interrupt, how often the queue ran empty in the middle
+        //? of a job, how often the step interrupt was too slow for the step
+        //? rate (STEP_RATE_GUARD) and a histogram of queue depths. Helps tuning MAX_JERK,
+        //? ACCELERATION and MOVEBUFFER_SIZE and telling whether the queue size
+        //? or the host link limits a job. With PROFILE enabled (see debug.h)
+        //? this also prints timing histograms of the step interrupt,
+        //? dda_clock() and dda_create().
+        //?
+        queue_stats_print();
+        profile_print();
+        #ifdef STEP_LINK
+          steplink_print();
+        #endif
+        break;
+
+      #ifdef STEP_TRACE
+      case 423:
+        //? --- M423: print step trace ---
+        //?
+        //? Example: M423
+        //?
+        //? Prints the recorded speed profile, one line per change of the
+        //? step interval: time in CPU ticks, step number within the move
+        //? (0 marks the start of a move) and step interval in CPU ticks.
+        //? Then clears it.
+        //? This command is only available with STEP_TRACE, see debug.h.
+        //?
+        dda_trace_print();
+        break;
+      #endif /* STEP_TRACE */
+
+      #ifdef TRACE
+      case 425:
+        //? --- M425: print event trace ---
+        //?
+        //? Example: M425
+        //?
+        //? Prints the recorded motion events, oldest first, and removes them.
+        //? One line per event: time in CPU ticks, event name and two numbers.
+        //? "start" and "end" of a move come with total steps and step
+        //? interval, "endstop" with the triggered axes (bit 0 = X) and steps
+        //? left on the fast axis, "plan" with move number and end speed in
+        //? steps of ramp. Events overwritten before printing are counted.
+        //? This command is only available with TRACE, see debug.h.
+        //?
+        trace_print(0);
+        break;
+      #endif /* TRACE */
+
+      #ifdef RAM_REPORT
+      case 432:
+        //? --- M432: report RAM usage ---
+        //?
+        //? Example: M432
+        //?
+        //? Reports static data and BSS size, stack size now, the most stack
+        //? used since startup and the bytes of RAM never touched since
+        //? startup, followed by the sizes of the movement queue, the G-code
+        //? parser and the serial buffers. All in bytes. Run it after a
+        //? demanding job; if plenty of bytes stayed untouched, buffers can
+        //? grow by that much.
+        //? This command is only available with RAM_REPORT, see debug.h.
+        //?
+        ram_print();
+        break;
+      #endif /* RAM_REPORT */
+
+      #ifdef BINARY_GCODE
+      case 424:
+        //? --- M424: binary G-code ---
+        //?
+        //? Example: M424 S1
+        //?
+        //? S1 makes Teacup accept movement commands as binary frames from
+        //? now on, next to text G-code; S0 turns this off again. A host can
+        //? tell from the reply whether binary frames are supported at all.
+        //? The frame format is described in gcode_parse.c.
+        //? This command is only available with BINARY_GCODE, see config.h.
+        //?
+        gcode_binary = (next_target.seen_S && next_target.S) ? 1 : 0;
+        break;
+      #endif /* BINARY_GCODE */
+
+      case 428:
+        //? --- M428: acceleration update interval ---
+        //?
+        //? Example: M428 S500
+        //?
+        //? Recalculate acceleration every 500 microseconds from now on. Gets
+        //? rounded to multiples of the 500 microsecond system clock tick,
+        //? without S the MOTION_CLOCK of config.h is restored.
+        //?
+        clock_set_motion_interval(next_target.seen_S ? next_target.S :
+                                  MOTION_CLOCK);
+        break;
+
+      case 429:
+        //? --- M429: report main loop load ---
+        //?
+        //? Example: M429
+        //?
+        //? Reports statistics collected since startup or the previous M429,
+        //? then starts over. These are rounds through the main loop per
+        //? second, the longest round in microseconds and percentages of time
+        //? spent idle, processing G-code and, as part of that, waiting for
+        //? room in the movement queue. Much G-code time with little waiting
+        //? tells the parser or planner limit throughput, much waiting tells
+        //? movements do.
+        //?
+        loop_stats_print();
+        break;
+
+      #ifdef JOG
+      case 430:
+        //? --- M430: jog ---
+        //?
+        //? Example: M430 X600 Y-300
+        //?
+        //? Move X at 600 mm/min and Y backwards at 300 mm/min, until told
+        //? otherwise. Another M430 in the same direction changes speed on
+        //? the fly, along the acceleration ramp, one in another direction
+        //? stops and starts over. M430 without axes, as well as any G-code,
+        //? decelerates to a stop and continues from there. Jogs stop at the
+        //? axis limits, X_MIN etc., or after JOG_DISTANCE. With
+        //? KINEMATICS_ARM4 the axes are the joints, in degrees/min.
+        //? Stream one M430 per speed change, e.g. per pendant reading.
+        //?
+        //? This command is only available with JOG, see config.h.
+        //?
+        {
+          uint8_t seen[E] = {
+            next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+            next_target.seen_U
+          };
+          axes_int32_t velocity;
+          enum axis_e i;
+
+          for (i = X; i < E; i++)
+            velocity[i] = seen[i] ? next_target.target.axis[i] : 0;
+          velocity[E] = 0;
+          jog(velocity);
+
+          // Axis words were speeds, not coordinates.
+          for (i = X; i < E; i++)
+            if (seen[i])
+              next_target.target.axis[i] = startpoint.axis[i];
+        }
+        break;
+      #endif
+
+      #ifdef BENCHMARK
+      case 431:
+        //? --- M431: planner benchmark ---
+        //?
+        //? Example: M431 S20
+        //?
+        //? Plans 20 rounds of canned moves without moving: short segments, a
+        //? circle split into lines and long moves, 44 lines per round. They
+        //? go through the G-code parser, dda_create() and lookahead like
+        //? lines from the host. Reports lines planned, lines per second, the
+        //? longest line in microseconds, lookahead timeouts and moves joined
+        //? by lookahead. Without S, 10 rounds. Waits for the queue to empty
+        //? first, position and modes are the same afterwards.
+        //? This command is only available with BENCHMARK, see debug.h.
+        //?
+        bench_run(next_target.seen_S ? next_target.S : 10);
+        break;
+      #endif /* BENCHMARK */
+
+      #ifdef SYNC_PIN
+      case 440:
+        //? --- M440: sync barrier ---
+        //?
+        //? Example: M440
+        //?
+        //? Moves after this start only when all machines on the sync line
+        //? reached an M440, too. Start times differ by 0.1 ms at most, so
+        //? several arms can move together without waiting for the host.
+        //? Barriers match up in order, so each machine has to get the same
+        //? number of them. Moves before it get done first, G-code after it
+        //? gets read and planned meanwhile. Without a partner, this waits
+        //? forever; M112 ends it.
+        //? This command is only available with SYNC_PIN, see config.h.
+        //?
+        enqueue_sync();
+        break;
+      #endif /* SYNC_PIN */
+
+      #ifdef MOTION_MACRO
+      case 820:
+        //? --- M820: start recording a motion macro ---
+        //?
+        //? Example: M820
+        //?
+        //? Waits for all movements to complete, then records each move from
+        //? here on, as planned, until M821. Replaces the previous macro.
+        //? This command is only available with MOTION_MACRO, see config.h.
+        //?
+        macro_record_start();
+        break;
+
+      case 821:
+        //? --- M821: stop recording a motion macro ---
+        //?
+        //? Example: M821
+        //?
+        //? Waits for all movements to complete, then reports the number of
+        //? moves recorded. Recording fails if there are more moves than
+        //? MOTION_MACRO or endstop searches, e.g. G28. Temperature waits
+        //? aren't recorded. With EECONFIG the macro gets stored in EEPROM,
+        //? which takes a few seconds.
+        //? This command is only available with MOTION_MACRO, see config.h.
+        //?
+        i = macro_record_stop();
+        if (i)
+          sersendf_P(PSTR("Macro: %u moves\n"), i);
+        else
+          serial_writestr_P(PSTR("E: macro recording failed\n"));
+        break;
+
+      case 822:
+        //? --- M822: replay the motion macro ---
+        //?
+        //? Example: M822
+        //?
+        //? Queues the moves recorded with M820/M821 without parsing or
+        //? planning them again. The macro starts at the current position,
+        //? so it's shifted by the distance between this position and the
+        //? one the recording started at. With non-linear kinematics, e.g.
+        //? KINEMATICS_ARM4, it has to start at the same position instead.
+        //? This command is only available with MOTION_MACRO, see config.h.
+        //?
+        if (enqueue_macro()) {
+          next_target.target.axis[X] = startpoint.axis[X];
+          next_target.target.axis[Y] = startpoint.axis[Y];
+          next_target.target.axis[Z] = startpoint.axis[Z];
+          next_target.target.axis[U] = startpoint.axis[U];
+          if ( ! next_target.option_e_relative)
+            next_target.target.axis[E] = startpoint.axis[E];
+        }
+        else {
+          serial_writestr_P(PSTR("E: no macro or not at its start\n"));
+        }
+        break;
+      #endif /* MOTION_MACRO */
+
 				// unknown mcode: spit an error
 			default:
 				sersendf_P(PSTR("E: Bad M-code %d\n"), next_target.M);
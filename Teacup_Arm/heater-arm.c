@@ -12,6 +12,7 @@
 #include "pinio.h"
 #include "sersendf.h"
 #include "debug.h"
+#include "timer.h"
 
 /**
   Test configuration.
@@ -68,6 +69,8 @@ typedef struct {
   };
   uint8_t uses_pwm;
   uint8_t invert;
+  /// Software PWM period in clock ticks, for PWM on pins without a timer.
+  uint8_t soft_period;
 } heater_definition_t;
 
 
@@ -78,13 +81,20 @@ typedef struct {
       &(pin ## _TIMER->MR[pin ## _MATCH]) : \
       &(pin ## _PORT->MASKED_ACCESS[MASK(pin ## _PIN)]) }, \
     pwm && pin ## _TIMER, \
-    invert ? 1 : 0 \
+    invert ? 1 : 0, \
+    pwm && ! pin ## _TIMER ? SOFT_PWM_PERIOD(pwm) : 0 \
   },
 static const heater_definition_t heaters[NUM_HEATERS] = {
   #include "config_wrapper.h"
 };
 #undef DEFINE_HEATER
 
+/// Software PWM duty, in clock ticks per period.
+static volatile uint8_t soft_pwm_duty[NUM_HEATERS];
+
+/// Position of each software PWM channel in its period.
+static uint8_t soft_pwm_count[NUM_HEATERS];
+
 /** Initialise heater subsystem.
 
   Initialise PWM timers, etc. Inspired by pwm.c in LPC1343CodeBase:
@@ -204,6 +214,11 @@ void heater_set(heater_t index, uint8_t value) {
       if (DEBUG_PID && (debug_flags & DEBUG_PID))
         sersendf_P(PSTR("PWM %su = %lu\n"), index, *heaters[index].match);
     }
+    else if (heaters[index].soft_period) {
+      // Pin is operated by heater_soft_pwm_tick().
+      soft_pwm_duty[index] =
+        ((uint16_t)value * heaters[index].soft_period + 127) / 255;
+    }
     else {
       *(heaters[index].masked_port) =
         ((value >= HEATER_THRESHOLD && ! heaters[index].invert) ||
@@ -216,4 +231,25 @@ void heater_set(heater_t index, uint8_t value) {
   }
 }
 
+/** Software PWM for heaters on pins without a PWM timer.
+
+  Called from clock_tick() every 2 ms. Each channel is on for the
+  first soft_pwm_duty ticks of its period. Masked port access makes this safe
+  against writes to other pins of the same port.
+*/
+void heater_soft_pwm_tick() {
+  heater_t i;
+
+  for (i = 0; i < NUM_HEATERS; i++) {
+    if (heaters[i].soft_period) {
+      if (++soft_pwm_count[i] >= heaters[i].soft_period)
+        soft_pwm_count[i] = 0;
+
+      *(heaters[i].masked_port) =
+        ((soft_pwm_count[i] < soft_pwm_duty[i]) != heaters[i].invert) ?
+        0xFFFF : 0x0000;
+    }
+  }
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
@@ -12,6 +12,7 @@
 #include	"crc.h"
 #include "sersendf.h"
 #include "debug.h"
+#include "timer.h"
 
 /// \struct heater_definition_t
 /// \brief simply holds pinout data- port, pin, pwm channel if used
@@ -21,18 +22,59 @@ typedef struct {
   /// Wether the heater pin signal needs to be inverted.
   uint8_t          invert;
 	volatile uint8_t *heater_pwm;  ///< pointer to 8-bit PWM register, eg OCR0A (8-bit) or ORC3L (low byte, 16-bit)
+  /// Hardware PWM frequency in Hz, 0 for the timer's default.
+  uint16_t         pwm_freq;
+  /// Software PWM period in clock ticks, for PWM on pins without PWM.
+  uint8_t          soft_period;
 } heater_definition_t;
 
 #undef DEFINE_HEATER
 /// \brief helper macro to fill heater definition struct from config.h
 #define	DEFINE_HEATER(name, pin, invert, pwm) { \
-  &(pin ## _WPORT), pin ## _PIN, invert ? 1 : 0, pwm ? (pin ## _PWM) : NULL},
+  &(pin ## _WPORT), pin ## _PIN, invert ? 1 : 0, pwm ? (pin ## _PWM) : NULL, \
+  (pwm) > 1 ? (uint16_t)(pwm) : 0, pwm ? SOFT_PWM_PERIOD(pwm) : 0},
 static const heater_definition_t heaters[NUM_HEATERS] =
 {
 	#include	"config_wrapper.h"
 };
 #undef DEFINE_HEATER
 
+/// Software PWM duty, in clock ticks per period.
+static volatile uint8_t soft_pwm_duty[NUM_HEATERS];
+
+/// Position of each software PWM channel in its period.
+static uint8_t soft_pwm_count[NUM_HEATERS];
+
+/** \brief Find the timer prescaler closest to a PWM frequency.
+
+  \param freq   The frequency wanted, Hz.
+
+  \param timer2 Whether this is for timer 2, which has more prescalers.
+
+  \return Clock select bits for TCCRnB.
+
+  All timers run in 8-bit fast PWM mode, so the frequency is
+  F_CPU / 256 / prescaler.
+*/
+static uint8_t pwm_prescaler(uint16_t freq, uint8_t timer2) {
+  static const uint16_t PROGMEM dividers[] = { 1, 8, 64, 256, 1024 };
+  static const uint16_t PROGMEM dividers2[] = { 1, 8, 32, 64, 128, 256, 1024 };
+  const uint16_t *d = timer2 ? dividers2 : dividers;
+  uint8_t n = timer2 ? sizeof(dividers2) / sizeof(dividers2[0]) :
+                       sizeof(dividers) / sizeof(dividers[0]);
+  uint8_t i, best = 0;
+  uint32_t diff, best_diff = UINT32_MAX;
+
+  for (i = 0; i < n; i++) {
+    diff = labs((int32_t)(F_CPU / 256 / pgm_read_word(&d[i])) - freq);
+    if (diff < best_diff) {
+      best_diff = diff;
+      best = i;
+    }
+  }
+  return best + 1;
+}
+
 
 /// \brief initialise heater subsystem
 /// Set directions, initialise PWM timers, read PID factors from eeprom, etc
@@ -121,33 +163,43 @@ void heater_init() {
 	// setup pins
 	for (i = 0; i < NUM_HEATERS; i++) {
 		if (heaters[i].heater_pwm) {
+      // Clock select register of the timer, for setting PWM frequency.
+      volatile uint8_t *tccrb = NULL;
+
 			*heaters[i].heater_pwm = heaters[i].invert ? 255 : 0;
 			// this is somewhat ugly too, but switch() won't accept pointers for reasons unknown
 			switch((uint16_t) heaters[i].heater_pwm) {
 				case (uint16_t) &OCR0A:
 					TCCR0A |= MASK(COM0A1);
+          tccrb = &TCCR0B;
 					break;
 				case (uint16_t) &OCR0B:
 					TCCR0A |= MASK(COM0B1);
+          tccrb = &TCCR0B;
 					break;
         #ifdef TCCR2A
 				case (uint16_t) &OCR2A:
 					TCCR2A |= MASK(COM2A1);
+          tccrb = &TCCR2B;
 					break;
 				case (uint16_t) &OCR2B:
 					TCCR2A |= MASK(COM2B1);
+          tccrb = &TCCR2B;
 					break;
         #endif
 				#ifdef TCCR3A
 				case (uint16_t) &OCR3AL:
 					TCCR3A |= MASK(COM3A1);
+          tccrb = &TCCR3B;
 					break;
 				case (uint16_t) &OCR3BL:
 					TCCR3A |= MASK(COM3B1);
+          tccrb = &TCCR3B;
 					break;
 				#ifdef COM3C1
 				case (uint16_t) &OCR3CL:
 					TCCR3A |= MASK(COM3C1);
+          tccrb = &TCCR3B;
 					break;
 				#endif
 				#endif
@@ -155,12 +207,15 @@ void heater_init() {
 					#if defined (OCR4AL)
 					case (uint16_t) &OCR4AL:
 						TCCR4A |= MASK(COM4A1);
+            tccrb = &TCCR4B;
 						break;
 					case (uint16_t) &OCR4BL:
 						TCCR4A |= MASK(COM4B1);
+            tccrb = &TCCR4B;
 						break;
 					case (uint16_t) &OCR4CL:
 						TCCR4A |= MASK(COM4C1);
+            tccrb = &TCCR4B;
 						break;
 					#else
 					// 10 bit timer
@@ -180,15 +235,29 @@ void heater_init() {
 				#ifdef	TCCR5A
 				case (uint16_t) &OCR5AL:
 					TCCR5A |= MASK(COM5A1);
+          tccrb = &TCCR5B;
 					break;
 				case (uint16_t) &OCR5BL:
 					TCCR5A |= MASK(COM5B1);
+          tccrb = &TCCR5B;
 					break;
 				case (uint16_t) &OCR5CL:
 					TCCR5A |= MASK(COM5C1);
+          tccrb = &TCCR5B;
 					break;
 				#endif
 			}
+
+      // Timers are shared, the heater defined last sets the frequency.
+      if (tccrb && heaters[i].pwm_freq) {
+        #ifdef TCCR2B
+          uint8_t timer2 = (tccrb == &TCCR2B);
+        #else
+          uint8_t timer2 = 0;
+        #endif
+        *tccrb = (*tccrb & ~0x07) |
+                 pwm_prescaler(heaters[i].pwm_freq, timer2);
+      }
 		}
 
 	}
@@ -223,6 +292,11 @@ void heater_set(heater_t index, uint8_t value) {
 		if (DEBUG_PID && (debug_flags & DEBUG_PID))
 			sersendf_P(PSTR("PWM{%u = %u}\n"), index, *heaters[index].heater_pwm);
 	}
+  else if (heaters[index].soft_period) {
+    // Pin is operated by heater_soft_pwm_tick().
+    soft_pwm_duty[index] =
+      ((uint16_t)value * heaters[index].soft_period + 127) / 255;
+  }
 	else {
     if ((value >= HEATER_THRESHOLD && ! heaters[index].invert) ||
         (value < HEATER_THRESHOLD && heaters[index].invert))
@@ -235,4 +309,26 @@ void heater_set(heater_t index, uint8_t value) {
     power_on();
 }
 
+/** \brief Software PWM for heaters on pins without hardware PWM.
+
+  Called from clock_tick() every 2 ms, with interrupts disabled.
+  Each channel is on for the first soft_pwm_duty ticks of its period.
+*/
+void heater_soft_pwm_tick() {
+  heater_t i;
+
+  for (i = 0; i < NUM_HEATERS; i++) {
+    if (heaters[i].heater_pwm || ! heaters[i].soft_period)
+      continue;
+
+    if (++soft_pwm_count[i] >= heaters[i].soft_period)
+      soft_pwm_count[i] = 0;
+
+    if ((soft_pwm_count[i] < soft_pwm_duty[i]) != heaters[i].invert)
+      *(heaters[i].heater_port) |= MASK(heaters[i].heater_pin);
+    else
+      *(heaters[i].heater_port) &= ~MASK(heaters[i].heater_pin);
+  }
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __AVR__ */
@@ -74,6 +74,41 @@ EE_factor EEMEM EE_factors[NUM_HEATERS];
 
 heater_runtime_t heaters_runtime[NUM_HEATERS];
 
+#ifndef BANG_BANG
+/** \def AUTOTUNE_CYCLES
+  Number of heating/cooling cycles M303 measures. The first cycle starts from
+  a cold heater and is discarded.
+*/
+#define AUTOTUNE_CYCLES   5
+
+/** \def AUTOTUNE_OVERSHOOT
+  Autotune gives up if the temperature rises this far above the target, in qC.
+*/
+#define AUTOTUNE_OVERSHOOT  (20 * 4)
+
+/** \def AUTOTUNE_TIMEOUT
+  Autotune gives up if heating or cooling takes longer than this, in qs.
+*/
+#define AUTOTUNE_TIMEOUT  (20 * 60 * 4)
+
+/**
+  \var autotune
+  \brief State of a running relay autotune, see heater_autotune().
+*/
+static struct {
+  heater_t  heater;   ///< Heater being tuned, NUM_HEATERS if none.
+  uint16_t  target;   ///< Temperature to oscillate around, qC.
+  uint16_t  t_max;    ///< Highest temperature of the current cycle, qC.
+  uint16_t  t_min;    ///< Lowest temperature of the current cycle, qC.
+  uint16_t  ticks;    ///< Time since the last relay switch, qs.
+  uint16_t  t_high;   ///< Length of the last heating phase, qs.
+  uint8_t   cycle;    ///< Cycles completed so far.
+  uint8_t   heating;  ///< Heater currently on the high side of the relay.
+  uint8_t   bias;     ///< Relay centre output.
+  uint8_t   d;        ///< Relay amplitude, output is bias +- d.
+} autotune = { .heater = NUM_HEATERS };
+#endif /* BANG_BANG */
+
 /** Inititalise PID data structures.
 
   \param i Index of the heater to initialise by Teacup numbering.
@@ -112,6 +147,138 @@ void pid_init() {
   }
 }
 
+#ifndef BANG_BANG
+/** \brief Start a relay autotune of a heater's PID factors.
+
+  \param h      Heater to tune.
+
+  \param target Temperature to tune at, qC. 0 cancels a running autotune.
+
+  The heater is switched between two outputs whenever the temperature crosses
+  the target, which makes it oscillate around the target. Amplitude and period
+  of this oscillation give the ultimate gain Ku and period Tu, from which the
+  PID factors are calculated by the classic Ziegler-Nichols rules:
+
+    Kp = 0.6 * Ku, Ki = 2 * Kp / Tu, Kd = Kp * Tu / 8
+
+  The relay centre is shifted each cycle so heating and cooling take equally
+  long. This runs from heater_tick(), so the heater's regular target
+  temperature is ignored until tuning is done.
+*/
+void heater_autotune(heater_t h, uint16_t target) {
+  if (autotune.heater < NUM_HEATERS)
+    heater_set(autotune.heater, 0);
+  autotune.heater = NUM_HEATERS;
+
+  if (h >= NUM_HEATERS || target == 0)
+    return;
+
+  autotune.target = target;
+  autotune.t_max = 0;
+  autotune.t_min = 0;
+  autotune.ticks = 0;
+  autotune.t_high = 0;
+  autotune.cycle = 0;
+  autotune.heating = 1;
+  autotune.bias = 127;
+  autotune.d = 127;
+  autotune.heater = h;
+}
+
+/** \brief One autotune step.
+
+  \param temp Current temperature of the heater being tuned, qC.
+
+  \return Heater output to use.
+
+  Called every qs from heater_tick(). All maths in integers, 1528 / 1000 is
+  0.6 * 8 / pi, with the 8 coming from Ku = 4 * d / (pi * amplitude) and the
+  amplitude being half of the peak to peak temperature swing.
+*/
+static uint8_t autotune_tick(uint16_t temp) {
+  heater_t h = autotune.heater;
+
+  if (autotune.ticks < UINT16_MAX)
+    autotune.ticks++;
+
+  if (temp > autotune.target + AUTOTUNE_OVERSHOOT ||
+      autotune.ticks > AUTOTUNE_TIMEOUT) {
+    sersendf_P(PSTR("!! PID autotune of heater %d failed\n"), h);
+    autotune.heater = NUM_HEATERS;
+    return 0;
+  }
+
+  if (autotune.heating) {
+    if (temp > autotune.t_max)
+      autotune.t_max = temp;
+    if (temp > autotune.target) {
+      autotune.heating = 0;
+      autotune.t_high = autotune.ticks;
+      autotune.ticks = 0;
+      autotune.t_min = temp;
+    }
+  }
+  else {
+    if (temp < autotune.t_min)
+      autotune.t_min = temp;
+    if (temp < autotune.target) {
+      uint16_t t_low = autotune.ticks;
+      uint16_t period = autotune.t_high + t_low;
+
+      autotune.heating = 1;
+      autotune.ticks = 0;
+
+      if (autotune.cycle) {
+        int16_t bias;
+        uint16_t amplitude = autotune.t_max - autotune.t_min;
+        int32_t p, i;
+
+        if (amplitude == 0)
+          amplitude = 1;
+
+        p = 1528L * autotune.d * PID_SCALE / 1000 / amplitude;
+        i = 2 * p / period;
+        heaters_pid[h].p_factor = p;
+        heaters_pid[h].i_factor = i;
+        heaters_pid[h].d_factor = p * period / (8 * TH_COUNT);
+        // Limit the integral term to full output.
+        if (i)
+          p = 255 * PID_SCALE / i;
+        heaters_pid[h].i_limit = p > INT16_MAX ? INT16_MAX : p;
+
+        sersendf_P(PSTR("bias:%u d:%u min:%u max:%u Tu:%u\n"),
+                   autotune.bias, autotune.d, autotune.t_min >> 2,
+                   autotune.t_max >> 2, period);
+
+        bias = autotune.bias + (int32_t)autotune.d *
+               ((int16_t)autotune.t_high - (int16_t)t_low) / period;
+        if (bias < 20)
+          bias = 20;
+        if (bias > 235)
+          bias = 235;
+        autotune.bias = bias;
+        autotune.d = bias > 127 ? 255 - bias : bias;
+      }
+
+      autotune.t_max = temp;
+      if (++autotune.cycle > AUTOTUNE_CYCLES) {
+        heaters_runtime[h].heater_i = 0;
+        autotune.heater = NUM_HEATERS;
+        sersendf_P(PSTR("PID autotune done, "));
+        heater_print(h);
+        #ifdef EECONFIG
+          heater_save_settings();
+        #endif
+        return 0;
+      }
+    }
+  }
+
+  return autotune.heating ? autotune.bias + autotune.d :
+                            autotune.bias - autotune.d;
+}
+#endif /* BANG_BANG */
+
 /** \brief run heater PID algorithm
 	\param h which heater we're running the loop for
 	\param type which temp sensor type this heater is attached to
@@ -131,6 +298,13 @@ void heater_tick(heater_t h, temp_type_t type, uint16_t current_temp, uint16_t t
 	if (h >= NUM_HEATERS)
 		return;
 
+  #ifndef BANG_BANG
+    if (h == autotune.heater) {
+      heater_set(h, autotune_tick(current_temp));
+      return;
+    }
+  #endif
+
 	if (target_temp == 0) {
 		heater_set(h, 0);
 		return;
@@ -15,6 +15,16 @@
 /// Default scaled I limit, equivalent to 384 qC*qs, or 24 C*s.
 #define DEFAULT_I_LIMIT   384
 
+/** \def SOFT_PWM_PERIOD
+
+  Software PWM period in 2 ms ticks for a 'pwm' frequency of a
+  DEFINE_HEATER() in Hz. 1 gives the longest period, 255 ticks, for the
+  finest resolution; above 2 Hz each doubling of the frequency halves the
+  number of duty steps.
+*/
+#define SOFT_PWM_PERIOD(f) \
+  ((f) < 2 ? 255 : (f) > 250 ? 2 : (uint8_t)(500 / (f)))
+
 /** \def HEATER_THRESHOLD
 
   Defines the threshold when to turn a non-PWM heater on and when to turn it
@@ -71,10 +81,15 @@ void heater_init(void);
 void pid_init(void);
 
 void heater_set(heater_t index, uint8_t value);
+void heater_soft_pwm_tick(void);
 void heater_tick(heater_t h, temp_type_t type, uint16_t current_temp, uint16_t target_temp);
 
 uint8_t heaters_all_zero(void);
 
+#ifndef BANG_BANG
+void heater_autotune(heater_t h, uint16_t target);
+#endif
+
 #ifdef EECONFIG
 void pid_set_p(heater_t index, int32_t p);
 void pid_set_i(heater_t index, int32_t i);
@@ -5,10 +5,12 @@
 */
 
 #include <math.h>
+#include <string.h>
 #include	"dda.h"
 #include	"dda_queue.h"
 #include	"pinio.h"
 #include	"gcode_parse.h"
+#include "dda_maths.h"
 
 // Check configuration.
 #if defined X_MIN_PIN || defined X_MAX_PIN
@@ -50,48 +52,206 @@
 //   units: / 1000 for um -> mm; * 60 for mm/s -> mm/min
 #ifdef ENDSTOP_CLEARANCE_X
   #define SEARCH_FAST_X (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_X / 1000.))
+            sqrt((double)2 * ACCELERATION_X * ENDSTOP_CLEARANCE_X / 1000.))
 #endif
 #ifdef ENDSTOP_CLEARANCE_Y
   #define SEARCH_FAST_Y (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_Y / 1000.))
+            sqrt((double)2 * ACCELERATION_Y * ENDSTOP_CLEARANCE_Y / 1000.))
 #endif
 #ifdef ENDSTOP_CLEARANCE_Z
   #define SEARCH_FAST_Z (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_Z / 1000.))
+            sqrt((double)2 * ACCELERATION_Z * ENDSTOP_CLEARANCE_Z / 1000.))
 #endif
 #ifdef ENDSTOP_CLEARANCE_U
 #define SEARCH_FAST_U (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_U / 1000.))
+            sqrt((double)2 * ACCELERATION_U * ENDSTOP_CLEARANCE_U / 1000.))
 #endif
 
+// Positions at MIN endstops, um.
+#ifdef X_MIN
+  #define HOME_POS_X_MIN (int32_t)(X_MIN * 1000.)
+#else
+  #define HOME_POS_X_MIN 0
+#endif
+#ifdef Y_MIN
+  #define HOME_POS_Y_MIN (int32_t)(Y_MIN * 1000.)
+#else
+  #define HOME_POS_Y_MIN 0
+#endif
+#ifdef Z_MIN
+  #define HOME_POS_Z_MIN (int32_t)(Z_MIN * 1000.)
+#else
+  #define HOME_POS_Z_MIN 0
+#endif
+#ifdef U_MIN
+  #define HOME_POS_U_MIN (int32_t)(U_MIN * 1000.)
+#else
+  #define HOME_POS_U_MIN 0
+#endif
 
-/// home all 4 axes
-void home() {
 
-#if defined	X_MIN_PIN
-    home_x_negative();
-#elif defined X_MAX_PIN
-    home_x_positive();
-#endif
+/// Axes to home together and how, see home_axes().
+typedef struct {
+  int8_t    dir[AXIS_COUNT];      ///< -1 towards MIN, +1 towards MAX, 0 = not
+  uint8_t   endstop[AXIS_COUNT];  ///< ENDSTOP_MIN() or ENDSTOP_MAX()
+  uint32_t  fast[AXIS_COUNT];     ///< search speed, mm/min
+  uint32_t  slow[AXIS_COUNT];     ///< back off speed, mm/min
+  int32_t   pos[AXIS_COUNT];      ///< position at the endstop, um
+} HOME_SET;
+
+/// Add an axis to a homing set.
+static void home_set_axis(HOME_SET *h, enum axis_e i, int8_t dir,
+                          uint8_t endstop, uint32_t fast, uint32_t slow,
+                          int32_t pos) {
+  h->dir[i] = dir;
+  h->endstop[i] = endstop;
+  h->fast[i] = fast > slow ? fast : slow;
+  h->slow[i] = slow;
+  h->pos[i] = pos;
+}
 
-#if defined	Y_MIN_PIN
-    home_y_negative();
-#elif defined Y_MAX_PIN
-    home_y_positive();
-#endif
+/** Queue one move of all axes in a homing set.
 
-#if defined	Z_MIN_PIN
-    home_z_negative();
-#elif defined Z_MAX_PIN
-    home_z_positive();
-#endif
+  \param h The set.
 
-#if defined	U_MIN_PIN
-    home_u_negative();
-#elif defined U_MAX_PIN
-    home_u_positive();
-#endif
+  \param back 0 for searching the endstops, 1 for backing off slowly. Only
+         axes which searched faster than their back off speed back off.
+
+  Each axis moves at its own speed. The slowest one moves 1 m, like a single
+  axis search, faster ones proportionally further, so all of them take the
+  same time and each finds its endstop. Axes stop one by one on their own
+  endstops, see dda_clock().
+*/
+static void home_move(HOME_SET *h, uint8_t back) {
+  TARGET t = startpoint;
+  uint32_t speed[AXIS_COUNT], min = 0xFFFFFFFF, F2 = 0;
+  uint8_t check = 0;
+  enum axis_e i;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    speed[i] = 0;
+    if (h->dir[i] && ( ! back || h->fast[i] > h->slow[i])) {
+      speed[i] = back ? h->slow[i] : h->fast[i];
+      if (speed[i] < min)
+        min = speed[i];
+    }
+  }
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    if (speed[i]) {
+      int32_t d = muldiv(1000000, speed[i], min);
+
+      t.axis[i] += back ? -h->dir[i] * d : h->dir[i] * d;
+      F2 += speed[i] * speed[i];
+      check |= h->endstop[i];
+    }
+  }
+
+  if (check) {
+    t.F = int_sqrt(F2);
+    enqueue_home(&t, check, back ? 0 : 1);
+  }
+}
+
+/** Home a set of axes at once.
+
+  \param axes Bit (1 << axis) set for each axis to home.
+
+  One move drives all these axes towards their endstops, each at its own
+  search speed, then a second one backs off slowly those which were fast.
+  This takes about as long as homing the slowest axis alone.
+
+  With HOME_SINGLE_PASS there is no back off. Home comes from the endstop
+  trigger points captured in the search move, then all axes return to them
+  at search speed.
+*/
+void home_axes(uint8_t axes) {
+  HOME_SET h;
+  enum axis_e i;
+
+  memset(&h, 0, sizeof(HOME_SET));
+
+  #if defined X_MIN_PIN
+    if (axes & (1 << X))
+      home_set_axis(&h, X, -1, ENDSTOP_MIN(X), SEARCH_FAST_X, SEARCH_FEEDRATE_X,
+                    HOME_POS_X_MIN);
+  #elif defined X_MAX_PIN && defined X_MAX
+    if (axes & (1 << X))
+      home_set_axis(&h, X, +1, ENDSTOP_MAX(X), SEARCH_FAST_X, SEARCH_FEEDRATE_X,
+                    (int32_t)(X_MAX * 1000.));
+  #endif
+
+  #if defined Y_MIN_PIN
+    if (axes & (1 << Y))
+      home_set_axis(&h, Y, -1, ENDSTOP_MIN(Y), SEARCH_FAST_Y, SEARCH_FEEDRATE_Y,
+                    HOME_POS_Y_MIN);
+  #elif defined Y_MAX_PIN && defined Y_MAX
+    if (axes & (1 << Y))
+      home_set_axis(&h, Y, +1, ENDSTOP_MAX(Y), SEARCH_FAST_Y, SEARCH_FEEDRATE_Y,
+                    (int32_t)(Y_MAX * 1000.));
+  #endif
+
+  #if defined Z_MIN_PIN
+    if (axes & (1 << Z))
+      home_set_axis(&h, Z, -1, ENDSTOP_MIN(Z), SEARCH_FAST_Z, SEARCH_FEEDRATE_Z,
+                    HOME_POS_Z_MIN);
+  #elif defined Z_MAX_PIN && defined Z_MAX
+    if (axes & (1 << Z))
+      home_set_axis(&h, Z, +1, ENDSTOP_MAX(Z), SEARCH_FAST_Z, SEARCH_FEEDRATE_Z,
+                    (int32_t)(Z_MAX * 1000.));
+  #endif
+
+  #if defined U_MIN_PIN
+    if (axes & (1 << U))
+      home_set_axis(&h, U, -1, ENDSTOP_MIN(U), SEARCH_FAST_U, SEARCH_FEEDRATE_U,
+                    HOME_POS_U_MIN);
+  #elif defined U_MAX_PIN && defined U_MAX
+    if (axes & (1 << U))
+      home_set_axis(&h, U, +1, ENDSTOP_MAX(U), SEARCH_FAST_U, SEARCH_FEEDRATE_U,
+                    (int32_t)(U_MAX * 1000.));
+  #endif
+
+  home_move(&h, 0);
+  #ifndef HOME_SINGLE_PASS
+    home_move(&h, 1);
+  #endif
+
+  // set home
+  queue_wait(); // we have to wait here, see G92
+  for (i = X; i < AXIS_COUNT; i++) {
+    if (h.dir[i]) {
+      startpoint.axis[i] = next_target.target.axis[i] = h.pos[i];
+      #ifdef HOME_SINGLE_PASS
+        // We're past the trigger point by the latched overshoot.
+        startpoint.axis[i] += h.dir[i] *
+                              steps_to_um(dda_endstop_overshoot(i), i);
+      #endif
+    }
+  }
+  dda_new_startpoint();
+
+  #ifdef HOME_SINGLE_PASS
+  {
+    // Return to the trigger points as an ordinary move.
+    TARGET t = startpoint;
+
+    t.F = 0xFFFFFFFF;
+    for (i = X; i < AXIS_COUNT; i++) {
+      if (h.dir[i]) {
+        t.axis[i] = h.pos[i];
+        if (h.fast[i] < t.F)
+          t.F = h.fast[i];
+      }
+    }
+    if (t.F != 0xFFFFFFFF)
+      enqueue(&t);
+  }
+  #endif
+}
+
+/// home all 4 axes
+void home() {
+  home_axes((1 << X) | (1 << Y) | (1 << Z) | (1 << U));
 }
 
 /// find X MIN endstop
@@ -104,13 +264,13 @@ void home_x_negative() {
       t.F = SEARCH_FAST_X;
     else
       t.F = SEARCH_FEEDRATE_X;
-    enqueue_home(&t, 0x01, 1);
+    enqueue_home(&t, ENDSTOP_MIN(X), 1);
 
     if (SEARCH_FAST_X > SEARCH_FEEDRATE_X) {
 			// back off slowly
       t.axis[X] = +1000000;
 			t.F = SEARCH_FEEDRATE_X;
-      enqueue_home(&t, 0x01, 0);
+      enqueue_home(&t, ENDSTOP_MIN(X), 0);
     }
 
 		// set X home
@@ -137,12 +297,12 @@ void home_x_positive() {
       t.F = SEARCH_FAST_X;
     else
       t.F = SEARCH_FEEDRATE_X;
-    enqueue_home(&t, 0x02, 1);
+    enqueue_home(&t, ENDSTOP_MAX(X), 1);
 
     if (SEARCH_FAST_X > SEARCH_FEEDRATE_X) {
       t.axis[X] = -1000000;
 			t.F = SEARCH_FEEDRATE_X;
-      enqueue_home(&t, 0x02, 0);
+      enqueue_home(&t, ENDSTOP_MAX(X), 0);
     }
 
 		// set X home
@@ -163,12 +323,12 @@ void home_y_negative() {
       t.F = SEARCH_FAST_Y;
     else
       t.F = SEARCH_FEEDRATE_Y;
-    enqueue_home(&t, 0x04, 1);
+    enqueue_home(&t, ENDSTOP_MIN(Y), 1);
 
     if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y) {
       t.axis[Y] = +1000000;
 			t.F = SEARCH_FEEDRATE_Y;
-      enqueue_home(&t, 0x04, 0);
+      enqueue_home(&t, ENDSTOP_MIN(Y), 0);
     }
 
 		// set Y home
@@ -195,12 +355,12 @@ void home_y_positive() {
       t.F = SEARCH_FAST_Y;
     else
       t.F = SEARCH_FEEDRATE_Y;
-    enqueue_home(&t, 0x08, 1);
+    enqueue_home(&t, ENDSTOP_MAX(Y), 1);
 
     if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y) {
       t.axis[Y] = -1000000;
 			t.F = SEARCH_FEEDRATE_Y;
-      enqueue_home(&t, 0x08, 0);
+      enqueue_home(&t, ENDSTOP_MAX(Y), 0);
     }
 
 		// set Y home
@@ -221,12 +381,12 @@ void home_z_negative() {
       t.F = SEARCH_FAST_Z;
     else
       t.F = SEARCH_FEEDRATE_Z;
-    enqueue_home(&t, 0x10, 1);
+    enqueue_home(&t, ENDSTOP_MIN(Z), 1);
 
     if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z) {
       t.axis[Z] = +1000000;
 			t.F = SEARCH_FEEDRATE_Z;
-      enqueue_home(&t, 0x10, 0);
+      enqueue_home(&t, ENDSTOP_MIN(Z), 0);
     }
 
 		// set Z home
@@ -253,12 +413,12 @@ void home_z_positive() {
       t.F = SEARCH_FAST_Z;
     else
       t.F = SEARCH_FEEDRATE_Z;
-    enqueue_home(&t, 0x20, 1);
+    enqueue_home(&t, ENDSTOP_MAX(Z), 1);
 
     if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z) {
       t.axis[Z] = -1000000;
 			t.F = SEARCH_FEEDRATE_Z;
-      enqueue_home(&t, 0x20, 0);
+      enqueue_home(&t, ENDSTOP_MAX(Z), 0);
     }
 
 		// set Z home
@@ -279,12 +439,12 @@ void home_u_negative() {
         t.F = SEARCH_FAST_U;
     else
         t.F = SEARCH_FEEDRATE_U;
-    enqueue_home(&t, 0x10, 1);
+    enqueue_home(&t, ENDSTOP_MIN(U), 1);
 
     if (SEARCH_FAST_U > SEARCH_FEEDRATE_U) {
         t.axis[U] = +1000000;
         t.F = SEARCH_FEEDRATE_U;
-        enqueue_home(&t, 0x10, 0);
+        enqueue_home(&t, ENDSTOP_MIN(U), 0);
     }
 
     // set U home
@@ -311,12 +471,12 @@ void home_u_positive() {
         t.F = SEARCH_FAST_U;
     else
         t.F = SEARCH_FEEDRATE_U;
-    enqueue_home(&t, 0x20, 1);
+    enqueue_home(&t, ENDSTOP_MAX(U), 1);
 
     if (SEARCH_FAST_U > SEARCH_FEEDRATE_U) {
         t.axis[U] = -1000000;
         t.F = SEARCH_FEEDRATE_U;
-        enqueue_home(&t, 0x20, 0);
+        enqueue_home(&t, ENDSTOP_MAX(U), 0);
     }
 
     // set U home
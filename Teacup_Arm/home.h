@@ -1,8 +1,12 @@
 #ifndef	_HOME_H
 #define _HOME_H
 
+#include <stdint.h>
+
 void home(void);
 
+void home_axes(uint8_t axes);
+
 void home_x_negative(void);
 void home_x_positive(void);
 void home_y_negative(void);
@@ -18,12 +18,19 @@
     http://www.nongnu.org/avr-libc/examples/twitest/twitest.c
 
   For technical details see section 22 of atmega328 datasheet.
+
+  Traffic goes through a queue of transactions, see i2c_submit(). The
+  interrupt works through this queue on its own, one transaction after the
+  other, so several devices can share the bus and nobody waits for it. The
+  byte-wise i2c_write() is a transaction as well, one which takes its bytes
+  from a small ringbuffer as they come in.
 */
 
 #include "i2c.h"
 
 #ifdef I2C
 
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/twi.h>
@@ -36,8 +43,7 @@
   #error Cant be I2C master and slave at the same time.
 #endif
 
-#if defined I2C_SLAVE_MODE || defined I2C_READ_SUPPORT || \
-    defined I2C_EEPROM_SUPPORT
+#if defined I2C_SLAVE_MODE
   #warning These portions of the code are untested and need work.
 #endif
 
@@ -48,13 +54,6 @@
   #define I2C_MODE 0
 #endif
 
-#define I2C_MODE_MASK         0b00001100
-// Start-Addr_R-Read-Stop: just read mode.
-#define I2C_MODE_SARP         0b00000000
-// Start-Addr_W-Write-Stop: just write mode.
-#define I2C_MODE_SAWP         0b00000100
-// Start-Addr_W-WrPageAdr-rStart-Addr_R-Read-Stop.
-#define I2C_MODE_ENHA         0b00001000
 // Transponder is busy.
 #define I2C_MODE_BUSY         0b01000000
 
@@ -64,8 +63,15 @@
 #define I2C_ERROR             0b00000001
 #define I2C_ERROR_LOW_PRIO    0b00100000
 
+// TWCR values for the master side. All of them clear TWINT and keep TWI on.
+#define TWCR_NEXT   ((1<<TWINT)|(I2C_MODE<<TWEA)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_ACK    ((1<<TWINT)|(1<<TWEA)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_NACK   ((1<<TWINT)|(0<<TWEA)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_START  ((1<<TWINT)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_STOP   ((1<<TWINT)|(I2C_MODE<<TWEA)|(1<<TWSTO)|(1<<TWEN))
+
 
-// Address of the device that is communicated with.
+// Address of the device i2c_write() talks to.
 uint8_t i2c_address;
 
 // State of TWI component of MCU.
@@ -78,14 +84,18 @@ volatile uint8_t i2c_state = 0;
 */
 volatile uint8_t i2c_should_end = 0;
 
-#ifdef I2C_EEPROM_SUPPORT
-  // For SAWSARP mode (see ENHA in i2c.h).
-  uint8_t i2c_page_address[I2C_PAGE_ADDRESS_SIZE];
-  // Index into the page address buffer.
-  uint8_t i2c_page_index;
-  // Count of bytes in page address.
-  uint8_t i2c_page_count;
-#endif /* I2C_EEPROM_SUPPORT */
+/// Transaction on the bus and the last one queued behind it.
+static I2C_TRANSACTION *volatile i2c_current = NULL;
+static I2C_TRANSACTION *i2c_last = NULL;
+
+/// Bytes of the current transaction written or read so far.
+static uint8_t i2c_index;
+
+/// Set while reading, after the write part of a transaction.
+static uint8_t i2c_reading;
+
+/// The transaction i2c_write() feeds, see there.
+static I2C_TRANSACTION i2c_stream;
 
 #ifdef I2C_SLAVE_MODE
   uint8_t i2c_in_buffer[I2C_SLAVE_RX_BUFFER_SIZE];
@@ -106,14 +116,15 @@ volatile uint8_t sendbuf[BUFSIZE];
   Inititalise the I2C/TWI subsystem.
 
   \param address Address the system should listen to in slave mode, unused
-                 when configured for master mode. In master mode, receiver
-                 address is given to the send command.
+                 when configured for master mode. In master mode, it's the
+                 receiver address for i2c_write().
 
   This also sets the I2C address. In slave mode it's the address we listen on.
 
-  In master mode it's the communication target address. As master one can talk
-  to different devices. Call again i2c_init() for changing the target address,
-  then. Doing so won't interrupt ongoing transmissions and overhead is small.
+  In master mode it's the communication target address of i2c_write().
+  Call again i2c_init() for changing it, then. Doing so won't interrupt
+  ongoing transmissions and overhead is small. Transactions submitted with
+  i2c_submit() carry their own address.
 */
 void i2c_init(uint8_t address) {
 
@@ -162,12 +173,42 @@ void i2c_init(uint8_t address) {
 
   Idea is that non-crucial display writes check the bus before actually
   writing, so they avoid long waits. If i2c_busy() returns zero, the bus
-  is free and writes won't cause a delay.
+  is free and writes won't cause a delay. Users of i2c_submit() don't need
+  this, they just queue up.
 */
 uint8_t i2c_busy(void) {
   return (i2c_state & I2C_MODE_BUSY);
 }
 
+/**
+  Queue a transaction.
+
+  \param t The transaction, with address, buffers, lengths and callback set.
+
+  Returns immediately. The transaction goes onto the bus as soon as the ones
+  queued before are done. Watch t->status or use t->done to learn when it's
+  finished. A transaction with both lengths zero just probes for the device.
+*/
+void i2c_submit(I2C_TRANSACTION *t) {
+
+  t->status = I2C_PENDING;
+  t->next = NULL;
+
+  ATOMIC_START
+    if (i2c_current == NULL) {
+      i2c_current = i2c_last = t;
+      i2c_index = 0;
+      i2c_reading = (t != &i2c_stream && t->tx_len == 0 && t->rx_len);
+      i2c_state |= I2C_MODE_BUSY;
+      TWCR = TWCR_START;
+    }
+    else {
+      i2c_last->next = t;
+      i2c_last = t;
+    }
+  ATOMIC_END
+}
+
 /**
   Send a byte to the I2C partner.
 
@@ -190,7 +231,8 @@ uint8_t i2c_busy(void) {
 
   Data is buffered, so this returns quickly for small amounts of data. Large
   amounts don't get lost, but this function has to wait until sufficient
-  previous data was sent.
+  previous data was sent. Code which can't afford waiting should use
+  i2c_submit() instead.
 
   To avoid unexpected delays, invoking code can check for bus availability
   with i2c_busy().
@@ -216,17 +258,42 @@ void i2c_write(uint8_t data, uint8_t last_byte) {
     delay_us(10);
   }
 
-  if ( ! (i2c_state & I2C_MODE_BUSY)) {
-    // No transmission ongoing, start one.
-    i2c_state = I2C_MODE_SAWP;
-    TWCR = (1<<TWINT)|(0<<TWEA)|(1<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-    i2c_state |= I2C_MODE_BUSY;
-  }
-
   ATOMIC_START
     buf_push(send, data);
     i2c_should_end = last_byte;
   ATOMIC_END
+
+  // The stream transaction ends when its buffer drains, start another one.
+  if (i2c_stream.status != I2C_PENDING) {
+    i2c_stream.address = i2c_address;
+    i2c_submit(&i2c_stream);
+  }
+}
+
+/**
+  Finish the current transaction and start the next one, if any. Called from
+  the interrupt only.
+*/
+static void i2c_finish(uint8_t status) {
+  I2C_TRANSACTION *t = i2c_current;
+
+  i2c_current = t->next;
+  i2c_index = 0;
+
+  if (i2c_current) {
+    // STOP, followed by a START.
+    i2c_reading = (i2c_current != &i2c_stream &&
+                   i2c_current->tx_len == 0 && i2c_current->rx_len);
+    TWCR = TWCR_STOP | TWCR_START;
+  }
+  else {
+    i2c_state &= ~I2C_MODE_BUSY;
+    TWCR = TWCR_STOP;
+  }
+
+  t->status = status;
+  if (t->done)
+    t->done(t);
 }
 
 /**
@@ -265,6 +332,7 @@ void i2c_write(uint8_t data, uint8_t last_byte) {
 #endif
 ISR(TWI_vect) {
   uint8_t status = TWSR & TW_STATUS_MASK;
+  I2C_TRANSACTION *t = i2c_current;
 
   #ifdef TWI_INTERRUPT_DEBUG
     serial_writechar('.');
@@ -272,119 +340,66 @@ ISR(TWI_vect) {
 
   switch (status) {
     case TW_START:
-      // Start happens, send a target address.
-      #ifdef TWI_INTERRUPT_DEBUG
-        serial_writechar('1');
-      #endif
-      if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_SARP) {
-        i2c_address |= 0x01;
-      } else {
-        i2c_address &= 0xFE;
-      }
-      TWDR = i2c_address;
-      TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      break;
     case TW_REP_START:
       // Start happens, send a target address.
       #ifdef TWI_INTERRUPT_DEBUG
-        serial_writechar('2');
+        serial_writechar('1');
       #endif
-      if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_ENHA) {
-        i2c_address |= 0x01;
-      } else {
-        i2c_address &= 0xFE;
+      if (t == NULL) {
+        TWCR = TWCR_STOP;
+        break;
       }
-      TWDR = i2c_address;
-      TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
+      TWDR = t->address | (i2c_reading ? 0x01 : 0x00);
+      TWCR = TWCR_NEXT;
       break;
+
     case TW_MT_SLA_ACK:
       // SLA+W was sent, then ACK received.
-      #ifdef TWI_INTERRUPT_DEBUG
-        serial_writechar('3');
-      #endif
-      if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_SAWP && buf_canread(send)) {
-        buf_pop(send, TWDR);
-        TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      }
-      #ifdef I2C_EEPROM_SUPPORT
-        if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_ENHA) {
-          TWDR = i2c_page_address[i2c_page_index++];
-          TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-        }
-      #endif
-      break;
     case TW_MT_DATA_ACK:
       // A byte was sent, got ACK.
       #ifdef TWI_INTERRUPT_DEBUG
         serial_writechar('4');
       #endif
-      if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_SAWP) {
+      if (t == &i2c_stream) {
         if (buf_canread(send)) {
           // Send the next byte.
           buf_pop(send, TWDR);
-          TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
+          TWCR = TWCR_NEXT;
         } else {
           // Buffer drained because transmission is completed.
-          i2c_state = 0;
           i2c_should_end = 0;
-          // Send stop condition.
-          TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(1<<TWSTO)|(1<<TWEN)|(0<<TWIE);
+          i2c_finish(I2C_DONE);
         }
       }
-      #ifdef I2C_EEPROM_SUPPORT
-        if ((i2c_state & I2C_MODE_MASK) == I2C_MODE_ENHA) {
-          // It was a page address byte.
-          if (i2c_page_index == i2c_page_count) {
-            // It was the last byte of the page address.
-            TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(1<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-          } else {
-            // Send the next page address byte.
-            TWDR = i2c_page_address[i2c_page_index++];
-            TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-          }
-        }
-      #endif
+      else if (i2c_index < t->tx_len) {
+        TWDR = t->tx[i2c_index++];
+        TWCR = TWCR_NEXT;
+      }
+      else if (t->rx_len) {
+        // Turn around for reading with a repeated start.
+        i2c_index = 0;
+        i2c_reading = 1;
+        TWCR = TWCR_START;
+      }
+      else {
+        i2c_finish(I2C_DONE);
+      }
       break;
 
-    #ifdef I2C_READ_SUPPORT
-
     case TW_MR_SLA_ACK:
-      // SLA+R was sent, got АСК, then received a byte.
-      if (i2c_index + 1 == i2c_byte_count) {
-        // Last byte fitting into the buffer. Request a byte, then send NACK
-        // to slave and it will release the bus.
-        TWCR = (1<<TWINT)|(0<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      } else {
-        // Or just receive a byte and sent ACK.
-        TWCR = (1<<TWINT)|(1<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      }
-      break;
-    case TW_MR_SLA_NACK:
-      // SLA+R was sent, got NАСК, it seems the slave is busy.
-      i2c_state |= I2C_ERROR_NO_ANSWER;
-      // Send stop condition.
-      TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(1<<TWSTO)|(1<<TWEN)|(0<<TWIE);
+      // SLA+R was sent, got ACK. Receive a byte, NACK it if it's the last.
+      TWCR = (t->rx_len > 1) ? TWCR_ACK : TWCR_NACK;
       break;
     case TW_MR_DATA_ACK:
-      i2c_buffer[i2c_index++] = TWDR;
-      // TODO: Add BUFFER OVERFLOW check.
-      if (i2c_index + 1 == i2c_byte_count) {
-        // Last byte wait the processing.
-        TWCR = (1<<TWINT)|(0<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      } else {
-        // Request the next byte.
-        TWCR = (1<<TWINT)|(0<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(1<<TWEN)|(1<<TWIE);
-      }
+      t->rx[i2c_index++] = TWDR;
+      TWCR = (i2c_index + 1 < t->rx_len) ? TWCR_ACK : TWCR_NACK;
       break;
     case TW_MR_DATA_NACK:
-      // Last byte received, send NACK to make the slave to release the bus.
-      i2c_buffer[i2c_index] = TWDR;
-      // Send stop condition.
-      TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(1<<TWSTO)|(1<<TWEN)|(0<<TWIE);
+      // Last byte received, we sent NACK, so the slave releases the bus.
+      t->rx[i2c_index] = TWDR;
+      i2c_finish(I2C_DONE);
       break;
 
-    #endif /* I2C_READ_SUPPORT */
-
     #ifdef I2C_SLAVE_MODE
 
     case TW_SR_ARB_LOST_SLA_ACK:
@@ -484,7 +499,8 @@ ISR(TWI_vect) {
         serial_writechar('5');
       #endif
     case TW_MT_SLA_NACK:
-      // SLA+W was sent, got NACK, so slave is busy or out of bus.
+    case TW_MR_SLA_NACK:
+      // SLA+W or SLA+R was sent, got NACK, so slave is busy or out of bus.
       #ifdef TWI_INTERRUPT_DEBUG
         serial_writechar('6');
       #endif
@@ -504,15 +520,20 @@ ISR(TWI_vect) {
         serial_writechar('8');
       #endif
 
-      i2c_state |= I2C_ERROR | I2C_INTERRUPTED;
-      // Let i2c_write() continue.
-      i2c_should_end = 0;
-      // Drain the buffer.
-      while (buf_canread(send)) {
-        buf_pop(send, TWDR);
+      if (t == NULL) {
+        TWCR = TWCR_STOP;
+        break;
       }
-      // Send stop condition.
-      TWCR = (1<<TWINT)|(I2C_MODE<<TWEA)|(0<<TWSTA)|(1<<TWSTO)|(1<<TWEN)|(0<<TWIE);
+      if (t == &i2c_stream) {
+        i2c_state |= I2C_ERROR | I2C_INTERRUPTED;
+        // Let i2c_write() continue.
+        i2c_should_end = 0;
+        // Drain the buffer.
+        while (buf_canread(send)) {
+          buf_pop(send, TWDR);
+        }
+      }
+      i2c_finish(I2C_FAILED);
       break;
 
     default:
@@ -22,30 +22,6 @@
 */
 //#define I2C_SLAVE_MODE
 
-/** \def I2C_READ_SUPPORT
-
-  Currently, reading from the I2C bus is implemented only partially. The
-  already existing parts are wrapped with this #define.
-
-  If reading from I2C is needed, at least a read buffer has to be added. This
-  buffer used to be 'i2c_buffer[]', a pointer 'i2c_index' into this buffer and
-  a variable 'i2c_byte_count' to track on how many bytes should be read.
-  Further requirements are adjustments to the wrapped code to use this buffer
-  and a function to make the read data available to calling code.
-*/
-//#define I2C_READ_SUPPORT
-
-/** \def I2C_EEPROM_SUPPORT
-
-  It's currently unclear what this enables exactly, apparently something to
-  deal easier with EEPROM chips. Uncomment this #define in addition to
-  I2C_MASTER_MODE or I2C_SLAVE_MODE to enable it.
-
-  Note that this part of the implementation is untested, it might not even
-  compile.
-*/
-//#define I2C_EEPROM_SUPPORT
-
 /** \def I2C_BITRATE
 
   Define the I2C bus speed here if acting as master. Maximum supported by
@@ -63,12 +39,12 @@
 
 /** \def I2C_BUFFER_SIZE
 
-  Size of send buffer. MUST be a \f$2^n\f$ value, maximum is 512.
+  Size of the send buffer of i2c_write(). MUST be a \f$2^n\f$ value, maximum
+  is 512.
 
   This buffer can be rather small, because there is another queue on the
-  display level. Transmissions can be large, e.g. 514 bytes when clearing the
-  display, but typically it's only some 3 to 10 bytes ( = sending one
-  character).
+  display level and bulk traffic goes through i2c_submit(), which needs no
+  buffer here.
 
   An exhausted buffer doesn't mean data loss, writing to the buffer then waits
   until sufficient previous data is sent.
@@ -80,15 +56,45 @@
   #define I2C_SLAVE_TX_BUFFER_SIZE  1
 #endif /* I2C_SLAVE_MODE */
 
-#ifdef I2C_EEPROM_SUPPORT
-  // Depends on EEPROM type, usually it is 1 or 2 bytes.
-  #define I2C_PAGE_ADDRESS_SIZE     2
-#endif /* I2C_EEPROM_SUPPORT */
+
+
+/// State of an I2C transaction.
+enum i2c_status_e {
+  I2C_DONE = 0,     ///< finished successfully, or never submitted
+  I2C_PENDING,      ///< queued or on the bus, don't touch
+  I2C_FAILED        ///< no ACK, bus error or lost arbitration
+};
+
+/**
+  An I2C transaction: write tx_len bytes, then, with a repeated start, read
+  rx_len bytes. Either count can be zero.
+
+  Storage belongs to the caller and has to stay valid until the transaction
+  is no longer I2C_PENDING. Typically it's static in the calling module.
+  Submitting each device's transactions this way lets several devices share
+  the bus without anybody waiting for it.
+*/
+typedef struct i2c_transaction {
+  uint8_t           address;  ///< 8 bit device address, R/W bit zero
+  const uint8_t    *tx;       ///< bytes to write, in RAM
+  uint8_t           tx_len;
+  uint8_t          *rx;       ///< room for the bytes read
+  uint8_t           rx_len;
+
+  /// Called from the I2C interrupt when the transaction finished, with
+  /// status already set. Keep it short. May be NULL.
+  void (*done)(struct i2c_transaction *t);
+
+  volatile uint8_t  status;   ///< enum i2c_status_e
+
+  struct i2c_transaction *next; ///< queue link, private to i2c.c
+} I2C_TRANSACTION;
 
 
 void i2c_init(uint8_t address);
 uint8_t i2c_busy(void);
 void i2c_write(uint8_t data, uint8_t last_byte);
+void i2c_submit(I2C_TRANSACTION *t);
 
 #endif /* I2C */
 
@@ -28,6 +28,11 @@ uint8_t	rxcrc;
 
 volatile uint8_t	intercom_flags;
 
+#ifdef MOTHERBOARD
+/// tx holds a new target or DIO state which wasn't sent yet
+static uint8_t tx_changed;
+#endif
+
 void intercom_init(void)
 {
 #ifdef MOTHERBOARD
@@ -61,6 +66,9 @@ void intercom_init(void)
 
 void send_temperature(uint8_t index, uint16_t temperature) {
 	tx.packet.temp[index] = temperature;
+	#ifdef MOTHERBOARD
+		tx_changed = 1;
+	#endif
 }
 
 uint16_t read_temperature(uint8_t index) {
@@ -73,6 +81,7 @@ void set_dio(uint8_t index, uint8_t value) {
 		tx.packet.dio |= (1 << index);
 	else
 		tx.packet.dio &= ~(1 << index);
+	tx_changed = 1;
 }
 #else
 uint8_t	get_dio(uint8_t index) {
@@ -118,6 +127,9 @@ void start_send(void) {
 	}
 
 	packet_pointer = 0;
+	#ifdef MOTHERBOARD
+		tx_changed = 0;
+	#endif
 
 	// actually start sending the packet
 	#ifdef MOTHERBOARD
@@ -127,6 +139,27 @@ void start_send(void) {
 	#endif
 }
 
+#ifdef MOTHERBOARD
+/** Called every 10 ms from clock.c. Sends a packet every INTERCOM_INTERVAL,
+	or right away when targets or DIO changed, so a new temperature doesn't
+	wait up to a whole interval. A packet still on the wire delays the next
+	one to the next tick.
+*/
+void intercom_tick(void) {
+	static uint8_t ticks = 0;
+
+	if (ticks < INTERCOM_INTERVAL / 10)
+		ticks++;
+	if (ticks < INTERCOM_INTERVAL / 10 && ! tx_changed)
+		return;
+	if (intercom_flags & FLAG_TX_IN_PROGRESS)
+		return;
+
+	ticks = 0;
+	start_send();
+}
+#endif
+
 /*
 	Interrupts, UART 0 for mendel
 */
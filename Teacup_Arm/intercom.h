@@ -76,6 +76,9 @@ uint8_t get_err(void);
 /// if extruder, return packet to host
 void start_send(void);
 
+/// if host, send a packet when due, call every 10 ms
+void intercom_tick(void);
+
 #define	FLAG_RX_IN_PROGRESS	1
 #define	FLAG_TX_IN_PROGRESS	2
 #define FLAG_NEW_RX					4
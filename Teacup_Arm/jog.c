@@ -0,0 +1,225 @@
+#include	"jog.h"
+
+/** \file
+	\brief Jogging, moving at a commanded speed until told otherwise.
+
+  A jog is a single move towards the axis limits, planned for the highest
+  speed the axes allow. dda_clock() keeps it at jog_feedrate, so a new speed
+  for the same direction takes effect within a millisecond, along the
+  acceleration ramp. Releasing ramps down to standstill and ends the move
+  where it stands, see dda_jog_end().
+*/
+
+#ifdef JOG
+
+#include <stdlib.h>
+#include <string.h>
+#include "dda_queue.h"
+#include "dda_maths.h"
+#include "dda_kinematics.h"
+#include "gcode_parse.h"
+#include "arduino.h"
+
+/** \def JOG_DISTANCE
+
+  How far a jog goes at most, in mm, unless an axis limit (X_MIN, X_MAX,
+  ...) comes first. With KINEMATICS_ARM4, jogs move the joints and this is
+  degrees, axis limits don't apply.
+*/
+#ifndef JOG_DISTANCE
+  #define JOG_DISTANCE 100
+#endif
+
+#ifdef X_MIN
+  #define JOG_MIN_X (int32_t)(X_MIN * 1000.)
+#else
+  #define JOG_MIN_X INT32_MIN
+#endif
+#ifdef X_MAX
+  #define JOG_MAX_X (int32_t)(X_MAX * 1000.)
+#else
+  #define JOG_MAX_X INT32_MAX
+#endif
+#ifdef Y_MIN
+  #define JOG_MIN_Y (int32_t)(Y_MIN * 1000.)
+#else
+  #define JOG_MIN_Y INT32_MIN
+#endif
+#ifdef Y_MAX
+  #define JOG_MAX_Y (int32_t)(Y_MAX * 1000.)
+#else
+  #define JOG_MAX_Y INT32_MAX
+#endif
+#ifdef Z_MIN
+  #define JOG_MIN_Z (int32_t)(Z_MIN * 1000.)
+#else
+  #define JOG_MIN_Z INT32_MIN
+#endif
+#ifdef Z_MAX
+  #define JOG_MAX_Z (int32_t)(Z_MAX * 1000.)
+#else
+  #define JOG_MAX_Z INT32_MAX
+#endif
+#ifdef U_MIN
+  #define JOG_MIN_U (int32_t)(U_MIN * 1000.)
+#else
+  #define JOG_MIN_U INT32_MIN
+#endif
+#ifdef U_MAX
+  #define JOG_MAX_U (int32_t)(U_MAX * 1000.)
+#else
+  #define JOG_MAX_U INT32_MAX
+#endif
+
+#ifndef KINEMATICS_ARM4
+/// axis limits in micrometers, no limit is the end of the number range
+static const int32_t PROGMEM jog_min_P[] = {
+  JOG_MIN_X, JOG_MIN_Y, JOG_MIN_Z, JOG_MIN_U
+};
+static const int32_t PROGMEM jog_max_P[] = {
+  JOG_MAX_X, JOG_MAX_Y, JOG_MAX_Z, JOG_MAX_U
+};
+#endif
+
+/// velocities of the running jog, thousandths per minute
+static axes_int32_t jog_velocity;
+
+/// whether a jog was queued and not released yet
+static uint8_t jog_running = 0;
+
+/// feedrate before the jog, the jog move has one of its own
+static uint32_t jog_saved_F;
+
+/** Move at the given speeds until told otherwise.
+
+  \param velocity Speed of each axis in thousandths of mm/min, as axis
+  words come, negative backwards. E is ignored.
+
+  With a jog running in the same direction, this changes speed only. Any
+  other direction releases the running jog first and starts a new one
+  after it stopped. All speeds zero just releases.
+*/
+void jog(const axes_int32_t velocity) {
+  axes_int32_t from;
+  TARGET t;
+  uint32_t vmax = 0, distance, f;
+  enum axis_e i;
+
+  for (i = X; i < E; i++)
+    if ((uint32_t)labs(velocity[i]) > vmax)
+      vmax = labs(velocity[i]);
+
+  f = approx_distance(approx_distance_3(labs(velocity[X]), labs(velocity[Y]),
+                                        labs(velocity[Z])),
+                      labs(velocity[U])) / 1000;
+  if (f == 0)
+    f = 1;
+  if (f > 65535)
+    f = 65535;
+
+  if (jog_running && vmax && ! queue_empty()) {
+    uint32_t vmax_old = 0;
+    uint8_t same = 1;
+
+    for (i = X; i < E; i++)
+      if ((uint32_t)labs(jog_velocity[i]) > vmax_old)
+        vmax_old = labs(jog_velocity[i]);
+    // Same direction, if the old velocities scale to the new ones.
+    for (i = X; i < E; i++)
+      if (labs(muldiv(jog_velocity[i], vmax, vmax_old) - velocity[i]) > 1000)
+        same = 0;
+
+    if (same) {
+      jog_feedrate = f;
+      memcpy(jog_velocity, velocity, sizeof(axes_int32_t));
+      return;
+    }
+  }
+
+  jog_release();
+  if (vmax == 0)
+    return;
+
+  #ifdef KINEMATICS_ARM4
+    joints_arm4(startpoint.axis, from);
+  #else
+    memcpy(from, startpoint.axis, sizeof(axes_int32_t));
+  #endif
+
+  // Distance of the fastest axis, shortened to stop at the first limit.
+  distance = JOG_DISTANCE * 1000UL;
+  #ifndef KINEMATICS_ARM4
+    for (i = X; i < E; i++) {
+      int32_t limit;
+      uint32_t room, travel;
+
+      if (velocity[i] == 0)
+        continue;
+      if (velocity[i] > 0) {
+        limit = pgm_read_dword(&jog_max_P[i]);
+        room = (from[i] < limit) ? (uint32_t)(limit - from[i]) : 0;
+      }
+      else {
+        limit = pgm_read_dword(&jog_min_P[i]);
+        room = (from[i] > limit) ? (uint32_t)(from[i] - limit) : 0;
+      }
+      travel = muldiv(distance, labs(velocity[i]), vmax);
+      if (travel > room)
+        distance = muldiv(room, vmax, labs(velocity[i]));
+    }
+  #endif
+  if (distance == 0)
+    return;
+
+  for (i = X; i < E; i++)
+    from[i] += muldiv(velocity[i], distance, vmax);
+
+  memcpy(&t, &startpoint, sizeof(TARGET));
+  #ifdef KINEMATICS_ARM4
+    arm4_to_carthesian(from, t.axis);
+  #else
+    memcpy(t.axis, from, sizeof(int32_t) * E);
+  #endif
+  if (t.e_relative)
+    t.axis[E] = 0;
+  // As fast as the axes allow, dda_create() limits this.
+  t.F = 65535;
+  t.jog = 1;
+
+  jog_saved_F = startpoint.F;
+  jog_feedrate = f;
+  dda_break_lookahead();
+  enqueue_jog(&t);
+
+  memcpy(jog_velocity, velocity, sizeof(axes_int32_t));
+  jog_running = 1;
+}
+
+/** Stop a running jog.
+
+  Waits until the jog move ramped down and stopped, then continues from
+  where it stopped. Axes not given in the current command move from there,
+  too. Does nothing without a jog.
+*/
+void jog_release(void) {
+  uint8_t seen[E] = {
+    next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+    next_target.seen_U
+  };
+  enum axis_e i;
+
+  if ( ! jog_running)
+    return;
+
+  jog_feedrate = 0;
+  queue_wait();
+  dda_jog_end();
+  startpoint.F = jog_saved_F;
+  for (i = X; i < E; i++)
+    if ( ! seen[i])
+      next_target.target.axis[i] = startpoint.axis[i];
+
+  jog_running = 0;
+}
+
+#endif /* JOG */
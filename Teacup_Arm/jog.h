@@ -0,0 +1,17 @@
+#ifndef	_JOG_H
+#define _JOG_H
+
+#include "config_wrapper.h"
+#include "dda.h"
+
+#ifdef JOG
+
+// move at the given speeds until told otherwise, see M430
+void jog(const axes_int32_t velocity);
+
+// stop a running jog and continue from where it stopped
+void jog_release(void);
+
+#endif /* JOG */
+
+#endif	/* _JOG_H */
@@ -45,7 +45,10 @@
 
   #define ATOMIC_START cli();
   #define ATOMIC_END sei();
-  #define MEMORY_BARRIER()
+
+  // Compiler barrier, like on AVR. The Cortex-M0 doesn't reorder memory
+  // accesses, so there's no need for a DMB.
+  #define MEMORY_BARRIER() __ASM volatile ("" ::: "memory")
 
 #elif defined SIMULATOR
 
@@ -46,6 +46,11 @@
 #include "spi.h"
 #include "sd.h"
 #include "display.h"
+#include "sersendf.h"
+#include "profile.h"
+#include "ram.h"
+#include "steplink.h"
+#include "settings.h"
 
 #ifdef SIMINFO
   #include "../simulavr/src/simulavr_info.h"
@@ -57,10 +62,6 @@
   #endif
 #endif
 
-#ifdef CANNED_CYCLE
-  const char PROGMEM canned_gcode_P[] = CANNED_CYCLE;
-#endif
-
 /** Initialise all the subsystems.
 
   Note that order of appearance is critical here. For example, running
@@ -69,6 +70,9 @@
 */
 void init(void) {
 
+  // paint free RAM for M432
+  ram_init();
+
   cpu_init();
 
 	// set up watchdog
@@ -90,11 +94,22 @@ void init(void) {
 	// set up timers
 	timer_init();
 
+  #ifdef STEP_LINK
+    steplink_init();
+  #endif
+
 	heater_init();
 
+  // machine settings, from EEPROM if saved there
+  settings_init();
+
 	// set up dda
 	dda_init();
 
+  #ifdef MOTION_MACRO
+    macro_init();
+  #endif
+
 	// start up analog read interrupt loop,
 	// if any of the temp sensors in your config.h use analog interface
 	analog_init();
@@ -115,19 +130,23 @@ void init(void) {
   // prepare the power supply
   power_init();
 
+	// say hi to host
+	serial_writestr_P(PSTR("start\nok\n"));
+
+  // Everything below is slow, but doesn't block the host or movements. The
+  // greeting gets drawn in the background, SD cards get mounted on first use.
   #ifdef DISPLAY
     display_init();
     display_greeting();
   #endif
-
-	// say hi to host
-	serial_writestr_P(PSTR("start\nok\n"));
-
 }
 
 /// this is where it all starts, and ends
 ///
-/// just run init(), then run an endless loop where we pass characters from the serial RX buffer to gcode_parse_char() and check the clocks
+/// just run init(), then run an endless loop of tasks, by priority: feed the
+/// parser while the queue has room, then clock(). Interrupts post events to
+/// main_events, with none pending and no task having work, sleep until the
+/// next one.
 #ifdef SIMULATOR
 int main (int argc, char** argv)
 {
@@ -136,81 +155,44 @@ int main (int argc, char** argv)
 int main (void)
 {
 #endif
-  uint8_t c, line_done, ack_waiting = 0;
-
 	init();
 
 	// main loop
 	for (;;)
 	{
+    uint32_t round_start = timer_read();
+    #ifdef PROFILE
+      uint32_t start;
+    #endif
+
+    // Events posted from now on count for this round.
+    main_events = 0;
+
 		// if queue is full, no point in reading chars- host will just have to wait
     if (queue_full() == 0) {
-      /**
-        Postpone sending acknowledgement until there's a free slot in the
-        movement queue. This way the host waits with sending the next line
-        until it can be processed immediately. As a result, the serial receive
-        queue is always almost empty; it exists only for receiving via XON/XOFF
-        flow control. Another result is, the incoming line can be longer than
-        the receiving buffer, see Github issue #52.
-
-        At the time of the introduction of this strategy gcode_parse_char()
-        parsed a single character in 100 to 400 CPU clocks, processing
-        the line end took some 30'000 clocks. 115200 baud mean one character
-        incoming every about 1250 CPU clocks on AVR 16 MHz.
-      */
-      if (ack_waiting) {
-        serial_writestr_P(PSTR("ok\n"));
-        ack_waiting = 0;
-      }
-
-      if (( ! gcode_active || gcode_active & GCODE_SOURCE_SERIAL) &&
-          serial_rxchars() != 0) {
-        gcode_active = GCODE_SOURCE_SERIAL;
-        c = serial_popchar();
-        line_done = gcode_parse_char(c);
-        if (line_done) {
-          gcode_active = 0;
-          ack_waiting = 1;
-        }
-      }
-
-      #ifdef SD
-        if (( ! gcode_active || gcode_active & GCODE_SOURCE_SD) &&
-            gcode_sources & GCODE_SOURCE_SD) {
-          if (sd_read_gcode_line()) {
-            serial_writestr_P(PSTR("\nSD file done.\n"));
-            gcode_sources &= ! GCODE_SOURCE_SD;
-            // There is no pf_close(), subsequent reads will stick at EOF
-            // and return zeros.
-          }
-        }
+      #ifdef PROFILE
+        start = timer_read();
       #endif
-
-      #ifdef CANNED_CYCLE
-        /**
-          WARNING!
-
-          This code works on a per-character basis.
-
-          Unlike with SD reading code above and for historical reasons (was
-          a quicky doing its job, before SD card was implemented), any data
-          received over serial WILL be randomly distributed through the canned
-          G-code, and you'll have a big mess!
-
-          The solution is to join the strategy above and make canned G-code
-          a third G-code source next to serial and SD.
-        */
-        static uint32_t canned_gcode_pos = 0;
-
-        gcode_parse_char(pgm_read_byte(&(canned_gcode_P[canned_gcode_pos])));
-
-        canned_gcode_pos++;
-        if (pgm_read_byte(&(canned_gcode_P[canned_gcode_pos])) == 0)
-          canned_gcode_pos = 0;
-
-      #endif /* CANNED_CYCLE */
+      gcode_schedule();
+      profile_add(PROFILE_GCODE, timer_read() - start);
 		}
 
+    #ifdef PROFILE
+      start = timer_read();
+    #endif
 		clock();
+    profile_add(PROFILE_HOUSE, timer_read() - start);
+
+    loop_stats_round(timer_read() - round_start);
+
+    // Nothing new and nothing to do? An event posted right between this test
+    // and sleeping is seen after the next interrupt, TICK_TIME at the latest.
+    if (main_events == 0 && (queue_full() || ! gcode_pending())) {
+      #ifdef SD_LOG
+        // Idle time is the time for slow sector writes.
+        sd_log_flush();
+      #endif
+      cpu_idle();
+    }
 	}
 }
@@ -44,23 +44,66 @@ void write_hex32(void (*writechar)(uint8_t), uint32_t v) {
 /// list of powers of ten, used for dividing down decimal numbers for sending, and also for our crude floating point algorithm
 const uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
 
-/** write decimal digits from a long unsigned int
-	\param v number to send
+/// powers[] for the 16-bit part of write_digits()
+static const uint16_t powers16[] = {1, 10, 100, 1000};
+
+/** write decimal digits, most significant first
+	\param v number to send, has to be below powers[e + 1]
+	\param e index of the most significant digit
+	\param fp write a decimal point after digit fp, 0xFF for none
+
+	Digits are found by repeated subtraction, no division needed. Once the
+	remainder fits, this continues with 16-bit and then 8-bit arithmetics,
+	which is much cheaper on AVR.
 */
-void write_uint32(void (*writechar)(uint8_t), uint32_t v) {
-	uint8_t e, t;
+static void write_digits(void (*writechar)(uint8_t), uint32_t v, uint8_t e,
+                         uint8_t fp) {
+	uint16_t v16;
+	uint8_t v8, t;
+
+	for ( ; e >= 4; e--) {
+		for (t = '0'; v >= powers[e]; v -= powers[e], t++);
+		writechar(t);
+		if (e == fp)
+			writechar('.');
+	}
+
+	v16 = v;                                      // < 10000
+	for ( ; e >= 2; e--) {
+		for (t = '0'; v16 >= powers16[e]; v16 -= powers16[e], t++);
+		writechar(t);
+		if (e == fp)
+			writechar('.');
+	}
+
+	v8 = v16;                                     // < 100
+	if (e == 1) {
+		for (t = '0'; v8 >= 10; v8 -= 10, t++);
+		writechar(t);
+		if (fp == 1)
+			writechar('.');
+	}
+	writechar('0' + v8);
+	if (fp == 0)
+		writechar('.');
+}
+
+/// index of the most significant decimal digit of v
+static uint8_t msd(uint32_t v) {
+	uint8_t e;
 
 	for (e = 9; e > 0; e--) {
 		if (v >= powers[e])
 			break;
 	}
+	return e;
+}
 
-	do
-	{
-		for (t = 0; v >= powers[e]; v -= powers[e], t++);
-    writechar(t + '0');
-	}
-	while (e--);
+/** write decimal digits from a long unsigned int
+	\param v number to send
+*/
+void write_uint32(void (*writechar)(uint8_t), uint32_t v) {
+	write_digits(writechar, v, msd(v), 0xFF);
 }
 
 /** write decimal digits from a long signed int
@@ -80,24 +123,12 @@ void write_int32(void (*writechar)(uint8_t), int32_t v) {
 \param fp number of decimal places to the right of the decimal point
 */
 void write_uint32_vf(void (*writechar)(uint8_t), uint32_t v, uint8_t fp) {
-	uint8_t e, t;
-
-	for (e = 9; e > 0; e--) {
-		if (v >= powers[e])
-			break;
-	}
+	uint8_t e = msd(v);
 
 	if (e < fp)
 		e = fp;
 
-	do
-	{
-		for (t = 0; v >= powers[e]; v -= powers[e], t++);
-    writechar(t + '0');
-		if (e == fp)
-      writechar('.');
-	}
-	while (e--);
+	write_digits(writechar, v, e, fp);
 }
 
 /** write decimal digits from a long signed int
@@ -112,3 +143,22 @@ void write_int32_vf(void (*writechar)(uint8_t), int32_t v, uint8_t fp) {
 
 	write_uint32_vf(writechar, v, fp);
 }
+
+/** write a list of decimal numbers, separated by commas
+\param v numbers to send
+\param count how many there are
+\param fp number of decimal places to the right of the decimal point
+
+Same as count times write_int32_vf() with commas in between, without
+going through a format string for each number. Meant for axis vectors.
+*/
+void write_int32_vf_list(void (*writechar)(uint8_t), const int32_t *v,
+                         uint8_t count, uint8_t fp) {
+	uint8_t i;
+
+	for (i = 0; i < count; i++) {
+		if (i)
+			writechar(',');
+		write_int32_vf(writechar, v[i], fp);
+	}
+}
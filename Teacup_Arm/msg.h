@@ -21,4 +21,7 @@ void write_int32(void (*writechar)(uint8_t), int32_t v);
 void write_uint32_vf(void (*writechar)(uint8_t), uint32_t v, uint8_t fp);
 void write_int32_vf(void (*writechar)(uint8_t), int32_t v, uint8_t fp);
 
+void write_int32_vf_list(void (*writechar)(uint8_t), const int32_t *v,
+                         uint8_t count, uint8_t fp);
+
 #endif	/* _SERMSG_H */
@@ -42,6 +42,11 @@
     see pff_diskio.c.
   - Added pf_unmount(), which just clears the pointer to the file system,
     avoiding failing read attempts.
+  - Implemented disk_writep() in pff_diskio.c, enabled with SD_RECORD or
+    SD_LOG.
+  - Added the start cluster to FILINFO and pf_open_clust(), which opens a
+    file by its start cluster and size without walking the directory, see
+    SD_FILE_CACHE.
 */
 
 #include "pff.h"        /* Petit FatFs configurations and declarations */
@@ -689,6 +694,7 @@ void get_fileinfo (     /* No return code */
         fno->fsize = LD_DWORD(dir+DIR_FileSize);    /* Size */
         fno->fdate = LD_WORD(dir+DIR_WrtDate);      /* Date */
         fno->ftime = LD_WORD(dir+DIR_WrtTime);      /* Time */
+        fno->fclust = get_clust(dir);               /* Start cluster */
     }
     *p = 0;
 }
@@ -899,6 +905,31 @@ FRESULT pf_open (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Open a File by its start cluster, as found with pf_readdir()          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_open_clust (
+    CLUST clust,        /* File start cluster, FILINFO.fclust */
+    DWORD size          /* File size, FILINFO.fsize */
+)
+{
+    FATFS *fs = FatFs;
+
+
+    if (!fs) return FR_NOT_ENABLED;     /* Check file system */
+
+    fs->org_clust = clust;
+    fs->fsize = size;
+    fs->fptr = 0;
+    fs->flag = FA_OPENED;
+
+    return FR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
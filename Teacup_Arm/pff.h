@@ -81,6 +81,7 @@ typedef struct {
     WORD    ftime;      /* Last modified time */
     BYTE    fattrib;    /* Attribute */
     char    fname[13];  /* File name */
+    CLUST   fclust;     /* File start cluster, for pf_open_clust() */
 } FILINFO;
 
 
@@ -106,6 +107,7 @@ typedef enum {
 FRESULT pf_mount (FATFS* fs);                               /* Mount a logical drive */
 void pf_unmount (FATFS* fs);                                /* Unmount a logical drive */
 FRESULT pf_open (const char* path);                         /* Open a file */
+FRESULT pf_open_clust (CLUST clust, DWORD size);            /* Open a file found before */
 FRESULT pf_read (void* buff, UINT btr, UINT* br);           /* Read data from the open file */
 FRESULT pf_parse_line (uint8_t (*parser)(uint8_t));         /* Read and parse a line of data from the open file. */
 FRESULT pf_write (const void* buff, UINT btw, UINT* bw);    /* Write data to the open file */
@@ -12,8 +12,12 @@
 
 #define _USE_READ   1   /* Enable pf_read() function */
 #define _USE_DIR    1   /* Enable pf_opendir() and pf_readdir() function */
-#define _USE_LSEEK  0   /* Enable pf_lseek() function */
-#define _USE_WRITE  0   /* Enable pf_write() function */
+#define _USE_LSEEK  1   /* Enable pf_lseek() function */
+#if defined SD_RECORD || defined SD_LOG  /* Enable pf_write() function */
+  #define _USE_WRITE  1
+#else
+  #define _USE_WRITE  0
+#endif
 
 /*---------------------------------------------------------------------------/
 / File system support.
@@ -22,8 +22,10 @@
 #define CMD1    (0x40 + 1)  /* SEND_OP_COND (MMC) */
 #define ACMD41  (0xC0 + 41) /* SEND_OP_COND (SDC) */
 #define CMD8    (0x40 + 8)  /* SEND_IF_COND */
+#define CMD12   (0x40 + 12) /* STOP_TRANSMISSION */
 #define CMD16   (0x40 + 16) /* SET_BLOCKLEN */
 #define CMD17   (0x40 + 17) /* READ_SINGLE_BLOCK */
+#define CMD18   (0x40 + 18) /* READ_MULTIPLE_BLOCK */
 #define CMD24   (0x40 + 24) /* WRITE_BLOCK */
 #define CMD55   (0x40 + 55) /* APP_CMD */
 #define CMD58   (0x40 + 58) /* READ_OCR */
@@ -37,6 +39,12 @@
 
 static BYTE card_type;                             /* Card type flags. */
 
+#ifdef SD_SECTOR_CACHE
+static BYTE cache[512];                            /* Last sector parsed. */
+static DWORD cache_sector = 0xFFFFFFFF;            /* Its number, none yet. */
+static DWORD stream_sector = 0xFFFFFFFF;           /* Next of CMD18, none. */
+#endif
+
 
 /** Send a command packet to MMC/SD card.
 
@@ -72,6 +80,8 @@ static BYTE send_cmd(BYTE cmd, DWORD arg) {
   if (cmd == CMD8) n = 0x87;          /* Valid CRC for CMD8(0x1AA) Stop */
   spi_rw(n);
 
+  if (cmd == CMD12) spi_rw(0xFF);     /* Skip a stuff byte when stop reading */
+
   /* Receive command response */
   n = 10;                             /* Wait for a response, try 10 times. */
   do {
@@ -141,12 +151,95 @@ DSTATUS disk_initialize(void) {
   }
 
   card_type = ty;
+  #ifdef SD_SECTOR_CACHE
+    cache_sector = 0xFFFFFFFF;                     /* Maybe another card. */
+    stream_sector = 0xFFFFFFFF;
+  #endif
   spi_deselect_sd();
   spi_rw(0xFF);
 
   return ty ? 0 : STA_NOINIT;
 }
 
+#ifdef SD_SECTOR_CACHE
+/** Stop a multiple block read, if one is going on.
+
+  Any other command to the card has to wait for this.
+*/
+static void stream_stop(void) {
+  UINT timeout;
+
+  if (stream_sector == 0xFFFFFFFF)
+    return;
+  stream_sector = 0xFFFFFFFF;
+
+  spi_speed_max();
+  send_cmd(CMD12, 0);
+  for (timeout = 40000; timeout && spi_rw(0xFF) != 0xFF; timeout--)
+    ;                                    /* Wait for leaving busy state. */
+
+  spi_deselect_sd();
+  spi_rw(0xFF);
+}
+
+/** Read a whole sector, streaming consecutive sectors.
+
+  \param buffer  Received data should go in here, 512 bytes.
+  \param sector  Sector number (LBA).
+
+  
+eturn RES_OK on success, else RES_ERROR.
+
+  Reading a file sector by sector, each single block read (CMD17) costs a
+  command, its response and waiting for the data token. Instead, this starts
+  a multiple block read (CMD18), which keeps delivering consecutive sectors
+  without further commands. Reading any other sector stops it. That happens
+  at a cluster break, if the file is fragmented, and with every other read,
+  e.g. of the FAT.
+
+  The card gets deselected between sectors, a multiple block read simply
+  waits for the next clocks. So other SPI devices can be used meanwhile.
+*/
+static DRESULT stream_read(BYTE* buffer, DWORD sector) {
+  BYTE token = 0xFF;
+  uint16_t timeout;
+
+  if (sector != stream_sector) {
+    stream_stop();
+
+    spi_speed_max();
+    if (send_cmd(CMD18, (card_type & CT_BLOCK) ? sector : sector * 512)) {
+      spi_deselect_sd();
+      spi_rw(0xFF);
+      return RES_ERROR;
+    }
+  }
+  else {
+    spi_speed_max();
+    spi_select_sd();
+  }
+  stream_sector = sector + 1;
+
+  /* Wait for data packet. */
+  for (timeout = 40000; timeout && (token == 0xFF); timeout--)
+    token = spi_rw(0xFF);
+
+  if (token != 0xFE) {
+    stream_stop();
+    return RES_ERROR;
+  }
+
+  spi_read_block(buffer, 512);
+  spi_rw(0xFF);                          /* Skip CRC. */
+  spi_rw(0xFF);
+
+  spi_deselect_sd();
+  spi_rw(0xFF);
+
+  return RES_OK;
+}
+#endif /* SD_SECTOR_CACHE */
+
 /** Read partial sector.
 
   \param buffer  Received data should go in here.
@@ -169,6 +262,10 @@ DRESULT disk_readp(BYTE* buffer, DWORD sector, UINT offset, UINT count) {
   uint16_t timeout;
   UINT trailing = 514 - offset - count;  /* 514 = block size + 2 bytes CRC */
 
+  #ifdef SD_SECTOR_CACHE
+    stream_stop();
+  #endif
+
   /* Convert to byte address on non-block cards. */
   if ( ! (card_type & CT_BLOCK))
     sector *= 512;
@@ -187,14 +284,7 @@ DRESULT disk_readp(BYTE* buffer, DWORD sector, UINT offset, UINT count) {
         spi_rw(0xFF);
 
       /* Receive the requested part of the sector. */
-      do {
-        /**
-          Note that this isn't optimised for performance. The increment and
-          the dereferencing could be done while waiting for the SPIF bit
-          to become set in spi_rw(). See http://www.matuschek.net/atmega-spi/.
-        */
-        *buffer++ = spi_rw(0xFF);
-      } while (--count);
+      spi_read_block(buffer, count);
 
       /* Skip trailing bytes and CRC. */
       while (trailing--)
@@ -229,7 +319,38 @@ DRESULT disk_readp(BYTE* buffer, DWORD sector, UINT offset, UINT count) {
   Reading lines of code this way should be more efficient than reading all the
   bytes into a small, not line-aligned buffer, just to read this buffer(s)
   right again byte by byte for parsing. It makes buffering entirely obsolete.
+
+  Except that each line starts reading its sector from the beginning again,
+  so a sector holding 20 lines gets transferred 20 times. With
+  SD_SECTOR_CACHE the sector is read only once into a buffer of 512 bytes,
+  following lines get parsed from there. Sectors get read with a multiple
+  block read then, see stream_read(). This also keeps the card
+  deselected while the parser processes a command, so other SPI devices
+  can be used meanwhile.
 */
+#ifdef SD_SECTOR_CACHE
+DRESULT disk_parsep(DWORD sector, UINT offset, UINT* count,
+                    uint8_t (*parser)(uint8_t)) {
+  uint8_t eol;
+  UINT read = 0;
+
+  if (sector != cache_sector) {
+    cache_sector = 0xFFFFFFFF;            /* Invalid while reading. */
+    if (stream_read(cache, sector) != RES_OK)
+      return RES_ERROR;
+    cache_sector = sector;
+  }
+
+  do {
+    eol = parser(cache[offset++]);
+    read++;
+  } while (offset < 512 && ! eol);
+
+  *count = read;
+
+  return eol ? RES_EOL_FOUND : RES_OK;
+}
+#else
 DRESULT disk_parsep(DWORD sector, UINT offset, UINT* count,
                     uint8_t (*parser)(uint8_t)) {
   DRESULT result;
@@ -283,6 +404,7 @@ DRESULT disk_parsep(DWORD sector, UINT offset, UINT* count,
 
   return result;
 }
+#endif /* SD_SECTOR_CACHE */
 #endif /* _USE_READ */
 
 /** Write partial pector.
@@ -296,30 +418,64 @@ DRESULT disk_parsep(DWORD sector, UINT offset, UINT* count,
   This is the main writing function. Forming this into file writes and such
   stuff is done by Petit FatFs it's self.
 
+  A sector gets written with a single block write (CMD24). The card stays
+  selected from initiating until finalizing, so no other SPI device can be
+  used in between. Finalizing fills the rest of the sector with zeros and
+  waits for the card to finish writing, up to 500 ms.
+
   Description about what's going on here see
   http://elm-chan.org/docs/mmc/mmc_e.html, bottom section.
 */
 #if _USE_WRITE
 DRESULT disk_writep(const BYTE* buff, DWORD sc) {
-  #error disk_writep() not yet implemented
-  DRESULT res;
+  static UINT remaining;                    /* Bytes left in the sector. */
+  DRESULT res = RES_ERROR;
+  UINT count;
 
   if ( ! buff) {
-    if (sc) {
-
-      // Initiate write process
-
+    if (sc) {                               /* Initiate writing a sector. */
+      #ifdef SD_SECTOR_CACHE
+        stream_stop();
+        if (sc == cache_sector)
+          cache_sector = 0xFFFFFFFF;
+      #endif
+
+      if ( ! (card_type & CT_BLOCK))
+        sc *= 512;
+
+      spi_speed_max();
+      if (send_cmd(CMD24, sc) == 0) {
+        spi_rw(0xFF);                       /* Data token. */
+        spi_rw(0xFE);
+        remaining = 512;
+        res = RES_OK;
+      }
     }
-    else {
-
-      // Finalize write process
+    else {                                  /* Finalize writing a sector. */
+      count = remaining + 2;                /* 2 bytes CRC. */
+      while (count--)
+        spi_rw(0);
+
+      /* Data response "accepted", then wait for leaving busy state. */
+      if ((spi_rw(0xFF) & 0x1F) == 0x05) {
+        for (count = 5000; spi_rw(0xFF) != 0xFF && count; count--)
+          delay_us(100);
+        if (count)
+          res = RES_OK;
+      }
 
+      spi_deselect_sd();                    /* Every send_cmd() selects. */
+      spi_rw(0xFF);
     }
   }
-  else {
-
-    // Send data to the disk
-
+  else {                                    /* Send data to the sector. */
+    count = (UINT)sc;
+    while (count && remaining) {
+      spi_rw(*buff++);
+      count--;
+      remaining--;
+    }
+    res = RES_OK;
   }
 
   return res;
@@ -1,11 +1,38 @@
 #include	"pinio.h"
 #include	"delay.h"
+#include	"dda_queue.h"
+#include	"memory_barrier.h"
 
 static char ps_is_on = 0;
 
 /// step/psu timeout
 volatile uint8_t	psu_timeout = 0;
 
+volatile uint8_t steppers_on = 0;
+
+#ifdef STEPPER_IDLE_DISABLE
+  volatile uint8_t steppers_moved = 0;
+
+  /// 250 ms ticks each axis stood still
+  static uint8_t steppers_idle[AXIS_COUNT];
+#endif
+
+#ifdef X_GRAYCODE
+  GRAYCODE x_graycode = { 0, 1 };
+#endif
+#ifdef Y_GRAYCODE
+  GRAYCODE y_graycode = { 0, 1 };
+#endif
+#ifdef Z_GRAYCODE
+  GRAYCODE z_graycode = { 0, 1 };
+#endif
+#ifdef U_GRAYCODE
+  GRAYCODE u_graycode = { 0, 1 };
+#endif
+#ifdef E_GRAYCODE
+  GRAYCODE e_graycode = { 0, 1 };
+#endif
+
 /** Initialise all I/O.
 
   This sets pins as input or output, appropriate for their usage.
@@ -13,6 +40,7 @@ volatile uint8_t	psu_timeout = 0;
 void pinio_init(void) {
   /// X Stepper.
   SET_OUTPUT(X_STEP_PIN); WRITE(X_STEP_PIN, 0);
+  STEP_INIT(X_STEP_PIN);
   SET_OUTPUT(X_DIR_PIN); WRITE(X_DIR_PIN, 0);
   #ifdef X_MIN_PIN
     SET_INPUT(X_MIN_PIN);
@@ -25,6 +53,7 @@ void pinio_init(void) {
 
   /// Y Stepper.
   SET_OUTPUT(Y_STEP_PIN); WRITE(Y_STEP_PIN, 0);
+  STEP_INIT(Y_STEP_PIN);
   SET_OUTPUT(Y_DIR_PIN); WRITE(Y_DIR_PIN, 0);
   #ifdef Y_MIN_PIN
     SET_INPUT(Y_MIN_PIN);
@@ -38,6 +67,7 @@ void pinio_init(void) {
   /// Z Stepper.
   #if defined Z_STEP_PIN && defined Z_DIR_PIN
     SET_OUTPUT(Z_STEP_PIN); WRITE(Z_STEP_PIN, 0);
+    STEP_INIT(Z_STEP_PIN);
     SET_OUTPUT(Z_DIR_PIN); WRITE(Z_DIR_PIN, 0);
   #endif
   #ifdef Z_MIN_PIN
@@ -52,6 +82,7 @@ void pinio_init(void) {
   /// U Stepper.
   #if defined U_STEP_PIN && defined U_DIR_PIN
     SET_OUTPUT(U_STEP_PIN); WRITE(U_STEP_PIN, 0);
+    STEP_INIT(U_STEP_PIN);
     SET_OUTPUT(U_DIR_PIN); WRITE(U_DIR_PIN, 0);
   #endif
   #ifdef U_MIN_PIN
@@ -65,6 +96,7 @@ void pinio_init(void) {
 
 #if defined E_STEP_PIN && defined E_DIR_PIN
     SET_OUTPUT(E_STEP_PIN); WRITE(E_STEP_PIN, 0);
+    STEP_INIT(E_STEP_PIN);
     SET_OUTPUT(E_DIR_PIN); WRITE(E_DIR_PIN, 0);
   #endif
 
@@ -132,10 +164,19 @@ void pinio_init(void) {
     power_off();
   #endif
 
+  // Endstop pullups stay on from here, dda_start() doesn't repeat this.
+  endstops_on();
+
   #ifdef DEBUG_LED_PIN
     SET_OUTPUT(DEBUG_LED_PIN);
     WRITE(DEBUG_LED_PIN, 0);
   #endif
+
+  #ifdef SYNC_PIN
+    // Not at a barrier, see queue_sync().
+    WRITE(SYNC_PIN, 0);
+    SET_OUTPUT(SYNC_PIN);
+  #endif
 }
 
 void power_on() {
@@ -160,6 +201,82 @@ void power_on() {
 	psu_timeout = 0;
 }
 
+/** Switch on all stepper drivers.
+
+  Called from dda_start() for each move, unless all are on already, which
+  is the usual case in the middle of a job.
+*/
+void steppers_enable() {
+
+	stepper_enable();
+	x_enable();
+	y_enable();
+	z_enable();
+  u_enable();
+	e_enable();
+
+  steppers_on = STEPPERS_ALL;
+}
+
+#ifdef STEPPER_IDLE_DISABLE
+/** Switch off the drivers of some axes.
+
+  \param mask Axes to switch off, one bit per axis.
+
+  Axes without an enable pin of their own keep running, of course.
+*/
+void steppers_disable(uint8_t mask) {
+
+  if (mask & (1 << X))
+    x_disable();
+  if (mask & (1 << Y))
+    y_disable();
+  if (mask & (1 << Z))
+    z_disable();
+  if (mask & (1 << U))
+    u_disable();
+  if (mask & (1 << E))
+    e_disable();
+
+  steppers_on &= ~mask;
+}
+
+/** Switch off axes standing still for STEPPER_IDLE_TIME.
+
+  Called from clock_250ms(). An axis of the current move counts as moving,
+  as well as one which moved since the last call, for moves shorter than
+  a tick. Atomic, so no move can start between the check and the switch off.
+*/
+void steppers_idle_tick() {
+  DDA *dda;
+  uint8_t moving, mask = 0;
+  enum axis_e i;
+
+  ATOMIC_START
+    moving = steppers_moved;
+    steppers_moved = 0;
+
+    dda = queue_current_movement();
+    if (dda)
+      moving |= dda->axis_mask;
+
+    for (i = X; i < AXIS_COUNT; i++) {
+      if ( ! (STEPPER_IDLE_DISABLE & steppers_on & (1 << i)))
+        continue;
+      if (moving & (1 << i))
+        steppers_idle[i] = 0;
+      else if (++steppers_idle[i] >= STEPPER_IDLE_TIME * 4) {
+        steppers_idle[i] = 0;
+        mask |= 1 << i;
+      }
+    }
+
+    if (mask)
+      steppers_disable(mask);
+  ATOMIC_END
+}
+#endif
+
 void power_off() {
 
 	stepper_disable();
@@ -168,6 +285,7 @@ void power_off() {
 	z_disable();
   u_disable();
 	e_disable();
+  steppers_on = 0;
 
 	#ifdef	PS_ON_PIN
 		SET_INPUT(PS_ON_PIN);
@@ -172,16 +172,111 @@ void pinio_init(void);
 void power_on(void);
 void power_off(void);
 
+/// Drivers switched on, one bit per axis, see steppers_enable().
+extern volatile uint8_t steppers_on;
+
+/// All of the above.
+#define STEPPERS_ALL ((1 << AXIS_COUNT) - 1)
+
+void steppers_enable(void);
+#ifdef STEPPER_IDLE_DISABLE
+/// Set by dda_start(), cleared by steppers_idle_tick().
+extern volatile uint8_t steppers_moved;
+
+void steppers_disable(uint8_t mask);
+void steppers_idle_tick(void);
+#endif
+
+/**
+  Step pins. With STEP_PULSE_MATCH, step pins connected to a timer match
+  output get their pulse from the timer: the step sets the match output high
+  and the match clears it after exactly STEP_PULSE_MATCH microseconds, so
+  unstep() has nothing to do for them. Other step pins are written as usual.
+*/
+#ifdef STEP_PULSE_MATCH
+  #ifndef __ARMEL__
+    #error STEP_PULSE_MATCH is available on ARM only.
+  #endif
+
+  #define _STEP_WRITE(IO, st) \
+    do { \
+      if (IO ## _TIMER) { \
+        if (st) { \
+          IO ## _TIMER->MR[IO ## _MATCH] = IO ## _TIMER->TC + \
+            STEP_PULSE_MATCH * (F_CPU / 1000000); \
+          IO ## _TIMER->EMR |= (1 << IO ## _MATCH); \
+        } \
+      } \
+      else \
+        _WRITE(IO, st); \
+    } while (0)
+
+  /// Connect a step pin to its match output, if it has one.
+  #define _STEP_INIT(IO) \
+    do { \
+      if (IO ## _TIMER) { \
+        if (IO ## _TIMER == LPC_TMR16B0) \
+          LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 7);  /* Turn on CT16B0. */ \
+        else if (IO ## _TIMER == LPC_TMR16B1) \
+          LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 8);  /* Turn on CT16B1. */ \
+        else if (IO ## _TIMER == LPC_TMR32B1) \
+          LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 10); /* Turn on CT32B1. */ \
+        LPC_IOCON->IO ## _CMSIS = IO ## _PWM;     /* Connect to timer. */ \
+        IO ## _TIMER->TCR = (1 << 0);             /* Free running. */ \
+        IO ## _TIMER->EMR = (IO ## _TIMER->EMR    /* Start low, */ \
+            & ~(1 << IO ## _MATCH))               /* clear on match. */ \
+            | (0x01 << ((IO ## _MATCH * 2) + 4)); \
+      } \
+    } while (0)
+#else
+  #define _STEP_WRITE(IO, st) _WRITE(IO, st)
+  #define _STEP_INIT(IO)      do { } while (0)
+#endif
+#define STEP_WRITE(IO, st)  _STEP_WRITE(IO, st)
+#define STEP_INIT(IO)       _STEP_INIT(IO)
+
+/**
+  Graycode output. Drivers expecting coil polarity signals instead of
+  step/dir get them on the step pin (coil A) and on the dir pin (coil B),
+  selected per axis with X_GRAYCODE, Y_GRAYCODE, etc. Each step counts the
+  position up or down, the two pins follow its graycode. There's no step
+  pulse, so unstep() has nothing to do for such axes.
+*/
+typedef struct {
+  uint8_t pos;   ///< position in the graycode sequence
+  int8_t  dir;   ///< +1 or -1, set by x_direction() and friends
+} GRAYCODE;
+
+#define _GRAY_STEP(STEP, DIR, g) \
+  do { \
+    (g).pos += (g).dir; \
+    _WRITE(STEP, ((g).pos >> 1) & 1); \
+    _WRITE(DIR, (((g).pos >> 1) ^ (g).pos) & 1); \
+  } while (0)
+#define GRAY_STEP(STEP, DIR, g)   _GRAY_STEP(STEP, DIR, g)
+#define GRAY_DIRECTION(g, d)      do { (g).dir = (d) ? 1 : -1; } while (0)
+
 /*
 X Stepper
 */
 
-#define	_x_step(st)						WRITE(X_STEP_PIN, st)
-#define x_step()              _x_step(1)
-#ifndef	X_INVERT_DIR
-	#define	x_direction(dir)		WRITE(X_DIR_PIN, dir)
+#ifdef X_GRAYCODE
+  extern GRAYCODE x_graycode;
+	#define	_x_step(st)					do { } while (0)
+  #define x_step()            GRAY_STEP(X_STEP_PIN, X_DIR_PIN, x_graycode)
+	#ifndef	X_INVERT_DIR
+		#define	x_direction(dir)	GRAY_DIRECTION(x_graycode, dir)
+	#else
+		#define	x_direction(dir)	GRAY_DIRECTION(x_graycode, (dir)^1)
+	#endif
 #else
-	#define	x_direction(dir)		WRITE(X_DIR_PIN, (dir)^1)
+	#define	_x_step(st)					STEP_WRITE(X_STEP_PIN, st)
+  #define x_step()            _x_step(1)
+	#ifndef	X_INVERT_DIR
+		#define	x_direction(dir)	WRITE(X_DIR_PIN, dir)
+	#else
+		#define	x_direction(dir)	WRITE(X_DIR_PIN, (dir)^1)
+	#endif
 #endif
 #ifdef	X_MIN_PIN
 	#ifndef X_INVERT_MIN
@@ -206,12 +301,23 @@ X Stepper
 Y Stepper
 */
 
-#define	_y_step(st)						WRITE(Y_STEP_PIN, st)
-#define y_step()              _y_step(1)
-#ifndef	Y_INVERT_DIR
-	#define	y_direction(dir)		WRITE(Y_DIR_PIN, dir)
+#ifdef Y_GRAYCODE
+  extern GRAYCODE y_graycode;
+	#define	_y_step(st)					do { } while (0)
+  #define y_step()            GRAY_STEP(Y_STEP_PIN, Y_DIR_PIN, y_graycode)
+	#ifndef	Y_INVERT_DIR
+		#define	y_direction(dir)	GRAY_DIRECTION(y_graycode, dir)
+	#else
+		#define	y_direction(dir)	GRAY_DIRECTION(y_graycode, (dir)^1)
+	#endif
 #else
-	#define	y_direction(dir)		WRITE(Y_DIR_PIN, (dir)^1)
+	#define	_y_step(st)					STEP_WRITE(Y_STEP_PIN, st)
+  #define y_step()            _y_step(1)
+	#ifndef	Y_INVERT_DIR
+		#define	y_direction(dir)	WRITE(Y_DIR_PIN, dir)
+	#else
+		#define	y_direction(dir)	WRITE(Y_DIR_PIN, (dir)^1)
+	#endif
 #endif
 #ifdef	Y_MIN_PIN
 	#ifndef Y_INVERT_MIN
@@ -236,8 +342,17 @@ Y Stepper
 Z Stepper
 */
 
-#if defined Z_STEP_PIN && defined Z_DIR_PIN
-	#define	_z_step(st)					WRITE(Z_STEP_PIN, st)
+#if defined Z_STEP_PIN && defined Z_DIR_PIN && defined Z_GRAYCODE
+  extern GRAYCODE z_graycode;
+	#define	_z_step(st)					do { } while (0)
+  #define z_step()            GRAY_STEP(Z_STEP_PIN, Z_DIR_PIN, z_graycode)
+	#ifndef	Z_INVERT_DIR
+		#define	z_direction(dir)	GRAY_DIRECTION(z_graycode, dir)
+	#else
+		#define	z_direction(dir)	GRAY_DIRECTION(z_graycode, (dir)^1)
+	#endif
+#elif defined Z_STEP_PIN && defined Z_DIR_PIN
+	#define	_z_step(st)					STEP_WRITE(Z_STEP_PIN, st)
   #define z_step()            _z_step(1)
 	#ifndef	Z_INVERT_DIR
 		#define	z_direction(dir)	WRITE(Z_DIR_PIN, dir)
@@ -273,8 +388,17 @@ Z Stepper
 U Stepper
 */
 
-#if defined U_STEP_PIN && defined U_DIR_PIN
-#define	_u_step(st)					WRITE(U_STEP_PIN, st)
+#if defined U_STEP_PIN && defined U_DIR_PIN && defined U_GRAYCODE
+extern GRAYCODE u_graycode;
+#define	_u_step(st)					do { } while (0)
+#define u_step()            GRAY_STEP(U_STEP_PIN, U_DIR_PIN, u_graycode)
+#ifndef	U_INVERT_DIR
+#define	u_direction(dir)	GRAY_DIRECTION(u_graycode, dir)
+#else
+#define	u_direction(dir)	GRAY_DIRECTION(u_graycode, (dir)^1)
+#endif
+#elif defined U_STEP_PIN && defined U_DIR_PIN
+#define	_u_step(st)					STEP_WRITE(U_STEP_PIN, st)
 #define u_step()            _u_step(1)
 #ifndef	U_INVERT_DIR
 #define	u_direction(dir)	WRITE(U_DIR_PIN, dir)
@@ -310,8 +434,17 @@ U Stepper
 Extruder
 */
 
-#if defined E_STEP_PIN && defined E_DIR_PIN
-	#define	_e_step(st)					WRITE(E_STEP_PIN, st)
+#if defined E_STEP_PIN && defined E_DIR_PIN && defined E_GRAYCODE
+  extern GRAYCODE e_graycode;
+	#define	_e_step(st)					do { } while (0)
+  #define e_step()            GRAY_STEP(E_STEP_PIN, E_DIR_PIN, e_graycode)
+	#ifndef	E_INVERT_DIR
+		#define	e_direction(dir)	GRAY_DIRECTION(e_graycode, dir)
+	#else
+		#define	e_direction(dir)	GRAY_DIRECTION(e_graycode, (dir)^1)
+	#endif
+#elif defined E_STEP_PIN && defined E_DIR_PIN
+	#define	_e_step(st)					STEP_WRITE(E_STEP_PIN, st)
   #define e_step()            _e_step(1)
 	#ifndef	E_INVERT_DIR
 		#define	e_direction(dir)	WRITE(E_DIR_PIN, dir)
@@ -329,7 +462,168 @@ End Step - All Steppers
 (so we don't have to delay in interrupt context)
 */
 
-#define unstep() 							do { _x_step(0); _y_step(0); _z_step(0); _u_step(0); _e_step(0); } while (0)
+#ifndef STEP_PORT_BATCH
+  #define unstep() 						do { _x_step(0); _y_step(0); _z_step(0); _u_step(0); _e_step(0); } while (0)
+#endif
+
+/**
+  Port batched step output. With STEP_PORT_BATCH, the Bresenham loop of
+  dda_step() collects the axes to step with STEP_COLLECT() and step_flush()
+  sets all step pins sharing a port with a single port write. unstep()
+  clears them the same way. Which pins share a port resolves at compile
+  time, the code left is one write per port in use.
+
+  Graycode axes aren't batched, step_flush() steps them individually.
+*/
+/// Axis bits as used by STEP_COLLECT(), same order as enum axis_e.
+#define STEP_BIT_X  0x01
+#define STEP_BIT_Y  0x02
+#define STEP_BIT_Z  0x04
+#define STEP_BIT_U  0x08
+#define STEP_BIT_E  0x10
+
+#ifdef STEP_PORT_BATCH
+  #if defined STEP_PULSE_MATCH || defined SIMULATOR
+    #error STEP_PORT_BATCH does not work with STEP_PULSE_MATCH or SIMULATOR.
+  #endif
+
+  #if defined __AVR__
+    #define _STEP_PORT(IO)          (&(IO ## _WPORT))
+    #define _STEP_PORT_SET(IO, m)   do { IO ## _WPORT |= (m); } while (0)
+    #define _STEP_PORT_CLEAR(IO, m) do { IO ## _WPORT &= ~(m); } while (0)
+  #elif defined __ARMEL__
+    #define _STEP_PORT(IO)          (IO ## _PORT)
+    #define _STEP_PORT_SET(IO, m) \
+      do { IO ## _PORT->MASKED_ACCESS[m] = (m); } while (0)
+    #define _STEP_PORT_CLEAR(IO, m) \
+      do { IO ## _PORT->MASKED_ACCESS[m] = 0; } while (0)
+  #endif
+  #define _STEP_PIN_MASK(IO)        MASK(IO ## _PIN)
+  #define STEP_PORT(IO)             _STEP_PORT(IO)
+  #define STEP_PORT_SET(IO, m)      _STEP_PORT_SET(IO, m)
+  #define STEP_PORT_CLEAR(IO, m)    _STEP_PORT_CLEAR(IO, m)
+  #define STEP_PIN_MASK(IO)         _STEP_PIN_MASK(IO)
+
+  /**
+    Per axis: 1 if batched, and the step pin. Axes not batched use the X
+    step pin as a stand-in, their bit never gets set.
+  */
+  #ifndef X_GRAYCODE
+    #define X_STEP_BATCH  1
+  #else
+    #define X_STEP_BATCH  0
+  #endif
+  #ifndef Y_GRAYCODE
+    #define Y_STEP_BATCH  1
+  #else
+    #define Y_STEP_BATCH  0
+  #endif
+  #if defined Z_STEP_PIN && defined Z_DIR_PIN && ! defined Z_GRAYCODE
+    #define Z_STEP_BATCH  1
+    #define Z_STEP_BATCH_PIN Z_STEP_PIN
+  #else
+    #define Z_STEP_BATCH  0
+    #define Z_STEP_BATCH_PIN X_STEP_PIN
+  #endif
+  #if defined U_STEP_PIN && defined U_DIR_PIN && ! defined U_GRAYCODE
+    #define U_STEP_BATCH  1
+    #define U_STEP_BATCH_PIN U_STEP_PIN
+  #else
+    #define U_STEP_BATCH  0
+    #define U_STEP_BATCH_PIN X_STEP_PIN
+  #endif
+  #if defined E_STEP_PIN && defined E_DIR_PIN && ! defined E_GRAYCODE
+    #define E_STEP_BATCH  1
+    #define E_STEP_BATCH_PIN E_STEP_PIN
+  #else
+    #define E_STEP_BATCH  0
+    #define E_STEP_BATCH_PIN X_STEP_PIN
+  #endif
+
+  #define _STEP_PORT_BIT(A, PIN, P, mask) \
+    ((A ## _STEP_BATCH && STEP_PORT(PIN) == STEP_PORT(P) && \
+      ((mask) & STEP_BIT_ ## A)) ? STEP_PIN_MASK(PIN) : 0)
+
+  /// Pin mask of all batched axes in mask with their step pin on port P.
+  #define STEP_PORT_BITS(P, mask) \
+    (_STEP_PORT_BIT(X, X_STEP_PIN, P, mask) | \
+     _STEP_PORT_BIT(Y, Y_STEP_PIN, P, mask) | \
+     _STEP_PORT_BIT(Z, Z_STEP_BATCH_PIN, P, mask) | \
+     _STEP_PORT_BIT(U, U_STEP_BATCH_PIN, P, mask) | \
+     _STEP_PORT_BIT(E, E_STEP_BATCH_PIN, P, mask))
+
+  /**
+    Whether an axis is the first one of its port, which does the write for
+    the whole port.
+  */
+  #define STEP_PORT_FIRST_X  (X_STEP_BATCH)
+  #define STEP_PORT_FIRST_Y  (Y_STEP_BATCH && \
+    ! (X_STEP_BATCH && STEP_PORT(Y_STEP_PIN) == STEP_PORT(X_STEP_PIN)))
+  #define STEP_PORT_FIRST_Z  (Z_STEP_BATCH && \
+    ! (X_STEP_BATCH && STEP_PORT(Z_STEP_BATCH_PIN) == STEP_PORT(X_STEP_PIN)) && \
+    ! (Y_STEP_BATCH && STEP_PORT(Z_STEP_BATCH_PIN) == STEP_PORT(Y_STEP_PIN)))
+  #define STEP_PORT_FIRST_U  (U_STEP_BATCH && \
+    ! (X_STEP_BATCH && STEP_PORT(U_STEP_BATCH_PIN) == STEP_PORT(X_STEP_PIN)) && \
+    ! (Y_STEP_BATCH && STEP_PORT(U_STEP_BATCH_PIN) == STEP_PORT(Y_STEP_PIN)) && \
+    ! (Z_STEP_BATCH && STEP_PORT(U_STEP_BATCH_PIN) == \
+                       STEP_PORT(Z_STEP_BATCH_PIN)))
+  #define STEP_PORT_FIRST_E  (E_STEP_BATCH && \
+    ! (X_STEP_BATCH && STEP_PORT(E_STEP_BATCH_PIN) == STEP_PORT(X_STEP_PIN)) && \
+    ! (Y_STEP_BATCH && STEP_PORT(E_STEP_BATCH_PIN) == STEP_PORT(Y_STEP_PIN)) && \
+    ! (Z_STEP_BATCH && STEP_PORT(E_STEP_BATCH_PIN) == \
+                       STEP_PORT(Z_STEP_BATCH_PIN)) && \
+    ! (U_STEP_BATCH && STEP_PORT(E_STEP_BATCH_PIN) == \
+                       STEP_PORT(U_STEP_BATCH_PIN)))
+
+  /// Set or clear the step pins of all axes in mask sharing a port with P.
+  #define STEP_PORT_WRITE(A, P, mask, op) \
+    do { \
+      if (STEP_PORT_FIRST_ ## A) { \
+        uint8_t m = STEP_PORT_BITS(P, mask); \
+        if (m) \
+          op(P, m); \
+      } \
+    } while (0)
+
+  #define STEP_COLLECT(mask, bit, step)  do { (mask) |= (bit); } while (0)
+
+  static void step_flush(uint8_t mask) __attribute__ ((always_inline));
+  inline void step_flush(uint8_t mask) {
+    STEP_PORT_WRITE(X, X_STEP_PIN, mask, STEP_PORT_SET);
+    STEP_PORT_WRITE(Y, Y_STEP_PIN, mask, STEP_PORT_SET);
+    STEP_PORT_WRITE(Z, Z_STEP_BATCH_PIN, mask, STEP_PORT_SET);
+    STEP_PORT_WRITE(U, U_STEP_BATCH_PIN, mask, STEP_PORT_SET);
+    STEP_PORT_WRITE(E, E_STEP_BATCH_PIN, mask, STEP_PORT_SET);
+
+    #ifdef X_GRAYCODE
+      if (mask & STEP_BIT_X) x_step();
+    #endif
+    #ifdef Y_GRAYCODE
+      if (mask & STEP_BIT_Y) y_step();
+    #endif
+    #ifdef Z_GRAYCODE
+      if (mask & STEP_BIT_Z) z_step();
+    #endif
+    #ifdef U_GRAYCODE
+      if (mask & STEP_BIT_U) u_step();
+    #endif
+    #ifdef E_GRAYCODE
+      if (mask & STEP_BIT_E) e_step();
+    #endif
+  }
+
+  #define unstep() \
+    do { \
+      STEP_PORT_WRITE(X, X_STEP_PIN, 0x1F, STEP_PORT_CLEAR); \
+      STEP_PORT_WRITE(Y, Y_STEP_PIN, 0x1F, STEP_PORT_CLEAR); \
+      STEP_PORT_WRITE(Z, Z_STEP_BATCH_PIN, 0x1F, STEP_PORT_CLEAR); \
+      STEP_PORT_WRITE(U, U_STEP_BATCH_PIN, 0x1F, STEP_PORT_CLEAR); \
+      STEP_PORT_WRITE(E, E_STEP_BATCH_PIN, 0x1F, STEP_PORT_CLEAR); \
+    } while (0)
+#else
+  #define STEP_COLLECT(mask, bit, step)  step()
+  #define step_flush(mask)               do { } while (0)
+#endif
 
 /*
 Stepper Enable Pins
@@ -45,4 +45,20 @@
 #define SQRT(x) ((SQR09(x) + ((x) / SQR09(x))) / 2)
 
 
+/*! Preprocessor fixed point quotients.
+
+  (num) / (den)
+  equals
+  Q32_INT(num, den) + Q32_FRAC(num, den) / 2^32
+
+  with a rounding error of the fraction below 2^-33. Meant to replace a
+  runtime division by den with multiplications, see mul_q32(). Both operands
+  have to be positive integers; den can't exceed about 4e9, else the fraction
+  may round up to 2^32.
+*/
+#define Q32_INT(num, den)  ((uint32_t)((num) / (den)))
+#define Q32_FRAC(num, den) \
+  ((uint32_t)((double)((num) % (den)) * 4294967296. / (den) + .5))
+
+
 #endif /* _PREPROCESSOR_MATH_H */
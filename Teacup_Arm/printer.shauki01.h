@@ -5,7 +5,7 @@
 *                                                                           *
 \***************************************************************************/
 
-/** \def KINEMATICS_STRAIGHT KINEMATICS_COREXY
+/** \def KINEMATICS_STRAIGHT KINEMATICS_COREXY KINEMATICS_ARM4
 
   This defines the type of kinematics your printer uses. That's essential!
 
@@ -20,9 +20,72 @@
     A bot using CoreXY kinematics. Typical for CoreXY
     are long and crossing toothed belts and a print head
     moving on the X-Y-plane.
+
+  KINEMATICS_ARM4
+    The PantherArm: base rotation (X), shoulder (Y), elbow (Z) and
+    wrist (U) joints. G-code X, Y and Z are the Cartesian position of the
+    wrist joint centre, U is the tool pitch against the horizon in degrees.
+    Joint angles are found by inverse kinematics in firmware, so STEPS_PER_M
+    of these axes are steps per 1000 degrees. See ARM_* below.
 */
 #define KINEMATICS_STRAIGHT
 //#define KINEMATICS_COREXY
+//#define KINEMATICS_ARM4
+
+/** \def ARM_SHOULDER_HEIGHT ARM_SHOULDER_OFFSET
+    \def ARM_UPPER_ARM_LENGTH ARM_FOREARM_LENGTH
+  Arm geometry for KINEMATICS_ARM4, ignored for all other kinematics.
+
+  ARM_SHOULDER_HEIGHT is the height of the shoulder pivot above the G-code
+  origin, ARM_SHOULDER_OFFSET its horizontal distance from the column axis.
+  The lengths are measured pivot to pivot: shoulder to elbow and elbow to
+  wrist.
+
+    Units: micrometers
+    Valid range: 0 to 1400000 (lengths combined)
+*/
+#define ARM_SHOULDER_HEIGHT      250000
+#define ARM_SHOULDER_OFFSET      0
+#define ARM_UPPER_ARM_LENGTH     300000
+#define ARM_FOREARM_LENGTH       300000
+
+/** \def PLANNER_FLOAT
+  Do the kinematics of KINEMATICS_ARM4 in single precision floating point
+  instead of integer table lookups. This is more precise, the integer
+  version works in units of 32 micrometers, and fast on CPUs with a
+  hardware FPU, like a Cortex-M4F. The step interrupt stays integer. On
+  AVR and the LPC1114 floats are done in software, slower than the integer
+  version and costing some 2 kB of flash, so keep this off there.
+*/
+//#define PLANNER_FLOAT
+
+/** \def JOINT_CALIBRATION
+  Correct repeatable angular errors of the joints of KINEMATICS_ARM4, like
+  those of printed or machined gears and rings. Each joint gets a table of
+  13 corrections, one every 32.768 degrees from -196.608 to +196.608
+  degrees, linearly interpolated in between. M434 sets them, M500 saves
+  them with the other settings. Costs 104 bytes of RAM.
+*/
+//#define JOINT_CALIBRATION
+
+/** \def SEGMENT_TOLERANCE SEGMENT_LENGTH_MIN SEGMENT_LENGTH_MAX
+  Segmentation of Cartesian moves for non-linear kinematics (KINEMATICS_ARM4).
+  Straight G-code moves become curves in joint space, so they get split into
+  short segments, each one a straight move of the joints.
+
+  SEGMENT_TOLERANCE is how far the tool may deviate from the straight line,
+  segment lengths get choosen accordingly, shorter ones near the column and
+  the shoulder, longer ones far away. SEGMENT_LENGTH_MIN and
+  SEGMENT_LENGTH_MAX limit this length. Short segments cost queue space and
+  CPU time, so don't go too low.
+
+  Units: micrometers
+  Sane values: TOLERANCE 5 to 100, LENGTH_MIN 200 to 2000,
+               LENGTH_MAX up to 50000
+*/
+#define SEGMENT_TOLERANCE        20
+#define SEGMENT_LENGTH_MIN       500
+#define SEGMENT_LENGTH_MAX       20000
 
 /** \def STEPS_PER_M_X STEPS_PER_M_Y STEPS_PER_M_Z STEPS_PER_M_E
   Steps per meter ( = steps per mm * 1000 ), calculate these values
@@ -81,6 +144,24 @@
 #define ENDSTOP_CLEARANCE_Z      500
 #define ENDSTOP_CLEARANCE_U      500
 
+/** \def BACKLASH_X BACKLASH_Y BACKLASH_Z BACKLASH_U
+  Backlash of the geared joints. When an axis reverses, this many extra
+  steps get added to its move to take up the slack. They're spread over the
+  whole move, so the step interrupt doesn't get slower and corners keep
+  their speed. Short moves right after reversing get a bit slower.
+
+  Leave all of them undefined to disable backlash compensation entirely.
+  Axes not defined get no compensation.
+
+    Units: micrometers, with arm kinematics millidegrees of the joint
+    Sane values: 0 to 2000
+    Valid range: 0 to 100000
+*/
+//#define BACKLASH_X               300
+//#define BACKLASH_Y               300
+//#define BACKLASH_Z               300
+//#define BACKLASH_U               300
+
 /** \def X_MIN X_MAX Y_MIN Y_MAX Z_MIN Z_MAX
   Soft axis limits. Define them to your machine's size relative to what your
   G-code considers to be the origin (typically the bed's center or the bed's
@@ -138,6 +219,120 @@
 */
 #define ACCELERATION             15000
 
+/** \def ACCELERATION_X ACCELERATION_Y ACCELERATION_Z ACCELERATION_U ACCELERATION_E
+  Acceleration limit of each axis, for axes with very different inertia. A
+  move accelerates as fast as the weakest of its participating axes allows.
+  Axes not defined here use ACCELERATION.
+
+    Units: mm/s^2 (degrees/s^2 for joints)
+    Useful range: 1 to 100'000
+*/
+#define ACCELERATION_X           15000
+#define ACCELERATION_Y           15000
+#define ACCELERATION_Z           15000
+#define ACCELERATION_U           15000
+#define ACCELERATION_E           15000
+
+/** \def ACCELERATION_SCURVE
+  Define this in addition to ACCELERATION_RAMPING to get jerk limited
+  acceleration. Acceleration then starts and ends each ramp softly instead
+  of switching on and off at once, which avoids exciting oscillations of
+  long levers. ACCELERATION and ACCELERATION_X..E become the peak
+  acceleration, on average it's 2/3 of this, so ramps get 1.5 times longer.
+*/
+//#define ACCELERATION_SCURVE
+
+/** \def ADVANCE_K
+  Pressure advance. Molten plastic in the hot end acts like a spring, so
+  extrusion lags behind speed changes, giving blobs at corners and thin
+  lines after them. With this, E runs ahead of its nominal position by
+  ADVANCE_K times the current E speed: it extrudes more while
+  accelerating and less while decelerating, the extra E step rate being
+  proportional to the acceleration of the move.
+
+  Applies to moves extruding forward while other axes move. Requires
+  ACCELERATION_RAMPING. Tune by printing a line with speed changes; too
+  high gives gaps at the start of lines.
+
+    Units: milliseconds of lead (E distance per E speed)
+    Sane values: 5 to 100, less for direct drive, more for Bowden
+    Valid range: 1 to 1000
+*/
+//#define ADVANCE_K                20
+
+/** \def FEED_OVERRIDE
+  Define this to make M220 act on the running move and all queued moves at
+  once, instead of on moves queued from then on. Speed follows an override
+  smoothly, about one percent per millisecond, and within the acceleration
+  ramps planned, so faster speeds than planned happen only as far as moves
+  are long enough to accelerate to them. Axis feedrate limits still apply.
+
+  Costs a ramp calculation every MOTION_CLOCK also while cruising.
+  Requires ACCELERATION_RAMPING, doesn't work with ACCELERATION_SCURVE.
+*/
+//#define FEED_OVERRIDE
+
+/** \def FEED_HOLD
+  Define this to allow pausing a job mid-move. A '!' received on the serial
+  line decelerates the running move to a stop along its ramp, a '~' resumes
+  it with a fresh acceleration ramp. Position, the rest of the move and the
+  movement queue stay as they are, so no homing is needed afterwards. Moves
+  too short to stop in stop at their end, as quickly as their planned end
+  speed allows.
+
+  Both characters are real-time commands, see REALTIME_COMMANDS, which gets
+  enabled by this. Requires ACCELERATION_RAMPING.
+*/
+//#define FEED_HOLD
+
+/** \def REALTIME_COMMANDS
+  Define this to take single character commands out of the serial stream
+  right in the receive interrupt, so they act within microseconds, even
+  while the queue is full or a long G4 is running:
+
+    ?     report state (Idle, Run, Stop, Hold) and position
+    !, ~  feed hold and resume, with FEED_HOLD
+    0x90  feed override back to 100%, with FEED_OVERRIDE
+    0x91  feed override +10%
+    0x92  feed override -10%
+
+  Don't use '?', '!' or '~' in G-code comments. Bytes of BINARY_GCODE frames
+  pass untouched, while binary frames are on 0x90 to 0x92 start frames
+  instead. Works with the hardware serial port of AVRs and ARMs, not with
+  USB_SERIAL.
+*/
+//#define REALTIME_COMMANDS
+
+/** \def JOG
+  Define this for M430, continuous jogging. Each axis moves at the speed
+  commanded, one jog is a single open-ended move, so streaming new speeds
+  changes speed smoothly instead of stopping each time. With
+  KINEMATICS_ARM4, jogs move the joints directly, handy for teaching points.
+  Requires ACCELERATION_RAMPING.
+*/
+//#define JOG
+
+/** \def STEP_POSITION
+  Define this to count steps of each axis in the step interrupt, one add per
+  step. M114, DEBUG_POSITION and the displays then convert this count to mm
+  instead of working it out from the end of the live move, which is cheaper
+  and also right for moves which stop early, like jogs and endstop stops.
+  Costs a few CPU cycles per step. Backlash takeup steps of BACKLASH_X and
+  friends get taken out, so they don't count as movement.
+*/
+//#define STEP_POSITION
+
+/** \def MOTION_CLOCK
+  How often acceleration gets recalculated. More often gives smoother ramps
+  at high accelerations, at the cost of more CPU time while moving, none
+  while idle. Gets rounded to multiples of 500 microseconds, the system
+  clock tick. Can be changed at runtime with M428.
+
+    Units: microseconds
+    Useful range: 500 to 2000
+*/
+#define MOTION_CLOCK             1000
+
 /** \def LOOKAHEAD
   Define this to enable look-ahead during *ramping* acceleration to smoothly
   transition between moves instead of performing a dead stop every move.
@@ -173,6 +368,19 @@
 #define MAX_JERK_U               200
 #define MAX_JERK_E               200
 
+/** \def JUNCTION_DEVIATION
+  Alternative to MAX_JERK for finding crossing speeds. Instead of limiting
+  the speed change of each axis separately, this looks at the angle between
+  two moves and allows the speed at which a circle staying within this
+  distance of the corner can be passed with the configured acceleration.
+  Shallow angles get passed at nearly full speed, reversals need a full
+  stop. MAX_JERK values are ignored then.
+
+    Units: um
+    Sane values: 5 to 100
+*/
+//#define JUNCTION_DEVIATION       20
+
 
 /***************************************************************************\
 *                                                                           *
@@ -222,6 +430,26 @@
 */
 #define TEMP_RESIDENCY_TIME      60
 
+/** \def TEMP_WAIT_DEFERRED
+  Don't stop the queue right at M116, but at the first following move which
+  moves the extruder. Homing and positioning the arm then happen while the
+  heaters heat up.
+
+  This changes what waiting for temperatures means: after M116, and after
+  M101 with heaters not up yet, moves without E no longer wait, only moves
+  extruding do. G-code relying on the arm standing still until heaters are
+  up, e.g. for a nozzle wipe after heating, needs an extruding move first.
+*/
+//#define TEMP_WAIT_DEFERRED
+
+/** \def ENFORCE_ORDER
+  Keep reports and heater changes in order with movement. M114 and M105
+  wait for the queue to drain before reporting. M104, M106 and M140 get
+  queued and happen as the moves sent before them end, without stopping
+  movement.
+*/
+//#define ENFORCE_ORDER
+
 /** \def TEMP_EWMA
 
   Smooth noisy temperature sensors. Good hardware shouldn't be noisy. Set to
@@ -254,6 +482,9 @@
 /** \def EECONFIG
   Enable EEPROM configuration storage.
 
+  Stores PID factors (M134) and machine settings like steps per mm (M500).
+  Values in this file are only defaults then, saved ones take precedence.
+
   Enabled by default. Commenting this out makes the binary several hundred
   bytes smaller, so you might want to disable EEPROM storage on small MCUs,
   like the ATmega168.
@@ -276,16 +507,141 @@
 */
 //#define BANG_BANG_OFF            45
 
+/** \def STEP_BATCH_RATE
+  Above this step rate, the step interrupt does two steps at once, above
+  twice this rate four steps. This reduces interrupt overhead and allows
+  higher step rates, at the cost of steps coming in bursts. Steps within a
+  burst are about 1 microsecond apart, which is fine for A4988 and DRV8825
+  drivers. Not available with ACCELERATION_REPRAP or ACCELERATION_TEMPORAL.
+  Undefine to always do one step per interrupt.
+
+    Units: steps/s
+    Sane values: 10'000 to 30'000 on a 16 MHz AVR
+*/
+//#define STEP_BATCH_RATE          20000
+
+/** \def STEP_TIMING_QUEUE
+  Let dda_clock() calculate step intervals ahead of time, in chunks of about
+  a millisecond, and hand them to the step interrupt through a small queue.
+  This way the step interrupt no longer waits for speed calculations for the
+  next ramp piece and neither side has to lock out the other. Costs about
+  80 bytes of RAM. Requires ACCELERATION_RAMPING.
+*/
+//#define STEP_TIMING_QUEUE
+
+/** \def STEP_RATE_GUARD
+  Watch for step interrupts too slow for the step rate asked for. Without,
+  such a step waits for a full round of the step timer, a 4 ms stall on
+  AVR. With, the step gets done right away, the move slows down and all
+  later moves stay below that step rate, plus this margin. Each lowered
+  cap gets reported to the host, M422 counts overloads. Requires
+  ACCELERATION_RAMPING.
+
+    Unit: percent
+    Valid range: 100 to 400
+*/
+//#define STEP_RATE_GUARD          125
+
+/** \def STEP_RAMP_EXACT
+  Update the step interval of acceleration ramps with every step, instead of
+  once per MOTION_CLOCK tick. Without, step intervals stay the same for a
+  millisecond and ramps come in small stairs, which gets noticeable at high
+  accelerations. Costs an int_div_sqrt() per step interrupt during ramps,
+  so maximum step rate drops by maybe a third on a 16 MHz AVR. Requires
+  ACCELERATION_RAMPING.
+
+  dda_clock() still checks endstops, but no longer changes speed. So this
+  intentionally excludes FEED_OVERRIDE, FEED_HOLD and JOG, which add ramps
+  of their own in dda_clock(), as well as ACCELERATION_SCURVE and
+  STEP_TIMING_QUEUE. Doing those with each step would cost a division or
+  more per step.
+*/
+//#define STEP_RAMP_EXACT
+
+/** \def INPUT_SHAPING_FREQUENCY INPUT_SHAPING_DAMPING INPUT_SHAPING_ZVD
+  Input shaping against ringing of the arm. The speed profile of each move
+  gets convolved with two impulses half a ringing period apart (ZV), or
+  three of them (ZVD), so the vibrations they excite cancel out. Moves take
+  half a period (ZV) or a whole period (ZVD) longer, ZVD is less picky about
+  the exact frequency. Requires STEP_TIMING_QUEUE.
+
+  All axes of a move step in a fixed ratio, so there's one shaper for all of
+  them. Tune it to the lowest frequency which rings, measured on a test
+  part or with an accelerometer.
+
+  The shaper needs a history of the speed profile, 2 bytes per millisecond
+  of delay. That's 500 / INPUT_SHAPING_FREQUENCY bytes for ZV, twice as much
+  for ZVD.
+
+    Units: Hz for the frequency, percent for the damping ratio
+    Sane values: 5 to 50 Hz, damping 5 to 15
+    Valid range: 5 to 100 Hz, damping 0 to 30
+*/
+//#define INPUT_SHAPING_FREQUENCY  12
+//#define INPUT_SHAPING_DAMPING    10
+//#define INPUT_SHAPING_ZVD
+
+/** \def TEMPORAL_MATCH_CHANNELS
+  With ACCELERATION_TEMPORAL on ARM, give each axis its own match register
+  of the step timer instead of searching for the next axis to step and
+  sharing one. Each axis then steps at its own exact interval, without jitter
+  from the other axes. The LPC1114 step timer has four match registers, so
+  X, Y, Z and U get one each and E shares the one of X.
+*/
+//#define TEMPORAL_MATCH_CHANNELS
+
+/** \def ARC_SEGMENT_LENGTH
+  Enables G2/G3 arcs. Arcs get cut into chords of about this length on the
+  controller, which saves the host from sending lots of short G1 moves.
+  Shorter chords follow the arc more closely, but cost more queue space.
+  Undefine to save some flash, G2/G3 give an error then.
+
+    Units: um
+    Sane values: 200 to 2000
+*/
+#define ARC_SEGMENT_LENGTH       1000
+
+/** \def BEZIER_TOLERANCE
+  Enables G5 cubic Bezier curves. Curves get cut into straight moves on the
+  controller, deviating no more than this from the exact curve. Flat parts
+  of a curve get long moves, sharp bends short ones. Undefine to save some
+  flash, G5 gives an error then.
+
+    Units: um
+    Sane values: 5 to 50
+*/
+#define BEZIER_TOLERANCE         10
+
 /** \def MOVEBUFFER_SIZE
   Move buffer size, in number of moves.
 
-  Note that each move takes a fair chunk of ram (107 bytes as of this writing), // SHAUKI with U is bigger now
-  so don't make the buffer too big. However, a larger movebuffer will probably
-  help with lots of short consecutive moves, as each move takes a bunch of
-  math (hence time) to set up so a longer buffer allows more of the math to
-  be done during preceding longer moves.
+  Note that each move takes a fair chunk of ram (112 bytes on AVR with this
+  configuration, more with more features), so don't make the buffer too big.
+  However, a larger movebuffer will probably help with lots of short
+  consecutive moves, as each move takes a bunch of math (hence time) to set
+  up so a longer buffer allows more of the math to be done during preceding
+  longer moves.
+
+  10 moves take 1120 bytes, 14% of the 8 kB RAM of an ATmega2560. That's 40
+  bytes more than the 8 moves of 135 bytes this buffer held before moves got
+  smaller, for two more moves of lookahead.
+*/
+#define MOVEBUFFER_SIZE          10
+
+/** \def MOTION_MACRO
+  Record up to this many moves with M820/M821 and replay them with M822.
+  Moves get recorded as planned, including lookahead, so replaying skips
+  parsing and planning entirely. Handy for repetitive cycles. With EECONFIG
+  the recording is kept in EEPROM and survives a reset.
+
+  Each move takes as much RAM as a movebuffer entry, see MOVEBUFFER_SIZE
+  above, and as much EEPROM with EECONFIG. With this configuration 16 moves
+  take 1.8 kB of the 8 kB RAM of an ATmega2560, on top of the movebuffer.
+  Macros taking more than 2 kB give a compile error.
+
+    Valid range: 1...30, 2 kB RAM permitting.
 */
-#define MOVEBUFFER_SIZE          8
+//#define MOTION_MACRO             16
 
 /** \def DC_EXTRUDER DC_EXTRUDER_PWM
   If you have a DC motor extruder, configure it as a "heater" above and define
@@ -295,6 +651,16 @@
 //#define DC_EXTRUDER              HEATER_motor
 //#define DC_EXTRUDER_PWM          180
 
+/** \def SPINDLE
+  Laser or spindle as end effector. Configure it as a "heater" above, on a
+  pin with hardware PWM, and define this value as the index or name. M3 and
+  M5 then switch it on and off in sync with the moves queued, M4 scales its
+  power with the current speed of the move, so slow corners and ramps get
+  no more energy per length than straight lines. Without
+  ACCELERATION_RAMPING, M4 works like M3.
+*/
+//#define SPINDLE                  HEATER_fan
+
 /** \def USE_WATCHDOG
   Teacup implements a watchdog, which has to be reset every 250ms or it will
   reboot the controller. As rebooting (and letting the GCode sending
@@ -340,11 +706,37 @@
 */
 #define ENDSTOP_STEPS            4
 
+/** \def ENDSTOP_CAPTURE
+  Check endstops in the step interrupt, with every step, instead of every
+  2 milliseconds in dda_clock(). An axis then stops, or starts decelerating,
+  on the very step its endstop triggers. This reduces overshoot and makes
+  homing positions more repeatable, especially on fast searches.
+
+  ENDSTOP_STEPS then counts steps instead of clock ticks, so debouncing
+  covers a much shorter time. Raise it for flaky endstops.
+
+  Costs a few cycles per step while searching, nothing on other moves.
+  Requires ACCELERATION_RAMPING.
+*/
+//#define ENDSTOP_CAPTURE
+
+/** \def HOME_SINGLE_PASS
+  Home with just the fast search move, without the slow back off at
+  SEARCH_FEEDRATE_{XYZU}. The position where each endstop triggered gets
+  captured, so the overshoot is known and doesn't spoil the home position.
+  The axes then move back to the trigger points as an ordinary move.
+
+  Much faster homing, with the precision of one step at search speed. Applies
+  to G28, G161 and G162 still do two passes. Requires ENDSTOP_CAPTURE.
+*/
+//#define HOME_SINGLE_PASS
+
 /** \def CANNED_CYCLE
   G-code commands in this string will be executed over and over again, without
   user interaction or even a serial connection. It's purpose is e.g. for
   exhibitions or when using Teacup for other purposes than printing. You can
-  add any G-code supported by Teacup.
+  add any G-code supported by Teacup. Lines from the host or the SD card go
+  in between whole lines of it.
 
   Note: don't miss these newlines (\n) and backslashes (\).
 */
@@ -0,0 +1,100 @@
+#include "profile.h"
+
+/** \file
+  \brief Profiler for timing critical code sections.
+
+  Durations are measured by the callers with the hardware timer, see
+  timer_read(), and collected here as min/avg/max plus a logarithmic
+  histogram. Cheap enough to run during production jobs.
+*/
+
+#ifdef PROFILE
+
+#include <string.h>
+#include "sersendf.h"
+#include "serial.h"
+#include "memory_barrier.h"
+#include "arduino.h"  // For F_CPU on ARM.
+
+/// Timing data of one section.
+typedef struct {
+  uint32_t  min;
+  uint32_t  max;
+  uint32_t  total;
+  uint32_t  count;
+  uint16_t  histogram[PROFILE_BUCKETS];
+} PROFILE_SECTION;
+
+static PROFILE_SECTION profile[PROFILE_COUNT];
+
+/** Add a measured duration.
+
+  \param section The section measured.
+  \param ticks Its duration, in CPU ticks.
+
+  Called from interrupts, too, so keep it short.
+*/
+void profile_add(enum profile_e section, uint32_t ticks) {
+  PROFILE_SECTION *p = &profile[section];
+  uint8_t bucket = 0;
+  uint32_t t = ticks;
+
+  ATOMIC_START
+    if (p->count == 0 || ticks < p->min)
+      p->min = ticks;
+    if (ticks > p->max)
+      p->max = ticks;
+    p->total += ticks;
+    p->count++;
+
+    while (t > 1 && bucket < PROFILE_BUCKETS - 1) {
+      t >>= 1;
+      bucket++;
+    }
+    if (p->histogram[bucket] < 0xFFFF)
+      p->histogram[bucket]++;
+  ATOMIC_END
+}
+
+/** Print profiling results and reset them.
+
+  Per section one line with count and min/avg/max in CPU ticks, followed by
+  the histogram, entry i counting durations of 2^i to 2^(i+1) ticks.
+*/
+void profile_print() {
+  PROFILE_SECTION p;
+  uint8_t i, j;
+
+  sersendf_P(PSTR("Profile, CPU ticks at %lu MHz\n"), F_CPU / 1000000);
+  for (i = 0; i < PROFILE_COUNT; i++) {
+    ATOMIC_START
+      memcpy(&p, &profile[i], sizeof(PROFILE_SECTION));
+      memset(&profile[i], 0, sizeof(PROFILE_SECTION));
+    ATOMIC_END
+
+    switch (i) {
+      case PROFILE_STEP:
+        serial_writestr_P(PSTR("step"));
+        break;
+      case PROFILE_CLOCK:
+        serial_writestr_P(PSTR("clock"));
+        break;
+      case PROFILE_CREATE:
+        serial_writestr_P(PSTR("create"));
+        break;
+      case PROFILE_GCODE:
+        serial_writestr_P(PSTR("gcode"));
+        break;
+      case PROFILE_HOUSE:
+        serial_writestr_P(PSTR("house"));
+        break;
+    }
+    sersendf_P(PSTR(": n %lu  min %lu  avg %lu  max %lu\n "), p.count, p.min,
+               p.count ? p.total / p.count : 0, p.max);
+    for (j = 0; j < PROFILE_BUCKETS; j++)
+      sersendf_P(PSTR(" %u"), p.histogram[j]);
+    sersendf_P(PSTR("\n"));
+  }
+}
+
+#endif /* PROFILE */
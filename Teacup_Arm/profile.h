@@ -0,0 +1,34 @@
+#ifndef	_PROFILE_H
+#define	_PROFILE_H
+
+#include <stdint.h>
+#include "debug.h"
+
+#ifdef PROFILE
+
+/// Code sections timed by the profiler.
+enum profile_e {
+  PROFILE_STEP,     ///< step interrupt, queue_step()
+  PROFILE_CLOCK,    ///< dda_clock()
+  PROFILE_CREATE,   ///< dda_create(), including lookahead
+  PROFILE_GCODE,    ///< main loop task gcode_schedule()
+  PROFILE_HOUSE,    ///< main loop task clock()
+  PROFILE_COUNT
+};
+
+/// Histogram buckets, bucket i counts durations of 2^i to 2^(i+1) CPU ticks.
+#define PROFILE_BUCKETS 20
+
+// add a measured duration, in CPU ticks
+void profile_add(enum profile_e section, uint32_t ticks);
+
+// print and reset all sections
+void profile_print(void);
+
+#else /* PROFILE */
+
+#define profile_add(section, ticks) /* empty */
+#define profile_print()             /* empty */
+
+#endif /* PROFILE */
+#endif /* _PROFILE_H */
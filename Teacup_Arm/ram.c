@@ -0,0 +1,82 @@
+#include "ram.h"
+
+/** \file
+  \brief RAM usage and stack high water mark.
+
+  Static data sits at the bottom of RAM, the stack grows down from the top.
+  ram_init() fills the gap in between with RAM_PAINT, ram_print() finds
+  how far the stack ever went down by looking for the first byte changed.
+  That's the margin left for growing MOVEBUFFER_SIZE, serial buffers or
+  other tables: as long as some hundred bytes stay untouched throughout a
+  demanding job, there's room.
+
+  Teacup doesn't use malloc(), so there's no heap between both.
+*/
+
+#ifdef RAM_REPORT
+
+#include <avr/io.h>
+#include "sersendf.h"
+#include "dda_queue.h"
+#include "gcode_parse.h"
+
+// Symbols of the avr-libc linker scripts.
+extern uint8_t __data_start, __data_end, __bss_start, __bss_end;
+extern uint8_t __heap_start;
+
+/// Bytes below the stack pointer spared by ram_init(), for its own frame.
+#define RAM_PAINT_MARGIN 32
+
+// Defaults as in serial-avr.c.
+#ifndef SERIAL_RX_BUFFER_SIZE
+  #define SERIAL_RX_BUFFER_SIZE 64
+#endif
+#ifndef SERIAL_TX_BUFFER_SIZE
+  #define SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+/** Paint free RAM.
+
+  Fills everything between static data and the stack with RAM_PAINT. Call
+  it first in init(), when the stack is still short.
+*/
+void ram_init() {
+  uint8_t *p = &__heap_start;
+  uint8_t *end = (uint8_t *)SP - RAM_PAINT_MARGIN;
+
+  while (p < end)
+    *p++ = RAM_PAINT;
+}
+
+/** Print RAM usage.
+
+  First line: static data and BSS sizes, stack size now and the most the
+  stack ever used, and the bytes never touched since ram_init(), all in
+  bytes. Second line: the biggest static allocations, movement queue,
+  G-code parser and serial buffers.
+*/
+void ram_print() {
+  uint8_t *top = (uint8_t *)RAMEND + 1;
+  uint8_t *p = &__heap_start;
+  uint8_t *sp = (uint8_t *)SP;
+
+  while (p < sp && *p == RAM_PAINT)
+    p++;
+
+  sersendf_P(PSTR("RAM: data %u  bss %u  stack %u  max %u  untouched %u\n"),
+             (uint16_t)(&__data_end - &__data_start),
+             (uint16_t)(&__bss_end - &__bss_start),
+             (uint16_t)(top - sp), (uint16_t)(top - p),
+             (uint16_t)(p - &__heap_start));
+  sersendf_P(PSTR("queue %u  gcode %u  serial %u\n"),
+             (uint16_t)sizeof(movebuffer),
+             (uint16_t)sizeof(GCODE_COMMAND),
+             #ifdef USB_SERIAL
+               0
+             #else
+               SERIAL_RX_BUFFER_SIZE + SERIAL_TX_BUFFER_SIZE
+             #endif
+             );
+}
+
+#endif /* RAM_REPORT */
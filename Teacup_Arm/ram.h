@@ -0,0 +1,24 @@
+#ifndef	_RAM_H
+#define	_RAM_H
+
+#include <stdint.h>
+#include "debug.h"
+
+#ifdef RAM_REPORT
+
+/// Fill byte of unused RAM, see ram_init().
+#define RAM_PAINT 0xC5
+
+// paint free RAM, call first thing at startup
+void ram_init(void);
+
+// print RAM usage and the stack high water mark
+void ram_print(void);
+
+#else /* RAM_REPORT */
+
+#define ram_init()  /* empty */
+#define ram_print() /* empty */
+
+#endif /* RAM_REPORT */
+#endif /* _RAM_H */
@@ -13,11 +13,13 @@
 
   Requirements:
 
-    - The name 'BUFSIZE' has to be kept exactly. One can use two or more
-      ringbuffers in the same source file, but they all have to be the same
-      size.
+    - The size of a buffer is taken from its array declaration, so one can
+      use two or more ringbuffers of different sizes in the same source
+      file. Naming it BUFSIZE is a convention only.
 
-    - BUFSIZE has to be a power of two: 2, 4, 8, 16, 32, 64, 128 or 256.
+    - The size has to be a power of two: 2, 4, 8, 16, 32, 64, 128 or 256.
+
+    - <name>buf has to be an array of bytes, not a pointer.
 
     - In the example above, 'rx' is the name of the buffer. <name>head,
       <name>tail and <name>buf have to be named exactly.
@@ -29,19 +31,19 @@
 
   When head == tail, buffer is empty.
   When head + 1 == tail, buffer is full.
-  Thus, number of available spaces in buffer is (tail - head) & bufsize.
+  Thus, number of available spaces in buffer is (tail - head) & (size - 1).
 
   Can write:
-  (tail - head - 1) & (BUFSIZE - 1)
+  (tail - head - 1) & (size - 1)
 
   Write to buffer:
-  buf[head++] = data; head &= (BUFSIZE - 1);
+  buf[head++] = data; head &= (size - 1);
 
   Can read:
-  (head - tail) & (BUFSIZE - 1)
+  (head - tail) & (size - 1)
 
   Read from buffer:
-  data = buf[tail++]; tail &= (BUFSIZE - 1);
+  data = buf[tail++]; tail &= (size - 1);
 */
 
 /** \def buf_canread()
@@ -56,7 +58,7 @@
 
 */
 #define buf_canread(buffer)     ((buffer ## head - buffer ## tail ) & \
-                                 (BUFSIZE - 1))
+                                 (sizeof(buffer ## buf) - 1))
 
 /** \def buf_pop()
 
@@ -76,7 +78,7 @@
 #define buf_pop(buffer, data)   do { \
                                   data = buffer ## buf[buffer ## tail]; \
                                   buffer ## tail = (buffer ## tail + 1) & \
-                                    (BUFSIZE - 1); \
+                                    (sizeof(buffer ## buf) - 1); \
                                 } while (0)
 
 /** \def buf_canwrite()
@@ -93,7 +95,7 @@
 
 */
 #define buf_canwrite(buffer)    ((buffer ## tail - buffer ## head - 1) & \
-                                 (BUFSIZE - 1))
+                                 (sizeof(buffer ## buf) - 1))
 
 /** \def buf_push()
 
@@ -111,5 +113,5 @@
 #define buf_push(buffer, data)  do { \
                                   buffer ## buf[buffer ## head] = data; \
                                   buffer ## head = (buffer ## head + 1) & \
-                                    (BUFSIZE - 1); \
+                                    (sizeof(buffer ## buf) - 1); \
                                 } while (0)
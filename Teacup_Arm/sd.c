@@ -6,15 +6,108 @@
 
 #ifdef SD
 
+#include <string.h>
+#include <stddef.h>
 #include "delay.h"
 #include "pinio.h"
 #include "serial.h"
 #include "sersendf.h"
 #include "gcode_parse.h"
+#include "dda_queue.h"
+#include "crc.h"
+#ifdef SD_RECORD
+  #include <stdlib.h>
+  #include "dda_maths.h"
+#endif
+#ifdef SD_LOG
+  #include "sendf.h"
+  #include "temp.h"
+#endif
+
+#ifdef EECONFIG
+  #include <avr/eeprom.h>
+#endif
 
 
 static FATFS sdfile;
 static FRESULT result;
+static uint8_t sd_mounted = 0;
+
+uint32_t sd_line_pos;
+
+#ifdef SD_FILE_CACHE
+/**
+  \struct SD_CACHE_ENTRY
+  \brief A file of the top level directory, see sd_cache_build().
+*/
+typedef struct {
+  char          name[13];       ///< 8.3 name, as stored on the card
+  uint8_t       attrib;         ///< AM_DIR and friends
+  CLUST         clust;          ///< start cluster
+  uint32_t      size;           ///< bytes
+} SD_CACHE_ENTRY;
+
+static SD_CACHE_ENTRY sd_cache[SD_FILE_CACHE];
+static uint8_t sd_cache_count = 0;
+
+/// whether sd_cache holds the whole top level directory
+static uint8_t sd_cache_complete = 0;
+#endif
+
+#ifdef EECONFIG
+/**
+  \struct SD_RESUME
+  \brief Where to resume a job from the SD card, see M426 and M427.
+*/
+typedef struct {
+  uint32_t      pos;            ///< file position of the line to resume with
+  axes_int32_t  axis;           ///< position to resume from, um
+  uint32_t      F;              ///< feedrate at this position
+  uint16_t      crc;            ///< crc_block() of the above
+} SD_RESUME;
+
+static SD_RESUME EEMEM ee_resume;
+#endif
+
+#ifdef SD_RECORD
+/**
+  \struct SD_SAMPLE
+  \brief A position recorded with M435, see sd_record_tick().
+
+  The first sample of a recording is a header, with SD_RECORD_MAGIC in X
+  and the sample interval in milliseconds in Y. The last one has
+  SD_RECORD_END in X.
+*/
+typedef struct {
+  int32_t       axis[E];        ///< X, Y, Z, U, um or millidegrees
+} SD_SAMPLE;
+
+#define SD_RECORD_MAGIC 0x63655254L   ///< "TRec"
+#define SD_RECORD_END   INT32_MIN
+
+/// samples written, 0 = not recording
+static uint32_t sd_record_count = 0;
+
+/// 10 ms ticks since the last sample
+static uint8_t sd_record_ticks;
+#endif
+
+#ifdef SD_LOG
+/// A log line, longer ones get cut.
+#define SD_LOG_LINE 96
+
+/// Log lines collected for the next sector write, see sd_log_flush().
+static uint8_t sd_log_sector[512];
+static uint16_t sd_log_fill;
+
+/// Line being composed, or the part not fitting into the sector.
+static uint8_t sd_log_line[SD_LOG_LINE];
+static uint8_t sd_log_line_len;
+
+static uint8_t sd_logging = 0;
+static uint8_t sd_log_seconds;
+static uint32_t sd_log_uptime;
+#endif
 
 /** Initialize SPI for SD card reading.
 */
@@ -23,12 +116,93 @@ void sd_init(void) {
   WRITE(SD_CARD_SELECT_PIN, 1);
 }
 
+#ifdef SD_FILE_CACHE
+/** Read the top level directory into the file cache.
+
+  Takes the first SD_FILE_CACHE entries, the cache is complete if there
+  aren't more.
+*/
+static void sd_cache_build(void) {
+  FILINFO fno;
+  DIR dir;
+
+  sd_cache_count = 0;
+  sd_cache_complete = 0;
+  if (pf_opendir(&dir, "/") != FR_OK)
+    return;
+
+  for (;;) {
+    if (pf_readdir(&dir, &fno) != FR_OK)
+      return;
+    if (fno.fname[0] == 0)
+      break;
+    if (sd_cache_count >= SD_FILE_CACHE)
+      return;
+
+    memcpy(sd_cache[sd_cache_count].name, fno.fname, sizeof(fno.fname));
+    sd_cache[sd_cache_count].attrib = fno.fattrib;
+    sd_cache[sd_cache_count].clust = fno.fclust;
+    sd_cache[sd_cache_count].size = fno.fsize;
+    sd_cache_count++;
+  }
+  sd_cache_complete = 1;
+}
+
+/** Find a file in the file cache.
+
+  \param filename Name as given with M23, case doesn't matter.
+
+  \return The entry, NULL if it's not there or a directory.
+*/
+static SD_CACHE_ENTRY *sd_cache_find(const char *filename) {
+  uint8_t i, j;
+  char a, b;
+
+  if (*filename == '/')
+    filename++;
+
+  for (i = 0; i < sd_cache_count; i++) {
+    for (j = 0; ; j++) {
+      a = filename[j];
+      b = sd_cache[i].name[j];
+      if (a >= 'a' && a <= 'z')
+        a -= 'a' - 'A';
+      if (a != b || a == 0)
+        break;
+    }
+    if (a == 0 && b == 0 && ! (sd_cache[i].attrib & AM_DIR))
+      return &sd_cache[i];
+  }
+
+  return NULL;
+}
+#endif /* SD_FILE_CACHE */
+
 /** Mount the SD card.
+
+  Mounting takes a while, so it's not done at startup, but with M21 or the
+  first access needing it, see sd_ready(). With SD_FILE_CACHE, this also
+  reads the top level directory into the cache.
 */
 void sd_mount(void) {
   result = pf_mount(&sdfile);
-  if (result != FR_OK)
+  sd_mounted = (result == FR_OK);
+  if ( ! sd_mounted)
     sersendf_P(PSTR("E: SD init failed. (%su)\n"), result);
+  #ifdef SD_FILE_CACHE
+    else
+      sd_cache_build();
+  #endif
+}
+
+/** Mount the SD card, unless it is already.
+
+  \return Whether the card is mounted now.
+*/
+static uint8_t sd_ready(void) {
+  if ( ! sd_mounted)
+    sd_mount();
+  return sd_mounted;
 }
 
 /** Unmount the SD card.
@@ -39,6 +213,11 @@ void sd_mount(void) {
 */
 void sd_unmount(void) {
   pf_unmount(&sdfile);
+  sd_mounted = 0;
+  #ifdef SD_FILE_CACHE
+    sd_cache_count = 0;
+    sd_cache_complete = 0;
+  #endif
 }
 
 /** List a given directory.
@@ -52,6 +231,24 @@ void sd_list(const char* path) {
   FILINFO fno;
   DIR dir;
 
+  if ( ! sd_ready())
+    return;
+
+  #ifdef SD_FILE_CACHE
+    if (sd_cache_complete && path[0] == '/' && path[1] == 0) {
+      uint8_t i;
+
+      for (i = 0; i < sd_cache_count; i++) {
+        serial_writestr((uint8_t *)sd_cache[i].name);
+        if (sd_cache[i].attrib & AM_DIR)
+          serial_writechar('/');
+        serial_writechar('\n');
+        delay_ms(2); // Time for sending the characters.
+      }
+      return;
+    }
+  #endif
+
   result = pf_opendir(&dir, path);
   if (result == FR_OK) {
     for (;;) {
@@ -78,6 +275,20 @@ void sd_list(const char* path) {
   until done or until stopped by G-code coming in over the serial line.
 */
 void sd_open(const char* filename) {
+  #ifdef SD_FILE_CACHE
+    SD_CACHE_ENTRY *entry;
+  #endif
+
+  if ( ! sd_ready())
+    return;
+
+  #ifdef SD_FILE_CACHE
+    entry = sd_cache_find(filename);
+    if (entry) {
+      result = pf_open_clust(entry->clust, entry->size);
+      return;
+    }
+  #endif
   result = pf_open(filename);
   if (result != FR_OK) {
     sersendf_P(PSTR("E: failed to open file. (%su)\n"), result);
@@ -100,9 +311,11 @@ void sd_open(const char* filename) {
   Much better is to parse straight as it comes from the card. This way there
   is no need for a buffer at all. Sectors are still read multiple times, but
   at least one line is read in one chunk (unless it crosses a sector boundary).
+  SD_SECTOR_CACHE trades 512 bytes of RAM for reading each sector only once.
 */
 uint8_t sd_read_gcode_line(void) {
 
+  sd_line_pos = sdfile.fptr;
   result = pf_parse_line(&gcode_parse_char);
   if (result == FR_END_OF_FILE) {
     return 1;
@@ -115,4 +328,349 @@ uint8_t sd_read_gcode_line(void) {
   return 0;
 }
 
+/** Find the file position to resume the current job from.
+
+  That's the line having created the move which runs right now, or waits
+  for temperatures. Each move remembers it, see enqueue_move(). With an
+  empty queue everything is done and it's the line read next.
+
+  Lines between these two, which don't move, get read again on resuming.
+  They're typically setting temperatures or the fan, so that's fine.
+*/
+static uint32_t sd_resume_pos(void) {
+  if (queue_empty())
+    return sdfile.fptr;
+
+  return movebuffer[mb_tail].sd_pos;
+}
+
+/** Report the position inside the file, like "SD printing byte 1234/56789".
+
+  The position reported is the one of the line running right now, see
+  sd_resume_pos().
+*/
+void sd_print_position(void) {
+  sersendf_P(PSTR("SD printing byte %lu/%lu\n"), sd_resume_pos(),
+             sdfile.fsize);
+}
+
+/** Move to a position inside the file.
+
+  \param pos Byte position to read the next line from. Clipped to the end of
+             the file.
+*/
+void sd_seek(uint32_t pos) {
+  result = pf_lseek(pos);
+  if (result != FR_OK)
+    sersendf_P(PSTR("E: failed to seek file. (%su)\n"), result);
+}
+
+#ifdef EECONFIG
+/** Save where to resume the current job in EEPROM.
+
+  Saved are the position of the line which created the running move and the
+  current position of the machine. The move runs on, so pause the job with
+  M25 and wait for moves to stop first to store where it actually stopped.
+*/
+void sd_resume_save(void) {
+  SD_RESUME r;
+
+  r.pos = sd_resume_pos();
+  update_current_position();
+  memcpy(r.axis, current_position.axis, sizeof(axes_int32_t));
+  r.F = current_position.F;
+  r.crc = crc_block(&r, offsetof(SD_RESUME, crc));
+
+  eeprom_write_block(&r, &ee_resume, sizeof(SD_RESUME));
+}
+
+/** Resume a job from the position saved with sd_resume_save().
+
+  The file has to be open already. The machine is expected to stand at the
+  saved position, which becomes the current one. Then reading continues
+  with the line saved. Absolute positioning asumed, this line moves from
+  wherever the job stopped to its target.
+*/
+void sd_resume(void) {
+  SD_RESUME r;
+
+  eeprom_read_block(&r, &ee_resume, sizeof(SD_RESUME));
+  if (r.crc != crc_block(&r, offsetof(SD_RESUME, crc))) {
+    serial_writestr_P(PSTR("E: no resume point saved\n"));
+    return;
+  }
+
+  queue_wait();
+  memcpy(startpoint.axis, r.axis, sizeof(axes_int32_t));
+  memcpy(next_target.target.axis, r.axis, sizeof(axes_int32_t));
+  startpoint.F = next_target.target.F = r.F;
+  dda_new_startpoint();
+
+  sd_seek(r.pos);
+  if (result == FR_OK)
+    gcode_sources |= GCODE_SOURCE_SD;
+}
+#endif /* EECONFIG */
+
+#ifdef SD_LOG
+/// Append a character to the log line, see sendf_P().
+static void sd_log_writechar(uint8_t c) {
+  if (sd_log_line_len < SD_LOG_LINE)
+    sd_log_line[sd_log_line_len++] = c;
+}
+
+/// Move as much of the log line into the sector as fits.
+static void sd_log_append(void) {
+  uint16_t n = 512 - sd_log_fill;
+
+  if (n > sd_log_line_len)
+    n = sd_log_line_len;
+  memcpy(&sd_log_sector[sd_log_fill], sd_log_line, n);
+  sd_log_fill += n;
+  sd_log_line_len -= n;
+  memmove(sd_log_line, &sd_log_line[n], sd_log_line_len);
+}
+
+/** Start logging to the file opened with M23.
+
+  Overwrites the file from its start, up to its size.
+*/
+void sd_log_start(void) {
+  #ifdef SD_RECORD
+    if (sd_record_count)
+      return;
+  #endif
+  if (sd_logging)
+    return;
+
+  gcode_sources &= ~GCODE_SOURCE_SD;
+  result = pf_lseek(0);
+  if (result != FR_OK) {
+    sersendf_P(PSTR("E: failed to open file. (%su)\n"), result);
+    return;
+  }
+
+  sd_log_fill = sd_log_line_len = 0;
+  sd_log_seconds = 0;
+  sd_logging = 1;
+}
+
+/** Stop logging.
+
+  Writes what's collected, the rest of the last sector gets filled with
+  zeros.
+*/
+void sd_log_stop(void) {
+  UINT written;
+
+  if ( ! sd_logging)
+    return;
+
+  sd_log_append();
+  if (sd_log_fill) {
+    pf_write(sd_log_sector, sd_log_fill, &written);
+    pf_write(NULL, 0, &written);
+  }
+  sd_logging = 0;
+}
+
+/** Compose a log line, if one is due.
+
+  Called once a second from clock_250ms(). Items, separated by spaces:
+  uptime in seconds, moves in the queue, temperatures in deg Celsius,
+  moves created, moves joined by lookahead, queue underruns and lowest
+  crossing speed since the last M422. A line coming while the previous
+  one still waits for its sector write gets dropped.
+*/
+void sd_log_tick(void) {
+  uint8_t depth;
+  temp_sensor_t i;
+
+  sd_log_uptime++;
+  if ( ! sd_logging || ++sd_log_seconds < SD_LOG || sd_log_line_len)
+    return;
+  sd_log_seconds = 0;
+
+  depth = mb_head >= mb_tail ? mb_head - mb_tail :
+          mb_head + MOVEBUFFER_SIZE - mb_tail;
+  sendf_P(sd_log_writechar, PSTR("%lu %u"), sd_log_uptime, depth);
+  for (i = 0; i < NUM_TEMP_SENSORS; i++)
+    sendf_P(sd_log_writechar, PSTR(" %u"), temp_get(i) >> 2);
+  sendf_P(sd_log_writechar, PSTR(" %lu %lu %u %u\n"), queue_stats.moves,
+          queue_stats.joined, queue_stats.underruns, queue_stats.min_crossF);
+
+  sd_log_append();
+}
+
+/** Write the collected log lines, if a sector is full.
+
+  Called from the main loop when it's idle. A sector goes out with a single
+  block write, which takes a few milliseconds.
+*/
+void sd_log_flush(void) {
+  UINT written;
+
+  if ( ! sd_logging || sd_log_fill < 512)
+    return;
+
+  result = pf_write(sd_log_sector, 512, &written);
+  if (result != FR_OK || written != 512) {
+    serial_writestr_P(PSTR("E: SD log full or failed\n"));
+    pf_write(NULL, 0, &written);
+    sd_logging = 0;
+    return;
+  }
+
+  sd_log_fill = 0;
+  sd_log_append();
+}
+#endif /* SD_LOG */
+
+#ifdef SD_RECORD
+/** Write a sample to the recording.
+
+  \return Whether it was written entirely. If not, the file is full or the
+          card failed and recording stops.
+*/
+static uint8_t sd_record_write(const SD_SAMPLE *s) {
+  UINT written;
+
+  result = pf_write(s, sizeof(SD_SAMPLE), &written);
+  if (result == FR_OK && written == sizeof(SD_SAMPLE)) {
+    sd_record_count++;
+    return 1;
+  }
+
+  pf_write(NULL, 0, &written);
+  sersendf_P(PSTR("E: recording stopped after %lu samples. (%su)\n"),
+             sd_record_count, result);
+  sd_record_count = 0;
+  return 0;
+}
+
+/** Start recording positions to the file opened with M23.
+
+  Overwrites the file from its start. It takes as many samples as fit into
+  the file's size.
+*/
+void sd_record_start(void) {
+  SD_SAMPLE s = { { SD_RECORD_MAGIC, SD_RECORD, 0, 0 } };
+
+  if (sd_record_count)
+    return;
+  #ifdef SD_LOG
+    if (sd_logging)
+      return;
+  #endif
+
+  gcode_sources &= ~GCODE_SOURCE_SD;
+  result = pf_lseek(0);
+  if (result != FR_OK) {
+    sersendf_P(PSTR("E: failed to open file. (%su)\n"), result);
+    return;
+  }
+
+  sd_record_ticks = 0;
+  sd_record_write(&s);
+}
+
+/// Stop recording, report the number of samples.
+void sd_record_stop(void) {
+  SD_SAMPLE s = { { SD_RECORD_END, 0, 0, 0 } };
+  UINT written;
+
+  if ( ! sd_record_count)
+    return;
+
+  if (sd_record_write(&s)) {
+    pf_write(NULL, 0, &written);
+    sersendf_P(PSTR("Recorded %lu samples\n"), sd_record_count - 2);
+    sd_record_count = 0;
+  }
+}
+
+/** Take a sample, if one is due.
+
+  Called from clock_10ms(). The position is the one of M114, taken from
+  the step counters, see update_current_position(). Writing is usually
+  some 20 SPI bytes, each 512 bytes a sector gets finalized, which takes
+  the card a millisecond or two.
+*/
+void sd_record_tick(void) {
+  SD_SAMPLE s;
+
+  if ( ! sd_record_count || ++sd_record_ticks < SD_RECORD / 10)
+    return;
+  sd_record_ticks = 0;
+
+  update_current_position();
+  memcpy(s.axis, current_position.axis, sizeof(SD_SAMPLE));
+  sd_record_write(&s);
+}
+
+/** Replay a recording from the file opened with M23.
+
+  \return Whether there was a recording.
+
+  Queues a move to each sample, at a speed taking the sample interval.
+  Samples without movement become dwells. Moves get planned as usual, so
+  lookahead smoothes the path. To replay a short recording faster, record
+  a motion macro while replaying, see M820.
+
+  This doesn't return before all moves are queued.
+*/
+uint8_t sd_replay(void) {
+  SD_SAMPLE s;
+  TARGET t;
+  UINT read;
+  uint32_t distance, still = 0, interval;
+  enum axis_e i;
+
+  result = pf_lseek(0);
+  if (result == FR_OK)
+    result = pf_read(&s, sizeof(SD_SAMPLE), &read);
+  if (result != FR_OK || read != sizeof(SD_SAMPLE) ||
+      s.axis[X] != SD_RECORD_MAGIC || s.axis[Y] == 0)
+    return 0;
+  interval = s.axis[Y];
+
+  gcode_sources &= ~GCODE_SOURCE_SD;
+  for (;;) {
+    result = pf_read(&s, sizeof(SD_SAMPLE), &read);
+    if (result != FR_OK || read != sizeof(SD_SAMPLE) ||
+        s.axis[X] == SD_RECORD_END)
+      break;
+
+    distance = approx_distance(
+                 approx_distance_3(labs(s.axis[X] - startpoint.axis[X]),
+                                   labs(s.axis[Y] - startpoint.axis[Y]),
+                                   labs(s.axis[Z] - startpoint.axis[Z])),
+                 labs(s.axis[U] - startpoint.axis[U]));
+    if (distance == 0) {
+      still += interval;
+      continue;
+    }
+    while (still) {
+      uint16_t ms = still > 60000 ? 60000 : still;
+
+      enqueue_dwell(ms);
+      still -= ms;
+    }
+
+    memcpy(&t, &startpoint, sizeof(TARGET));
+    for (i = X; i < E; i++)
+      t.axis[i] = s.axis[i];
+    if (t.e_relative)
+      t.axis[E] = 0;
+    // um per interval to mm/min.
+    t.F = distance * 60 / interval;
+    if (t.F == 0)
+      t.F = 1;
+    enqueue(&t);
+  }
+
+  return 1;
+}
+#endif /* SD_RECORD */
+
 #endif /* SD */
@@ -34,6 +34,39 @@ void sd_open(const char* filename);
 
 uint8_t sd_read_gcode_line(void);
 
+/// file position of the line read last, see sd_read_gcode_line()
+extern uint32_t sd_line_pos;
+
+void sd_print_position(void);
+
+void sd_seek(uint32_t pos);
+
+#ifdef EECONFIG
+  void sd_resume_save(void);
+
+  void sd_resume(void);
+#endif
+
+#ifdef SD_LOG
+  void sd_log_start(void);
+
+  void sd_log_stop(void);
+
+  void sd_log_tick(void);
+
+  void sd_log_flush(void);
+#endif
+
+#ifdef SD_RECORD
+  void sd_record_start(void);
+
+  void sd_record_stop(void);
+
+  void sd_record_tick(void);
+
+  uint8_t sd_replay(void);
+#endif
+
 #endif /* SD_CARD_SELECT_PIN */
 
 #endif /* _SD_H */
@@ -15,6 +15,8 @@
 
 #include "arduino.h"
 #include "cmsis-lpc11xx.h"
+#include "cpu.h"
+#include "clock.h"
 #include "delay.h"
 #include "sersendf.h"
 
@@ -23,6 +25,48 @@
          See serial-avr.c for inspiration.
 #endif
 
+/** \def SERIAL_TX_BUFFER_SIZE
+
+  Size of the TX buffer, see config.h. MUST be a \f$2^n\f$ value.
+
+  The hardware FIFO takes 16 characters only, so a software buffer emptied
+  by the UART interrupt keeps longer messages from blocking the main loop.
+  There's no RX buffer, receiving uses the hardware FIFO directly. Except
+  with REALTIME_COMMANDS, which need to see characters as they arrive.
+*/
+#ifndef SERIAL_TX_BUFFER_SIZE
+  #define SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+/** TX buffer.
+
+  txhead is the head pointer and points to the next available space.
+
+  txtail is the tail pointer and points to last character in the buffer.
+*/
+volatile uint8_t txhead = 0;
+volatile uint8_t txtail = 0;
+volatile uint8_t txbuf[SERIAL_TX_BUFFER_SIZE];
+
+#ifdef REALTIME_COMMANDS
+  /** \def SERIAL_RX_BUFFER_SIZE
+
+    Size of the RX buffer, MUST be a \f$2^n\f$ value. The receive interrupt
+    moves characters there from the hardware FIFO, taking real-time
+    characters out on the way.
+  */
+  #ifndef SERIAL_RX_BUFFER_SIZE
+    #define SERIAL_RX_BUFFER_SIZE 64
+  #endif
+
+  /// RX buffer, pointers like the TX buffer.
+  volatile uint8_t rxhead = 0;
+  volatile uint8_t rxtail = 0;
+  volatile uint8_t rxbuf[SERIAL_RX_BUFFER_SIZE];
+#endif
+
+#include "ringbuffer.h"
+
 
 /** Initialise serial subsystem.
 
@@ -40,8 +84,8 @@ void serial_init() {
                 | 0 << 6; // Rx irq trigger level.
                           // 0 = 1 char, 1 = 4 chars, 2 = 8 chars, 3 = 14 chars.
 
-  // Disable IRQs.
-  LPC_UART->IER = 0 << 0  // Rx Data available irq enable.
+  // Disable IRQs, except for receiving, which posts EVENT_RX.
+  LPC_UART->IER = 1 << 0  // Rx Data available irq enable.
                 | 0 << 1  // Tx Fifo empty irq enable.
                 | 0 << 2; // Rx Line Status irq enable.
 
@@ -183,6 +227,10 @@ void serial_init() {
   LPC_IOCON->TXD_CMSIS = 0x01 << 0  // Function TXD.
                        | 0x00 << 3; // Pullup inactive.
 
+  // TX interrupt, enabled for the UART by serial_writechar() as needed.
+  NVIC_SetPriority(UART_IRQn, 3);                 // Lowest priority.
+  NVIC_EnableIRQ(UART_IRQn);
+
   #ifndef UART_DLM
     /**
       Baud rate settings were calculated at runtime, report them to the user
@@ -211,9 +259,46 @@ void serial_init() {
 
   Other than the AVR implementation this returns not the number of characters
   in the line, but only wether there is at least one or not.
+
+  Characters stay in the hardware FIFO, so the receive interrupt turns itself
+  off after posting EVENT_RX. Finding the FIFO drained turns it on again.
+  With REALTIME_COMMANDS they're in the RX buffer instead.
 */
+#ifdef REALTIME_COMMANDS
 uint8_t serial_rxchars(void) {
-  return LPC_UART->LSR & 0x01;
+  return buf_canread(rx);
+}
+
+/** Read one character.
+*/
+uint8_t serial_popchar(void) {
+  uint8_t c = 0;
+
+  if (buf_canread(rx))
+    buf_pop(rx, c);
+
+  return c;
+}
+
+/** Read up to len characters at once from the RX buffer.
+
+  \return Number of characters actually read.
+*/
+uint8_t serial_read(uint8_t *data, uint8_t len) {
+  uint8_t n = 0;
+
+  while (n < len && buf_canread(rx))
+    buf_pop(rx, data[n++]);
+
+  return n;
+}
+#else
+uint8_t serial_rxchars(void) {
+  if (LPC_UART->LSR & 0x01)
+    return 1;
+
+  LPC_UART->IER |= (0x01 << 0);               // RDA irq on.
+  return 0;
 }
 
 /** Read one character.
@@ -227,22 +312,95 @@ uint8_t serial_popchar(void) {
   return c;
 }
 
+/** Read up to len characters at once, straight from the hardware FIFO.
+
+  \return Number of characters actually read.
+*/
+uint8_t serial_read(uint8_t *data, uint8_t len) {
+  uint8_t n = 0;
+
+  while (n < len && serial_rxchars())
+    data[n++] = LPC_UART->RBR;
+
+  return n;
+}
+#endif /* REALTIME_COMMANDS */
+
+/** Move characters from the TX buffer to the hardware FIFO.
+
+  Does nothing unless the hardware FIFO is empty, then fills it with up to
+  16 characters.
+*/
+static void serial_tx_fill(void) {
+  uint8_t i;
+
+  if (LPC_UART->LSR & (0x01 << 5)) {          // THR empty?
+    for (i = 0; i < 16 && buf_canread(tx); i++)
+      buf_pop(tx, LPC_UART->THR);
+  }
+  if ( ! buf_canread(tx))
+    LPC_UART->IER &= ~(0x01 << 1);            // Nothing left, THRE irq off.
+}
+
+/** Transmit interrupt.
+
+  Happens when the hardware FIFO ran empty. Must have the same name as in
+  cmsis-startup_lpc11xx.s
+*/
+void UART_IRQHandler(void) {
+  (void)LPC_UART->IIR;                        // Reading clears THRE irq.
+  #ifdef REALTIME_COMMANDS
+    // Drain the FIFO, RDA irq stays on. Like on AVR, characters not
+    // fitting into the buffer get lost.
+    if (LPC_UART->LSR & 0x01) {
+      uint8_t c;
+
+      while (LPC_UART->LSR & 0x01) {
+        c = LPC_UART->RBR;
+        if ( ! serial_realtime_rx(c) && buf_canwrite(rx))
+          buf_push(rx, c);
+      }
+      event_post(EVENT_RX);
+    }
+  #else
+  if (LPC_UART->LSR & 0x01) {                 // Characters received?
+    LPC_UART->IER &= ~(0x01 << 0);            // RDA irq off.
+    event_post(EVENT_RX);
+  }
+  #endif
+  serial_tx_fill();
+}
+
 /** Send one character.
 
-  If the queue is full, we wait as long as sending a character takes
-  (87 microseconds at 115200 baud) and send then blindly. This way we can
-  send arbitrarily long messages without slowing down short messages or even
-  blocking.
+  Characters go into the TX buffer, the UART interrupt sends them. Like on
+  AVR, we sleep while the buffer is full, unless we're in an interrupt
+  handler. There we write only if there's room. With interrupts disabled,
+  e.g. during startup, we move characters to the hardware ourselves.
 */
 void serial_writechar(uint8_t data) {
-  if ( ! (LPC_UART->LSR & (0x01 << 5)))       // Queue full?
-    delay_us((1000000 / BAUD * 10) + 1);
-
   #ifndef UART_DLM                        // Longer delays for fresh hardware.
     delay_ms(100);
   #endif
 
-  LPC_UART->THR = data;
+  if (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) {  // Inside a handler?
+    if (buf_canwrite(tx))
+      buf_push(tx, data);
+  }
+  else if (interrupts_enabled()) {
+    for ( ; buf_canwrite(tx) == 0; )
+      cpu_idle();
+    buf_push(tx, data);
+  }
+  else {
+    for ( ; buf_canwrite(tx) == 0; )
+      serial_tx_fill();
+    buf_push(tx, data);
+    serial_tx_fill();
+  }
+
+  // With an empty FIFO, the interrupt comes after one character time.
+  LPC_UART->IER |= (0x01 << 1);               // THRE irq on.
 }
 
 #endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
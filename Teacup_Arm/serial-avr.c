@@ -11,16 +11,23 @@
 #include "memory_barrier.h"
 #include "arduino.h"
 #include "pinio.h"
+#include "cpu.h"
+#include "clock.h"
 
-/** \def BUFSIZE
+/** \def SERIAL_RX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
 
-  Size of TX and RX buffers. MUST be a \f$2^n\f$ value.
+  Size of RX and TX buffers, see config.h. MUST be a \f$2^n\f$ value.
 
   Unlike ARM MCUs, which come with a hardware buffer, AVRs require a read and
   transmit buffer implemented in software. This buffer not only raises
   reliability, it also allows transmitting characters from interrupt context.
 */
-#define BUFSIZE     64
+#ifndef SERIAL_RX_BUFFER_SIZE
+  #define SERIAL_RX_BUFFER_SIZE 64
+#endif
+#ifndef SERIAL_TX_BUFFER_SIZE
+  #define SERIAL_TX_BUFFER_SIZE 64
+#endif
 
 /** \def ASCII_XOFF
 
@@ -45,7 +52,7 @@
 */
 volatile uint8_t rxhead = 0;
 volatile uint8_t rxtail = 0;
-volatile uint8_t rxbuf[BUFSIZE];
+volatile uint8_t rxbuf[SERIAL_RX_BUFFER_SIZE];
 
 /** TX buffer.
 
@@ -53,7 +60,7 @@ volatile uint8_t rxbuf[BUFSIZE];
 */
 volatile uint8_t txhead = 0;
 volatile uint8_t txtail = 0;
-volatile uint8_t txbuf[BUFSIZE];
+volatile uint8_t txbuf[SERIAL_TX_BUFFER_SIZE];
 
 #include "ringbuffer.h"
 
@@ -100,6 +107,14 @@ ISR(USART_RX_vect)
 ISR(USART0_RX_vect)
 #endif
 {
+  event_post(EVENT_RX);
+
+  #ifdef REALTIME_COMMANDS
+    uint8_t c = UDR0;
+
+    if ( ! serial_realtime_rx(c) && buf_canwrite(rx))
+      buf_push(rx, c);
+  #else
   if (buf_canwrite(rx))
     buf_push(rx, UDR0);
   else {
@@ -111,6 +126,7 @@ ISR(USART0_RX_vect)
 
     trash = UDR0;
   }
+  #endif
 
   #ifdef XONXOFF
     if (flowflags & FLOWFLAG_STATE_XON && buf_canwrite(rx) <= 16) {
@@ -159,6 +175,19 @@ uint8_t serial_rxchars() {
   return buf_canread(rx);
 }
 
+/** Resume the sender after reading from the RX buffer, if appropriate.
+*/
+static void serial_check_xon(void) {
+  #ifdef XONXOFF
+    if ((flowflags & FLOWFLAG_STATE_XON) == 0 && buf_canread(rx) <= 16) {
+      // The buffer has (SERIAL_RX_BUFFER_SIZE - 16) free characters again,
+      // so send an XON.
+      flowflags = FLOWFLAG_SEND_XON;
+      UCSR0B |= MASK(UDRIE0);
+    }
+  #endif
+}
+
 /** Read one character.
 */
 uint8_t serial_popchar() {
@@ -169,17 +198,28 @@ uint8_t serial_popchar() {
   if (buf_canread(rx))
     buf_pop(rx, c);
 
-  #ifdef XONXOFF
-    if ((flowflags & FLOWFLAG_STATE_XON) == 0 && buf_canread(rx) <= 16) {
-      // The buffer has (BUFSIZE - 16) free characters again, so send an XON.
-      flowflags = FLOWFLAG_SEND_XON;
-      UCSR0B |= MASK(UDRIE0);
-    }
-  #endif
+  serial_check_xon();
 
   return c;
 }
 
+/** Read up to len characters at once.
+
+  \return Number of characters actually read.
+*/
+uint8_t serial_read(uint8_t *data, uint8_t len) {
+  uint8_t n = 0;
+
+  while (n < len && buf_canread(rx)) {
+    buf_pop(rx, data[n]);
+    n++;
+  }
+
+  serial_check_xon();
+
+  return n;
+}
+
 /** Send one character.
 */
 void serial_writechar(uint8_t data) {
@@ -187,8 +227,9 @@ void serial_writechar(uint8_t data) {
   // Check if interrupts are enabled.
   if (SREG & MASK(SREG_I)) {
     // If they are, we should be ok to block since the tx buffer is emptied
-    // from an interrupt.
-    for ( ; buf_canwrite(tx) == 0; ) ;
+    // from an interrupt. Which also wakes us up from sleeping.
+    for ( ; buf_canwrite(tx) == 0; )
+      cpu_idle();
     buf_push(tx, data);
   }
   else {
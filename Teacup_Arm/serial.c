@@ -10,6 +10,103 @@
 	It also supports XON/XOFF flow control of the receive buffer, to help avoid overruns.
 */
 
+#ifdef REALTIME_COMMANDS
+#include "dda.h"
+#include "dda_queue.h"
+#ifdef BINARY_GCODE
+  #include "gcode_parse.h"
+#endif
+
+volatile uint8_t serial_status_request = 0;
+
+#ifdef BINARY_GCODE
+  /// bytes of a binary frame received so far, 0 between frames
+  static uint8_t rt_frame_len = 0;
+  static uint8_t rt_frame_size;
+#endif
+
+/** Handle a real-time character.
+
+  Called from the receive interrupt for each character received. Real-time
+  characters act right away, without waiting for their turn in the RX buffer
+  or for room in the movement queue. Reports sent back would block the
+  interrupt, so a '?' only raises a flag for serial_status().
+
+  \return 1 if the character was a real-time one and is consumed, 0 if it
+  belongs to the G-code stream.
+
+  Bytes of binary frames can have any value, so they pass untouched. A frame
+  starts like gcode_parse_char() sees it, with a byte with the high bit set
+  while M424 S1 is active, and its length follows from the field mask. In
+  between frames, real-time characters work as usual, except 0x90 to 0x92,
+  which start frames then.
+*/
+static uint8_t serial_realtime_rx(uint8_t c) {
+  #ifdef BINARY_GCODE
+    if (rt_frame_len || (gcode_binary && (c & 0x80))) {
+      rt_frame_len++;
+      if (rt_frame_len == 2)
+        rt_frame_size = gcode_frame_size(c);
+      else if (rt_frame_len > 2 && rt_frame_len >= rt_frame_size)
+        rt_frame_len = 0;
+      return 0;
+    }
+  #endif
+
+  switch (c) {
+    case SERIAL_STATUS:
+      serial_status_request = 1;
+      return 1;
+
+    #ifdef FEED_HOLD
+    case SERIAL_HOLD:
+      dda_hold();
+      return 1;
+
+    case SERIAL_RESUME:
+      dda_resume();
+      return 1;
+    #endif
+
+    #ifdef FEED_OVERRIDE
+    // Steps of 10 percent, limits like M220, 100% = 256.
+    case SERIAL_OVERRIDE_100:
+      feed_override = 256;
+      return 1;
+
+    case SERIAL_OVERRIDE_UP:
+      feed_override = (feed_override > 1024 - 26) ? 1024 : feed_override + 26;
+      return 1;
+
+    case SERIAL_OVERRIDE_DN:
+      feed_override = (feed_override < 26 + 26) ? 26 : feed_override - 26;
+      return 1;
+    #endif
+  }
+  return 0;
+}
+
+/** Report machine state and position after a '?'.
+
+  Prints one line, like "Run X:10.000,Y:...". Called from clock(), so it
+  also runs while the main loop waits for queue room.
+*/
+void serial_status(void) {
+  if ( ! serial_status_request)
+    return;
+  serial_status_request = 0;
+
+  #ifdef FEED_HOLD
+    if (feed_hold != FEED_HOLD_OFF)
+      serial_writestr_P(feed_hold == FEED_HOLD_HELD ?
+                        PSTR("Hold ") : PSTR("Stop "));
+    else
+  #endif
+  serial_writestr_P(queue_empty() ? PSTR("Idle ") : PSTR("Run "));
+  print_current_position();
+}
+#endif /* REALTIME_COMMANDS */
+
 #define TEACUP_C_INCLUDE
 #include "serial-avr.c"
 #include "serial-arm.c"
@@ -10,6 +10,7 @@
   #define serial_init() usb_init()
   #define serial_rxchars() usb_serial_available()
   #define serial_popchar() usb_serial_getchar()
+  #define serial_read(data, len) usb_serial_read(data, len)
 #else
   // initialise serial subsystem
   void serial_init(void);
@@ -21,10 +22,28 @@
 
   // read one character
   uint8_t serial_popchar(void);
+  // read up to len characters, return how many
+  uint8_t serial_read(uint8_t *data, uint8_t len);
   // send one character
   void serial_writechar(uint8_t data);
 #endif /* USB_SERIAL */
 
+#ifdef REALTIME_COMMANDS
+  /// Real-time characters, taken out of the stream on reception.
+  #define SERIAL_STATUS       '?'
+  #define SERIAL_HOLD         '!'
+  #define SERIAL_RESUME       '~'
+  #define SERIAL_OVERRIDE_100 0x90
+  #define SERIAL_OVERRIDE_UP  0x91
+  #define SERIAL_OVERRIDE_DN  0x92
+
+  /// Set by the receive interrupt on a '?', cleared by serial_status().
+  extern volatile uint8_t serial_status_request;
+
+  // report machine state and position, if a '?' came in
+  void serial_status(void);
+#endif
+
 void serial_writestr(uint8_t *data);
 
 // write from flash
@@ -0,0 +1,143 @@
+/** \file
+  \brief Machine settings which can be changed at runtime.
+
+  Everything the movement code needs from these, like the um <=> steps
+  quotients and c0, gets calculated once here, so it reads precalculated
+  values only, just like it did with constants from flash.
+*/
+
+#include "settings.h"
+
+#include <string.h>
+#include "dda_maths.h"
+#include "serial.h"
+#include "sersendf.h"
+#include "crc.h"
+
+#if defined EECONFIG && ! defined SIMULATOR
+  #include <avr/eeprom.h>
+#endif
+
+
+/// \var settings_P
+/// \brief settings from config.h, used when there are no valid saved ones
+static const SETTINGS PROGMEM settings_P = {
+  .steps_per_m = {
+    STEPS_PER_M_X,
+    STEPS_PER_M_Y,
+    STEPS_PER_M_Z,
+    STEPS_PER_M_U,
+    STEPS_PER_M_E
+  },
+  .maximum_feedrate = {
+    MAXIMUM_FEEDRATE_X,
+    MAXIMUM_FEEDRATE_Y,
+    MAXIMUM_FEEDRATE_Z,
+    MAXIMUM_FEEDRATE_U,
+    MAXIMUM_FEEDRATE_E
+  },
+  .acceleration = {
+    ACCELERATION_X,
+    ACCELERATION_Y,
+    ACCELERATION_Z,
+    ACCELERATION_U,
+    ACCELERATION_E
+  },
+  #ifdef LOOKAHEAD
+  .maximum_jerk = {
+    MAX_JERK_X,
+    MAX_JERK_Y,
+    MAX_JERK_Z,
+    MAX_JERK_U,
+    MAX_JERK_E
+  },
+  #endif
+};
+
+SETTINGS settings;
+
+#ifdef EECONFIG
+  static SETTINGS EEMEM ee_settings;
+  static uint16_t EEMEM ee_settings_crc;
+#endif
+
+/// Take the saved settings, or the ones from config.h if there are none.
+void settings_init(void) {
+  #ifdef EECONFIG
+    if (settings_load())
+      return;
+  #endif
+  settings_reset();
+}
+
+/// Go back to the settings from config.h.
+void settings_reset(void) {
+  uint8_t i;
+
+  for (i = 0; i < sizeof(SETTINGS) / sizeof(uint32_t); i++)
+    ((uint32_t *)&settings)[i] = pgm_read_dword((uint32_t *)&settings_P + i);
+  settings_apply();
+}
+
+/** Recalculate everything depending on the settings.
+
+  Call this after changing settings. Queued moves keep the settings they
+  were created with; the current position stays the same in mm.
+*/
+void settings_apply(void) {
+  axes_q32_init(settings.steps_per_m);
+  dda_apply_settings();
+}
+
+#ifdef EECONFIG
+/// Write settings to EEPROM, which takes some 3 ms per changed byte.
+void settings_save(void) {
+  eeprom_update_block(&settings, &ee_settings, sizeof(SETTINGS));
+  eeprom_update_word(&ee_settings_crc, crc_block(&settings, sizeof(SETTINGS)));
+}
+
+/** Read settings from EEPROM.
+
+  \return 1 if there were valid settings, else 0 and settings are untouched.
+*/
+uint8_t settings_load(void) {
+  SETTINGS s;
+
+  eeprom_read_block(&s, &ee_settings, sizeof(SETTINGS));
+  if (crc_block(&s, sizeof(SETTINGS)) != eeprom_read_word(&ee_settings_crc))
+    return 0;
+
+  memcpy(&settings, &s, sizeof(SETTINGS));
+  settings_apply();
+  return 1;
+}
+#endif /* EECONFIG */
+
+/// Send one line of settings, in units of config.h.
+static void settings_print_axes(PGM_P label, const uint32_t *value) {
+  serial_writestr_P(label);
+  sersendf_P(PSTR(" X:%lu Y:%lu Z:%lu U:%lu E:%lu\n"),
+             value[X], value[Y], value[Z], value[U], value[E]);
+}
+
+/// Report all settings to the host.
+void settings_print(void) {
+  settings_print_axes(PSTR("steps/m"), settings.steps_per_m);
+  settings_print_axes(PSTR("feedrate"), settings.maximum_feedrate);
+  settings_print_axes(PSTR("accel"), settings.acceleration);
+  #ifdef LOOKAHEAD
+    settings_print_axes(PSTR("jerk"), settings.maximum_jerk);
+  #endif
+  #ifdef JOINT_CALIBRATION
+  {
+    uint8_t i, j;
+
+    for (i = X; i < E; i++) {
+      sersendf_P(PSTR("cal %c:"), 'X' + i);
+      for (j = 0; j < JOINT_CAL_POINTS; j++)
+        sersendf_P(PSTR(" %d"), settings.joint_cal[i][j]);
+      serial_writechar('\n');
+    }
+  }
+  #endif
+}
@@ -0,0 +1,47 @@
+#ifndef _SETTINGS_H
+#define _SETTINGS_H
+
+#include <stdint.h>
+
+#include "config_wrapper.h"
+#include "dda.h"
+#ifdef JOINT_CALIBRATION
+  #include "dda_kinematics.h"
+#endif
+
+/**
+  Machine settings which can be changed at runtime.
+
+  They start out with the values from config.h, or with the ones saved with
+  M500 when built with EECONFIG. Units are the ones of config.h.
+*/
+typedef struct {
+  axes_uint32_t steps_per_m;      ///< motor steps per meter of travel
+  axes_uint32_t maximum_feedrate; ///< mm/min
+  axes_uint32_t acceleration;     ///< mm/s^2
+  #ifdef LOOKAHEAD
+  axes_uint32_t maximum_jerk;     ///< mm/min
+  #endif
+  #ifdef JOINT_CALIBRATION
+  /// millidegrees, see joint_calibrate()
+  int16_t       joint_cal[E][JOINT_CAL_POINTS];
+  #endif
+} SETTINGS;
+
+extern SETTINGS settings;
+
+void settings_init(void);
+
+void settings_reset(void);
+
+void settings_apply(void);
+
+#ifdef EECONFIG
+void settings_save(void);
+
+uint8_t settings_load(void);
+#endif
+
+void settings_print(void);
+
+#endif /* _SETTINGS_H */
@@ -6,6 +6,7 @@
 #define disable_transmit()
 #define enable_transmit()
 #undef USB_SERIAL
+#undef STEP_PORT_BATCH
 
 #undef BSS
 #ifdef __MACH__  // Mac OS X
@@ -19,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "simulator/data_recorder.h"
 
 #define ACD         7
@@ -30,6 +32,12 @@
 #define eeprom_read_word(ptr16) (*(ptr16))
 #define eeprom_write_dword(ptr32, i32) (*(ptr32)=i32)
 #define eeprom_write_word(ptr16, i16) (*(ptr16)=i16)
+#define eeprom_read_byte(ptr8) (*(ptr8))
+#define eeprom_update_byte(ptr8, i8) (*(ptr8)=i8)
+#define eeprom_update_word(ptr16, i16) (*(ptr16)=i16)
+#define eeprom_read_block(dst, src, n) memcpy(dst, src, n)
+#define eeprom_write_block(src, dst, n) memcpy(dst, src, n)
+#define eeprom_update_block(src, dst, n) memcpy(dst, src, n)
 
 
 /**
@@ -0,0 +1,51 @@
+; Movements of M431, see bench.c. Relative, so rounds add up to nothing.
+G91
+M83
+G1 F3000
+; short segments, zigzag
+G1 X0.2 Y0.1 E0.01
+G1 X0.2 Y-0.1 E0.01
+G1 X0.2 Y0.1 E0.01
+G1 X0.2 Y-0.1 E0.01
+G1 X0.2 Y0.1 E0.01
+G1 X0.2 Y-0.1 E0.01
+G1 X0.2 Y0.1 E0.01
+G1 X0.2 Y-0.1 E0.01
+G1 X-0.2 Y0.1 E0.01
+G1 X-0.2 Y-0.1 E0.01
+G1 X-0.2 Y0.1 E0.01
+G1 X-0.2 Y-0.1 E0.01
+G1 X-0.2 Y0.1 E0.01
+G1 X-0.2 Y-0.1 E0.01
+G1 X-0.2 Y0.1 E0.01
+G1 X-0.2 Y-0.1 E0.01
+; circle, as a slicer would write an arc
+G1 X-0.170 Y1.294 E0.02
+G1 X-0.500 Y1.206 E0.02
+G1 X-0.794 Y1.036 E0.02
+G1 X-1.036 Y0.794 E0.02
+G1 X-1.206 Y0.500 E0.02
+G1 X-1.294 Y0.170 E0.02
+G1 X-1.294 Y-0.170 E0.02
+G1 X-1.206 Y-0.500 E0.02
+G1 X-1.036 Y-0.794 E0.02
+G1 X-0.794 Y-1.036 E0.02
+G1 X-0.500 Y-1.206 E0.02
+G1 X-0.170 Y-1.294 E0.02
+G1 X0.170 Y-1.294 E0.02
+G1 X0.500 Y-1.206 E0.02
+G1 X0.794 Y-1.036 E0.02
+G1 X1.036 Y-0.794 E0.02
+G1 X1.206 Y-0.500 E0.02
+G1 X1.294 Y-0.170 E0.02
+G1 X1.294 Y0.170 E0.02
+G1 X1.206 Y0.500 E0.02
+G1 X1.036 Y0.794 E0.02
+G1 X0.794 Y1.036 E0.02
+G1 X0.500 Y1.206 E0.02
+G1 X0.170 Y1.294 E0.02
+; long moves
+G1 X20 F6000
+G1 Y20
+G1 X-20
+G1 Y-20 F3000
@@ -0,0 +1,17 @@
+#ifndef _DATA_RECORDER_H
+#define _DATA_RECORDER_H
+
+/** \file
+  \brief Data recorder of the simulator.
+
+  The host planner benchmark, see planner_bench.c, plans moves without
+  running them, so there are no pin changes to record yet. Comments go to
+  stderr.
+*/
+
+#include <stdint.h>
+
+/// Write a comment line to the recording.
+void record_comment(const char msg[]);
+
+#endif /* _DATA_RECORDER_H */
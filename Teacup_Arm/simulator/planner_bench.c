@@ -0,0 +1,272 @@
+/** \file
+  \brief Host planner benchmark, replays a G-code file through the planner.
+
+  Like M431 on the controller, see bench.c, but on the host and with any
+  G-code file. Lines go through gcode_parse_char(), moves through
+  dda_create() and lookahead, just like in the firmware. The queue runs dry,
+  see queue_dry_run(), so moves get planned, but never started.
+
+  Usage: planner-bench [-v] [-n rounds] file.gcode
+
+  -v sends serial output, like error messages, to stderr. -n
+  replays the file this many times, 1 by default. Before that, the file
+  gets fed once without timing it, so modes, position and lookahead are
+  the same for each timed round.
+
+  Only the G-codes moves need are processed here, see
+  process_gcode_command(), instead of gcode_process.c, which drags in
+  heaters, SD card and everything else. Other commands get counted and
+  ignored.
+
+  Times are host times, useful for comparing planner changes, not for
+  predicting times on the controller.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config_wrapper.h"
+#include "gcode_parse.h"
+#include "gcode_process.h"
+#include "dda.h"
+#include "dda_queue.h"
+#include "settings.h"
+#include "pinio.h"
+#include "serial.h"
+#include "timer.h"
+#include "temp.h"
+#include "clock.h"
+#include "cpu.h"
+#include "delay.h"
+#include "sd.h"
+
+/// Whether serial output goes to stderr, see -v.
+static uint8_t verbose = 0;
+
+/// Commands skipped by process_gcode_command().
+static uint32_t ignored = 0;
+
+/**
+  Stand-ins for the parts of the firmware not in this build. There's no
+  serial line, no step timer running and no heater to wait for.
+*/
+volatile uint8_t main_events;
+LOOP_STATS loop_stats;
+uint32_t sd_line_pos;
+
+void serial_writechar(uint8_t data) {
+  if (verbose)
+    fputc(data, stderr);
+}
+
+void serial_writestr_P(PGM_P data_P) {
+  while (pgm_read_byte(data_P))
+    serial_writechar(pgm_read_byte(data_P++));
+}
+
+uint8_t serial_rxchars(void) {
+  return 0;
+}
+
+uint8_t serial_popchar(void) {
+  return 0;
+}
+
+uint32_t timer_read(void) {
+  return (uint32_t)(sim_runtime_ns() * (F_CPU / 1000000) / 1000);
+}
+
+uint8_t timer_set(int32_t delay, uint8_t check_short) {
+  (void)delay;
+  (void)check_short;
+  return 0;
+}
+
+uint8_t timer_missed(void) {
+  return 0;
+}
+
+void timer_reset(void) {
+}
+
+void cpu_idle(void) {
+}
+
+void delay_us(uint16_t delay) {
+  (void)delay;
+}
+
+uint8_t temp_achieved(void) {
+  return 1;
+}
+
+void temp_print(temp_sensor_t index) {
+  (void)index;
+}
+
+uint8_t sd_read_gcode_line(void) {
+  return 1;
+}
+
+/** Process the line just parsed, moves only.
+
+  Does the same as process_gcode_command() in gcode_process.c for G0, G1,
+  G90, G91, G92, M82 and M83, without axis limits and work offsets. Runs
+  with queue_dry_run() on, so waiting for the queue takes no time.
+*/
+void process_gcode_command(void) {
+  uint32_t backup_f;
+  enum axis_e i;
+
+  if ( ! next_target.seen_M) {
+    if (next_target.option_all_relative)
+      for (i = X; i < E; i++)
+        next_target.target.axis[i] += startpoint.axis[i];
+    next_target.target.e_relative = next_target.option_all_relative ||
+                                    next_target.option_e_relative;
+  }
+
+  if (next_target.seen_G) {
+    switch (next_target.G) {
+      case 0:
+        backup_f = next_target.target.F;
+        next_target.target.F = MAXIMUM_FEEDRATE_X * 2L;
+        enqueue(&next_target.target);
+        next_target.target.F = backup_f;
+        break;
+
+      case 1:
+        enqueue(&next_target.target);
+        break;
+
+      case 90:
+        next_target.option_all_relative = 0;
+        break;
+
+      case 91:
+        next_target.option_all_relative = 1;
+        break;
+
+      case 92: {
+        uint8_t seen[AXIS_COUNT] = {
+          next_target.seen_X, next_target.seen_Y, next_target.seen_Z,
+          next_target.seen_U, next_target.seen_E
+        };
+        uint8_t any = 0;
+
+        queue_wait();
+        for (i = X; i < AXIS_COUNT; i++)
+          any |= seen[i];
+        for (i = X; i < AXIS_COUNT; i++)
+          if (seen[i] || ! any)
+            startpoint.axis[i] = next_target.target.axis[i] =
+              seen[i] ? next_target.target.axis[i] : 0;
+        dda_new_startpoint();
+        break;
+      }
+
+      default:
+        ignored++;
+    }
+  }
+  else if (next_target.seen_M) {
+    switch (next_target.M) {
+      case 82:
+        next_target.option_e_relative = 0;
+        break;
+
+      case 83:
+        next_target.option_e_relative = 1;
+        break;
+
+      default:
+        ignored++;
+    }
+  }
+}
+
+/** Feed all of a G-code file to the parser.
+
+  \return Number of lines.
+*/
+static uint32_t feed(FILE *f) {
+  uint32_t lines = 0;
+  int c, last = '\n';
+
+  rewind(f);
+  while ((c = fgetc(f)) != EOF) {
+    if (gcode_parse_char((uint8_t)c))
+      lines++;
+    last = c;
+  }
+  // Last line without a line end.
+  if (last != '\n' && gcode_parse_char('\n'))
+    lines++;
+
+  return lines;
+}
+
+int main(int argc, char **argv) {
+  uint32_t rounds = 1, lines = 0, moves, joined, timeouts;
+  uint64_t start_ns, elapsed_ns;
+  FILE *f;
+  int opt;
+
+  sim_start(argc, argv);
+
+  for (opt = 1; opt < argc - 1; opt++) {
+    if (strcmp(argv[opt], "-v") == 0)
+      verbose = 1;
+    else if (strcmp(argv[opt], "-n") == 0 && opt < argc - 2)
+      rounds = strtoul(argv[++opt], NULL, 10);
+    else
+      break;
+  }
+  if (opt != argc - 1 || rounds == 0) {
+    fprintf(stderr, "Usage: %s [-v] [-n rounds] file.gcode\n", argv[0]);
+    return 2;
+  }
+  f = fopen(argv[opt], "r");
+  if ( ! f) {
+    perror(argv[opt]);
+    return 1;
+  }
+
+  gcode_init();
+  pinio_init();
+  settings_init();
+  dda_init();
+  sei();
+
+  queue_dry_run(1);
+  feed(f);
+  queue_wait();
+
+  moves = queue_stats.moves;
+  joined = queue_stats.joined;
+  timeouts = queue_stats.timeouts;
+  queue_stats.plan_total = queue_stats.plan_max = 0;
+  ignored = 0;
+
+  start_ns = sim_runtime_ns();
+  while (rounds--)
+    lines += feed(f);
+  queue_wait();
+  elapsed_ns = sim_runtime_ns() - start_ns;
+  queue_dry_run(0);
+  fclose(f);
+
+  moves = queue_stats.moves - moves;
+  printf("Lines: %u Moves: %u Ignored: %u Joined: %u Timeouts: %u\n",
+         lines, moves, ignored, queue_stats.joined - joined,
+         queue_stats.timeouts - timeouts);
+  printf("Time: %.3f s Lines/s: %.0f Moves/s: %.0f\n",
+         elapsed_ns / 1e9, elapsed_ns ? lines * 1e9 / elapsed_ns : 0.,
+         elapsed_ns ? moves * 1e9 / elapsed_ns : 0.);
+  printf("Plan: %.2f/%.2f us avg/max per move\n",
+         moves ? (double)queue_stats.plan_total / moves / (F_CPU / 1000000)
+               : 0., (double)queue_stats.plan_max / (F_CPU / 1000000));
+
+  return 0;
+}
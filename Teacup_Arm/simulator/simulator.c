@@ -0,0 +1,139 @@
+/** \file
+  \brief Host side stand-ins for what simulator.h declares.
+
+  AVR registers are plain variables, pins are an array and the tick counter
+  runs on the host clock. Time is real time, there's no time warp, which is
+  what timing the planner needs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "simulator.h"
+#include "data_recorder.h"
+
+uint8_t ACSR;
+uint8_t TIMSK1;
+uint16_t OCR1A, OCR1B;
+uint16_t TCCR1A, TCCR1B;
+volatile bool sim_interrupts = false;
+
+static bool pins[PIN_NB];
+
+/// Host clock when sim_timer_init() was called, in nanoseconds.
+static uint64_t sim_start_ns;
+
+static uint64_t host_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void sim_start(int argc, char ** argv) {
+  (void)argc;
+  (void)argv;
+  sim_timer_init(1);
+}
+
+void sim_info(const char fmt[], ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void sim_debug(const char fmt[], ...) {
+  #ifdef DEBUG
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+  #else
+    (void)fmt;
+  #endif
+}
+
+void sim_error(const char msg[]) {
+  fprintf(stderr, "ERROR: %s\n", msg);
+  exit(1);
+}
+
+void sim_assert(bool cond, const char msg[]) {
+  if ( ! cond)
+    sim_error(msg);
+}
+
+void record_comment(const char msg[]) {
+  fprintf(stderr, "# %s\n", msg);
+}
+
+/// G-code isn't recorded, see data_recorder.h.
+void sim_gcode_ch(char ch) {
+  (void)ch;
+}
+
+void sim_gcode(const char msg[]) {
+  while (*msg)
+    sim_gcode_ch(*msg++);
+}
+
+void sim_report_temptables(int sensor) {
+  (void)sensor;
+}
+
+void cli(void) {
+  sim_interrupts = false;
+}
+
+void sei(void) {
+  sim_interrupts = true;
+}
+
+bool _READ(pin_t pin) {
+  sim_assert(pin < PIN_NB, "_READ: bad pin");
+  return pins[pin];
+}
+
+void _WRITE(pin_t pin, bool on) {
+  sim_assert(pin < PIN_NB, "_WRITE: bad pin");
+  pins[pin] = on;
+}
+
+void _SET_OUTPUT(pin_t pin) {
+  sim_assert(pin < PIN_NB, "_SET_OUTPUT: bad pin");
+}
+
+void _SET_INPUT(pin_t pin) {
+  sim_assert(pin < PIN_NB, "_SET_INPUT: bad pin");
+}
+
+/// Only real time is supported, scale gets ignored.
+void sim_timer_init(uint8_t scale) {
+  (void)scale;
+  sim_start_ns = host_ns();
+}
+
+void sim_timer_stop(void) {
+}
+
+void sim_timer_set(void) {
+}
+
+/// Timer 1 counts F_CPU ticks, like on the real thing.
+uint16_t sim_tick_counter(void) {
+  return (uint16_t)(sim_runtime_ns() * (F_CPU / 1000000) / 1000);
+}
+
+uint64_t sim_runtime_ns(void) {
+  return host_ns() - sim_start_ns;
+}
+
+void sim_time_warp(void) {
+}
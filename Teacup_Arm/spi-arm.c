@@ -0,0 +1,72 @@
+/** \file
+  \brief SPI subsystem, ARM specific part.
+
+  To be included from spi.c, for more details see there.
+
+  The LPC1114 has two SSP units, this uses SSP0 on its DIP28 pins, see
+  arduino_lpc1114.h. Device selection works with GPIO pins, just like on AVR.
+*/
+
+#if defined TEACUP_C_INCLUDE && defined __ARMEL__
+
+#include "cmsis-lpc11xx.h"
+
+/** Initialise SPI subsystem.
+
+  SSP0 gets clocked at F_CPU (SSP0CLKDIV = 1) and set up for 8 bit frames,
+  SPI mode 0, master. See chapter 14 in the LPC111x User Manual. cpu_init()
+  leaves its clock on when SPI is defined.
+*/
+void spi_init() {
+
+  LPC_SYSCON->PRESETCTRL |= (1 << 0);            // De-assert SSP0 reset.
+  LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 11);        // Turn on SSP0 power.
+  LPC_SYSCON->SSP0CLKDIV = 1;
+
+  // Pinout. SCK0 can go to three pins, pick PIO0_6.
+  LPC_IOCON->SCK_LOC = 0x02;
+  LPC_IOCON->SCK_CMSIS = 0x02 << 0;              // Function SCK0.
+  LPC_IOCON->MISO_CMSIS = 0x01 << 0              // Function MISO0.
+                        | IO_MODEMASK_PULLUP;
+  LPC_IOCON->MOSI_CMSIS = 0x01 << 0;             // Function MOSI0.
+  // SS is a plain output here, MAX6675 uses it as chip select.
+  SET_OUTPUT(SS);
+  WRITE(SS, 1);
+
+  LPC_SSP0->CR0 = (8 - 1) << 0                   // 8 bit frames.
+                | 0       << 4                   // SPI frame format.
+                | 0       << 6                   // CPOL = 0.
+                | 0       << 7                   // CPHA = 0.
+                | 0       << 8;                  // SCR = 0.
+  spi_speed_100_400();
+  LPC_SSP0->CR1 = 1 << 1;                        // Enable, master.
+}
+
+/** Read a block of bytes over SPI.
+
+  \param buffer Received bytes go in here.
+  \param count  Number of bytes to read, at least 1.
+
+  Sends 0xFF for each byte, as SD cards want it. SSP0 has FIFOs of 8 frames
+  each way, so up to 8 bytes are kept in flight. More could overrun the
+  receive FIFO.
+*/
+void spi_read_block(uint8_t *buffer, uint16_t count) {
+  uint16_t to_send = count;
+  uint8_t in_flight = 0;
+
+  while (count) {
+    if (to_send && in_flight < 8) {
+      LPC_SSP0->DR = 0xFF;
+      to_send--;
+      in_flight++;
+    }
+    if (LPC_SSP0->SR & (1 << 2)) {               // Receive FIFO not empty.
+      *buffer++ = LPC_SSP0->DR;
+      count--;
+      in_flight--;
+    }
+  }
+}
+
+#endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
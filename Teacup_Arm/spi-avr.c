@@ -0,0 +1,60 @@
+/** \file
+  \brief SPI subsystem, AVR specific part.
+
+  To be included from spi.c, for more details see there.
+*/
+
+#if defined TEACUP_C_INCLUDE && defined __AVR__
+
+/** Initialise SPI subsystem.
+
+  Code copied from ATmega164/324/644/1284 data sheet, section 18.2, page 160,
+  or moved here from mendel.c.
+*/
+void spi_init() {
+
+  // Set SCK (clock) and MOSI line to output, ie. set USART in master mode.
+  SET_OUTPUT(SCK);
+  SET_OUTPUT(MOSI);
+  SET_INPUT(MISO);
+  // SS must be set as output to disconnect it from the SPI subsystem.
+  // Too bad if something else tries to use this pin as digital input.
+  // See ATmega164/324/644/1284 data sheet, section 18.3.2, page 162.
+  // Not written there: this must apparently be done before setting the SPRC
+  // register, else future R/W-operations may hang.
+  SET_OUTPUT(SS);
+
+  // This sets the whole SPRC register.
+  spi_speed_100_400();
+}
+
+/** Read a block of bytes over SPI.
+
+  \param buffer Received bytes go in here.
+  \param count  Number of bytes to read, at least 1.
+
+  Sends 0xFF for each byte, as SD cards want it. Same as calling spi_rw()
+  count times, but the next transfer gets started right after picking up
+  a byte, before storing it. At (F_CPU / 2) a transfer takes only 16 clocks,
+  so a plain loop around spi_rw() spends about as much time on loop overhead
+  as on transferring.
+
+  The receive side is double buffered, so the byte has to be picked up before
+  the next transfer completes, only. See ATmega164/324/644/1284 data sheet,
+  section 18.2, page 160.
+*/
+void spi_read_block(uint8_t *buffer, uint16_t count) {
+  uint8_t byte;
+
+  SPDR = 0xFF;
+  while (--count) {
+    loop_until_bit_is_set(SPSR, SPIF);
+    byte = SPDR;
+    SPDR = 0xFF;
+    *buffer++ = byte;
+  }
+  loop_until_bit_is_set(SPSR, SPIF);
+  *buffer = SPDR;
+}
+
+#endif /* defined TEACUP_C_INCLUDE && defined __AVR__ */
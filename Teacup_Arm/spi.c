@@ -10,37 +10,19 @@
   Other than serial, SPI has to deal with multiple devices. Device selection
   happens before reading and writing, data exchange its self is the same for
   each device, then.
+
+  All SPI traffic happens from the main loop, so devices never interrupt each
+  other's transfers. The SD card gets deselected between sectors, see
+  stream_read(), so a temperature sensor reading, some 30 us, simply goes
+  in between two of them.
 */
 #include "spi.h"
 
 #ifdef SPI
 
-/** Initialise SPI subsystem.
-
-  Code copied from ATmega164/324/644/1284 data sheet, section 18.2, page 160,
-  or moved here from mendel.c.
-*/
-void spi_init() {
-
-  // Set SCK (clock) and MOSI line to output, ie. set USART in master mode.
-  SET_OUTPUT(SCK);
-  SET_OUTPUT(MOSI);
-  SET_INPUT(MISO);
-  // SS must be set as output to disconnect it from the SPI subsystem.
-  // Too bad if something else tries to use this pin as digital input.
-  // See ATmega164/324/644/1284 data sheet, section 18.3.2, page 162.
-  // Not written there: this must apparently be done before setting the SPRC
-  // register, else future R/W-operations may hang.
-  SET_OUTPUT(SS);
-
-  #ifdef SPI_2X
-    SPSR = 0x01;
-  #else
-    SPSR = 0x00;
-  #endif
-
-  // This sets the whole SPRC register.
-  spi_speed_100_400();
-}
+#define TEACUP_C_INCLUDE
+#include "spi-avr.c"
+#include "spi-arm.c"
+#undef TEACUP_C_INCLUDE
 
 #endif /* SPI */
@@ -7,20 +7,14 @@
 
 #ifdef SPI
 
-/**
-  Test configuration.
-*/
-#ifdef __ARMEL__
-  #error SPI (SD_CARD_SELECT_PIN, TEMP_MAX6675, TEMP_MCP3008) not yet supported on ARM.
-#endif
-
-// Uncomment this to double SPI frequency from (F_CPU / 4) to (F_CPU / 2).
-//#define SPI_2X
-
 /** Initialise SPI subsystem.
 */
 void spi_init(void);
 
+/** Read a block of bytes over SPI.
+*/
+void spi_read_block(uint8_t *buffer, uint16_t count);
+
 /** SPI device selection.
 
   Because out famous WRITE() macro works with constant pins, only, we define
@@ -67,10 +61,13 @@ inline void spi_deselect_mcp3008(void) {
 }
 #endif /* TEMP_MCP3008 */
 
+#if defined __AVR__
+
 /** Set SPI clock speed to something between 100 and 400 kHz.
 
   This is needed for initialising SD cards. We set the whole SPCR register
-  in one step, because this is faster than and'ing in bits.
+  in one step, because this is faster than and'ing in bits. SPSR has only
+  the 2x mode bit writable, so it gets written in one step as well.
 
   About dividers. We have:
   SPCR = 0x50; // normal mode: (F_CPU / 4), 2x mode: (F_CPU / 2)
@@ -82,7 +79,6 @@ inline void spi_deselect_mcp3008(void) {
   expected situations:
     F_CPU                    16 MHz    20 MHz
     SPI clock normal mode   125 kHz   156 kHz
-    SPI clock 2x mode       250 kHz   312 kHz
 
   About the other bits:
   0x50 = (1 << SPE) | (1 << MSTR);
@@ -93,13 +89,30 @@ inline void spi_deselect_mcp3008(void) {
 static void spi_speed_100_400(void) __attribute__ ((always_inline));
 inline void spi_speed_100_400(void) {
   SPCR = 0x53;
+  SPSR = 0x00;
 }
 
-/** Set SPI clock speed to maximum.
+/** Set SPI clock speed to maximum, (F_CPU / 2).
+
+  Fine for SD cards after initialisation, they can go up to 25 MHz.
 */
 static void spi_speed_max(void) __attribute__ ((always_inline));
 inline void spi_speed_max(void) {
   SPCR = 0x50; // See list at spi_speed_100_400().
+  SPSR = 0x01;
+}
+
+/** Set SPI clock speed for sensors, (F_CPU / 16).
+
+  MAX6675 takes up to 4.3 MHz, MCP3008 up to 3.6 MHz at 5 V, but only
+  1.35 MHz at 2.7 V. They transfer two or three bytes per reading, so
+  a safe 1 MHz costs next to nothing. Call this after selecting the device,
+  SD card code changes the speed as it sees fit.
+*/
+static void spi_speed_sensor(void) __attribute__ ((always_inline));
+inline void spi_speed_sensor(void) {
+  SPCR = 0x51; // See list at spi_speed_100_400().
+  SPSR = 0x00;
 }
 
 /** Exchange a byte over SPI.
@@ -120,6 +133,51 @@ inline uint8_t spi_rw(uint8_t byte) {
   return SPDR;
 }
 
+#elif defined __ARMEL__
+
+/** Set SPI clock speed to 200 kHz, for initialising SD cards.
+
+  On the LPC1114 this is SSP0, clocked with the full system clock, see
+  spi_init(). Bit rate is F_CPU / (CPSR * (SCR + 1)), CPSR has to be even.
+  See chapter 14.6 in the LPC111x User Manual.
+*/
+static void spi_speed_100_400(void) __attribute__ ((always_inline));
+inline void spi_speed_100_400(void) {
+  LPC_SSP0->CPSR = F_CPU / 200000UL;
+}
+
+/** Set SPI clock speed to F_CPU / 4, 12 MHz.
+
+  SD cards could go up to 25 MHz and SSP0 to F_CPU / 2, but not with every
+  SD adapter and its wiring.
+*/
+static void spi_speed_max(void) __attribute__ ((always_inline));
+inline void spi_speed_max(void) {
+  LPC_SSP0->CPSR = 4;
+}
+
+/** Set SPI clock speed for sensors, 1 MHz. See the AVR version.
+*/
+static void spi_speed_sensor(void) __attribute__ ((always_inline));
+inline void spi_speed_sensor(void) {
+  LPC_SSP0->CPSR = F_CPU / 1000000UL;
+}
+
+/** Exchange a byte over SPI.
+
+  Same as on AVR. Waiting for the receive FIFO not to be empty (RNE) means
+  the transfer completed.
+*/
+static uint8_t spi_rw(uint8_t) __attribute__ ((always_inline));
+inline uint8_t spi_rw(uint8_t byte) {
+  LPC_SSP0->DR = byte;
+  while ( ! (LPC_SSP0->SR & (1 << 2)))
+    ;
+  return LPC_SSP0->DR;
+}
+
+#endif /* __AVR__, __ARMEL__ */
+
 #endif /* SPI */
 
 #endif /* _SPI_H */
@@ -0,0 +1,154 @@
+#include "steplink.h"
+
+/** \file
+  \brief Step link, streaming moves to a stepping coprocessor.
+
+  The planner output, moves as they start and step intervals of the step
+  timing queue, goes out on USART2 of the ATmega, TX2 on DIO16, framed like
+  intercom packets. A small coprocessor can run the Bresenham algorithm and
+  step timer on these frames alone, without the G-code parser, planner, SD
+  card, display or temperature control on its CPU.
+
+  Send only, buffered and interrupt driven. Frames come from the step
+  interrupt and from dda_clock(), so they get queued atomically. The buffer
+  holds a move and more than a full step timing queue, frames not fitting
+  anyways mean the link is too slow. They get dropped and counted, see
+  M422.
+
+  This controller still runs its own step interrupt on the same timing, for
+  its step outputs, position, endstops and the move queue. So both step
+  the same, which also allows to compare them.
+*/
+
+#ifdef STEP_LINK
+
+#include <string.h>
+#include <avr/interrupt.h>
+#include "pinio.h"
+#include "memory_barrier.h"
+#include "sersendf.h"
+
+/// 256 bytes, so uint8_t indices wrap on their own.
+#define STEP_LINK_BUFFER 256
+
+static uint8_t tx_buffer[STEP_LINK_BUFFER];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+
+/// frames dropped, see steplink_print()
+static volatile uint16_t tx_dropped = 0;
+
+/// Set up USART2 for sending, 8N1.
+void steplink_init() {
+  UCSR2A = MASK(U2X2);
+  UBRR2 = (((F_CPU / 8) / STEP_LINK) - 0.5);
+  UCSR2B = MASK(TXEN2);
+  UCSR2C = MASK(UCSZ21) | MASK(UCSZ20);
+}
+
+/** Queue a frame for sending.
+
+  \param frame The frame, start and type set.
+  \param size Bytes of the frame used, without the check byte.
+*/
+static void steplink_send(STEP_LINK_FRAME *frame, uint8_t size) {
+  uint8_t *data = (uint8_t *)frame;
+  uint8_t i, check = 0, head;
+
+  frame->start = STEP_LINK_START;
+
+  ATOMIC_START
+    head = tx_head;
+    if ((uint8_t)(tx_tail - head - 1) < (uint8_t)(size + 1)) {
+      tx_dropped++;
+    }
+    else {
+      for (i = 0; i < size; i++) {
+        check ^= data[i];
+        tx_buffer[head++] = data[i];
+      }
+      tx_buffer[head++] = check;
+      tx_head = head;
+      UCSR2B |= MASK(UDRIE2);
+    }
+  ATOMIC_END
+}
+
+/** Send a move as it starts.
+
+  \param *dda The move.
+  \param gen Its timing generation.
+
+  Called from dda_start().
+*/
+void steplink_move(DDA *dda, uint8_t gen) {
+  STEP_LINK_FRAME frame;
+
+  frame.type = STEP_LINK_MOVE;
+  frame.gen = gen;
+  frame.move.directions = (dda->x_direction << X) | (dda->y_direction << Y) |
+                          (dda->z_direction << Z) | (dda->u_direction << U) |
+                          (dda->e_direction << E);
+  memcpy(frame.move.delta, dda->delta, sizeof(frame.move.delta));
+  frame.move.total_steps = dda->total_steps;
+  frame.move.c = dda->c;
+
+  steplink_send(&frame, 3 + sizeof(frame.move));
+}
+
+/** Send a step interval.
+
+  \param gen Timing generation of the move.
+  \param step_no First step it applies to.
+  \param c The interval, in timer ticks.
+
+  Called from dda_fill_step_timing() with each entry.
+*/
+void steplink_timing(uint8_t gen, uint32_t step_no, uint32_t c) {
+  STEP_LINK_FRAME frame;
+
+  frame.type = STEP_LINK_TIMING;
+  frame.gen = gen;
+  frame.timing.step_no = step_no;
+  frame.timing.c = c;
+
+  steplink_send(&frame, 3 + sizeof(frame.timing));
+}
+
+/** Send an early end of the move.
+
+  \param gen New timing generation of the move.
+  \param total_steps New length of the move.
+
+  Called from endstop_act().
+*/
+void steplink_stop(uint8_t gen, uint32_t total_steps) {
+  STEP_LINK_FRAME frame;
+
+  frame.type = STEP_LINK_STOP;
+  frame.gen = gen;
+  frame.stop.total_steps = total_steps;
+
+  steplink_send(&frame, 3 + sizeof(frame.stop));
+}
+
+/// Report frames dropped since the last report, see M422.
+void steplink_print() {
+  uint16_t dropped;
+
+  ATOMIC_START
+    dropped = tx_dropped;
+    tx_dropped = 0;
+  ATOMIC_END
+
+  sersendf_P(PSTR("Step link dropped:%u\n"), dropped);
+}
+
+/// Transmit buffer empty, send the next byte.
+ISR(USART2_UDRE_vect) {
+  UDR2 = tx_buffer[tx_tail++];
+  if (tx_tail == tx_head)
+    UCSR2B &= ~MASK(UDRIE2);
+}
+
+#endif /* STEP_LINK */
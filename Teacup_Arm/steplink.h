@@ -0,0 +1,80 @@
+#ifndef _STEPLINK_H
+#define _STEPLINK_H
+
+#include "config_wrapper.h"
+#include <stdint.h>
+
+#ifdef STEP_LINK
+
+#include "dda.h"
+
+/** \def STEP_LINK_START
+  First byte of each frame, same as intercom.c uses.
+*/
+#define STEP_LINK_START 0x55
+
+/// frame types, see STEP_LINK_FRAME
+enum steplink_type_e {
+  STEP_LINK_MOVE = 'M',
+  STEP_LINK_TIMING = 'T',
+  STEP_LINK_STOP = 'S',
+};
+
+/**
+  \struct STEP_LINK_FRAME
+  \brief A frame of the step link, as sent, little endian.
+
+  Frames have the size of their type, the unused part of the union isn't
+  sent. Each frame is followed by the XOR of its bytes, like the crc of
+  intercom packets. gen is move_state.timing_gen, the stepping coprocessor
+  drops timing frames of an older generation.
+
+  - MOVE starts a move: directions, steps of each axis and of the fast
+    axis for the Bresenham algorithm and the interval of the first step.
+  - TIMING sets the step interval from step step_no on, like an entry of
+    the step timing queue of dda.c.
+  - STOP ends the move early, after total_steps steps, because of an
+    endstop. Deceleration follows in TIMING frames of the new generation.
+*/
+typedef struct {
+  uint8_t   start;          ///< STEP_LINK_START
+  uint8_t   type;           ///< enum steplink_type_e
+  uint8_t   gen;            ///< see move_state.timing_gen
+  union {
+    struct {
+      uint8_t   directions; ///< bit (1 << axis) set for positive
+      uint32_t  delta[AXIS_COUNT];
+      uint32_t  total_steps;
+      uint32_t  c;
+    } __attribute__ ((packed)) move;
+    struct {
+      uint32_t  step_no;
+      uint32_t  c;
+    } __attribute__ ((packed)) timing;
+    struct {
+      uint32_t  total_steps;
+    } __attribute__ ((packed)) stop;
+  };
+} __attribute__ ((packed)) STEP_LINK_FRAME;
+
+void steplink_init(void);
+
+// send a move, as it starts
+void steplink_move(DDA *dda, uint8_t gen);
+
+// send a step interval, from step_no on
+void steplink_timing(uint8_t gen, uint32_t step_no, uint32_t c);
+
+// send an early end of the move
+void steplink_stop(uint8_t gen, uint32_t total_steps);
+
+// report frames dropped for lack of buffer space
+void steplink_print(void);
+
+#else
+
+#define steplink_init() /* empty */
+
+#endif /* STEP_LINK */
+
+#endif /* _STEPLINK_H */
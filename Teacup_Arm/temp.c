@@ -21,30 +21,32 @@
 
 #ifdef	TEMP_INTERCOM
   #ifdef __ARMEL__
-    #error TEMP_INTERCOM not yet supported on ARM.
+    #error TEMP_INTERCOM not supported on ARM, the LPC1114 has one UART only.
   #endif
 	#include	"intercom.h"
   #include "pinio.h"
 #endif
 
 #ifdef	TEMP_MAX6675
-  #ifdef __ARMEL__
-    #error MAX6675 sensors (TEMP_MAX6675) not yet supported on ARM.
-  #endif
   #include "spi.h"
 #endif
 
 #ifdef TEMP_MCP3008
-  #ifdef __ARMEL__
-    #error MCP3008 sensors (TEMP_MCP3008) not yet supported on ARM.
-  #endif
   #include "spi.h"
-  #include "thermistortable.h"
+  #include "analog.h"
 #endif
 
 #ifdef	TEMP_THERMISTOR
 #include	"analog.h"
-#include	"thermistortable.h"
+#endif
+
+#if defined TEMP_THERMISTOR || defined TEMP_MCP3008
+  #include "thermistortable.h"
+
+  #if defined TEMPTABLE_SHIFT && \
+      ((NUMTEMPS - 1) << TEMPTABLE_SHIFT) < 1023
+    #error Direct indexed temperature tables have to cover all ADC readings.
+  #endif
 #endif
 
 #ifdef	TEMP_AD595
@@ -77,11 +79,15 @@ static struct {
 	uint16_t					last_read_temp; ///< last received reading
 	uint16_t					target_temp;		///< manipulate attached heater to attempt to achieve this value
 
-	uint16_t					temp_residency; ///< how long have we been close to target temperature in temp ticks?
+	uint16_t					temp_residency; ///< how long have we been close to target temperature in 10 ms ticks?
 
   uint8_t  active;          ///< State machine tracker for readers that need it.
 } temp_sensors_runtime[NUM_TEMP_SENSORS];
 
+/// Whether all sensors with a target have been there for TEMP_RESIDENCY_TIME,
+/// updated with each temp_sensor_tick(), see temp_achieved().
+static uint8_t temp_all_achieved = 255;
+
 /** \def TEMP_EWMA
 
   Default alpha constant for the Exponentially Weighted Moving Average (EWMA)
@@ -143,7 +149,8 @@ void temp_init() {
 /**
   Look up a degree Celsius value from a raw ADC reading.
 
-  \param temp   The raw ADC reading to look up.
+  \param temp   The raw ADC reading to look up, with ANALOG_EXTRA_BITS more
+                resolution than the 10 bits the tables are made for.
 
   \param sensor The sensor to look up. Each sensor can have its own table.
 
@@ -152,24 +159,39 @@ void temp_init() {
   The table(s) looked up here are in thermistortable.h and are created on the
   fly by Configtool when saving config.h. They contain value pairs mapping
   raw ADC readings to 14.2 values already, so all we have to do here is to
-  inter-/extrapolate.
+  inter-/extrapolate. Oversampled readings just scale table readings up,
+  interpolation then uses the additional bits.
+
+  Tables are searched with a binary search, which takes log2(NUMTEMPS) steps.
+  If thermistortable.h defines TEMPTABLE_SHIFT, its entries are evenly spaced,
+  entry n being the one for ADC reading n << TEMPTABLE_SHIFT. The entry is
+  then found by a single shift, so the cost per reading is constant.
 */
 #if defined TEMP_THERMISTOR || defined TEMP_MCP3008
 static uint16_t temp_table_lookup(uint16_t temp, uint8_t sensor) {
   uint8_t lo, hi;
   uint8_t table_num = temp_sensors[sensor].additional;
 
+  #ifdef TEMPTABLE_SHIFT
+    // Evenly spaced entries, index directly.
+    lo = temp >> (TEMPTABLE_SHIFT + ANALOG_EXTRA_BITS);
+    if (lo > NUMTEMPS - 2)
+      lo = NUMTEMPS - 2;
+    hi = lo + 1;
+  #else
   // Binary search for table value bigger than our target.
   //
   //   lo = index of highest entry less than target.
   //   hi = index of lowest entry greater than or equal to target.
   for (lo = 0, hi = NUMTEMPS - 1; hi - lo > 1; ) {
     uint8_t j = lo + (hi - lo) / 2 ;
-    if (pgm_read_word(&(temptable[table_num][j][0])) >= temp)
+    if ((pgm_read_word(&(temptable[table_num][j][0])) << ANALOG_EXTRA_BITS)
+        >= temp)
       hi = j ;
     else
       lo = j ;
   }
+  #endif
 
   if (DEBUG_PID && (debug_flags & DEBUG_PID))
     sersendf_P(PSTR("pin:%d Raw ADC:%d table entry: %d"),
@@ -194,18 +216,21 @@ static uint16_t temp_table_lookup(uint16_t temp, uint8_t sensor) {
     // y₁= temptable[hi][1]
     temp = (
       // ((x - x₀)y₁
-      ((uint32_t)temp - pgm_read_word(&(temptable[table_num][lo][0]))) *
+      ((uint32_t)temp - ((uint32_t)pgm_read_word(&(temptable[table_num][lo][0]))
+                         << ANALOG_EXTRA_BITS)) *
                         pgm_read_word(&(temptable[table_num][hi][1]))
       //             +
       +
       //               (x₁-x)y₀)
-      (pgm_read_word(&(temptable[table_num][hi][0])) - (uint32_t)temp) *
+      (((uint32_t)pgm_read_word(&(temptable[table_num][hi][0]))
+        << ANALOG_EXTRA_BITS) - (uint32_t)temp) *
         pgm_read_word(&(temptable[table_num][lo][1])))
       //                        /
       /
       //                          (x₁ - x₀)
-      (pgm_read_word(&(temptable[table_num][hi][0])) -
-       pgm_read_word(&(temptable[table_num][lo][0])));
+      ((uint32_t)(pgm_read_word(&(temptable[table_num][hi][0])) -
+                  pgm_read_word(&(temptable[table_num][lo][0])))
+       << ANALOG_EXTRA_BITS);
   } else
   if (sizeof(temptable[0][0]) == 3 * sizeof(uint16_t)) {
     // Linear interpolation using pre-computed slope.
@@ -214,7 +239,8 @@ static uint16_t temp_table_lookup(uint16_t temp, uint8_t sensor) {
     #define Y1 pgm_read_word(&(temptable[table_num][hi][1]))
     #define D1 pgm_read_word(&(temptable[table_num][hi][2]))
 
-    temp = Y1 - ((((int32_t)temp - X1) * D1 + (1 << 7)) >> 8);
+    temp = Y1 - ((((int32_t)temp - ((int32_t)X1 << ANALOG_EXTRA_BITS)) * D1 +
+                  (1 << (7 + ANALOG_EXTRA_BITS))) >> (8 + ANALOG_EXTRA_BITS));
   }
 
   if (DEBUG_PID && (debug_flags & DEBUG_PID))
@@ -229,10 +255,13 @@ static uint16_t temp_table_lookup(uint16_t temp, uint8_t sensor) {
 
 #ifdef TEMP_MAX6675
 static uint16_t temp_max6675_read(temp_sensor_t i) {
+  uint16_t temp;
+
   // Note: value reading in this section was rewritten without
   //       testing when spi.c/.h was introduced. --Traumflug
   // Note: MAX6675 can give a reading every 0.22s
   spi_select_max6675();
+  spi_speed_sensor();
   // No delay required, see
   // https://github.com/Traumflug/Teacup_Firmware/issues/22
 
@@ -278,7 +307,7 @@ static uint16_t temp_read_thermistor(temp_sensor_t i) {
     case 1:  // Start ADC conversion.
       #ifdef NEEDS_START_ADC
         #if TEMP_READ_CONTINUOUS
-          result = analog_read(i);
+          result = analog_read_filtered(i);
         #endif
         start_adc();
         #if ! TEMP_READ_CONTINUOUS
@@ -289,7 +318,7 @@ static uint16_t temp_read_thermistor(temp_sensor_t i) {
 
     case 2:  // Convert temperature values.
       #if ! defined NEEDS_START_ADC || ! TEMP_READ_CONTINUOUS
-        result = analog_read(i);
+        result = analog_read_filtered(i);
       #endif
       temp_sensors_runtime[i].active = 0;
       return temp_table_lookup(result, i);
@@ -314,6 +343,7 @@ static uint16_t temp_mcp3008_read(uint8_t channel) {
   uint8_t temp_h, temp_l;
 
   spi_select_mcp3008();
+  spi_speed_sensor();
 
   // Start bit.
   spi_rw(0x01);
@@ -330,7 +360,8 @@ static uint16_t temp_mcp3008_read(uint8_t channel) {
 static uint16_t temp_read_mcp3008(temp_sensor_t i) {
   switch (temp_sensors_runtime[i].active++) {
     case 1:
-      return temp_table_lookup(temp_mcp3008_read(temp_sensors[i].temp_pin), i);
+      return temp_table_lookup(temp_mcp3008_read(temp_sensors[i].temp_pin)
+                               << ANALOG_EXTRA_BITS, i);
     case 10:  // Idle for 100ms.
       temp_sensors_runtime[i].active = 0;
   }
@@ -347,7 +378,7 @@ static uint16_t temp_read_ad595(temp_sensor_t i) {
     case 1:  // Start ADC conversion.
       #ifdef NEEDS_START_ADC
         #if TEMP_READ_CONTINUOUS
-          result = analog_read(i);
+          result = analog_read_filtered(i);
         #endif
         start_adc();
         #if ! TEMP_READ_CONTINUOUS
@@ -358,12 +389,12 @@ static uint16_t temp_read_ad595(temp_sensor_t i) {
 
     case 2:  // Convert temperature values.
       #if ! TEMP_READ_CONTINUOUS
-        result = analog_read(i);
+        result = analog_read_filtered(i);
       #endif
       temp_sensors_runtime[i].active = 0;
       // Convert >> 8 instead of >> 10 because internal temp is stored as
       // 14.2 fixed point.
-      return (result * 500L) >> 8;
+      return (result * 500L) >> (8 + ANALOG_EXTRA_BITS);
   }
   return TEMP_NOT_READY;
 }
@@ -374,7 +405,7 @@ static uint16_t temp_read_intercom(temp_sensor_t i) {
   switch (temp_sensors_runtime[i].active++) {
     case 1:
       return read_temperature(temp_sensors[i].temp_pin);
-    case 25:  // Idle for 250ms.
+    case INTERCOM_INTERVAL / 10:  // Idle until the next packet.
       temp_sensors_runtime[i].active = 0;
   }
   return TEMP_NOT_READY;
@@ -454,9 +485,13 @@ static void run_pid_loop(int i) {
 /**
   Called every 10ms from clock.c. Check all temp sensors that are ready for
   checking. When complete, update the PID loop for sensors tied to heaters.
+
+  Also keeps residency, how long each sensor has been within TEMP_HYSTERESIS
+  of its target, in ticks, and whether all of them got there.
 */
 void temp_sensor_tick() {
 	temp_sensor_t i = 0;
+  uint8_t all_ok;
 
 	for (; i < NUM_TEMP_SENSORS; i++) {
     if (TEMP_READ_CONTINUOUS)
@@ -486,6 +521,25 @@ void temp_sensor_tick() {
       }
     }
   }
+
+  all_ok = 255;
+  for (i = 0; i < NUM_TEMP_SENSORS; i++) {
+    if (labs((int16_t)(temp_sensors_runtime[i].last_read_temp -
+                       temp_sensors_runtime[i].target_temp)) <
+        (TEMP_HYSTERESIS * 4)) {
+      if (temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME * 120))
+        temp_sensors_runtime[i].temp_residency++;
+    }
+    // Deal with flakey sensors which occasionally report a wrong value
+    // by setting residency back, but not entirely to zero.
+    else if (temp_sensors_runtime[i].temp_residency)
+      temp_sensors_runtime[i].temp_residency--;
+
+    if (temp_sensors_runtime[i].target_temp > 0 &&
+        temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME * 100))
+      all_ok = 0;
+  }
+  temp_all_achieved = all_ok;
 }
 
 /**
@@ -505,25 +559,13 @@ void temp_heater_tick() {
 }
 
 /**
-  Called every 1s from clock.c. Update temperature residency info.
+  Called every 1s from clock.c. Report temperatures with DEBUG_PID, residency
+  is kept by temp_sensor_tick().
 */
 void temp_residency_tick() {
   temp_sensor_t i;
 
   for (i = 0; i < NUM_TEMP_SENSORS; i++) {
-		if (labs((int16_t)(temp_sensors_runtime[i].last_read_temp - temp_sensors_runtime[i].target_temp)) < (TEMP_HYSTERESIS*4)) {
-			if (temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME*120))
-        temp_sensors_runtime[i].temp_residency += 100;
-		}
-		else {
-			// Deal with flakey sensors which occasionally report a wrong value
-			// by setting residency back, but not entirely to zero.
-      if (temp_sensors_runtime[i].temp_residency > 100)
-        temp_sensors_runtime[i].temp_residency -= 100;
-			else
-				temp_sensors_runtime[i].temp_residency = 0;
-		}
-
     if (DEBUG_PID && (debug_flags & DEBUG_PID))
       sersendf_P(PSTR("DU temp: {%d %d %d.%d}"), i,
                  temp_sensors_runtime[i].last_read_temp,
@@ -536,18 +578,11 @@ void temp_residency_tick() {
 
 /**
  * Report whether all temp sensors in use are reading their target
- * temperatures. Used for M116 and friends.
+ * temperatures. Used for M116 and friends. temp_sensor_tick() did the work
+ * already, this is just a lookup.
  */
 uint8_t	temp_achieved() {
-	temp_sensor_t i;
-	uint8_t all_ok = 255;
-
-	for (i = 0; i < NUM_TEMP_SENSORS; i++) {
-    if (temp_sensors_runtime[i].target_temp > 0 &&
-        temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME*100))
-			all_ok = 0;
-	}
-	return all_ok;
+	return temp_all_achieved;
 }
 
 /// specify a target temperature
@@ -561,6 +596,8 @@ void temp_set(temp_sensor_t index, uint16_t temperature) {
 	if (temp_sensors_runtime[index].target_temp != temperature) {
 		temp_sensors_runtime[index].target_temp = temperature;
 		temp_sensors_runtime[index].temp_residency = 0;
+		// Until the next tick had a look.
+		temp_all_achieved = 0;
 	#ifdef	TEMP_INTERCOM
 		if (temp_sensors[index].temp_type == TT_INTERCOM)
 			send_temperature(temp_sensors[index].temp_pin, temperature);
@@ -11,7 +11,11 @@
 #include "clock.h"
 #include "pinio.h"
 #include "dda_queue.h"
+#include "memory_barrier.h"
+#include "profile.h"
 
+/// CPU ticks up to the last system clock tick, see timer_read().
+static volatile uint32_t clock_time = 0;
 
 /** Timer initialisation.
 
@@ -90,8 +94,17 @@ void timer_init() {
 */
 void SysTick_Handler(void) {
 
+  clock_time += TICK_TIME;
   clock_tick();
+}
+
+/** Request a run of dda_clock().
 
+  Called from clock_tick() every MOTION_CLOCK. It runs soon after, in
+  PendSV_Handler(), which has a lower priority than the step interrupt.
+  Requests while PendSV is still running are ignored.
+*/
+void timer_motion_maintenance() {
   SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;             // Trigger PendSV_Handler().
 }
 
@@ -101,7 +114,12 @@ void SysTick_Handler(void) {
   cmsis-startup_lpc11xx.s
 */
 void PendSV_Handler(void) {
+  #ifdef PROFILE
+    uint32_t start = timer_read();
+  #endif
+
   dda_clock();
+  profile_add(PROFILE_CLOCK, timer_read() - start);
 }
 
 /** Step interrupt.
@@ -110,6 +128,28 @@ void PendSV_Handler(void) {
   cmsis-startup_lpc11xx.s
 */
 void TIMER32_0_IRQHandler(void) {
+#ifdef TEMPORAL_MATCH_CHANNELS
+  uint32_t step_time = LPC_TMR32B0->TC, duration;
+  uint8_t ir, ch;
+
+  #ifdef DEBUG_LED_PIN
+    WRITE(DEBUG_LED_PIN, 1);
+  #endif
+
+  /**
+    Each axis has its own match channel here, so several of them can be
+    pending at once. Reset exactly those we handle, then step each. Interrupt
+    generation per channel is handled by timer_channel_set() and
+    timer_channel_stop().
+  */
+  ir = LPC_TMR32B0->IR & ((1 << TIMER_CHANNELS) - 1);
+  LPC_TMR32B0->IR = ir;
+
+  for (ch = 0; ch < TIMER_CHANNELS; ch++)
+    if (ir & (1 << ch))
+      queue_step_channel(ch);
+#else
+  uint32_t step_time = LPC_TMR32B0->MR0, duration;
 
   #ifdef DEBUG_LED_PIN
     WRITE(DEBUG_LED_PIN, 1);
@@ -128,6 +168,12 @@ void TIMER32_0_IRQHandler(void) {
   LPC_TMR32B0->IR = (1 << 0);                     // Clear match on channel 0.
 
   queue_step();
+#endif
+
+  duration = LPC_TMR32B0->TC - step_time;
+  if (duration > queue_stats.step_isr_max)
+    queue_stats.step_isr_max = duration;
+  profile_add(PROFILE_STEP, duration);
 
   #ifdef DEBUG_LED_PIN
     WRITE(DEBUG_LED_PIN, 0);
@@ -186,12 +232,21 @@ uint8_t timer_set(int32_t delay, uint8_t check_short) {
     }
   #endif /* ACCELERATION_TEMPORAL */
 
+  #ifdef TEMPORAL_MATCH_CHANNELS
+    /**
+      Steps are scheduled by timer_channel_set(), so MR0 is the last step of
+      X or E, not of the last step at all. Remaining users are timeouts, like
+      waiting for temperatures, so count from now.
+    */
+    LPC_TMR32B0->MR0 = LPC_TMR32B0->TC + delay;
+  #else
   /**
     Still here? Then we can schedule the next step. Off of the previous step.
     If there is no previous step, TC and MR0 should have been reset to zero
     by calling timer_reset() shortly before we arrive here.
   */
   LPC_TMR32B0->MR0 += delay;
+  #endif
 
   /**
     Turn on the stepper interrupt. As this interrupt is the only use of this
@@ -202,6 +257,77 @@ uint8_t timer_set(int32_t delay, uint8_t check_short) {
   return 0;
 }
 
+/** Whether the step interrupt set by timer_set() was missed.
+
+  \return 1 if the step time passed before MR0 got set, so the interrupt
+          would come only after a full round of the timer.
+
+  Call this from the step interrupt, after a timer_set(). To the timer the
+  step then happened at the time it was due, so doing it right away keeps
+  the timing of the following steps.
+*/
+uint8_t timer_missed() {
+  #ifdef TEMPORAL_MATCH_CHANNELS
+    // Steps run on the match channels, MR0 is timeouts only.
+    return 0;
+  #else
+    uint32_t late;
+
+    if ( ! (LPC_TMR32B0->MCR & (1 << 0)))
+      return 0;
+
+    // Read the counter before the flag, so a match can't happen in between.
+    late = LPC_TMR32B0->TC - LPC_TMR32B0->MR0;
+    return late && late < 0x80000000 && ! (LPC_TMR32B0->IR & (1 << 0));
+  #endif
+}
+
+#ifdef TEMPORAL_MATCH_CHANNELS
+/** Current time of the step timer.
+
+  Base for absolute times handed to timer_channel_set().
+*/
+uint32_t timer_channel_now() {
+  return LPC_TMR32B0->TC;
+}
+
+/** Schedule a step on one match channel.
+
+  \param ch Match channel, 0 to TIMER_CHANNELS - 1.
+
+  \param time Absolute step timer time of the step, see timer_channel_now().
+
+  Unlike timer_set() this takes an absolute time, so each channel can keep
+  its own, exact timing independent from other channels. A time already past
+  or too close to now to be met gets the interrupt as soon as possible. The
+  caller keeps its own idea of the time of this step, so later steps of this
+  channel are on time again.
+
+  MR1..MR3 follow MR0 in the register map, so the channel indexes them. Match
+  control has three bits per channel, the lowest one enables the interrupt.
+  It's a read-modify-write, so call it with interrupts off or from the step
+  interrupt.
+*/
+void timer_channel_set(uint8_t ch, uint32_t time) {
+  uint32_t now = LPC_TMR32B0->TC;
+
+  // Same safety margin as in timer_set().
+  if ((int32_t)(time - now) < 100)
+    time = now + 100;
+
+  (&LPC_TMR32B0->MR0)[ch] = time;
+  LPC_TMR32B0->MCR |= (1 << (ch * 3));
+}
+
+/** Stop interrupts of one match channel.
+
+  \param ch Match channel, 0 to TIMER_CHANNELS - 1.
+*/
+void timer_channel_stop(uint8_t ch) {
+  LPC_TMR32B0->MCR &= ~(1 << (ch * 3));
+}
+#endif /* TEMPORAL_MATCH_CHANNELS */
+
 /** Timer reset.
 
   Reset the timer, so step interrupts scheduled at an arbitrary point in time
@@ -223,4 +349,28 @@ void timer_stop() {
   SysTick->CTRL = 0;
 }
 
+/** Read the current time.
+
+  \return Time in CPU ticks. Wraps around after 2^32 ticks, so use it for
+          time differences only.
+
+  CT32B0 gets reset by timer_reset(), so this is based on the system tick
+  timer, which counts down from TICK_TIME - 1. A tick which already
+  happened, but wasn't processed yet, shows up as pending.
+*/
+uint32_t timer_read() {
+  uint32_t time, elapsed;
+
+  ATOMIC_START
+    time = clock_time;
+    elapsed = TICK_TIME - 1 - SysTick->VAL;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+      time += TICK_TIME;
+      elapsed = TICK_TIME - 1 - SysTick->VAL;
+    }
+  ATOMIC_END
+
+  return time + elapsed;
+}
+
 #endif /* defined TEACUP_C_INCLUDE && defined __ARMEL__ */
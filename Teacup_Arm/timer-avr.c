@@ -18,6 +18,7 @@
 #include "clock.h"
 #include "cpu.h"
 #include "memory_barrier.h"
+#include "profile.h"
 
 #ifdef	MOTHERBOARD
 #include	"dda_queue.h"
@@ -30,38 +31,95 @@
 */
 uint32_t	next_step_time;
 
+/// time the delay of the last timer_set() counts from, see timer_missed()
+static uint16_t step_start;
+
 #ifdef ACCELERATION_TEMPORAL
 /// Unwanted extra delays, ideally always zero.
 uint32_t	step_extra_time = 0;
 #endif /* ACCELERATION_TEMPORAL */
 
 
-/** System clock interrupt.
+/// CPU ticks up to the last system clock tick, see timer_read().
+static volatile uint32_t clock_time = 0;
 
-  Comparator B is the system clock, happens every TICK_TIME.
+/** \def MOTION_VECTOR
+  Comparator C of timer 1 serves as a software interrupt for dda_clock(), see
+  timer_motion_maintenance(). Timers without comparator C, and the simulator,
+  run dda_clock() at the end of the system clock interrupt instead.
 */
-ISR(TIMER1_COMPB_vect) {
-  static volatile uint8_t busy = 0;
+#if defined OCR1C && ! defined SIMULATOR
+  #define MOTION_VECTOR
+#endif
 
-	// set output compare register to the next clock tick
-	OCR1B = (OCR1B + TICK_TIME) & 0xFFFF;
+/** Motion maintenance, the slow part of the system clock.
 
-  clock_tick();
+  Here we do potentially lengthy calculations, with interrupts enabled, so
+  the step interrupt can always interrupt this. Make sure we didn't re-enter.
+*/
+static void motion_maintenance(void) {
+  static volatile uint8_t busy = 0;
 
-  /**
-    Lengthy calculations ahead! Make sure we didn't re-enter, then allow
-    nested interrupts.
-  */
   if ( ! busy) {
+    #ifdef PROFILE
+      uint32_t start = timer_read();
+    #endif
+
     busy = 1;
     sei();
 
     dda_clock();
+    profile_add(PROFILE_CLOCK, timer_read() - start);
 
     busy = 0;
   }
 }
 
+/** System clock interrupt.
+
+  Comparator B is the system clock, happens every TICK_TIME.
+*/
+ISR(TIMER1_COMPB_vect) {
+	// set output compare register to the next clock tick
+	OCR1B = (OCR1B + TICK_TIME) & 0xFFFF;
+  clock_time += TICK_TIME;
+
+  clock_tick();
+}
+
+#ifdef MOTION_VECTOR
+/** Software interrupt for motion maintenance.
+
+  Comparator C has a lower priority than both, step interrupt and system
+  clock. So after the system clock interrupt, a pending step interrupt is
+  served first, then this runs with interrupts enabled.
+*/
+ISR(TIMER1_COMPC_vect) {
+  TIMSK1 &= ~MASK(OCIE1C);
+  motion_maintenance();
+}
+#endif
+
+/** Request a run of dda_clock().
+
+  Called from clock_tick() every MOTION_CLOCK. It runs soon after, in an
+  interrupt context of lower priority than the step interrupt. Requests while
+  dda_clock() is still running are ignored. Must be called with interrupts
+  disabled.
+
+  To get an interrupt without an interrupt source we set comparator C a few
+  cycles ahead. Its flag gets set even if another interrupt runs at that time,
+  so the request is never lost.
+*/
+void timer_motion_maintenance() {
+  #ifdef MOTION_VECTOR
+    OCR1C = TCNT1 + 64;
+    TIMSK1 |= MASK(OCIE1C);
+  #else
+    motion_maintenance();
+  #endif
+}
+
 #ifdef	MOTHERBOARD
 
 /** Step interrupt.
@@ -76,12 +134,19 @@ ISR(TIMER1_COMPA_vect) {
 			WRITE(DEBUG_LED_PIN, 1);
 		#endif
 
+		uint16_t step_time = OCR1A, duration;
+
 		// disable this interrupt. if we set a new timeout, it will be re-enabled when appropriate
 		TIMSK1 &= ~MASK(OCIE1A);
 
 		// stepper tick
 		queue_step();
 
+    duration = TCNT1 - step_time;
+    if (duration > queue_stats.step_isr_max)
+      queue_stats.step_isr_max = duration;
+    profile_add(PROFILE_STEP, duration);
+
 		// led off
 		#ifdef DEBUG_LED_PIN
 			WRITE(DEBUG_LED_PIN, 0);
@@ -155,7 +220,6 @@ void timer_init() {
 	do a sei() after it to make the interrupt actually fire.
 */
 uint8_t timer_set(int32_t delay, uint8_t check_short) {
-	uint16_t step_start = 0;
 	#ifdef ACCELERATION_TEMPORAL
 	uint16_t current_time;
 	#endif /* ACCELERATION_TEMPORAL */
@@ -217,6 +281,30 @@ uint8_t timer_set(int32_t delay, uint8_t check_short) {
   return 0;
 }
 
+/** Whether the step interrupt set by timer_set() was missed.
+
+  \return 1 if the step time passed before the comparator got set, so the
+          interrupt would come only after a full round of the timer.
+
+  Call this from the step interrupt, after a timer_set(). To the timer the
+  step then happened at the time it was due, so doing it right away keeps
+  the timing of the following steps.
+*/
+uint8_t timer_missed() {
+  #ifdef SIMULATOR
+    return 0;
+  #endif
+  if ( ! (TIMSK1 & MASK(OCIE1A)) || next_step_time >= 65536)
+    return 0;
+
+  // Delays go up to 65535 ticks, so a counter past OCR1A doesn't tell
+  // whether the match is behind or a full round ahead. Time since the
+  // start of the delay does, a counter right at the match still fires.
+  // Read the counter before the flag, so a match can't happen in between.
+  return (uint16_t)(TCNT1 - step_start) > next_step_time &&
+         ! (TIFR1 & MASK(OCF1A));
+}
+
 /** Timer reset.
 
   Reset the timer, so step interrupts scheduled at an arbitrary point in time
@@ -242,4 +330,32 @@ void timer_stop() {
 }
 #endif /* ifdef MOTHERBOARD */
 
+/** Read the current time.
+
+  \return Time in CPU ticks. Wraps around after 2^32 ticks, so use it for
+          time differences only.
+
+  Timer 1 is 16 bits only, everything above is counted by the system clock
+  interrupt. A clock tick which already happened, but wasn't processed yet,
+  shows up in the interrupt flag.
+*/
+uint32_t timer_read() {
+  uint32_t time;
+  uint16_t last_tick;
+
+  ATOMIC_START
+    time = clock_time;
+    last_tick = OCR1B - TICK_TIME;
+    #ifndef SIMULATOR
+      if (TIFR1 & MASK(OCF1B)) {
+        time += TICK_TIME;
+        last_tick += TICK_TIME;
+      }
+    #endif
+    time += (uint16_t)(TCNT1 - last_tick);
+  ATOMIC_END
+
+  return time;
+}
+
 #endif /* defined TEACUP_C_INCLUDE && (defined __AVR__ || defined SIMULATOR) */
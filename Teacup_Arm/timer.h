@@ -2,6 +2,7 @@
 #define	_TIMER_H
 
 #include	<stdint.h>
+#include "config_wrapper.h"
 #include "arduino.h"  // For F_CPU on ARM.
 
 // time-related constants
@@ -10,19 +11,38 @@
 
 /// How often we overflow and update our clock.
 /// With F_CPU = 16MHz, max is < 4.096ms (TICK_TIME = 65535).
-#define TICK_TIME (2 MS)
+/// dda_clock() runs every MOTION_CLOCK, a multiple of this.
+#define TICK_TIME (500 US)
 
-/// Convert back to ms from cpu ticks so our system clock runs
+/// Convert back to us from cpu ticks so our system clock runs
 /// properly if you change TICK_TIME.
-#define TICK_TIME_MS (TICK_TIME / (F_CPU / 1000))
+#define TICK_TIME_US (TICK_TIME / (F_CPU / 1000000))
 
 
 void timer_init(void);
 
 uint8_t timer_set(int32_t delay, uint8_t check_short);
 
+uint8_t timer_missed(void);
+
 void timer_reset(void);
 
 void timer_stop(void);
 
+uint32_t timer_read(void);
+
+void timer_motion_maintenance(void);
+
+#ifdef TEMPORAL_MATCH_CHANNELS
+/// Number of step timer match channels. Axis i steps on channel
+/// i % TIMER_CHANNELS.
+#define TIMER_CHANNELS 4
+
+uint32_t timer_channel_now(void);
+
+void timer_channel_set(uint8_t ch, uint32_t time);
+
+void timer_channel_stop(uint8_t ch);
+#endif
+
 #endif	/* _TIMER_H */
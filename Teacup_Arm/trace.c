@@ -0,0 +1,112 @@
+#include "trace.h"
+
+/** \file
+  \brief Binary event trace for debugging motion at full speed.
+
+  Recording an event from an interrupt costs a timer read and a few stores,
+  where printing it right away with sersendf_P() takes milliseconds and
+  changes the timing under test. The entries wait in a ring buffer, the
+  main loop prints them later, see trace_print(). When the buffer is full,
+  the oldest entries get overwritten.
+*/
+
+#ifdef TRACE
+
+#include <string.h>
+#include "sersendf.h"
+#include "serial.h"
+#include "timer.h"
+#include "memory_barrier.h"
+
+/// One recorded event.
+typedef struct {
+  uint32_t  time;     ///< CPU ticks, see timer_read()
+  uint32_t  a;        ///< first argument, meaning depends on the event
+  uint32_t  b;        ///< second argument
+  uint8_t   event;    ///< see enum trace_e
+} TRACE_ENTRY;
+
+static TRACE_ENTRY trace_buffer[TRACE_SIZE];
+static uint8_t trace_head = 0;
+static uint8_t trace_count = 0;
+
+/// Entries lost to overwriting since the last trace_print().
+static uint8_t trace_lost = 0;
+
+/** Record an event.
+
+  \param event The event, see enum trace_e.
+  \param a First argument.
+  \param b Second argument.
+
+  Called from interrupts, too, so keep it short.
+*/
+void trace(enum trace_e event, uint32_t a, uint32_t b) {
+  TRACE_ENTRY *entry;
+
+  ATOMIC_START
+    entry = &trace_buffer[trace_head];
+    entry->time = timer_read();
+    entry->a = a;
+    entry->b = b;
+    entry->event = event;
+    trace_head = (trace_head + 1) & (TRACE_SIZE - 1);
+    if (trace_count < TRACE_SIZE)
+      trace_count++;
+    else if (trace_lost < 255)
+      trace_lost++;
+  ATOMIC_END
+}
+
+/** Print recorded events, oldest first, and remove them.
+
+  \param max Print at most this many, 0 for all. Printing a few at a time
+  keeps the main loop responsive.
+
+  One line per event: time in CPU ticks, event name, both arguments.
+*/
+void trace_print(uint8_t max) {
+  TRACE_ENTRY entry;
+  uint8_t lost;
+
+  ATOMIC_START
+    lost = trace_lost;
+    trace_lost = 0;
+  ATOMIC_END
+  if (lost)
+    sersendf_P(PSTR("Trace: %u lost\n"), lost);
+
+  do {
+    ATOMIC_START
+      if (trace_count) {
+        memcpy(&entry, &trace_buffer[(trace_head - trace_count) &
+                                     (TRACE_SIZE - 1)], sizeof(TRACE_ENTRY));
+        trace_count--;
+      }
+      else
+        entry.event = TRACE_COUNT;
+    ATOMIC_END
+
+    if (entry.event == TRACE_COUNT)
+      break;
+
+    sersendf_P(PSTR("%lu "), entry.time);
+    switch (entry.event) {
+      case TRACE_DDA_START:
+        serial_writestr_P(PSTR("start"));
+        break;
+      case TRACE_DDA_END:
+        serial_writestr_P(PSTR("end"));
+        break;
+      case TRACE_ENDSTOP:
+        serial_writestr_P(PSTR("endstop"));
+        break;
+      case TRACE_PLAN:
+        serial_writestr_P(PSTR("plan"));
+        break;
+    }
+    sersendf_P(PSTR(" %lu %lu\n"), entry.a, entry.b);
+  } while (--max);
+}
+
+#endif /* TRACE */
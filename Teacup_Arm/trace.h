@@ -0,0 +1,33 @@
+#ifndef	_TRACE_H
+#define	_TRACE_H
+
+#include <stdint.h>
+#include "debug.h"
+
+#ifdef TRACE
+
+/// Events recorded by the trace, see trace().
+enum trace_e {
+  TRACE_DDA_START,  ///< dda_start(), total steps and initial step interval
+  TRACE_DDA_END,    ///< move finished, steps done and step interval
+  TRACE_ENDSTOP,    ///< endstop_act(), triggered axes, fast axis steps left
+  TRACE_PLAN,       ///< lookahead replanned a move, move id and end steps
+  TRACE_COUNT
+};
+
+/// Trace entries kept, a power of two.
+#define TRACE_SIZE 32
+
+// record an event, from any context
+void trace(enum trace_e event, uint32_t a, uint32_t b);
+
+// print and remove up to max of the oldest entries, 0 for all
+void trace_print(uint8_t max);
+
+#else /* TRACE */
+
+#define trace(event, a, b) /* empty */
+#define trace_print(max)   /* empty */
+
+#endif /* TRACE */
+#endif /* _TRACE_H */
@@ -314,6 +314,14 @@ static union{
   uint32_t baud; } cdc_line_coding={{0x00, 0xE1, 0x00, 0x00, 0x00, 0x00, 0x08}};
 static uint8_t cdc_line_rtsdtr=0;
 
+// Teacup: packet buffers. Reading takes a whole OUT packet from the endpoint
+// at once, writing collects a line before handing it to the endpoint. This
+// selects the endpoint once per packet instead of once per character.
+static uint8_t rx_packet[CDC_RX_SIZE];
+static uint8_t rx_len=0, rx_index=0;
+static uint8_t tx_line[CDC_TX_SIZE];
+static uint8_t tx_len=0;
+
 
 /**************************************************************************
  *
@@ -343,56 +351,57 @@ uint8_t usb_configured(void)
 	return usb_configuration;
 }
 
-// get the next character, or -1 if nothing received
-int16_t usb_serial_getchar(void)
+// Teacup: move the next received packet into rx_packet[], if rx_packet[]
+// is used up. Releases the endpoint bank right away, so the host can send
+// the next packet while we parse this one.
+static void usb_serial_rx_fill(void)
 {
-	uint8_t c, intr_state;
+	uint8_t c, n, i, intr_state;
 
-	// interrupts are disabled so these functions can be
-	// used from the main program or interrupt context,
-	// even both in the same program!
+	if (rx_index < rx_len || !usb_configuration) return;
+	rx_len = rx_index = 0;
 	intr_state = SREG;
 	cli();
-	if (!usb_configuration) {
-		SREG = intr_state;
-		return -1;
-	}
 	UENUM = CDC_RX_ENDPOINT;
-	retry:
 	c = UEINTX;
-	if (!(c & (1<<RWAL))) {
-		// no data in buffer
-		if (c & (1<<RXOUTI)) {
-			UEINTX = 0x6B;
-			goto retry;
-		}
-		SREG = intr_state;
-		return -1;
+	if (c & (1<<RWAL)) {
+		n = UEBCLX;
+		for (i = 0; i < n; i++) rx_packet[i] = UEDATX;
+		rx_len = n;
+		UEINTX = 0x6B;
+	} else if (c & (1<<RXOUTI)) {
+		// zero length packet
+		UEINTX = 0x6B;
 	}
-	// take one byte out of the buffer
-	c = UEDATX;
-	// if buffer completely used, release it
-	if (!(UEINTX & (1<<RWAL))) UEINTX = 0x6B;
 	SREG = intr_state;
-	return c;
+}
+
+// get the next character, or -1 if nothing received
+int16_t usb_serial_getchar(void)
+{
+	usb_serial_rx_fill();
+	if (rx_index == rx_len) return -1;
+	return rx_packet[rx_index++];
 }
 
 // number of bytes available in the receive buffer
 uint8_t usb_serial_available(void)
 {
-	uint8_t n=0, i, intr_state;
+	usb_serial_rx_fill();
+	return rx_len - rx_index;
+}
 
-	intr_state = SREG;
-	cli();
-	if (usb_configuration) {
-		UENUM = CDC_RX_ENDPOINT;
-		n = UEBCLX;
-		if (!n) {
-			i = UEINTX;
-			if (i & (1<<RXOUTI) && !(i & (1<<RWAL))) UEINTX = 0x6B;
-		}
+// Teacup: read up to len characters, return how many. Copies from whole
+// packets, see usb_serial_rx_fill().
+uint8_t usb_serial_read(uint8_t *data, uint8_t len)
+{
+	uint8_t n = 0;
+
+	while (n < len) {
+		usb_serial_rx_fill();
+		if (rx_index == rx_len) break;
+		while (n < len && rx_index < rx_len) data[n++] = rx_packet[rx_index++];
 	}
-	SREG = intr_state;
 	return n;
 }
 
@@ -401,6 +410,7 @@ void usb_serial_flush_input(void)
 {
 	uint8_t intr_state;
 
+	rx_len = rx_index = 0;
 	if (usb_configuration) {
 		intr_state = SREG;
 		cli();
@@ -414,53 +424,25 @@ void usb_serial_flush_input(void)
 
 /**
   Transmit a character.
+
+  Characters get collected in tx_line[] and go to the endpoint as one
+  usb_serial_write() when a line is complete or tx_line[] is full. Teacup
+  ends all its messages with a newline, so nothing stays behind. Main
+  program only, not from interrupts.
 */
 void serial_writechar(uint8_t c) {
-	uint8_t timeout, intr_state;
 
 	// if we're not online (enumerated and configured), error
-  if ( ! usb_configuration) return;
-
-	// interrupts are disabled so these functions can be
-	// used from the main program or interrupt context,
-	// even both in the same program!
-	intr_state = SREG;
-	cli();
-	UENUM = CDC_TX_ENDPOINT;
-	// if we gave up due to timeout before, don't wait again
-	if (transmit_previous_timeout) {
-		if (!(UEINTX & (1<<RWAL))) {
-			SREG = intr_state;
-      return;
-		}
-		transmit_previous_timeout = 0;
-	}
-	// wait for the FIFO to be ready to accept data
-	timeout = UDFNUML + TRANSMIT_TIMEOUT;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
-		// have we waited too long?  This happens if the user
-		// is not running an application that is listening
-		if (UDFNUML == timeout) {
-			transmit_previous_timeout = 1;
-      return;
-		}
-		// has the USB gone offline?
-    if ( ! usb_configuration)
-      return;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = CDC_TX_ENDPOINT;
-	}
-	// actually write the byte into the FIFO
-	UEDATX = c;
-	// if this completed a packet, transmit it now!
-	if (!(UEINTX & (1<<RWAL))) UEINTX = 0x3A;
-	transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
-	SREG = intr_state;
+  if ( ! usb_configuration) {
+    tx_len = 0;
+    return;
+  }
+
+  tx_line[tx_len++] = c;
+  if (c == '\n' || tx_len == sizeof(tx_line)) {
+    usb_serial_write(tx_line, tx_len);
+    tx_len = 0;
+  }
 }
 
 
@@ -639,6 +621,10 @@ void usb_serial_flush_output(void)
 {
 	uint8_t intr_state;
 
+	if (tx_len) {
+		usb_serial_write(tx_line, tx_len);
+		tx_len = 0;
+	}
 	intr_state = SREG;
 	cli();
 	if (transmit_flush_timer) {
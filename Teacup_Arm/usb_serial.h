@@ -29,9 +29,9 @@
 
     - No need for usb_serial_flush_input(), usb_serial_flush_output().
 
-    - usb_serial_write() does about the same as serial_writestr() /
-      serial_writestr_P() but isn't used, so either drop it or, if it's
-      faster / smaller, change other code to use it.
+    - serial_writechar() collects lines and sends them with
+      usb_serial_write(), reading works with whole packets, too. Further
+      speedups would need a way to hand the parser a packet directly.
 
     - Macros ATOMIC_START, ATOMIC_END not used.
 */
@@ -43,6 +43,7 @@ uint8_t usb_configured(void);		// is the USB port configured
 // receiving data
 int16_t usb_serial_getchar(void);	// receive a character (-1 if timeout/error)
 uint8_t usb_serial_available(void);	// number of bytes in receive buffer
+uint8_t usb_serial_read(uint8_t *data, uint8_t len); // receive up to len bytes
 void usb_serial_flush_input(void);	// discard any buffered input
 
 // transmitting data